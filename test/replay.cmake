@@ -0,0 +1,36 @@
+# This is a smoke test for the whole pipeline without a headset. The simulator writes a
+# capture file with a fixed number of packets, which is replayed as fast as possible
+# through unicorn2txt. The statistics of the replay should show that nothing was lost.
+#
+# Use as
+#   cmake -DSIM=unicorn-sim -DAPP=unicorn2txt -P replay.cmake
+
+set(PACKETS 2500)
+
+file(REMOVE replay.raw replay.txt)
+
+# the simulated device is already streaming and runs 20 times faster than real time
+execute_process(COMMAND ${SIM} -s -a 20 -n ${PACKETS} -o replay.raw
+                RESULT_VARIABLE result OUTPUT_VARIABLE output)
+if (NOT result EQUAL 0)
+        message(FATAL_ERROR "The simulator failed:\n${output}")
+endif()
+
+# the answers are the replay speed, the fill mode, the output file, the metrics and the real-time options
+file(WRITE replay.in "0\n\nreplay.txt\n\n\n")
+execute_process(COMMAND ${APP} replay.raw
+                INPUT_FILE replay.in RESULT_VARIABLE result OUTPUT_VARIABLE output)
+if (NOT result EQUAL 0)
+        message(FATAL_ERROR "The replay failed:\n${output}")
+endif()
+if (NOT output MATCHES "received ${PACKETS}, lost 0 in 0 gaps, duplicated 0, out-of-order 0")
+        message(FATAL_ERROR "The replay is not complete:\n${output}")
+endif()
+
+# the text file has a header line and one line per sample
+file(STRINGS replay.txt lines)
+list(LENGTH lines numLines)
+math(EXPR expected "${PACKETS} + 1")
+if (NOT numLines EQUAL expected)
+        message(FATAL_ERROR "The output file has ${numLines} instead of ${expected} lines.")
+endif()
@@ -0,0 +1,256 @@
+/*
+ * This application receives the binary stream that is sent by unicorn2net and reports
+ * on the number of frames that are received and lost. It is meant for testing the network
+ * sink, and as an example for writing a receiver in another language.
+ *
+ * Use as
+ *   unicorn-recv [-t] [-p port] [-g group]
+ *
+ * where -t listens for a TCP connection instead of receiving UDP datagrams, and the group
+ * is the multicast address to join. The default is to join the default multicast group.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+
+#include "unicorn.h"
+#include "unicorn_net.h"
+#include "unicorn_stream.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+/* Helper function for stopping properly. */
+void signal_handler(int signum);
+
+#define MAXMESSAGE  (STREAM_HEADERSIZE + STREAM_BATCH * (4 + STREAM_MAXCHANS * 4))
+#define WAITTIME    (100)     // in milliseconds, how often it is checked whether the receiver should stop
+
+int running = 1;
+
+#ifndef _WIN32
+
+/* Helper functions to read little-endian values. */
+static uint16_t get16(const unsigned char *ptr)
+{
+        return ptr[0] | (ptr[1] << 8);
+}
+
+static uint32_t get32(const unsigned char *ptr)
+{
+        return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+/*******************************************************************************************************/
+/* Helper function to wait for data, this returns 0 when the socket can be read. The signal handler does not
+ * interrupt a blocking recv or accept, hence it is polled with a timeout to check whether it should stop. */
+static int wait_readable(int fd)
+{
+        struct pollfd pfd = {fd, POLLIN, 0};
+        return !(poll(&pfd, 1, WAITTIME) > 0 && (pfd.revents & (POLLIN | POLLHUP | POLLERR)));
+}
+
+/*******************************************************************************************************/
+int main(int argc, char **argv)
+{
+        int fd, listener = -1, opt, tcp = 0, port = STREAM_DEFAULTPORT;
+        const char *group = STREAM_DEFAULTHOST;
+        unsigned char buf[MAXMESSAGE];
+        unsigned long messages = 0, frames = 0, lost = 0, reordered = 0, lastFrames = 0;
+        uint32_t expected = 0, counter = 0;
+        int haveSequence = 0;
+        float value = NAN;
+        double lastReport;
+
+        while ((opt = getopt(argc, argv, "tp:g:h")) != -1) {
+                switch (opt) {
+                case 't': tcp = 1; break;
+                case 'p': port = atoi(optarg); break;
+                case 'g': group = optarg; break;
+                default:
+                        printf("Use as %s [-t] [-p port] [-g group]\n", argv[0]);
+                        return 1;
+                }
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+
+        if ((fd = socket(AF_INET, tcp ? SOCK_STREAM : SOCK_DGRAM, 0)) < 0) {
+                printf("Cannot open socket: %s\n", strerror(errno));
+                return 1;
+        }
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+                printf("Cannot bind to port %d: %s\n", port, strerror(errno));
+                close(fd);
+                return 1;
+        }
+
+        signal(SIGINT, signal_handler);
+        signal(SIGTERM, signal_handler);
+
+        if (tcp) {
+                listener = fd;
+                listen(listener, 1);
+                printf("Waiting for connection on port %d\n", port);
+                fflush(stdout);
+                while (running && wait_readable(listener))
+                        ;
+                if (!running) {
+                        close(listener);
+                        return 0;
+                }
+                if ((fd = accept(listener, NULL, NULL)) < 0) {
+                        printf("Cannot accept connection: %s\n", strerror(errno));
+                        close(listener);
+                        return 1;
+                }
+        }
+        else {
+                struct ip_mreq mreq;
+                if (inet_pton(AF_INET, group, &mreq.imr_multiaddr) == 1 && (ntohl(mreq.imr_multiaddr.s_addr) >> 28) == 0xE) {
+                        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+                        if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0)
+                                printf("Cannot join multicast group %s: %s\n", group, strerror(errno));
+                        else
+                                printf("Joined multicast group %s\n", group);
+                }
+        }
+        printf("Receiving on port %d\n", port);
+        fflush(stdout);
+
+        lastReport = unicorn_clock();
+        while (running) {
+                size_t len;
+
+                if (wait_readable(fd))
+                        continue;
+
+                if (tcp) {
+                        if (unicorn_recv_all(fd, buf, STREAM_HEADERSIZE) != 0)
+                                break;
+                        len = STREAM_HEADERSIZE;
+                        size_t size = get16(buf + 6) * (4 + get16(buf + 4) * (buf[3] == STREAM_INT24 ? 3 : 4));
+                        if (get16(buf) != STREAM_MAGIC || len + size > MAXMESSAGE) {
+                                printf("Invalid message.\n");
+                                break;
+                        }
+                        if (unicorn_recv_all(fd, buf + len, size) != 0)
+                                break;
+                        len += size;
+                }
+                else {
+                        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                        if (n < 0 && errno == EINTR)
+                                continue;
+                        if (n < STREAM_HEADERSIZE || get16(buf) != STREAM_MAGIC)
+                                continue;
+                        len = n;
+                }
+
+                int format = buf[3];
+                int numChannels = get16(buf + 4);
+                int numFrames = get16(buf + 6);
+                uint32_t sequence = get32(buf + 8);
+                size_t frameSize = 4 + numChannels * (format == STREAM_INT24 ? 3 : 4);
+                /* a message without frames or channels, or that is shorter than its header says, is dropped */
+                if (numFrames == 0 || numChannels == 0 || len < STREAM_HEADERSIZE + numFrames * frameSize)
+                        continue;
+
+                /* the sequence number tells how many frames went missing in between */
+                if (haveSequence && sequence != expected) {
+                        if ((int32_t)(sequence - expected) > 0)
+                                lost += sequence - expected;
+                        else {
+                                /* a late message was counted as lost when the next one arrived */
+                                reordered++;
+                                lost -= min(lost, (unsigned long)numFrames);
+                        }
+                }
+                /* a late message does not move the expected sequence number back */
+                if (!haveSequence || (int32_t)(sequence - expected) >= 0)
+                        expected = sequence + numFrames;
+                haveSequence = 1;
+                messages++;
+                frames += numFrames;
+
+                /* keep the counter and the first channel of the last frame */
+                const unsigned char *frame = buf + STREAM_HEADERSIZE + (numFrames - 1) * frameSize;
+                counter = get32(frame);
+                if (format == STREAM_INT24) {
+                        int32_t val = (int32_t)((uint32_t)frame[4] << 8 | (uint32_t)frame[5] << 16 | (uint32_t)frame[6] << 24) >> 8;
+                        value = (val == STREAM_MISSING ? NAN : val * unicorn_resolution[0]);
+                }
+                else {
+                        uint32_t val = get32(frame + 4);
+                        memcpy(&value, &val, 4);
+                }
+
+                double now = unicorn_clock();
+                if (now - lastReport >= 1) {
+                        printf("Received %lu frames in %lu messages, %.1f frames per second, lost %lu, reordered %lu, counter = %u, first channel = %.2f\n", frames, messages, (frames - lastFrames) / (now - lastReport), lost, reordered, counter, value);
+                        fflush(stdout);
+                        lastFrames = frames;
+                        lastReport = now;
+                }
+        }
+
+        printf("Received %lu frames in %lu messages, lost %lu, reordered %lu.\n", frames, messages, lost, reordered);
+
+        close(fd);
+        if (listener >= 0)
+                close(listener);
+
+        return 0;
+}
+
+#else
+
+int main(int argc, char **argv)
+{
+        printf("The receiver is not available on Windows.\n");
+        return 1;
+}
+
+#endif
+
+/*******************************************************************************************************/
+/* Helper function for stopping properly. */
+void signal_handler(int signum) {
+        running = 0;
+}
@@ -0,0 +1,309 @@
+/*
+ * This application simulates a Unicorn on a pseudo-terminal. It answers to the start and
+ * stop commands and streams packets with synthetic EEG data and an incrementing counter.
+ * The pseudo-terminal can be opened by all other applications as if it were the serial
+ * port of a real device, which allows testing and benchmarking without the headset.
+ *
+ * Use as
+ *   unicorn-sim [-r rate] [-a acceleration] [-j jitter] [-l loss] [-u duplicate] [-d drop] [-c corrupt] [-n count] [-o capture] [-s]
+ *
+ * where the rate is in Hz, the acceleration is a factor relative to real time (0 is as fast
+ * as possible), the jitter is in milliseconds and the others are probabilities per packet.
+ * All bytes that are sent can also be written to a capture file, which can be replayed.
+ * With -s the simulated device is already streaming, like after a crash of the application.
+ * With -n it stops after the specified number of packets, which is useful for automated tests.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+
+#include "unicorn.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#if defined __APPLE__
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+/* Helper function for stopping properly. */
+void signal_handler(int signum);
+
+#define EEGAMPLITUDE  (20.0)  // in uV
+#define EEGFREQUENCY  (10.0)  // in Hz
+#define FASTBLOCK     (64)    // number of packets between checking for commands when running as fast as possible
+
+int running = 1;
+
+#ifndef _WIN32
+
+/* Helper function to return a uniform random number between 0 and 1. */
+static double uniform(void)
+{
+        return (double)rand() / RAND_MAX;
+}
+
+/*******************************************************************************************************/
+/* Helper function to construct one packet with synthetic data. */
+static void encode_packet(unsigned char *buf, unsigned long counter, double rate)
+{
+        double t = counter / rate;
+        float dat[NCHANS];
+
+        for (int ch=0; ch<8; ch++)
+                dat[ch] = EEGAMPLITUDE * sin(2 * M_PI * EEGFREQUENCY * t + ch * M_PI / 8) + 2.0 * (uniform() - 0.5);
+
+        /* the accelerometer measures gravity along the z-axis, the gyroscope is at rest */
+        dat[8]  = 0;
+        dat[9]  = 0;
+        dat[10] = 1;
+        dat[11] = 0;
+        dat[12] = 0;
+        dat[13] = 0;
+
+        /* the battery is full */
+        dat[14] = 100;
+        dat[15] = counter;
+
+        unicorn_encode(buf, counter, dat);
+}
+
+/*******************************************************************************************************/
+/* Helper function to write all bytes, this only blocks when running as fast as possible. */
+static int write_all(int fd, const unsigned char *buf, size_t len, int block)
+{
+        while (len > 0) {
+                ssize_t n = write(fd, buf, len);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno != EAGAIN || !block)
+                                return 1;
+                        struct pollfd pfd = {fd, POLLOUT, 0};
+                        poll(&pfd, 1, 100);
+                        if (!running)
+                                return 1;
+                        continue;
+                }
+                buf += n;
+                len -= n;
+        }
+        return 0;
+}
+
+/*******************************************************************************************************/
+int main(int argc, char **argv)
+{
+        int master, slave, opt;
+        char name[256];
+        double rate = FSAMPLE, acceleration = 1.0, jitter = 0;
+        double pLoss = 0, pDuplicate = 0, pDrop = 0, pCorrupt = 0;
+        unsigned char command[3] = {0, 0, 0}, packet[PACKETSIZE];
+        unsigned long counter = 0, count = 0, sent = 0, lost = 0, duplicated = 0, dropped = 0, corrupted = 0, overflow = 0;
+        int streaming = 0;
+        double t0 = 0, lastSend = 0, delay = 0;  /* the delay is the jitter of the next packet */
+        FILE *capture = NULL;
+
+        while ((opt = getopt(argc, argv, "r:a:j:l:u:d:c:n:o:sh")) != -1) {
+                switch (opt) {
+                case 'r': rate = atof(optarg); break;
+                case 'a': acceleration = atof(optarg); break;
+                case 'j': jitter = atof(optarg) / 1000.; break;
+                case 'l': pLoss = atof(optarg); break;
+                case 'u': pDuplicate = atof(optarg); break;
+                case 'd': pDrop = atof(optarg); break;
+                case 'c': pCorrupt = atof(optarg); break;
+                case 'n': count = strtoul(optarg, NULL, 10); break;
+                case 's': streaming = 1; break;
+                case 'o':
+                        if ((capture = fopen(optarg, "wb")) == NULL) {
+                                printf("Cannot open file: %s\n", strerror(errno));
+                                return 1;
+                        }
+                        break;
+                default:
+                        printf("Use as %s [-r rate] [-a acceleration] [-j jitter] [-l loss] [-u duplicate] [-d drop] [-c corrupt] [-n count] [-o capture] [-s]\n", argv[0]);
+                        return 1;
+                }
+        }
+
+        if (openpty(&master, &slave, name, NULL, NULL) != 0) {
+                printf("Cannot open pseudo-terminal: %s\n", strerror(errno));
+                return 1;
+        }
+
+        /* the serial line should pass all bytes as they are */
+        struct termios tio;
+        tcgetattr(slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+        fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+        /* the slave remains open here, so that the master does not hang up when the application closes the port */
+        printf("Simulating Unicorn on %s\n", name);
+        printf("rate = %.1f Hz, acceleration = %.1f, jitter = %.1f ms\n", rate, acceleration, jitter * 1000);
+        printf("loss = %.4f, duplicate = %.4f, drop = %.4f, corrupt = %.4f\n", pLoss, pDuplicate, pDrop, pCorrupt);
+        fflush(stdout);
+
+        /* the device is still streaming from an earlier session */
+        if (streaming) {
+                counter = 1;
+                t0 = lastSend = unicorn_clock();
+                printf("Started data stream.\n");
+                fflush(stdout);
+        }
+
+        signal(SIGINT, signal_handler);
+        signal(SIGTERM, signal_handler);
+        signal(SIGHUP, signal_handler);
+
+        while (running) {
+                int timeout = 100;
+                double now = unicorn_clock();
+                double next = 0;
+
+                if (streaming && acceleration > 0) {
+                        next = t0 + (counter - 1) / (rate * acceleration) + delay;
+                        timeout = max(0, (int)(1000 * (next - now)));
+                }
+                else if (streaming) {
+                        timeout = 0;
+                }
+
+                struct pollfd pfd = {master, POLLIN, 0};
+                if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+                        break;
+
+                if (pfd.revents & POLLIN) {
+                        unsigned char buf[64];
+                        ssize_t n = read(master, buf, sizeof(buf));
+                        for (ssize_t i = 0; i < n; i++) {
+                                command[0] = command[1];
+                                command[1] = command[2];
+                                command[2] = buf[i];
+                                if (memcmp(command, start_acq, 3) == 0) {
+                                        write_all(master, (unsigned char *)start_response, 3, 1);
+                                        streaming = 1;
+                                        counter = 1;
+                                        t0 = lastSend = unicorn_clock();
+                                        printf("Started data stream.\n");
+                                }
+                                else if (memcmp(command, stop_acq, 3) == 0) {
+                                        write_all(master, (unsigned char *)stop_response, 3, 1);
+                                        streaming = 0;
+                                        printf("Stopped data stream after %lu packets.\n", counter - 1);
+                                }
+                                fflush(stdout);
+                        }
+                }
+
+                if (!streaming)
+                        continue;
+
+                /* send all packets that are due, or a block of packets when running as fast as possible */
+                for (int k = 0; running && streaming && k < FASTBLOCK; k++) {
+                        if (count && counter > count) {
+                                running = 0;
+                                break;
+                        }
+                        if (acceleration > 0) {
+                                double due = t0 + (counter - 1) / (rate * acceleration);
+                                /* the jitter delays packets, but they remain in order */
+                                if (jitter > 0)
+                                        due = max(lastSend, due + delay);
+                                if (due > unicorn_clock())
+                                        break;
+                                lastSend = due;
+                        }
+
+                        encode_packet(packet, counter, rate);
+                        counter++;
+                        /* the jitter is drawn once per packet, not every time that it is checked whether it is due */
+                        delay = jitter * uniform();
+
+                        if (uniform() < pLoss) {
+                                lost++;
+                                continue;
+                        }
+
+                        size_t len = PACKETSIZE;
+                        if (uniform() < pCorrupt) {
+                                packet[uniform() < 0.5 ? 0 : 1] ^= 0xFF;
+                                corrupted++;
+                        }
+                        if (uniform() < pDrop) {
+                                size_t i = rand() % PACKETSIZE;
+                                memmove(packet + i, packet + i + 1, PACKETSIZE - i - 1);
+                                len--;
+                                dropped++;
+                        }
+
+                        int copies = (uniform() < pDuplicate ? 2 : 1);
+                        duplicated += copies - 1;
+                        for (int c = 0; c < copies; c++) {
+                                /* in real time the packet is lost when the buffer is full, like a real device */
+                                if (write_all(master, packet, len, acceleration == 0) != 0)
+                                        overflow++;
+                                else
+                                        sent++;
+                                if (capture)
+                                        fwrite(packet, 1, len, capture);
+                        }
+                }
+        }
+
+        printf("Sent %lu packets, lost %lu, duplicated %lu, dropped a byte in %lu, corrupted %lu, overflow %lu.\n", sent, lost, duplicated, dropped, corrupted, overflow);
+
+        if (capture)
+                fclose(capture);
+        close(master);
+        close(slave);
+
+        return 0;
+}
+
+#else
+
+int main(int argc, char **argv)
+{
+        printf("The simulator requires pseudo-terminals, which are not available on Windows.\n");
+        return 1;
+}
+
+#endif
+
+/*******************************************************************************************************/
+/* Helper function for stopping properly. */
+void signal_handler(int signum) {
+        running = 0;
+}
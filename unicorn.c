@@ -0,0 +1,1332 @@
+/*
+ * Shared code for reading data from one or multiple Unicorn devices.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+
+#include "unicorn.h"
+#include "unicorn_cache.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#include <windows.h>
+#endif
+
+#if defined __linux__
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#endif
+
+char start_acq[3]      = {0x61, 0x7C, 0x87};
+char stop_acq[3]       = {0x63, 0x5C, 0xC5};
+char start_response[3] = {0x00, 0x00, 0x00};
+char stop_response[3]  = {0x00, 0x00, 0x00};
+char start_sequence[2] = {0xC0, 0x00};
+char stop_sequence[2]  = {0x0D, 0x0A};
+
+const char *unicorn_label[NCHANS] = {"eeg1","eeg2","eeg3","eeg4","eeg5","eeg6","eeg7","eeg8","accelX","accelY","accelZ","gyroX","gyroY","gyroZ","battery","counter"};
+const char *unicorn_unit[NCHANS]  = {"uV","uV","uV","uV","uV","uV","uV","uV","g","g","g","deg/s","deg/s","deg/s","percent","integer"};
+const char *unicorn_type[NCHANS]  = {"EEG","EEG","EEG","EEG","EEG","EEG","EEG","EEG","ACCEL","ACCEL","ACCEL","GYRO","GYRO","GYRO","BATTERY","COUNTER"};
+
+/* this is the value of the least significant bit of each channel in the packet */
+#define EEGRES   (4500000. / 50331642.)
+const double unicorn_resolution[NCHANS] = {EEGRES,EEGRES,EEGRES,EEGRES,EEGRES,EEGRES,EEGRES,EEGRES,1/4096.,1/4096.,1/4096.,1/32.8,1/32.8,1/32.8,100/15.,1};
+
+/*******************************************************************************************************/
+/* Helper function to check whether a name refers to a device rather than to a regular file. */
+static int is_device(const char *name)
+{
+#if defined _WIN32
+        return (strncmp(name, "COM", 3)==0 || strncmp(name, "\\\\.\\", 4)==0);
+#else
+        struct stat st;
+        /* a name that does not exist is only a port when it is in /dev, otherwise it is a capture file that is missing */
+        if (stat(name, &st) != 0)
+                return (strncmp(name, "/dev/", 5)==0);
+        return !S_ISREG(st.st_mode);
+#endif
+}
+
+static int probe(unicorn_t *dev);
+
+/*******************************************************************************************************/
+/* Helper function to find the serial number of a port in the cache. */
+static int cache_serial(const unicorn_cache_t *cache, const char *port, char *serial)
+{
+        for (int i = 0; i < cache->numEntries; i++) {
+                if (strcmp(cache->entry[i].port, port) == 0) {
+                        strcpy(serial, cache->entry[i].serial);
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+/*******************************************************************************************************/
+int unicorn_list(struct sp_port ***port_list)
+{
+        unicorn_cache_t cache;
+        int inputDevice = 0;
+
+        printf("Getting port list.\n");
+        if (sp_list_ports(port_list) != SP_OK) {
+                printf("Cannot get port list.\n");
+                return -1;
+        }
+        unicorn_cache_load(&cache);
+
+        /* Iterate through the ports. When port_list[i] is NULL
+         * this indicates the end of the list. */
+        for (int i = 0; (*port_list)[i] != NULL; i++) {
+                struct sp_port *port = (*port_list)[i];
+                char serial[SERIALLEN] = "";
+
+                /* Get the name of the port. */
+                char *port_name = sp_get_port_name(port);
+                char *port_description = sp_get_port_description(port);
+
+                /* try to identify the serial port with a name or description like UN-20211209, or with the cache */
+                if (unicorn_serial(port_name, serial) || unicorn_serial(port_description, serial) || cache_serial(&cache, port_name, serial))
+                        inputDevice = i;
+                else if (strstr(port_name, "UN")!=0 || (port_description && strstr(port_description, "UN")!=0))
+                        inputDevice = i;
+
+                if (strlen(serial))
+                        printf("port %d: %s (%s)\n", i, port_name, serial);
+                else
+                        printf("port %d: %s\n", i, port_name);
+        }
+
+        return inputDevice;
+}
+
+/*******************************************************************************************************/
+void unicorn_input(char *line, int len)
+{
+        /* the previous answer should not be used again */
+        if (fgets(line, len, stdin) == NULL)
+                strcpy(line, "\n");
+}
+
+/*******************************************************************************************************/
+void unicorn_arguments(char *line, size_t len, int argc, char **argv)
+{
+        line[0] = 0;
+        for (int i = 1; i < argc && strlen(line) + strlen(argv[i]) + 2 < len; i++) {
+                strcat(line, argv[i]);
+                strcat(line, " ");
+        }
+}
+
+/*******************************************************************************************************/
+/* Helper function to find the port of a device from its serial number, the cache is tried before listing all ports. */
+static int select_serial(char *token, struct sp_port **port_list, unicorn_t *dev)
+{
+        unicorn_cache_t cache;
+        struct sp_port **list = port_list;
+        char *port = strchr(token, '=');
+        const char *cached;
+        int found = 0;
+
+        if (port)
+                *port++ = 0;
+        if (strlen(token) >= SERIALLEN) {
+                printf("Invalid serial number %s.\n", token);
+                return 1;
+        }
+        strcpy(dev->serial, token);
+
+        /* the port is added to the cache once the data stream has been started */
+        if (port) {
+                if (sp_get_port_by_name(port, &dev->port) != SP_OK) {
+                        printf("Invalid port %s.\n", port);
+                        return 1;
+                }
+                return 0;
+        }
+
+        /* the port in the cache is only used when the device responds on it */
+        unicorn_cache_load(&cache);
+        if ((cached = unicorn_cache_lookup(&cache, token)) != NULL) {
+                if (sp_get_port_by_name(cached, &dev->port) == SP_OK) {
+                        if (probe(dev) == 0) {
+                                printf("Found %s on port %s.\n", token, cached);
+                                return 0;
+                        }
+                        sp_free_port(dev->port);
+                        dev->port = NULL;
+                }
+                printf("No response from %s on port %s, searching all ports.\n", token, cached);
+                unicorn_cache_update(&cache, token, NULL);
+                unicorn_cache_save(&cache);
+        }
+
+        /* the serial number can be part of the name or description of the port, e.g. on macOS */
+        if (list == NULL && sp_list_ports(&list) != SP_OK)
+                return 1;
+        for (int i = 0; list[i] != NULL && !found; i++) {
+                char serial[SERIALLEN];
+                if (unicorn_serial(sp_get_port_name(list[i]), serial) || unicorn_serial(sp_get_port_description(list[i]), serial))
+                        found = (strcmp(serial, token) == 0 && sp_copy_port(list[i], &dev->port) == SP_OK);
+        }
+        if (list != port_list)
+                sp_free_port_list(list);
+
+        if (!found) {
+                printf("Cannot find %s, specify it once like %s=port.\n", token, token);
+                return 1;
+        }
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Helper function to select one or multiple ports from a line like "1 3 4" or "/dev/ttys004". */
+int unicorn_select(char *line, struct sp_port **port_list, int inputDevice, unicorn_t *device, int maxDevices)
+{
+        struct sp_port **list = port_list;
+        int numPorts = 0, numDevices = 0;
+        char *token;
+
+        for (token = strtok(line, " ,\t\r\n"); token != NULL && numDevices < maxDevices; token = strtok(NULL, " ,\t\r\n")) {
+                unicorn_t *dev = &device[numDevices];
+                memset(dev, 0, sizeof(unicorn_t));
+                if (strncmp(token, "UN-", 3) == 0) {
+                        /* this is the serial number of the device */
+                        if (select_serial(token, list, dev) != 0)
+                                break;
+                }
+                else if (strspn(token, "0123456789") != strlen(token) && !is_device(token)) {
+                        /* this is a capture file with raw packets */
+                        FILE *fp = fopen(token, "rb");
+                        if (fp == NULL) {
+                                printf("Cannot open capture file %s: %s\n", token, strerror(errno));
+                                break;
+                        }
+                        fclose(fp);
+                        dev->fileName = strdup(token);
+                        dev->speed = 1.0;
+                }
+                else if (strspn(token, "0123456789") != strlen(token)) {
+                        /* the port can also be specified by name, e.g. the pseudo-terminal of the simulator */
+                        if (sp_get_port_by_name(token, &dev->port) != SP_OK) {
+                                printf("Invalid port %s.\n", token);
+                                break;
+                        }
+                }
+                else {
+                        int i = atoi(token);
+                        /* the ports are only listed when needed, e.g. when they were given on the command line */
+                        if (list == NULL && sp_list_ports(&list) != SP_OK)
+                                break;
+                        for (numPorts = 0; list[numPorts] != NULL; numPorts++)
+                                ;
+                        if (i < 0 || i >= numPorts) {
+                                printf("Invalid port %s.\n", token);
+                                break;
+                        }
+                        if (sp_copy_port(list[i], &dev->port) != SP_OK)
+                                break;
+                }
+
+                /* the serial number can be part of the name or description of the port */
+                if (dev->port && strlen(dev->serial) == 0) {
+                        if (!unicorn_serial(sp_get_port_name(dev->port), dev->serial))
+                                unicorn_serial(sp_get_port_description(dev->port), dev->serial);
+                }
+                numDevices++;
+        }
+
+        if (list != port_list)
+                sp_free_port_list(list);
+
+        /* an invalid port or serial number invalidates the whole selection */
+        if (token != NULL && numDevices < maxDevices) {
+                for (int i = 0; i < numDevices; i++) {
+                        free(device[i].fileName);
+                        if (device[i].port)
+                                sp_free_port(device[i].port);
+                        memset(&device[i], 0, sizeof(unicorn_t));
+                }
+                return 0;
+        }
+
+        /* there is no room for the remaining ones */
+        if (token != NULL)
+                printf("Ignoring %s and any further ports, at most %d can be selected.\n", token, maxDevices);
+
+        /* use the default when nothing was specified */
+        if (numDevices == 0) {
+                while (port_list && port_list[numPorts] != NULL)
+                        numPorts++;
+                if (inputDevice < 0 || inputDevice >= numPorts)
+                        return 0;
+                memset(&device[0], 0, sizeof(unicorn_t));
+                if (sp_copy_port(port_list[inputDevice], &device[0].port) != SP_OK)
+                        return 0;
+                numDevices = 1;
+        }
+
+        return numDevices;
+}
+
+/*******************************************************************************************************/
+/* Helper function to check whether any of the devices is a capture file. */
+int unicorn_replay(const unicorn_t *device, int numDevices)
+{
+        for (int i = 0; i < numDevices; i++)
+                if (device[i].fileName)
+                        return 1;
+        return 0;
+}
+
+/*******************************************************************************************************/
+void unicorn_set_speed(unicorn_t *device, int numDevices, double speed)
+{
+        for (int i = 0; i < numDevices; i++)
+                device[i].speed = speed;
+}
+
+/*******************************************************************************************************/
+/* Helper function that returns the name of the serial port or of the capture file. */
+const char *unicorn_name(const unicorn_t *dev)
+{
+        if (dev->fileName)
+                return dev->fileName;
+        else
+                return sp_get_port_name(dev->port);
+}
+
+/*******************************************************************************************************/
+/* Helper function to map a capture file in memory. */
+static int replay_open(unicorn_t *dev)
+{
+        printf("Opening capture file %s.\n", dev->fileName);
+#if defined _WIN32
+        FILE *fp = fopen(dev->fileName, "rb");
+        if (fp == NULL)
+                return 1;
+        fseek(fp, 0, SEEK_END);
+        dev->size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        unsigned char *data = malloc(dev->size);
+        if (data == NULL || fread(data, 1, dev->size, fp) != dev->size) {
+                free(data);
+                fclose(fp);
+                return 1;
+        }
+        fclose(fp);
+        dev->data = data;
+#else
+        struct stat st;
+        int fd = open(dev->fileName, O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+                if (fd >= 0)
+                        close(fd);
+                return 1;
+        }
+        dev->size = st.st_size;
+        dev->data = mmap(NULL, dev->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (dev->data == MAP_FAILED) {
+                dev->data = NULL;
+                return 1;
+        }
+        /* the file is read from start to end */
+        madvise((void *)dev->data, dev->size, MADV_SEQUENTIAL);
+#endif
+        dev->offset = 0;
+        printf("Replaying %lu packets at %s.\n", (unsigned long)(dev->size / PACKETSIZE), dev->speed > 0 ? "the recorded pace" : "maximum speed");
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Helper function that returns how many bytes of the capture file can be read now. */
+static size_t replay_available(const unicorn_t *dev)
+{
+        size_t due = dev->size;
+        if (dev->speed > 0)
+                due = ((size_t)((unicorn_clock() - dev->replayStart) * dev->speed * FSAMPLE) + 1) * PACKETSIZE;
+        due = min(due, dev->size);
+        return (due > dev->offset ? due - dev->offset : 0);
+}
+
+/*******************************************************************************************************/
+/* Helper function that returns how many seconds it takes until the next packet of the capture file can be read. */
+static double replay_wait(const unicorn_t *dev)
+{
+        if (dev->speed <= 0 || dev->offset >= dev->size)
+                return 0;
+        double due = dev->replayStart + (dev->offset / PACKETSIZE) / (dev->speed * FSAMPLE);
+        return max(0, due - unicorn_clock());
+}
+
+#if defined __linux__
+
+/*******************************************************************************************************/
+/* Helper function to open the tty directly in raw mode at 115200 baud, 8N1 and without flow control. */
+static int tty_open(unicorn_t *dev)
+{
+        struct termios tio;
+        const char *name = sp_get_port_name(dev->port);
+
+        if ((dev->fd = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC)) < 0)
+                return 1;
+
+        if (tcgetattr(dev->fd, &tio) != 0) {
+                close(dev->fd);
+                return 1;
+        }
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B115200);
+        cfsetospeed(&tio, B115200);
+        tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+        tio.c_cflag |= (CLOCAL | CREAD);
+        tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+        /* reads return immediately, the waiting is done with poll or epoll */
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 0;
+        if (tcsetattr(dev->fd, TCSANOW, &tio) != 0) {
+                close(dev->fd);
+                return 1;
+        }
+
+        dev->direct = 1;
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Helper function to wait until the tty is ready, this returns 1 when it is and 0 on a timeout. */
+static int tty_wait(int fd, short events, double deadline)
+{
+        struct pollfd pfd = {fd, events, 0};
+        int result;
+
+        do {
+                double remaining = deadline - unicorn_clock();
+                if (remaining <= 0)
+                        return 0;
+                result = poll(&pfd, 1, (int)ceil(1000 * remaining));
+        } while (result < 0 && errno == EINTR);
+
+        return (result > 0);
+}
+
+#endif
+
+/*******************************************************************************************************/
+/* Helper function to read up to len bytes that are available now, this returns -1 on an error. */
+static int port_read(unicorn_t *dev, void *buf, size_t len)
+{
+#if defined __linux__
+        if (dev->direct) {
+                ssize_t result = read(dev->fd, buf, len);
+                if (result < 0)
+                        return (errno == EAGAIN || errno == EINTR ? 0 : -1);
+                return (int)result;
+        }
+#endif
+        return sp_nonblocking_read(dev->port, buf, len);
+}
+
+/*******************************************************************************************************/
+/* Helper function to read len bytes, this returns the number of bytes that was read before the timeout. */
+static int port_blocking_read(unicorn_t *dev, void *buf, size_t len, unsigned int timeout)
+{
+#if defined __linux__
+        if (dev->direct) {
+                double deadline = unicorn_clock() + timeout / 1000.;
+                size_t done = 0;
+                while (done < len && tty_wait(dev->fd, POLLIN, deadline)) {
+                        int result = port_read(dev, (char *)buf + done, len - done);
+                        if (result < 0)
+                                return -1;
+                        /* nothing to read while the tty is ready means that it was hung up */
+                        if (result == 0)
+                                break;
+                        done += result;
+                }
+                return (int)done;
+        }
+#endif
+        return sp_blocking_read(dev->port, buf, len, timeout);
+}
+
+/*******************************************************************************************************/
+/* Helper function to write the bytes that fit in the output queue now, this returns -1 on an error. */
+static int port_write(unicorn_t *dev, const void *buf, size_t len)
+{
+#if defined __linux__
+        if (dev->direct) {
+                ssize_t result = write(dev->fd, buf, len);
+                if (result < 0)
+                        return (errno == EAGAIN || errno == EINTR ? 0 : -1);
+                return (int)result;
+        }
+#endif
+        return sp_nonblocking_write(dev->port, buf, len);
+}
+
+/*******************************************************************************************************/
+/* Helper function to open and configure the serial port. */
+static int port_open(unicorn_t *dev)
+{
+        printf("Opening port %s (%s).\n", sp_get_port_name(dev->port), sp_get_port_description(dev->port));
+        dev->direct = 0;
+#if defined __linux__
+        if (tty_open(dev) == 0) {
+                printf("Setting tty to 115200, 8N1, no flow control.\n");
+                return 0;
+        }
+        printf("Cannot open %s directly, using libserialport instead.\n", sp_get_port_name(dev->port));
+#endif
+        if (sp_open(dev->port, SP_MODE_READ_WRITE) != SP_OK) {
+                printf("Cannot open port %s.\n", sp_get_port_name(dev->port));
+                return 1;
+        }
+
+        printf("Setting port to 115200, 8N1, no flow control.\n");
+        if (sp_set_baudrate(dev->port, 115200) != SP_OK ||
+            sp_set_bits(dev->port, 8) != SP_OK ||
+            sp_set_parity(dev->port, SP_PARITY_NONE) != SP_OK ||
+            sp_set_stopbits(dev->port, 1) != SP_OK ||
+            sp_set_flowcontrol(dev->port, SP_FLOWCONTROL_NONE) != SP_OK) {
+                printf("Cannot configure port %s.\n", sp_get_port_name(dev->port));
+                return 1;
+        }
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Helper function to close the serial port, the port itself is kept so that it can be opened again. */
+static void port_close(unicorn_t *dev)
+{
+#if defined __linux__
+        if (dev->direct)
+                close(dev->fd);
+        else
+                sp_close(dev->port);
+        dev->direct = 0;
+#else
+        sp_close(dev->port);
+#endif
+}
+
+/*******************************************************************************************************/
+/* Helper function to open and configure the serial port of a device. */
+int unicorn_open(unicorn_t *dev)
+{
+        unicorn_framer_init(&dev->framer);
+        memset(&dev->stats, 0, sizeof(unicorn_stats_t));
+        dev->packets = 0;
+        dev->haveCounter = 0;
+
+        if (dev->fileName) {
+                if (replay_open(dev) != 0) {
+                        printf("Cannot open capture file %s.\n", dev->fileName);
+                        return 1;
+                }
+                return 0;
+        }
+
+        return port_open(dev);
+}
+
+/*******************************************************************************************************/
+/* Helper functions for the steps of the handshake. */
+static void handshake_enter(unicorn_handshake_t *hs, int state)
+{
+        hs->state = state;
+        hs->since = unicorn_clock();
+}
+
+static void handshake_retry(unicorn_handshake_t *hs)
+{
+        if (++hs->attempt < hs->retries)
+                handshake_enter(hs, HANDSHAKE_BACKOFF);
+        else
+                handshake_enter(hs, HANDSHAKE_FAILED);
+}
+
+static void handshake_begin(unicorn_t *dev, int start, int retries)
+{
+        unicorn_handshake_t *hs = &dev->handshake;
+        memset(hs, 0, sizeof(unicorn_handshake_t));
+        hs->start = start;
+        hs->retries = retries;
+        hs->lastByte = unicorn_clock();
+        handshake_enter(hs, start ? HANDSHAKE_DRAINING : HANDSHAKE_SENDING);
+}
+
+/*******************************************************************************************************/
+/* Helper function to take the next step of the handshake, this does not block. */
+static void handshake_step(unicorn_t *dev)
+{
+        unicorn_handshake_t *hs = &dev->handshake;
+        unsigned char buf[READSIZE];
+        double now = unicorn_clock();
+        int result = 0;
+
+        switch (hs->state) {
+        case HANDSHAKE_DRAINING:
+                /* the bytes that are left over from a previous session are discarded until the device is quiet */
+                while ((result = port_read(dev, buf, READSIZE)) > 0) {
+                        hs->drained += result;
+                        hs->lastByte = now;
+                }
+                if (now - hs->lastByte >= HANDSHAKE_QUIET) {
+                        handshake_enter(hs, HANDSHAKE_SENDING);
+                }
+                else if (!hs->stopSent && now - hs->since >= HANDSHAKE_DRAIN) {
+                        /* the device is still streaming, for example after the application crashed */
+                        port_write(dev, stop_acq, 3);
+                        hs->stopSent = 1;
+                }
+                else if (now - hs->since >= HANDSHAKE_DRAIN + HANDSHAKE_RESPONSE) {
+                        handshake_retry(hs);
+                }
+                break;
+
+        case HANDSHAKE_SENDING:
+                hs->received = 0;
+                if ((result = port_write(dev, (hs->start ? start_acq : stop_acq), 3)) == 3)
+                        handshake_enter(hs, HANDSHAKE_WAITING);
+                else if (result >= 0)
+                        handshake_retry(hs);
+                break;
+
+        case HANDSHAKE_WAITING:
+                if (hs->start) {
+                        /* only the response is read, the packets that follow it are for the framer */
+                        while (hs->received < 3 && (result = port_read(dev, hs->response + hs->received, 3 - hs->received)) > 0)
+                                hs->received += result;
+                        if (hs->received == 3 && memcmp(hs->response, start_response, 3) == 0)
+                                handshake_enter(hs, HANDSHAKE_DONE);
+                        else if (hs->received == 3)
+                                handshake_retry(hs);
+                }
+                else {
+                        /* the device can send some more packets before it stops, the response is followed by silence */
+                        while ((result = port_read(dev, buf, READSIZE)) > 0) {
+                                for (int i = 0; i < result; i++) {
+                                        hs->response[0] = hs->response[1];
+                                        hs->response[1] = hs->response[2];
+                                        hs->response[2] = buf[i];
+                                }
+                                hs->received += result;
+                                hs->lastByte = now;
+                        }
+                        if (hs->received >= 3 && memcmp(hs->response, stop_response, 3) == 0 && now - hs->lastByte >= HANDSHAKE_QUIET)
+                                handshake_enter(hs, HANDSHAKE_DONE);
+                }
+                if (hs->state == HANDSHAKE_WAITING && now - hs->since >= HANDSHAKE_RESPONSE)
+                        handshake_retry(hs);
+                break;
+
+        case HANDSHAKE_BACKOFF:
+                /* the next attempt starts with a clean slate */
+                if (now - hs->since >= HANDSHAKE_DELAY * (1 << (hs->attempt - 1))) {
+                        hs->lastByte = now;
+                        hs->stopSent = 0;
+                        handshake_enter(hs, hs->start ? HANDSHAKE_DRAINING : HANDSHAKE_SENDING);
+                }
+                break;
+        }
+
+        if (result < 0)
+                handshake_enter(hs, HANDSHAKE_FAILED);
+}
+
+/*******************************************************************************************************/
+/* Helper function to wait until one of the ports has data, or until the time of the next step. */
+static void handshake_wait(unicorn_t *device, int numDevices)
+{
+#if defined __linux__ || defined __APPLE__
+        struct pollfd pfd[MAXDEVICES];
+        int n = 0;
+        for (int i = 0; i < numDevices && n < MAXDEVICES; i++) {
+                int fd = device[i].fd;
+                if (device[i].fileName || device[i].handshake.state >= HANDSHAKE_DONE)
+                        continue;
+                if (!device[i].direct && sp_get_port_handle(device[i].port, &fd) != SP_OK)
+                        continue;
+                pfd[n].fd = fd;
+                pfd[n].events = POLLIN;
+                pfd[n].revents = 0;
+                n++;
+        }
+        poll(pfd, n, HANDSHAKE_STEP);
+#else
+        unicorn_sleep(HANDSHAKE_STEP / 1000.);
+#endif
+}
+
+/*******************************************************************************************************/
+/* Helper function to start or stop multiple devices in parallel, this returns the number of devices that failed. */
+static int handshake(unicorn_t *device, int numDevices, int start, int retries)
+{
+        int busy, failed = 0;
+
+        for (int i = 0; i < numDevices; i++) {
+                if (device[i].fileName)
+                        continue;
+                handshake_begin(&device[i], start, retries);
+        }
+
+        do {
+                busy = 0;
+                for (int i = 0; i < numDevices; i++) {
+                        if (device[i].fileName || device[i].handshake.state >= HANDSHAKE_DONE)
+                                continue;
+                        handshake_step(&device[i]);
+                        busy += (device[i].handshake.state < HANDSHAKE_DONE);
+                }
+                if (busy)
+                        handshake_wait(device, numDevices);
+        } while (busy);
+
+        for (int i = 0; i < numDevices; i++) {
+                unicorn_t *dev = &device[i];
+                unicorn_handshake_t *hs = &dev->handshake;
+
+                if (dev->fileName) {
+                        if (start)
+                                dev->replayStart = dev->lastRead = unicorn_clock();
+                        continue;
+                }
+
+                if (hs->drained)
+                        printf("Discarded %lu stale bytes from port %s.\n", hs->drained, unicorn_name(dev));
+                if (hs->state == HANDSHAKE_FAILED) {
+                        printf("Cannot %s data stream of port %s after %d attempts.\n", (start ? "start" : "stop"), unicorn_name(dev), hs->attempt);
+                        failed++;
+                }
+                else if (hs->attempt) {
+                        printf("%s data stream of port %s after %d attempts.\n", (start ? "Started" : "Stopped"), unicorn_name(dev), hs->attempt + 1);
+                }
+                if (start)
+                        dev->lastRead = unicorn_clock();
+        }
+
+        return failed;
+}
+
+/*******************************************************************************************************/
+/* Helper function to add the ports of the devices that responded to the cache, the file is only written when it changed. */
+static void remember(const unicorn_t *device, int numDevices)
+{
+        unicorn_cache_t cache;
+        int changed = 0;
+
+        unicorn_cache_load(&cache);
+        for (int i = 0; i < numDevices; i++) {
+                if (device[i].fileName || strlen(device[i].serial) == 0 || device[i].handshake.state != HANDSHAKE_DONE)
+                        continue;
+                changed += unicorn_cache_update(&cache, device[i].serial, sp_get_port_name(device[i].port));
+        }
+        if (changed && unicorn_cache_save(&cache) != 0)
+                printf("Cannot write the cache with the ports of the devices.\n");
+}
+
+/*******************************************************************************************************/
+/* Helper function to start the data stream. */
+int unicorn_start(unicorn_t *dev)
+{
+        int failed = handshake(dev, 1, 1, HANDSHAKE_RETRIES);
+        remember(dev, 1);
+        return (failed != 0);
+}
+
+/*******************************************************************************************************/
+/* Helper function to stop the data stream. */
+int unicorn_stop(unicorn_t *dev)
+{
+        return (handshake(dev, 1, 0, HANDSHAKE_RETRIES) != 0);
+}
+
+/*******************************************************************************************************/
+int unicorn_start_all(unicorn_t *device, int numDevices)
+{
+        int failed = handshake(device, numDevices, 1, HANDSHAKE_RETRIES);
+        remember(device, numDevices);
+        return (failed != 0);
+}
+
+/*******************************************************************************************************/
+int unicorn_stop_all(unicorn_t *device, int numDevices)
+{
+        return (handshake(device, numDevices, 0, HANDSHAKE_RETRIES) != 0);
+}
+
+/*******************************************************************************************************/
+/* Helper function to check with a single start and stop whether a device responds on its port, this returns 0 if it does. */
+static int probe(unicorn_t *dev)
+{
+        int failed;
+
+        if (port_open(dev) != 0)
+                return 1;
+        failed = handshake(dev, 1, 1, 1);
+        if (!failed)
+                failed = handshake(dev, 1, 0, 1);
+        port_close(dev);
+        return failed;
+}
+
+/*******************************************************************************************************/
+int unicorn_reconnect(unicorn_t *dev)
+{
+        if (dev->fileName)
+                return 1;
+
+        printf("Reconnecting port %s.\n", unicorn_name(dev));
+        port_close(dev);
+        if (port_open(dev) != 0)
+                return 1;
+
+        /* the hardware counter starts again, the samples in between are missing */
+        unicorn_framer_init(&dev->framer);
+        dev->haveCounter = 0;
+        dev->stats.reconnects++;
+        return unicorn_start(dev);
+}
+
+/*******************************************************************************************************/
+/* Helper function to close the serial port of a device. */
+void unicorn_close(unicorn_t *dev)
+{
+        if (dev->data) {
+#if defined _WIN32
+                free((void *)dev->data);
+#else
+                munmap((void *)dev->data, dev->size);
+#endif
+                dev->data = NULL;
+        }
+        if (dev->fileName) {
+                free(dev->fileName);
+                dev->fileName = NULL;
+        }
+        if (dev->port) {
+                port_close(dev);
+                sp_free_port(dev->port);
+                dev->port = NULL;
+        }
+}
+
+/*******************************************************************************************************/
+/* Helper function to parse one packet into 16 channels. */
+void unicorn_decode(const unsigned char *buf, float *dat)
+{
+        unicorn_decode_strided(buf, dat, 1);
+}
+
+/*******************************************************************************************************/
+void unicorn_decode_strided(const unsigned char *buf, float *dat, int stride)
+{
+        for (int ch=0; ch<8; ch++) {
+                long val = (long)buf[3+ch*3] << 16 | (long)buf[4+ch*3] << 8 | (long)buf[5+ch*3];
+                if (val & 0x00800000) {
+                        /* sign extension of the 24-bit value */
+                        val -= 0x01000000;
+                }
+                dat[ch*stride] = (float)val * 4500000. / 50331642.;
+        }
+
+        for (int ch=0; ch<3; ch++) {
+                short val = (short)buf[27+ch*2] | (short)buf[28+ch*2] << 8;
+                dat[(8+ch)*stride] = (float)val / 4096.;
+        }
+
+        for (int ch=0; ch<3; ch++) {
+                short val = (short)buf[33+ch*2] | (short)buf[34+ch*2] << 8;
+                dat[(11+ch)*stride] = (float)val / 32.8;
+        }
+
+        dat[14*stride] = (buf[2] & 0x0F) * 100. / 15.;
+        dat[15*stride] = unicorn_counter(buf);
+}
+
+/*******************************************************************************************************/
+/* Helper function to construct one packet from 16 channels, this is the inverse of unicorn_decode. */
+void unicorn_encode(unsigned char *buf, unsigned long counter, const float *dat)
+{
+        memset(buf, 0, PACKETSIZE);
+        buf[0] = start_sequence[0];
+        buf[1] = start_sequence[1];
+        buf[2] = lround(dat[14] * 15. / 100.) & 0x0F;
+
+        for (int ch=0; ch<8; ch++) {
+                long val = lround(dat[ch] * 50331642. / 4500000.) & 0x00FFFFFF;
+                buf[3+ch*3] = (val >> 16) & 0xFF;
+                buf[4+ch*3] = (val >> 8) & 0xFF;
+                buf[5+ch*3] = val & 0xFF;
+        }
+
+        for (int ch=0; ch<3; ch++) {
+                short val = lround(dat[8+ch] * 4096.);
+                buf[27+ch*2] = val & 0xFF;
+                buf[28+ch*2] = (val >> 8) & 0xFF;
+        }
+
+        for (int ch=0; ch<3; ch++) {
+                short val = lround(dat[11+ch] * 32.8);
+                buf[33+ch*2] = val & 0xFF;
+                buf[34+ch*2] = (val >> 8) & 0xFF;
+        }
+
+        buf[39] = counter & 0xFF;
+        buf[40] = (counter >> 8) & 0xFF;
+        buf[41] = (counter >> 16) & 0xFF;
+        buf[42] = (counter >> 24) & 0xFF;
+        buf[43] = stop_sequence[0];
+        buf[44] = stop_sequence[1];
+}
+
+/*******************************************************************************************************/
+unsigned long unicorn_counter(const unsigned char *buf)
+{
+        return (unsigned long)buf[39] | (unsigned long)buf[40] << 8 | (unsigned long)buf[41] << 16 | (unsigned long)buf[42] << 24;
+}
+
+/*******************************************************************************************************/
+/* Helper function to parse the fill mode from a line like "nan", "linear" or "none". */
+int unicorn_fill_mode(const char *line, int fillMode)
+{
+        if (strncmp(line, "nan", 3)==0)
+                return FILL_NAN;
+        else if (strncmp(line, "linear", 6)==0)
+                return FILL_LINEAR;
+        else if (strncmp(line, "none", 4)==0)
+                return FILL_NONE;
+        else
+                return fillMode;
+}
+
+/*******************************************************************************************************/
+/* Helper function that checks the hardware counter and passes the sample on to the callback. Depending on the
+ * fill mode, missing samples are inserted as NaN or as a linear interpolation between the previous and the current
+ * sample. Duplicated and out-of-order samples are dropped, unless the fill mode is FILL_NONE. */
+void unicorn_fill(unicorn_t *dev, unsigned long counter, const float *dat, int fillMode, unicorn_sample_t callback, void *userData)
+{
+        unicorn_stats_t *stats = &dev->stats;
+        unsigned long missing = 0;
+
+        stats->received++;
+
+        if (dev->haveCounter) {
+                if (counter == dev->lastCounter) {
+                        stats->duplicated++;
+                        if (fillMode != FILL_NONE)
+                                return;
+                }
+                else if (counter < dev->lastCounter) {
+                        stats->outOfOrder++;
+                        if (fillMode != FILL_NONE)
+                                return;
+                }
+                else if (counter - dev->lastCounter > 1) {
+                        missing = counter - dev->lastCounter - 1;
+                        stats->lost += missing;
+                        stats->gaps++;
+                }
+        }
+
+        /* very long gaps are not filled, the data simply continues */
+        if (fillMode != FILL_NONE && missing > 0 && missing <= MAXGAP) {
+                float fill[NCHANS];
+                for (unsigned long k = 1; k <= missing; k++) {
+                        float w = (float)k / (missing + 1);
+                        for (int ch = 0; ch < NCHANS; ch++) {
+                                if (fillMode == FILL_LINEAR)
+                                        fill[ch] = (1.0f - w) * dev->lastSample[ch] + w * dat[ch];
+                                else
+                                        fill[ch] = NAN;
+                        }
+                        /* the counter channel always reflects the missing sample */
+                        fill[15] = dev->lastCounter + k;
+                        stats->filled++;
+                        callback(dev, dev->lastCounter + k, fill, 1, userData);
+                }
+        }
+
+        if (!dev->haveCounter || counter > dev->lastCounter) {
+                dev->haveCounter = 1;
+                dev->lastCounter = counter;
+                memcpy(dev->lastSample, dat, NCHANS * sizeof(float));
+        }
+
+        callback(dev, counter, dat, 0, userData);
+}
+
+/*******************************************************************************************************/
+void unicorn_print_stats(const unicorn_t *dev)
+{
+        const unicorn_stats_t *stats = &dev->stats;
+        printf("Port %s: received %lu, lost %lu in %lu gaps, duplicated %lu, out-of-order %lu, filled %lu, discarded %lu bytes",
+               unicorn_name(dev), stats->received, stats->lost, stats->gaps, stats->duplicated, stats->outOfOrder, stats->filled, dev->framer.discarded);
+        if (stats->reconnects)
+                printf(", reconnected %lu times", stats->reconnects);
+        printf(".\n");
+}
+
+/*******************************************************************************************************/
+void unicorn_framer_init(unicorn_framer_t *framer)
+{
+        memset(framer->buf, 0, PACKETSIZE);
+        framer->fill = 0;
+        framer->discarded = 0;
+}
+
+/*******************************************************************************************************/
+/* Helper function to check the start and stop sequence of a complete packet. */
+static int framer_valid(const unicorn_framer_t *framer)
+{
+        return (framer->buf[0] == (unsigned char)start_sequence[0] &&
+                framer->buf[1] == (unsigned char)start_sequence[1] &&
+                framer->buf[PACKETSIZE-2] == (unsigned char)stop_sequence[0] &&
+                framer->buf[PACKETSIZE-1] == (unsigned char)stop_sequence[1]);
+}
+
+/*******************************************************************************************************/
+/* Helper function to discard bytes up to the next possible start of a packet. */
+static void framer_resync(unicorn_framer_t *framer)
+{
+        unsigned int offset;
+        for (offset = 1; offset < framer->fill; offset++) {
+                if (framer->buf[offset] != (unsigned char)start_sequence[0])
+                        continue;
+                if (offset + 1 == framer->fill || framer->buf[offset+1] == (unsigned char)start_sequence[1])
+                        break;
+        }
+        memmove(framer->buf, framer->buf + offset, framer->fill - offset);
+        framer->fill -= offset;
+        framer->discarded += offset;
+}
+
+/*******************************************************************************************************/
+/* Helper function to pass bytes through the framer, the callback is called for every complete packet. */
+void unicorn_feed(unicorn_t *dev, const unsigned char *data, size_t len, unicorn_callback_t callback, void *userData)
+{
+        unicorn_framer_t *framer = &dev->framer;
+
+        while (len > 0) {
+                size_t n = min(len, (size_t)(PACKETSIZE - framer->fill));
+                memcpy(framer->buf + framer->fill, data, n);
+                framer->fill += n;
+                data += n;
+                len -= n;
+
+                while (framer->fill == PACKETSIZE) {
+                        if (framer_valid(framer)) {
+                                framer->fill = 0;
+                                dev->packets++;
+                                callback(dev, framer->buf, userData);
+                        }
+                        else {
+                                framer_resync(framer);
+                        }
+                }
+        }
+}
+
+/*******************************************************************************************************/
+/* Helper function to read one packet from a single device, this blocks until the timeout. */
+int unicorn_read(unicorn_t *dev, unsigned char *packet, unsigned int timeout)
+{
+        unicorn_framer_t *framer = &dev->framer;
+
+        while (1) {
+                int result;
+
+                if (dev->fileName) {
+                        if (dev->offset >= dev->size) {
+                                printf("Reached the end of %s.\n", dev->fileName);
+                                return REPLAY_END;
+                        }
+                        unicorn_sleep(replay_wait(dev));
+                        result = min(replay_available(dev), (size_t)(PACKETSIZE - framer->fill));
+                        memcpy(framer->buf + framer->fill, dev->data + dev->offset, result);
+                        dev->offset += result;
+                }
+                else {
+                        result = port_blocking_read(dev, framer->buf + framer->fill, PACKETSIZE - framer->fill, timeout);
+                        if (result <= 0)
+                                return 1;
+                }
+                framer->fill += result;
+
+                while (framer->fill == PACKETSIZE) {
+                        if (framer_valid(framer)) {
+                                memcpy(packet, framer->buf, PACKETSIZE);
+                                framer->fill = 0;
+                                dev->packets++;
+                                dev->lastRead = unicorn_clock();
+                                return 0;
+                        }
+                        else {
+                                framer_resync(framer);
+                        }
+                }
+        }
+}
+
+/*******************************************************************************************************/
+int unicorn_waiting(unicorn_t *dev)
+{
+        if (dev->fileName)
+                return (int)min(replay_available(dev), (size_t)READSIZE);
+#if defined __linux__
+        if (dev->direct) {
+                int waiting = 0;
+                ioctl(dev->fd, FIONREAD, &waiting);
+                return max(0, waiting);
+        }
+#endif
+        return max(0, sp_input_waiting(dev->port));
+}
+
+/*******************************************************************************************************/
+/* Helper function to set up the event set for all ports, this is done again after a port has been reopened. */
+static int loop_setup(unicorn_loop_t *loop)
+{
+        unicorn_t *device = loop->device;
+
+        unicorn_loop_free(loop);
+        loop->numPorts = 0;
+
+#if defined __linux__
+        /* a single epoll instance reports which of the devices have data, the ports that were opened
+         * with libserialport are also added, using their file descriptor */
+        if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+                return 1;
+
+        for (int i = 0; i < loop->numDevices; i++) {
+                struct epoll_event event;
+                int fd = device[i].fd;
+                /* capture files are not part of the event set */
+                if (device[i].fileName)
+                        continue;
+                if (!device[i].direct && sp_get_port_handle(device[i].port, &fd) != SP_OK)
+                        return 1;
+                event.events = EPOLLIN;
+                event.data.u32 = i;
+                if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &event) != 0)
+                        return 1;
+                loop->numPorts++;
+        }
+#else
+        if (sp_new_event_set(&loop->events) != SP_OK)
+                return 1;
+
+        for (int i = 0; i < loop->numDevices; i++) {
+                /* capture files are not part of the event set */
+                if (device[i].fileName)
+                        continue;
+                if (sp_add_port_events(loop->events, device[i].port, SP_EVENT_RX_READY) != SP_OK)
+                        return 1;
+                loop->numPorts++;
+        }
+#endif
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+int unicorn_loop_init(unicorn_loop_t *loop, unicorn_t *device, int numDevices)
+{
+        loop->device = device;
+        loop->numDevices = numDevices;
+        loop->numPorts = 0;
+        loop->events = NULL;
+        loop->epfd = -1;
+
+        for (int i = 0; i < numDevices; i++)
+                device[i].lastRead = unicorn_clock();
+
+        return loop_setup(loop);
+}
+
+/*******************************************************************************************************/
+/* Helper function to reconnect a device that failed, this returns -1 when that is not possible. */
+static int loop_reconnect(unicorn_loop_t *loop, unicorn_t *dev)
+{
+        if (unicorn_reconnect(dev) != 0 || loop_setup(loop) != 0) {
+                printf("Cannot reconnect port %s.\n", unicorn_name(dev));
+                return -1;
+        }
+        dev->lastRead = unicorn_clock();
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Helper function to wait for data, this sets ready[i] to 1 for the devices that can be read and to 2 for the devices
+ * that were hung up. This returns -1 on an error. */
+static int loop_wait(unicorn_loop_t *loop, double wait, unsigned char *ready)
+{
+#if defined __linux__
+        struct epoll_event event[MAXDEVICES];
+        int numEvents = epoll_wait(loop->epfd, event, MAXDEVICES, (int)(1000 * wait));
+
+        memset(ready, 0, loop->numDevices);
+        if (numEvents < 0)
+                return (errno == EINTR ? 0 : -1);
+        for (int i = 0; i < numEvents; i++)
+                ready[event[i].data.u32] = ((event[i].events & (EPOLLHUP | EPOLLERR)) ? 2 : 1);
+        return 0;
+#else
+        /* all ports are checked, since the event set does not tell which one has data */
+        memset(ready, 1, loop->numDevices);
+        if (wait >= 0.001 && sp_wait(loop->events, (unsigned int)(1000 * wait)) != SP_OK)
+                return -1;
+        return 0;
+#endif
+}
+
+/*******************************************************************************************************/
+/* Wait until one of the devices has data, read whatever is available and pass it through the framers.
+ * This returns the number of packets, -1 when one of the devices did not send anything for longer than the timeout
+ * and could not be reconnected, or REPLAY_END when one of the capture files has been replayed completely. */
+int unicorn_loop_poll(unicorn_loop_t *loop, unsigned int timeout, unicorn_callback_t callback, void *userData)
+{
+        unsigned char buf[READSIZE];
+        unsigned char ready[MAXDEVICES];
+        int packets = 0;
+        double wait = timeout / 1000.;
+
+        /* capture files can cause the wait to be shorter */
+        for (int i = 0; i < loop->numDevices; i++) {
+                if (loop->device[i].fileName)
+                        wait = min(wait, replay_wait(&loop->device[i]));
+        }
+
+        if (loop->numPorts == 0)
+                unicorn_sleep(wait);
+        else if (loop_wait(loop, wait, ready) != 0)
+                return -1;
+
+        double now = unicorn_clock();
+
+        for (int i = 0; i < loop->numDevices; i++) {
+                unicorn_t *dev = &loop->device[i];
+                unsigned long before = dev->packets;
+                int result = 0;
+
+                if (dev->fileName) {
+                        if (dev->offset >= dev->size) {
+                                printf("Reached the end of %s.\n", dev->fileName);
+                                return REPLAY_END;
+                        }
+                        /* the data is passed directly from the mapped file, a limited amount at a time */
+                        size_t len = min(replay_available(dev), (size_t)REPLAYSIZE);
+                        if (len > 0) {
+                                dev->lastRead = now;
+                                unicorn_feed(dev, dev->data + dev->offset, len, callback, userData);
+                                dev->offset += len;
+                                packets += dev->packets - before;
+                        }
+                        continue;
+                }
+
+                /* a read that does not fill the buffer has emptied the input queue, which saves one read */
+                do {
+                        if (!ready[i] || (result = port_read(dev, buf, READSIZE)) <= 0)
+                                break;
+                        /* this is the arrival time of the packets that are completed by these bytes */
+                        dev->lastRead = unicorn_clock();
+                        unicorn_feed(dev, buf, result, callback, userData);
+                } while (result == READSIZE);
+
+                if (result < 0 || (ready[i] == 2 && dev->packets == before)) {
+                        printf("Cannot read from port %s.\n", unicorn_name(dev));
+                        if (loop_reconnect(loop, dev) != 0)
+                                return -1;
+                        continue;
+                }
+
+                if (dev->packets != before) {
+                        packets += dev->packets - before;
+                }
+                else if (1000. * (now - dev->lastRead) > timeout) {
+                        printf("No data from port %s.\n", unicorn_name(dev));
+                        if (loop_reconnect(loop, dev) != 0)
+                                return -1;
+                }
+        }
+
+        return packets;
+}
+
+/*******************************************************************************************************/
+void unicorn_loop_free(unicorn_loop_t *loop)
+{
+        if (loop->events)
+                sp_free_event_set(loop->events);
+        loop->events = NULL;
+#if defined __linux__
+        if (loop->epfd >= 0)
+                close(loop->epfd);
+        loop->epfd = -1;
+#endif
+}
+
+/*******************************************************************************************************/
+/* Helper function that returns a monotonic time in seconds. */
+double unicorn_clock(void)
+{
+#if defined _WIN32
+        static LARGE_INTEGER frequency = {0};
+        LARGE_INTEGER now;
+        if (frequency.QuadPart == 0)
+                QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&now);
+        return (double)now.QuadPart / (double)frequency.QuadPart;
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+/*******************************************************************************************************/
+void unicorn_sleep(double seconds)
+{
+        if (seconds <= 0)
+                return;
+#if defined _WIN32
+        Sleep((DWORD)(1000 * seconds));
+#else
+        usleep((useconds_t)(1e6 * seconds));
+#endif
+}
@@ -0,0 +1,206 @@
+/*
+ * Shared code for reading data from one or multiple Unicorn devices.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_H
+#define UNICORN_H
+
+#include <stddef.h>
+
+#include "libserialport.h"
+
+#define FSAMPLE     (250)
+#define NCHANS      (16)
+#define PACKETSIZE  (45)
+#define TIMEOUT     (5000)
+#define MAXDEVICES  (16)
+#define READSIZE    (16*PACKETSIZE)
+#define REPLAYSIZE  (1024*PACKETSIZE)
+#define MAXGAP      (FSAMPLE)
+#define SERIALLEN   (32)
+#define REPLAY_END  (-2)    // returned when a capture file has been replayed completely
+
+/* These are the steps of the handshake that starts or stops the data stream. */
+#define HANDSHAKE_DRAINING  (0)     // discard stale bytes until the device is quiet
+#define HANDSHAKE_SENDING   (1)
+#define HANDSHAKE_WAITING   (2)     // for the response
+#define HANDSHAKE_BACKOFF   (3)     // before the next attempt
+#define HANDSHAKE_DONE      (4)
+#define HANDSHAKE_FAILED    (5)
+
+#define HANDSHAKE_RETRIES   (4)
+#define HANDSHAKE_RESPONSE  (1.0)   // in seconds
+#define HANDSHAKE_QUIET     (0.1)   // in seconds without data
+#define HANDSHAKE_DRAIN     (0.5)   // in seconds, after this a device that is still streaming is stopped
+#define HANDSHAKE_DELAY     (0.1)   // in seconds, this doubles with every attempt
+#define HANDSHAKE_STEP      (10)    // in milliseconds
+
+/* These are the options for dealing with samples that are missing according to the hardware counter. */
+#define FILL_NONE   (0)
+#define FILL_NAN    (1)
+#define FILL_LINEAR (2)
+
+extern char start_acq[3];
+extern char stop_acq[3];
+extern char start_response[3];
+extern char stop_response[3];
+extern char start_sequence[2];
+extern char stop_sequence[2];
+
+extern const char *unicorn_label[NCHANS];
+extern const char *unicorn_unit[NCHANS];
+extern const char *unicorn_type[NCHANS];
+extern const double unicorn_resolution[NCHANS];
+
+/* The framer collects bytes until it has a complete packet that starts with
+ * the start_sequence and ends with the stop_sequence. When the data is out of
+ * sync, bytes are discarded until the next start_sequence. */
+typedef struct {
+        unsigned char buf[PACKETSIZE];
+        unsigned int fill;
+        unsigned long discarded;
+} unicorn_framer_t;
+
+/* The handshake does not block, so that multiple devices can be started or stopped in parallel. */
+typedef struct {
+        int state;
+        int start;                      /* 1 to start the data stream, 0 to stop it */
+        int attempt;
+        int retries;
+        int stopSent;                   /* a device that was still streaming has been asked to stop */
+        double since;                   /* when the current step started */
+        double lastByte;                /* when the most recent byte was received */
+        unsigned char response[3];      /* the most recent three bytes */
+        unsigned long received;
+        unsigned long drained;          /* stale bytes that were discarded */
+} unicorn_handshake_t;
+
+/* The hardware counter is used to keep track of lost, duplicated and out-of-order packets. */
+typedef struct {
+        unsigned long received;
+        unsigned long lost;
+        unsigned long duplicated;
+        unsigned long outOfOrder;
+        unsigned long gaps;
+        unsigned long filled;
+        unsigned long reconnects;
+} unicorn_stats_t;
+
+typedef struct {
+        struct sp_port *port;
+        char serial[SERIALLEN];         /* like UN-2021.05.36, this is empty when the serial number is not known */
+        int direct;                     /* on Linux the tty is opened directly, with libserialport as fallback */
+        int fd;                         /* of the tty when it is opened directly */
+        char *fileName;                 /* the data is replayed from a capture file instead of the serial port */
+        double speed;                   /* the replay speed relative to real time, 0 is as fast as possible */
+        const unsigned char *data;      /* the capture file is mapped in memory */
+        size_t size, offset;
+        double replayStart;
+        unicorn_framer_t framer;
+        unicorn_handshake_t handshake;
+        unsigned long packets;
+        double lastRead;
+        unicorn_stats_t stats;
+        int haveCounter;
+        unsigned long lastCounter;
+        float lastSample[NCHANS];
+        void *userData;
+} unicorn_t;
+
+/* This is called for every complete packet, the userData is the one that was passed to unicorn_loop_poll. */
+typedef void (*unicorn_callback_t)(unicorn_t *dev, const unsigned char *packet, void *userData);
+
+/* This is called for every sample that comes out of the gap detection, filled is 1 for samples that were inserted. */
+typedef void (*unicorn_sample_t)(unicorn_t *dev, unsigned long counter, const float *dat, int filled, void *userData);
+
+/* The event loop services all devices from a single thread. */
+typedef struct {
+        unicorn_t *device;
+        int numDevices;
+        int numPorts;
+        struct sp_event_set *events;
+        int epfd;                       /* on Linux the ports are serviced with epoll */
+} unicorn_loop_t;
+
+/* Helper function to list the ports, this returns the most likely Unicorn as default or -1 on error. */
+int unicorn_list(struct sp_port ***port_list);
+
+/* Helper function to read the answer to a question, at the end of the input the answer is empty so that the default is used. */
+void unicorn_input(char *line, int len);
+
+/* Helper function to join the command line arguments into a line for unicorn_select. */
+void unicorn_arguments(char *line, size_t len, int argc, char **argv);
+
+/* Helper function to select one or multiple ports from a line like "1 3 4" or "/dev/ttys004" or "session.raw".
+ * A serial number like "UN-2021.05.36" is looked up in the cache, and "UN-2021.05.36=/dev/rfcomm0" adds it.
+ * The port list is only needed for port numbers, it can be NULL. */
+int unicorn_select(char *line, struct sp_port **port_list, int inputDevice, unicorn_t *device, int maxDevices);
+
+/* Helper functions for capture files. */
+int unicorn_replay(const unicorn_t *device, int numDevices);
+void unicorn_set_speed(unicorn_t *device, int numDevices, double speed);
+const char *unicorn_name(const unicorn_t *dev);
+
+/* Helper functions to open, start, stop and close a device. */
+int unicorn_open(unicorn_t *dev);
+int unicorn_start(unicorn_t *dev);
+int unicorn_stop(unicorn_t *dev);
+void unicorn_close(unicorn_t *dev);
+
+/* Helper functions to start or stop multiple devices in parallel, this returns 0 when all of them succeeded. */
+int unicorn_start_all(unicorn_t *device, int numDevices);
+int unicorn_stop_all(unicorn_t *device, int numDevices);
+
+/* Helper function to close and open the port again, and to restart the data stream. */
+int unicorn_reconnect(unicorn_t *dev);
+
+/* Helper function to read one packet from a single device, this blocks until the timeout. This returns 0 on
+ * success, REPLAY_END at the end of a capture file or 1 on error. */
+int unicorn_read(unicorn_t *dev, unsigned char *packet, unsigned int timeout);
+
+/* Helper function to return the number of bytes that can be read without blocking. */
+int unicorn_waiting(unicorn_t *dev);
+
+/* Helper function to parse one packet into 16 channels, the strided version writes channel c to dat[c*stride]. */
+void unicorn_decode(const unsigned char *packet, float *dat);
+void unicorn_decode_strided(const unsigned char *packet, float *dat, int stride);
+unsigned long unicorn_counter(const unsigned char *packet);
+
+/* Helper function to construct one packet from 16 channels, this is the inverse of unicorn_decode. */
+void unicorn_encode(unsigned char *packet, unsigned long counter, const float *dat);
+
+/* Helper functions for the detection of missing samples. */
+int unicorn_fill_mode(const char *line, int fillMode);
+void unicorn_fill(unicorn_t *dev, unsigned long counter, const float *dat, int fillMode, unicorn_sample_t callback, void *userData);
+void unicorn_print_stats(const unicorn_t *dev);
+
+/* Helper functions for the framer. */
+void unicorn_framer_init(unicorn_framer_t *framer);
+void unicorn_feed(unicorn_t *dev, const unsigned char *data, size_t len, unicorn_callback_t callback, void *userData);
+
+/* Helper functions for the event loop. */
+int unicorn_loop_init(unicorn_loop_t *loop, unicorn_t *device, int numDevices);
+int unicorn_loop_poll(unicorn_loop_t *loop, unsigned int timeout, unicorn_callback_t callback, void *userData);
+void unicorn_loop_free(unicorn_loop_t *loop);
+
+/* Helper functions that deal with a monotonic time in seconds. */
+double unicorn_clock(void);
+void unicorn_sleep(double seconds);
+
+#endif
@@ -32,10 +32,18 @@
 #include <errno.h>
 #include <math.h>
 #include <signal.h>
+#include <assert.h>
+#include <stdatomic.h>
 
 #include "libserialport.h"
 #include "portaudio.h"
-#include "samplerate.h"
+#include "unicorn.h"
+#include "unicorn_latency.h"
+#include "unicorn_metrics.h"
+#include "unicorn_realtime.h"
+#include "unicorn_audio.h"
+#include "unicorn_montage.h"
+#include "unicorn_block.h"
 
 #if defined __linux__ || defined __APPLE__
 // Linux and macOS code goes here
@@ -51,392 +59,182 @@ int sp_check(enum sp_return result);
 
 /* Helper functions for stopping neatly. */
 void signal_handler(int signum);
-void stream_finished(void *userData);
 
 /* Helper function to read and parse one sample. */
-int unicorn_pull_sample(struct sp_port *port, float *dat);
+int unicorn_pull_sample(unicorn_t *dev, unsigned long *counter, float *dat);
 
-/* Helper function for low-pass filtering. */
-#define smooth(old, new, lambda) ((1.0-lambda)*(old) + (lambda)*(new))
+/* Helper function to read all samples that are available, at least one and at most a full block. */
+int unicorn_pull_block(unicorn_t *dev, unicorn_block_t *block);
+void unicorn_queue_sample(unicorn_t *dev, unsigned long counter, const float *dat, int filled, void *userData);
 
-#define SAMPLETYPE    paFloat32
-#define BLOCKSIZE     (0.01)  // in seconds
-#define BUFFERSIZE    (2.00)  // in seconds
-#define DEFAULTRATE   (44100.0)
-#define FSAMPLE       (250)
-#define NCHAN         (16)
 #define STRLEN        (80)
-#define PACKETSIZE    (45)
-#define TIMEOUT       (5000)
-#define HPFILTER      (10.0)
-#define OUTPUTLIMIT   (1.0)
-
-char start_acq[]      = {0x61, 0x7C, 0x87};
-char stop_acq[]       = {0x63, 0x5C, 0xC5};
-char start_response[] = {0x00, 0x00, 0x00};
-char stop_response[]  = {0x00, 0x00, 0x00};
-char start_sequence[] = {0xC0, 0x00};
-char stop_sequence[]  = {0x0D, 0x0A};
-
-struct sp_port *port = NULL;
-int keepRunning = 1;
-
-typedef struct {
-        float *data;
-        unsigned long frames;
-} dataBuffer_t;
-
-dataBuffer_t inputData, outputData;
-
-SRC_STATE* resampleState = NULL;
-SRC_DATA resampleData;
-int srcErr;
-
-float inputRate, outputRate, resampleRatio;
-short enableResampleBuffers = 0, enableUpdateRatio = 0, enableUpdateLimit = 0;
-int channelCount, outputBlocksize, inputBufsize, outputBufsize;
-float outputLimit;
-
-/*******************************************************************************************************/
-int resample_buffers(void) {
-        resampleData.src_ratio      = resampleRatio;
-        resampleData.end_of_input   = 0;
-        resampleData.data_in        = inputData.data;
-        resampleData.input_frames   = inputData.frames;
-        resampleData.data_out       = outputData.data + outputData.frames * channelCount;
-        resampleData.output_frames  = outputBufsize - outputData.frames;
-
-        /* check whether there is data in the input buffer */
-        if (inputData.frames==0)
-                return 0;
-
-        /* check whether there is room for new data in the output buffer */
-        if (outputData.frames==outputBufsize)
-                return 0;
-
-        int srcErr = src_process (resampleState, &resampleData);
-        if (srcErr)
-        {
-                printf("ERROR: Cannot resample the input data\n");
-                printf("ERROR: %s\n", src_strerror(srcErr));
-                exit(srcErr);
-        }
-
-        /* the output data buffer increased */
-        outputData.frames += resampleData.output_frames_gen;
-
-        /* the input data buffer decreased */
-        size_t len = (inputData.frames - resampleData.input_frames_used) * channelCount * sizeof(float);
-        memcpy(inputData.data, inputData.data + resampleData.input_frames_used * channelCount, len);
-        inputData.frames -= resampleData.input_frames_used;
-
-        return 0;
-}
-
-/*******************************************************************************************************/
-int update_ratio(void) {
-        float nominal = (float)outputRate/inputRate;
-        float estimate = nominal + (0.5*outputBufsize - outputData.frames) / outputBlocksize;
-
-        /* do not change the ratio by too much */
-        estimate = min(estimate, 1.2*nominal);
-        estimate = max(estimate, 0.8*nominal);
-
-        /* allow some variation of the target buffer size */
-        /* it should fall between the lower and upper range */
-        float verylow   = (0.40*outputBufsize);
-        float low       = (0.48*outputBufsize);
-        float high      = (0.52*outputBufsize);
-        float veryhigh  = (0.60*outputBufsize);
-
-        /* this is called every 0.01 seconds, hence lambda=1.0*BLOCKSIZE implements a 1 second smoothing
-           and 10*BLOCKSIZE implements a 0.1 second smoothing */
-        if (outputData.frames<verylow)
-                resampleRatio = smooth(resampleRatio, estimate, 10. * BLOCKSIZE);
-        else if (outputData.frames<low)
-                resampleRatio = smooth(resampleRatio, estimate, 1. * BLOCKSIZE);
-        else if (outputData.frames>high)
-                resampleRatio = smooth(resampleRatio, estimate, 1. * BLOCKSIZE);
-        else if (outputData.frames>veryhigh)
-                resampleRatio = smooth(resampleRatio, estimate, 10. * BLOCKSIZE);
-        else
-                resampleRatio = smooth(resampleRatio, nominal, 10. * BLOCKSIZE);
-
-        // printf("%lu\t%f\t%f\t%f\n", outputData.frames, nominal, estimate, resampleRatio);
-
-        return 0;
-}
-
-/*******************************************************************************************************/
-static int output_callback(const void *input,
-                           void *output,
-                           unsigned long frameCount,
-                           const PaStreamCallbackTimeInfo* timeInfo,
-                           PaStreamCallbackFlags statusFlags,
-                           void *userData)
-{
-        float *data = (float *)output;
-        dataBuffer_t *outputData = (dataBuffer_t *)userData;
-        unsigned int newFrames = min(frameCount, outputData->frames);
 
-        size_t len = newFrames * channelCount * sizeof(float);
-        memcpy(data, outputData->data, len);
+unicorn_t device;
 
-        len = (frameCount - newFrames) * channelCount * sizeof(float);
-        memset(data + newFrames * channelCount, 0, len);
-
-        len = (outputData->frames - newFrames) * channelCount * sizeof(float);
-        memcpy(outputData->data, outputData->data + newFrames * channelCount, len);
-
-        outputData->frames -= newFrames;
-
-        if (enableUpdateLimit) {
-               for (unsigned int i = 0; i < (newFrames * channelCount); i++)
-                        outputLimit = max(outputLimit, fabsf(data[i]));
-        }
+/* samples that are interpolated for missing packets are returned on subsequent calls */
+float pendingData[MAXGAP+1][NCHANS];
+unsigned long pendingCounter[MAXGAP+1];
+int pendingCount = 0, pendingIndex = 0;
+int keepRunning = 1;
 
-        if (enableResampleBuffers)
-                resample_buffers();
+/* the resampling and the audio output are handled by another thread */
+unicorn_audio_t audio;
+unicorn_latency_t latency;
 
-        if (enableUpdateRatio)
-                update_ratio();
+/* the EEG channels can be re-referenced prior to the sonification */
+unicorn_montage_t montage;
 
-        return paContinue;
-}
+/* the metrics are served from another thread */
+unicorn_metrics_t metrics;
+unicorn_realtime_t realtime;
+unicorn_metric_t *metricRatio, *metricLimit, *metricInput, *metricOutput;
+unicorn_metric_t *metricUnderflow, *metricOverflow, *metricZeroFilled, *metricOverrun, *metricOutputMin, *metricOutputMax;
 
 /*******************************************************************************************************/
 int main(int argc, char **argv)
 {
-        char line[STRLEN];
-        FILE *fp;
+        char line[STRLEN], metricsAddress[STRLEN];
         int inputDevice = 0;
-        float bufferSize, blockSize, hpFilter;
+        float bufferSize, blockSize, hpFilter, outputLimit, outputRate;
         struct sp_port **port_list = NULL;
-        float eegdata[NCHAN], eegfilt[NCHAN];
+        unicorn_block_t block;
         unsigned long samplesReceived = 0;
-
-        /* variables that are specific for PortAudio */
         unsigned int outputDevice;
-        PaStream *outputStream;
-        PaStreamParameters outputParameters;
-        PaError paErr = paNoError;
-        unsigned int numDevices;
+        int channelCount;
         const PaDeviceInfo *deviceInfo;
 
         /* STAGE 1: Initialize the input serial port. */
 
-        printf("Getting port list.\n");
-        sp_check(sp_list_ports(&port_list));
-
-        /* Iterate through the ports. When port_list[i] is NULL
-         * this indicates the end of the list. */
-        for (int i = 0; port_list[i] != NULL; i++) {
-                struct sp_port *port = port_list[i];
-
-                /* Get the name of the port. */
-                char *port_name = sp_get_port_name(port);
-                char *port_description = sp_get_port_description(port);
-
-                /* try to identify the serial port with a name or description like UN-20211209 */
-                if (strstr(port_name, "UN")!=0 || strstr(port_description, "UN")!=0)
-                        inputDevice = i;
-
-                printf("port %d: %s\n", i, port_name);
+        if (argc > 1) {
+                /* the port or serial number can also be given on the command line, then the ports are not listed */
+                unicorn_arguments(line, STRLEN, argc, argv);
+        }
+        else {
+                if ((inputDevice = unicorn_list(&port_list)) < 0)
+                        return 1;
+                printf("Select serial port [%d]: ", inputDevice);
+                unicorn_input(line, STRLEN);
+        }
+        if (unicorn_select(line, port_list, inputDevice, &device, 1)!=1) {
+                printf("No port selected.\n");
+                sp_free_port_list(port_list);
+                return 1;
         }
 
-        printf("Select serial port [%d]: ", inputDevice);
-        fgets(line, STRLEN, stdin);
-        if (strlen(line)==1)
-                inputDevice = inputDevice;
-        else
-                inputDevice = atoi(line);
+        if (unicorn_replay(&device, 1)) {
+                printf("Replay speed relative to real time, 0 is as fast as possible [1]: ");
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        unicorn_set_speed(&device, 1, atof(line));
+        }
 
-        printf("Buffer size in seconds [%.4f]: ", BUFFERSIZE);
-        fgets(line, STRLEN, stdin);
+        printf("Buffer size in seconds [%.4f]: ", AUDIO_BUFFERSIZE);
+        unicorn_input(line, STRLEN);
         if (strlen(line) == 1)
-                bufferSize = BUFFERSIZE;
+                bufferSize = AUDIO_BUFFERSIZE;
         else
                 bufferSize = atof(line);
 
-        printf("Block size in seconds [%.4f]: ", BLOCKSIZE);
-        fgets(line, STRLEN, stdin);
+        printf("Block size in seconds [%.4f]: ", AUDIO_BLOCKSIZE);
+        unicorn_input(line, STRLEN);
         if (strlen(line) == 1)
-                blockSize = BLOCKSIZE;
+                blockSize = AUDIO_BLOCKSIZE;
         else
                 blockSize = atof(line);
 
-        printf("High-pass filter in seconds [%.0f]: ", HPFILTER);
-        fgets(line, STRLEN, stdin);
+        printf("High-pass filter in seconds [%.0f]: ", AUDIO_HPFILTER);
+        unicorn_input(line, STRLEN);
         if (strlen(line) == 1)
-                /* this implements an exponential decay of 1/2 after 10 seconds at 250 Hz */
-                hpFilter = 1.0 - pow(0.5, 1.0/(FSAMPLE*HPFILTER));
+                hpFilter = AUDIO_HPFILTER;
         else
-                hpFilter = 1.0 - pow(0.5, 1.0/(FSAMPLE*atof(line)));
+                hpFilter = atof(line);
 
         printf("Output limit [automatic scale]: ");
-        fgets(line, STRLEN, stdin);
-        if (strlen(line) == 1) {
+        unicorn_input(line, STRLEN);
+        if (strlen(line) == 1)
                 /* start with the default and update automatically */
-                outputLimit = OUTPUTLIMIT;
-                enableUpdateLimit = 1;
-        }
-        else {
+                outputLimit = 0;
+        else
                 /* use the user-supplied value and do not update automatically */
                 outputLimit = atof(line);
-                enableUpdateLimit = 0;
+
+        printf("Montage none, car, bipolar or matrix file [none]: ");
+        unicorn_input(line, STRLEN);
+        if (unicorn_montage_init(&montage, line)!=0) {
+                sp_free_port_list(port_list);
+                return 1;
         }
 
-        /* copy the selected port, clear the others */
-        sp_check(sp_copy_port(port_list[inputDevice], &port));
+        /* the selected port has been copied, clear the others */
         sp_free_port_list(port_list);
 
-        printf("Opening port %s (%s).\n", sp_get_port_name(port), sp_get_port_description(port));
-        sp_check(sp_open(port, SP_MODE_READ_WRITE));
-
-        printf("Setting port to 115200, 8N1, no flow control.\n");
-        sp_check(sp_set_baudrate(port, 115200));
-        sp_check(sp_set_bits(port, 8));
-        sp_check(sp_set_parity(port, SP_PARITY_NONE));
-        sp_check(sp_set_stopbits(port, 1));
-        sp_check(sp_set_flowcontrol(port, SP_FLOWCONTROL_NONE));
-
-        inputRate = FSAMPLE;
-        inputBufsize = bufferSize * inputRate;
+        if (unicorn_open(&device)!=0)
+                goto cleanup1;
 
         /* STAGE 2: Initialize the output audio port. */
 
-        printf("PortAudio version: 0x%08X\n", Pa_GetVersion());
-
-        /* Initialize library before making any other calls. */
-        paErr = Pa_Initialize();
-        if(paErr != paNoError) {
-                printf("ERROR: Cannot initialize PortAudio.\n");
-                printf("ERROR: %s\n", Pa_GetErrorText(paErr));
-                goto cleanup2;
-        }
-
-        numDevices = Pa_GetDeviceCount();
-        if (numDevices <= 0) {
-                printf("ERROR: No audio devices available.\n");
-                paErr = numDevices;
+        if (unicorn_audio_init()!=0)
                 goto cleanup2;
-        }
 
-        printf("Number of host APIs = %d\n", Pa_GetHostApiCount());
-        printf("Number of devices = %d\n", numDevices);
-        for (int i = 0; i < numDevices; i++) {
-                deviceInfo = Pa_GetDeviceInfo(i);
-                if (Pa_GetHostApiCount() == 1)
-                        printf("device %2d - %s (%d in, %d out)\n", i,
-                               deviceInfo->name,
-                               deviceInfo->maxInputChannels,
-                               deviceInfo->maxOutputChannels);
-                else
-                        printf("device %2d - %s - %s (%d in, %d out)\n", i,
-                               Pa_GetHostApiInfo(deviceInfo->hostApi)->name,
-                               deviceInfo->name,
-                               deviceInfo->maxInputChannels,
-                               deviceInfo->maxOutputChannels);
-        }
         printf("Select output device [%d]: ", Pa_GetDefaultOutputDevice());
-        fgets(line, STRLEN, stdin);
+        unicorn_input(line, STRLEN);
         if (strlen(line)==1)
                 outputDevice = Pa_GetDefaultOutputDevice();
         else
                 outputDevice = atoi(line);
 
-        printf("Output sampling rate [%.0f]: ", DEFAULTRATE);
-        fgets(line, STRLEN, stdin);
+        printf("Output sampling rate [%.0f]: ", AUDIO_DEFAULTRATE);
+        unicorn_input(line, STRLEN);
         if (strlen(line)==1)
-                outputRate = DEFAULTRATE;
+                outputRate = AUDIO_DEFAULTRATE;
         else
                 outputRate = atof(line);
 
-        channelCount = 8; // the automatic scaling messes up when using all 16 channels
+        channelCount = AUDIO_MAXCHANS;
         deviceInfo = Pa_GetDeviceInfo(outputDevice);
         printf("Number of channels [%d]: ", min(channelCount, deviceInfo->maxOutputChannels));
-        fgets(line, STRLEN, stdin);
+        unicorn_input(line, STRLEN);
         if (strlen(line) == 1)
                 channelCount = min(channelCount, deviceInfo->maxOutputChannels);
         else
                 channelCount = min(channelCount, atoi(line));
 
-        printf("outputDevice = %d\n", outputDevice);
-        printf("outputRate = %f\n", outputRate);
-        printf("channelCount = %d\n", channelCount);
-
-        outputParameters.device = outputDevice;
-        outputParameters.channelCount = channelCount;
-        outputParameters.sampleFormat = SAMPLETYPE;
-        outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
-        outputParameters.hostApiSpecificStreamInfo = NULL;
-
-        outputBufsize = bufferSize * outputRate;
-        outputBlocksize = blockSize * outputRate;
-
-        paErr = Pa_OpenStream(
-                &outputStream,
-                NULL,
-                &outputParameters,
-                outputRate,
-                outputBlocksize,
-                paNoFlag,
-                output_callback,
-                &outputData);
-        if(paErr != paNoError)
-        {
-                printf("ERROR: Cannot open output stream.\n");
-                printf("ERROR: %s\n", Pa_GetErrorText(paErr));
+        memset(metricsAddress, 0, STRLEN);
+        printf("Metrics port or socket file [none]: ");
+        unicorn_input(line, STRLEN);
+        if (strlen(line)>1)
+                strncpy(metricsAddress, line, strlen(line)-1);
+
+        printf("Real-time options, any of fifo:priority rr:priority cpu:list audio:list lock [none]: ");
+        unicorn_input(line, STRLEN);
+        if (unicorn_realtime_parse(&realtime, line)!=0) {
+                printf("Cannot parse the real-time options.\n");
                 goto cleanup2;
         }
 
-        printf("Opened output stream with %d channels at %.0f Hz.\n", channelCount, outputRate);
-
-        /* ensure a gracefull exit when the audio stream is closed */
-        Pa_SetStreamFinishedCallback(&outputStream, stream_finished);
+        unicorn_metrics_init(&metrics, 1, &latency);
+        metricRatio  = unicorn_metrics_add(&metrics, "unicorn_resample_ratio", "Ratio between the output and input sampling rate of the resampler.", "gauge");
+        metricLimit  = unicorn_metrics_add(&metrics, "unicorn_output_limit", "Scaling of the EEG data to the audio range between -1 and +1.", "gauge");
+        metricInput  = unicorn_metrics_add(&metrics, "unicorn_input_buffer_frames", "Number of samples waiting in the input buffer of the resampler.", "gauge");
+        metricOutput = unicorn_metrics_add(&metrics, "unicorn_output_buffer_frames", "Number of audio frames waiting in the output buffer.", "gauge");
+        metricOutputMin  = unicorn_metrics_add(&metrics, "unicorn_output_buffer_min_frames", "Lowest number of frames in the output buffer during the last second.", "gauge");
+        metricOutputMax  = unicorn_metrics_add(&metrics, "unicorn_output_buffer_max_frames", "Highest number of frames in the output buffer during the last second.", "gauge");
+        metricUnderflow  = unicorn_metrics_add(&metrics, "unicorn_audio_underflows_total", "Number of callbacks in which the audio interface reported an output underflow.", "counter");
+        metricOverflow   = unicorn_metrics_add(&metrics, "unicorn_audio_overflows_total", "Number of callbacks in which the audio interface reported an output overflow.", "counter");
+        metricZeroFilled = unicorn_metrics_add(&metrics, "unicorn_audio_zero_filled_frames_total", "Number of audio frames that were filled with zeros because the output buffer was empty.", "counter");
+        metricOverrun    = unicorn_metrics_add(&metrics, "unicorn_input_overruns_total", "Number of samples that were dropped because the input buffer was full.", "counter");
 
         /* STAGE 3: Initialize the resampling. */
 
-        inputData.frames = 0;
-        inputData.data = NULL;
-        if ((inputData.data = malloc(inputBufsize * channelCount * sizeof(float))) == NULL)
-                goto cleanup3;
-        else
-                memset(inputData.data, 0, inputBufsize * channelCount * sizeof(float));
-
-        outputData.frames = 0;
-        outputData.data = NULL;
-        if ((outputData.data = malloc(outputBufsize * channelCount * sizeof(float))) == NULL)
-                goto cleanup3;
-        else
-                memset(outputData.data, 0, outputBufsize * channelCount * sizeof(float));
-
-        printf("Setting up %s rate converter with %s\n",
-               src_get_name (SRC_SINC_MEDIUM_QUALITY),
-               src_get_description (SRC_SINC_MEDIUM_QUALITY));
-
-        resampleState = src_new (SRC_SINC_MEDIUM_QUALITY, channelCount, &srcErr);
-        if (resampleState == NULL) {
-                printf("ERROR: Cannot set up resample state.\n");
-                printf("ERROR: %s\n", src_strerror(srcErr));
+        unicorn_latency_init(&latency);
+        if (unicorn_audio_open(&audio, outputDevice, outputRate, channelCount, bufferSize, blockSize, hpFilter, outputLimit, &latency)!=0)
                 goto cleanup3;
-        }
+        unicorn_audio_realtime(&audio, &realtime);
 
         /* STAGE 4: Start the streams. */
 
-        unsigned char *buf = malloc(PACKETSIZE);
-        memset(buf, 0, PACKETSIZE);
-
-        if (sp_blocking_write(port, start_acq, 3, TIMEOUT)!=3) {
-                printf("Cannot start data stream.\n");
+        if (unicorn_start(&device)!=0)
                 goto cleanup4;
-        }
-
-        int result = sp_blocking_read(port, buf, 3, TIMEOUT);
-        if (result!=3 || buf[0]!=0x00 || buf[1]!=0x00 || buf[2]!=0x00) {
-                printf("Incorrect response.\n");
-                goto cleanup4;
-        }
 
         printf("Started data stream.\n");
 
@@ -447,166 +245,140 @@ int main(int argc, char **argv)
         signal(SIGUSR2, signal_handler);
 #endif
 
-        printf("Flushing initial data...\n");
-
-        /* discard the first few seconds, this tends to have weird values */
-        while (samplesReceived<5*FSAMPLE) {
-                if (unicorn_pull_sample(port, eegdata)!=0) {
-                        printf("Cannot read packet.\n");
-                        goto cleanup4;
-                }
-                samplesReceived++;
-        }
-        samplesReceived = 0;
-
-        /* initialize an exponential smoothing filter */
-        for (unsigned int i=0; i<channelCount; i++) {
-                eegfilt[i] = eegdata[i];
-        }
-
-        printf("Filling buffer...\n");
-
-        /* wait one second to fill the input buffer halfway */
-        while (samplesReceived<inputBufsize/2)
-        {
-                if (unicorn_pull_sample(port, eegdata)!=0) {
-                        printf("Cannot read packet.\n");
-                        goto cleanup4;
-                }
-                samplesReceived++;
-
-                /* apply a highpass filter by subtracting a smoothed version of the signal */
-                for (unsigned int i=0; i<channelCount; i++) {
-                        eegfilt[i] = smooth(eegfilt[i], eegdata[i], hpFilter);
-                        eegdata[i] -= eegfilt[i];
-                }
-
-                /* add the current sample to the input buffer and increment the counter */
-                for (unsigned int i = 0; i < channelCount; i++) {
-                        if (enableUpdateLimit) {
-                                outputLimit = max(outputLimit, fabsf(eegdata[i]));
-                        }
-                        inputData.data[inputData.frames * channelCount + i] = eegdata[i] / outputLimit;
-                }
-                inputData.frames++;
-        }
-
-        resampleRatio = outputRate / inputRate;
-        printf("Initial resampleRatio = %f\n", resampleRatio);
-
-        srcErr = src_set_ratio (resampleState, resampleRatio);
-        if (srcErr) {
-                printf("ERROR: Cannot set resampling ratio.\n");
-                printf("ERROR: %s\n", src_strerror(srcErr));
+        if (strlen(metricsAddress) && unicorn_metrics_start(&metrics, metricsAddress)!=0)
                 goto cleanup4;
-        }
 
-        paErr = Pa_StartStream(outputStream);
-        if(paErr != paNoError) {
-                printf("ERROR: Cannot start output audio stream.\n");
-                printf("ERROR: %s\n", Pa_GetErrorText(paErr));
-                goto cleanup4;
-        }
-
-        printf("Started output audio stream.\n");
+        /* the options apply to the main thread, which reads the data and does the resampling */
+        unicorn_realtime_start(&realtime);
 
-        /* enable the resampling and the dynamic updating of the samplerate ratio */
-        enableResampleBuffers = 1;
-        enableUpdateRatio = 1;
-        keepRunning = 1;
-
-        printf("Processing data...\n");
+        /* the samples that arrive together are processed together as a block */
+        if (unicorn_block_alloc(&block, NCHANS, BLOCK_DEFAULTSIZE)!=0)
+                goto cleanup4;
+        unsigned long allocations = atomic_load(&unicorn_block_allocations);
 
+        /* the audio output starts by itself once the initial transient has decayed and the buffer has the prefill */
         while (keepRunning) {
-                if (unicorn_pull_sample(port, eegdata)!=0) {
+                int result = unicorn_pull_block(&device, &block);
+                /* the end of a capture file is not an error */
+                if (result==REPLAY_END)
+                        goto cleanup5;
+                if (result!=0) {
                         printf("Cannot read packet.\n");
-                        goto cleanup4;
+                        goto cleanup5;
                 }
-                samplesReceived++;
-
-                /* apply a highpass filter by subtracting a smoothed version of the signal */
-                for (unsigned int i=0; i<channelCount; i++) {
-                        eegfilt[i] = smooth(eegfilt[i], eegdata[i], hpFilter);
-                        eegdata[i] -= eegfilt[i];
-                }
-
-                /* add the current sample to the input buffer and increment the counter */
-                for (unsigned int i = 0; i < channelCount; i++) {
-                        if (enableUpdateLimit) {
-                                outputLimit = max(outputLimit, fabsf(eegdata[i]));
-                        }
-                        inputData.data[inputData.frames * channelCount + i] = eegdata[i] / outputLimit;
+                unicorn_montage_apply_block(&montage, &block, NCHANS);
+                if (unicorn_audio_put_block(&audio, &block)!=0)
+                        goto cleanup5;
+
+                if (audio.state != AUDIO_PLAYING)
+                        continue;
+                if (samplesReceived == 0)
+                        printf("Processing data...\n");
+                unsigned long previous = samplesReceived;
+                samplesReceived += block.numSamples;
+
+                unicorn_metrics_update(&metrics, &device);
+                unicorn_metrics_set(metricRatio, audio.resampleRatio);
+                unicorn_metrics_set(metricLimit, audio.outputLimit);
+                unicorn_metrics_set(metricInput, audio.inputData.frames);
+                unicorn_metrics_set(metricOutput, audio.outputData.frames);
+                unicorn_metrics_set(metricUnderflow, atomic_load(&audio.underflow));
+                unicorn_metrics_set(metricOverflow, atomic_load(&audio.overflow));
+                unicorn_metrics_set(metricZeroFilled, atomic_load(&audio.zeroFilled));
+                unicorn_metrics_set(metricOverrun, audio.overrun);
+
+                if ((samplesReceived / FSAMPLE) != (previous / FSAMPLE)) {
+                        unsigned long fillMin, fillMax;
+                        unicorn_audio_realtime_report(&audio);
+                        printf("Processed %lu samples, resampleRatio = %.2f, outputLimit = %.2f, lost = %lu, ", samplesReceived, audio.resampleRatio, audio.outputLimit, device.stats.lost);
+                        unicorn_latency_print(&latency);
+                        printf("\n");
+
+                        unicorn_audio_fill(&audio, &fillMin, &fillMax);
+                        unicorn_metrics_set(metricOutputMin, fillMin);
+                        unicorn_metrics_set(metricOutputMax, fillMax);
+                        printf("Output buffer = %.0f%% to %.0f%%, underflow = %lu, overflow = %lu, zero-filled = %lu frames, overrun = %lu samples\n",
+                               100. * fillMin / audio.outputBufsize, 100. * fillMax / audio.outputBufsize,
+                               atomic_load(&audio.underflow), atomic_load(&audio.overflow), atomic_load(&audio.zeroFilled), audio.overrun);
                 }
-                inputData.frames++;
-
-                if ((samplesReceived % FSAMPLE)==0)
-                        printf("Processed %lu samples, resampleRatio = %.2f, outputLimit = %.2f\n", samplesReceived, resampleRatio, outputLimit);
         }
 
+        /* the same block is used over and over again, hence streaming should not have allocated any */
+        assert(atomic_load(&unicorn_block_allocations) == allocations);
+
 /* each of the stages comes with its own cleanup section */
+cleanup5:
+        unicorn_block_free(&block);
+
 cleanup4:
-        enableResampleBuffers = 0;
-        enableUpdateRatio = 0;
-        enableUpdateLimit = 0;
-        Pa_StopStream(outputStream);
-        sp_blocking_write(port, stop_acq, 3, TIMEOUT);
+        unicorn_metrics_stop(&metrics);
+        unicorn_stop(&device);
+        unicorn_print_stats(&device);
+        printf("Audio output: underflow %lu, overflow %lu, zero-filled %lu frames, input overrun %lu samples.\n",
+               atomic_load(&audio.underflow), atomic_load(&audio.overflow), atomic_load(&audio.zeroFilled), audio.overrun);
 
 cleanup3:
-        if (resampleState)
-                src_delete (resampleState);
-        if (inputData.data)
-                free(inputData.data);
-        if (outputData.data)
-                free(outputData.data);
+        unicorn_audio_close(&audio);
 
 cleanup2:
-        Pa_Terminate();
+        unicorn_audio_terminate();
 
 cleanup1:
-        sp_close(port);
-        sp_free_port(port);
+        unicorn_close(&device);
 
         return 0;
 }
 
 /*******************************************************************************************************/
 /* Helper function to read and parse one EEG data sample. */
-int unicorn_pull_sample(struct sp_port *port, float *dat)
+int unicorn_pull_sample(unicorn_t *dev, unsigned long *counter, float *dat)
 {
-        unsigned char buf[45];
-        int result = sp_blocking_read(port, buf, PACKETSIZE, TIMEOUT);
-        if (result!=PACKETSIZE || buf[0]!=0xC0 || buf[1]!=0x00) {
-                return 1;
+        unsigned char buf[PACKETSIZE];
+        float sample[NCHANS];
+
+        /* the audio output needs a constant rate, hence missing samples are interpolated */
+        while (pendingIndex == pendingCount) {
+                pendingIndex = 0;
+                pendingCount = 0;
+                int result = unicorn_read(dev, buf, TIMEOUT);
+                if (result!=0)
+                        return result;
+                unicorn_decode(buf, sample);
+                unicorn_fill(dev, unicorn_counter(buf), sample, FILL_LINEAR, unicorn_queue_sample, NULL);
         }
 
-        float battery = (buf[2] & 0x0F) * 100. / 15.;
-        unsigned long counter = (unsigned long)buf[39] | (unsigned long)buf[40] << 8 | (unsigned long)buf[41] << 16 | (unsigned long)buf[42] << 24;
+        *counter = pendingCounter[pendingIndex];
+        memcpy(dat, pendingData[pendingIndex++], NCHANS * sizeof(float));
 
-        for (int ch=0; ch<8; ch++) {
-                unsigned long val = (unsigned long)buf[3+ch*3] << 16 | (unsigned long)buf[4+ch*3] << 8 | (unsigned long)buf[5+ch*3];
-                if (val & 0x00800000) {
-                        val = val | 0xFF000000;
-                }
-                dat[ch] = (float)val * 4500000. / 50331642.;
-        }
-
-        for (int ch=0; ch<3; ch++) {
-                short val = (short)buf[27+ch*2] | (short)buf[28+ch*2] << 8;
-                dat[8+ch] = (float)val / 4096.;
-        }
+        return 0;
+}
 
-        for (int ch=0; ch<3; ch++) {
-                short val = (short)buf[33+ch*2] | (short)buf[34+ch*2] << 8;
-                dat[11+ch] = (float)val / 32.8;
-        }
+/*******************************************************************************************************/
+/* Helper function to read all samples that are available, at least one and at most a full block. */
+int unicorn_pull_block(unicorn_t *dev, unicorn_block_t *block)
+{
+        unsigned long counter;
+        float dat[NCHANS];
 
-        /* collect and copy the output data */
-        dat[14] = battery;
-        dat[15] = counter;
+        unicorn_block_clear(block);
+        do {
+                int result = unicorn_pull_sample(dev, &counter, dat);
+                if (result!=0)
+                        return result;
+                unicorn_block_append(block, counter, dev->lastRead, dat);
+        } while (block->numSamples < block->capacity && (pendingIndex < pendingCount || unicorn_waiting(dev) >= PACKETSIZE - (int)dev->framer.fill));
 
         return 0;
 }
 
+/*******************************************************************************************************/
+/* Helper function to keep the samples until they are pulled. */
+void unicorn_queue_sample(unicorn_t *dev, unsigned long counter, const float *dat, int filled, void *userData)
+{
+        pendingCounter[pendingCount] = counter;
+        memcpy(pendingData[pendingCount++], dat, NCHANS * sizeof(float));
+}
+
 /*******************************************************************************************************/
 /* Helper function for serial port error handling. */
 int sp_check(enum sp_return result)
@@ -633,13 +405,6 @@ int sp_check(enum sp_return result)
         }
 }
 
-/*******************************************************************************************************/
-/* Helper function for stopping properly. */
-void stream_finished(void *userData) {
-        keepRunning = 0;
-        return;
-}
-
 /*******************************************************************************************************/
 /* Helper function for stopping properly. */
 void signal_handler(int signum) {
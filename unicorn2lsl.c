@@ -28,6 +28,13 @@
 
 #include "libserialport.h"
 #include "lsl_c.h"
+#include "unicorn.h"
+#include "unicorn_sync.h"
+#include "unicorn_latency.h"
+#include "unicorn_metrics.h"
+#include "unicorn_realtime.h"
+#include "unicorn_bandpower.h"
+#include "unicorn_decimate.h"
 
 #if defined __linux__ || defined __APPLE__
 // Linux and macOS code goes here
@@ -47,93 +54,130 @@ void signal_handler(int signum);
 /* Helper function to generate random UID string. */
 void rand_str(char *, size_t);
 
-char start_acq[]      = {0x61, 0x7C, 0x87};
-char stop_acq[]       = {0x63, 0x5C, 0xC5};
-char start_response[] = {0x00, 0x00, 0x00};
-char stop_response[]  = {0x00, 0x00, 0x00};
-char start_sequence[] = {0xC0, 0x00};
-char stop_sequence[]  = {0x0D, 0x0A};
+/* Helper function to decode one packet. */
+void push_packet(unicorn_t *dev, const unsigned char *packet, void *userData);
+
+/* Helper function to write one sample to the LSL outlet of the device. */
+void push_sample(unicorn_t *dev, unsigned long counter, const float *dat, int filled, void *userData);
+
+/* Helper function to write one aligned frame with the data of all devices. */
+void push_frame(const float *frame, const unsigned char *flag, double time, void *userData);
+
+/* Helper function to create an LSL outlet. */
+lsl_outlet create_outlet(const char *streamName, int numStreamDevices);
+
+/* Helper function to create an LSL outlet for the band power of the EEG channels. */
+lsl_outlet create_band_outlet(const char *streamName, int numStreamDevices);
 
-#define FSAMPLE     (250)
-#define NCHANS      (16)
 #define STRLEN      (80)
-#define PACKETSIZE  (45)
-#define TIMEOUT     (5000)
 #define LSLSTREAM   "Unicorn"
 #define LSLTYPE     "EEG"
+#define LSLBANDTYPE "BandPower"
 #define LSLBUFFER   (360)
-
-struct sp_port *port = NULL;
+#define NEEG        (8)
+
+unicorn_t device[MAXDEVICES];
+lsl_outlet outlet[MAXDEVICES];
+lsl_outlet bandOutlet[MAXDEVICES];
+unicorn_bandpower_t bandpower[MAXDEVICES];
+int bandRate = 0;
+unicorn_decimate_t decimate[MAXDEVICES];
+int decimateFactor = 1;
+int numDevices = 0;
 int running = 1;
+int alignDevices = 0;
+int fillMode = FILL_NAN;
+unicorn_sync_t timeline;
+unsigned long reconnects[MAXDEVICES];
+double clockOffset = 0;
+unsigned long framesWritten = 0;
+unicorn_latency_t latency;
+unicorn_metrics_t metrics;
+unicorn_realtime_t realtime;
 
 int main(int argc, char **argv)
 {
-        char line[STRLEN], outputStream[STRLEN], outputUID[STRLEN];
+        char line[STRLEN], outputStream[STRLEN], metricsAddress[STRLEN];
         int inputDevice = 0;
         struct sp_port **port_list = NULL;
-        unsigned long counter = 0;
-
-        printf("Getting port list.\n");
-        check(sp_list_ports(&port_list));
-
-        /* Iterate through the ports. When port_list[i] is NULL
-         * this indicates the end of the list. */
-        for (int i = 0; port_list[i] != NULL; i++) {
-                struct sp_port *port = port_list[i];
+        unicorn_loop_t loop;
 
-                /* Get the name of the port. */
-                char *port_name = sp_get_port_name(port);
-                char *port_description = sp_get_port_description(port);
+        if (argc > 1) {
+                /* the ports or serial numbers can also be given on the command line, then the ports are not listed */
+                unicorn_arguments(line, STRLEN, argc, argv);
+        }
+        else {
+                if ((inputDevice = unicorn_list(&port_list)) < 0)
+                        return 1;
+                printf("Select one or multiple ports [%d]: ", inputDevice);
+                unicorn_input(line, STRLEN);
+        }
+        numDevices = unicorn_select(line, port_list, inputDevice, device, MAXDEVICES);
 
-                /* try to identify the serial port with a name or description like UN-20211209 */
-                if (strstr(port_name, "UN")!=0 || strstr(port_description, "UN")!=0)
-                        inputDevice = i;
+        if (unicorn_replay(device, numDevices)) {
+                printf("Replay speed relative to real time, 0 is as fast as possible [1]: ");
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        unicorn_set_speed(device, numDevices, atof(line));
+        }
 
-                printf("port %d: %s\n", i, port_name);
+        if (numDevices>1) {
+                printf("Align devices in a single stream [no]: ");
+                unicorn_input(line, STRLEN);
+                alignDevices = (line[0]=='y' || line[0]=='Y');
         }
 
-        printf("Select port [%d]: ", inputDevice);
-        fgets(line, STRLEN, stdin);
-        if (strlen(line)==1)
-                inputDevice = inputDevice;
-        else
-                inputDevice = atoi(line);
+        printf("Fill missing samples with nan, linear or none [nan]: ");
+        unicorn_input(line, STRLEN);
+        fillMode = unicorn_fill_mode(line, FILL_NAN);
+
+        printf("Downsample by a factor, 1 is none [1]: ");
+        unicorn_input(line, STRLEN);
+        if (strlen(line)>1)
+                decimateFactor = min(DECIMATE_MAXFACTOR, max(1, atoi(line)));
 
         memset(outputStream, 0, STRLEN);
         sprintf(outputStream, LSLSTREAM);
         printf("LSL stream name [%s]: ", LSLSTREAM);
-        fgets(line, STRLEN, stdin);
+        unicorn_input(line, STRLEN);
         if (strlen(line)>1)
                 strncpy(outputStream, line, strlen(line)-1);
 
-        /* copy the selected port, clear the others */
-        check(sp_copy_port(port_list[inputDevice], &port));
-        sp_free_port_list(port_list);
-
-        printf("Opening port %s (%s).\n", sp_get_port_name(port), sp_get_port_description(port));
-        check(sp_open(port, SP_MODE_READ_WRITE));
+        printf("Band power updates per second, 0 is none [0]: ");
+        unicorn_input(line, STRLEN);
+        if (strlen(line)>1)
+                bandRate = min(FSAMPLE, max(0, atoi(line)));
 
-        printf("Setting port to 115200, 8N1, no flow control.\n");
-        check(sp_set_baudrate(port, 115200));
-        check(sp_set_bits(port, 8));
-        check(sp_set_parity(port, SP_PARITY_NONE));
-        check(sp_set_stopbits(port, 1));
-        check(sp_set_flowcontrol(port, SP_FLOWCONTROL_NONE));
+        memset(metricsAddress, 0, STRLEN);
+        printf("Metrics port or socket file [none]: ");
+        unicorn_input(line, STRLEN);
+        if (strlen(line)>1)
+                strncpy(metricsAddress, line, strlen(line)-1);
+
+        printf("Real-time options, any of fifo:priority rr:priority cpu:list lock [none]: ");
+        unicorn_input(line, STRLEN);
+        if (unicorn_realtime_parse(&realtime, line)!=0) {
+                printf("Cannot parse the real-time options.\n");
+                sp_free_port_list(port_list);
+                return 1;
+        }
 
-        unsigned char *buf = malloc(PACKETSIZE);
-        memset(buf, 0, PACKETSIZE);
+        /* the selected ports have been copied, clear the others */
+        sp_free_port_list(port_list);
 
-        if (sp_blocking_write(port, start_acq, 3, TIMEOUT)!=3) {
-                printf("Cannot start data stream.\n");
-                goto cleanup0;
+        if (numDevices==0) {
+                printf("No port selected.\n");
+                return 1;
         }
 
-        int result = sp_blocking_read(port, buf, 3, TIMEOUT);
-        if (result!=3 || buf[0]!=0x00 || buf[1]!=0x00 || buf[2]!=0x00) {
-                printf("Incorrect response.\n");
-                goto cleanup0;
+        for (int i = 0; i < numDevices; i++) {
+                if (unicorn_open(&device[i])!=0)
+                        goto cleanup0;
         }
 
+        if (unicorn_start_all(device, numDevices)!=0)
+                goto cleanup1;
+
         printf("Started data stream.\n");
 
         signal(SIGINT, signal_handler);
@@ -143,13 +187,212 @@ int main(int argc, char **argv)
         signal(SIGUSR2, signal_handler);
 #endif
 
-        /* initialize the LSL stream */
+        /* with aligned devices there is a single stream that is downsampled */
+        for (int i = 0; decimateFactor>1 && i < (alignDevices ? 1 : numDevices); i++) {
+                int numChannels = (alignDevices ? numDevices*(NCHANS+1) : NCHANS);
+                if (unicorn_decimate_init(&decimate[i], numChannels, (alignDevices ? NCHANS+1 : NCHANS), decimateFactor)!=0)
+                        goto cleanup1;
+        }
+
+        if (alignDevices) {
+                /* initialize a single LSL stream for all devices */
+                outlet[0] = create_outlet(outputStream, numDevices);
+                if (bandRate)
+                        bandOutlet[0] = create_band_outlet(outputStream, numDevices);
+                unicorn_sync_init(&timeline, numDevices, push_frame, outlet[0]);
+                /* the aligned timeline uses the monotonic clock, LSL has its own clock */
+                clockOffset = lsl_local_clock() - unicorn_clock();
+        }
+        else {
+                /* initialize one LSL stream per device */
+                for (int i = 0; i < numDevices; i++) {
+                        char streamName[STRLEN+8];
+                        if (numDevices==1)
+                                snprintf(streamName, sizeof(streamName), "%s", outputStream);
+                        else
+                                snprintf(streamName, sizeof(streamName), "%s-%d", outputStream, i+1);
+                        outlet[i] = create_outlet(streamName, 1);
+                        if (bandRate)
+                                bandOutlet[i] = create_band_outlet(streamName, 1);
+                        device[i].userData = outlet[i];
+                }
+        }
+
+        for (int i = 0; i < numDevices; i++)
+                unicorn_bandpower_init(&bandpower[i], NEEG, bandRate);
+
+        unicorn_latency_init(&latency);
+        unicorn_metrics_init(&metrics, numDevices, &latency);
+        if (strlen(metricsAddress) && unicorn_metrics_start(&metrics, metricsAddress)!=0)
+                goto cleanup2;
+
+        /* the options apply to the main thread, which reads the data from all devices */
+        unicorn_realtime_start(&realtime);
+
+        if (unicorn_loop_init(&loop, device, numDevices)!=0) {
+                printf("Cannot set up event loop.\n");
+                goto cleanup2;
+        }
+
+        while (running) {
+                int result = unicorn_loop_poll(&loop, TIMEOUT, push_packet, NULL);
+                /* the end of a capture file is not an error */
+                if (result==REPLAY_END)
+                        break;
+                if (result<0) {
+                        printf("Cannot read packet.\n");
+                        break;
+                }
+                unicorn_metrics_update(&metrics, device);
+        }
+
+        unicorn_loop_free(&loop);
+
+        printf("Wrote %lu samples, ", unicorn_latency_count(&latency));
+        unicorn_latency_print(&latency);
+        printf(".\n");
+
+cleanup2:
+        unicorn_metrics_stop(&metrics);
+        for (int i = 0; i < (alignDevices ? 1 : numDevices); i++) {
+                lsl_destroy_outlet(outlet[i]);
+                if (bandRate)
+                        lsl_destroy_outlet(bandOutlet[i]);
+                if (decimateFactor>1)
+                        unicorn_decimate_free(&decimate[i]);
+        }
+
+cleanup1:
+        unicorn_stop_all(device, numDevices);
+        for (int i = 0; i < numDevices; i++)
+                unicorn_print_stats(&device[i]);
+
+cleanup0:
+        for (int i = 0; i < numDevices; i++)
+                unicorn_close(&device[i]);
+
+        return 0;
+}
+
+
+/* Helper function to decode one packet. */
+void push_packet(unicorn_t *dev, const unsigned char *packet, void *userData)
+{
+        float dat[NCHANS];
+
+        unicorn_decode(packet, dat);
+
+        /* the alignment deals with missing samples by itself */
+        unicorn_fill(dev, unicorn_counter(packet), dat, (alignDevices ? FILL_NONE : fillMode), push_sample, userData);
+}
+
+
+/* Helper function to write one sample to the LSL outlet of the device. */
+void push_sample(unicorn_t *dev, unsigned long counter, const float *dat, int filled, void *userData)
+{
+        if (alignDevices) {
+                int i = (int)(dev - device);
+                /* the hardware counter starts again after a reconnect */
+                if (dev->stats.reconnects != reconnects[i]) {
+                        reconnects[i] = dev->stats.reconnects;
+                        unicorn_sync_reset(&timeline, i);
+                }
+                unicorn_sync_push(&timeline, i, counter, dev->lastRead, dat);
+                return;
+        }
+
+        /* write this sample to LSL, the time of a downsampled sample is corrected for the delay of the filter */
+        if (decimateFactor==1) {
+                lsl_push_sample_f((lsl_outlet)dev->userData, dat);
+        }
+        else {
+                float output[NCHANS];
+                if (unicorn_decimate_put(&decimate[dev - device], dat, output))
+                        lsl_push_sample_ft((lsl_outlet)dev->userData, output, lsl_local_clock() - decimate[dev - device].delay);
+        }
+
+        /* the band power is written at a lower rate to its own stream */
+        if (bandRate) {
+                int i = (int)(dev - device);
+                float power[BANDPOWER_NUMBANDS*NEEG];
+                if (unicorn_bandpower_put(&bandpower[i], dat, power))
+                        lsl_push_sample_f(bandOutlet[i], power);
+        }
+
+        /* the latency is measured from the arrival of the packet on the serial port */
+        unicorn_latency_record(&latency, unicorn_clock() - dev->lastRead);
+
+        /* give some feedback on screen */
+        if ((counter % FSAMPLE)==0) {
+                if (numDevices==1)
+                        printf("Wrote %lu samples, ", counter);
+                else
+                        printf("Wrote %lu samples from device %d, ", counter, (int)(dev - device)+1);
+                unicorn_latency_print(&latency);
+                printf(".\n");
+        }
+}
+
+
+/* Helper function to write one aligned frame with the data of all devices. */
+void push_frame(const float *frame, const unsigned char *flag, double time, void *userData)
+{
+        float dat[MAXDEVICES*(NCHANS+1)];
+
+        /* each device contributes its channels, followed by the gap flag */
+        for (int i = 0; i < numDevices; i++) {
+                memcpy(dat + i*(NCHANS+1), frame + i*NCHANS, NCHANS * sizeof(float));
+                dat[i*(NCHANS+1) + NCHANS] = flag[i];
+        }
+
+        /* write this sample to LSL with the time on the common timeline */
+        if (decimateFactor==1) {
+                lsl_push_sample_ft((lsl_outlet)userData, dat, time + clockOffset);
+        }
+        else {
+                float output[MAXDEVICES*(NCHANS+1)];
+                if (unicorn_decimate_put(&decimate[0], dat, output))
+                        lsl_push_sample_ft((lsl_outlet)userData, output, time + clockOffset - decimate[0].delay);
+        }
+        framesWritten++;
+
+        /* the band power of all devices is updated at the same moment, since the frames are aligned */
+        if (bandRate) {
+                float power[MAXDEVICES*BANDPOWER_NUMBANDS*NEEG];
+                int update = 0;
+                for (int i = 0; i < numDevices; i++)
+                        update = unicorn_bandpower_put(&bandpower[i], frame + i*NCHANS, power + i*BANDPOWER_NUMBANDS*NEEG);
+                if (update)
+                        lsl_push_sample_ft(bandOutlet[0], power, time + clockOffset);
+        }
+
+        /* the time of the frame is the estimated arrival time on the common timeline */
+        unicorn_latency_record(&latency, unicorn_clock() - time);
+
+        /* give some feedback on screen */
+        if ((framesWritten % FSAMPLE)==0) {
+                printf("Wrote %lu aligned samples, drift =", framesWritten);
+                for (int i = 0; i < numDevices; i++)
+                        printf(" %.1f", unicorn_sync_drift(&timeline, i));
+                printf(" ppm, ");
+                unicorn_latency_print(&latency);
+                printf(".\n");
+        }
+}
+
+/* Helper function to create an LSL outlet, with multiple devices the channels are repeated for each device. */
+lsl_outlet create_outlet(const char *streamName, int numStreamDevices)
+{
+        char outputUID[STRLEN], chanLabel[STRLEN];
+        int numChannels = (numStreamDevices==1 ? NCHANS : numStreamDevices*(NCHANS+1));
+
         rand_str(outputUID, 8);
-        lsl_streaminfo info = lsl_create_streaminfo(outputStream, LSLTYPE, NCHANS, FSAMPLE, cft_float32, outputUID);
+        lsl_streaminfo info = lsl_create_streaminfo(streamName, LSLTYPE, numChannels, (double)FSAMPLE/decimateFactor, cft_float32, outputUID);
         printf("Opened LSL stream.\n");
-        printf("LSL name = %s\n", outputStream);
+        printf("LSL name = %s\n", streamName);
         printf("LSL type = %s\n", LSLTYPE);
         printf("LSL uid = %s\n", outputUID);
+        printf("LSL rate = %g Hz\n", (double)FSAMPLE/decimateFactor);
 
         /* add some meta-data fields to it */
         lsl_xml_ptr desc = lsl_get_desc(info);
@@ -158,74 +401,69 @@ int main(int argc, char **argv)
         lsl_append_child_value(acquisition, "model", "Unicorn");
         lsl_append_child_value(acquisition, "precision", "24");
         lsl_xml_ptr chns = lsl_append_child(desc, "channels");
-        const char *label[NCHANS] = {"eeg1","eeg2","eeg3","eeg4","eeg5","eeg6","eeg7","eeg8","accelX","accelY","accelZ","gyroX","gyroY","gyroZ","battery","counter"};
-        const char *unit[NCHANS] = {"uV","uV","uV","uV","uV","uV","uV","uV","g","g","g","deg/s","deg/s","deg/s","percent","integer"};
-        const char *type[NCHANS] = {"EEG","EEG","EEG","EEG","EEG","EEG","EEG","EEG","ACCEL","ACCEL","ACCEL","GYRO","GYRO","GYRO","BATTERY","COUNTER"};
-        for (int c=0; c<NCHANS; c++) {
-                printf("LSL channel %2d: %8s, %8s, %8s\n", c+1, label[c], unit[c], type[c]);
-                lsl_xml_ptr chn = lsl_append_child(chns, "channel");
-                lsl_append_child_value(chn, "label", label[c]);
-                lsl_append_child_value(chn, "unit", unit[c]);
-                lsl_append_child_value(chn, "type", type[c]);
-        }
 
-        lsl_outlet outlet = lsl_create_outlet(info, 0, LSLBUFFER);
-
-        while (running) {
-                int result = sp_blocking_read(port, buf, PACKETSIZE, TIMEOUT);
-                if (result!=PACKETSIZE || buf[0]!=0xC0 || buf[1]!=0x00) {
-                        printf("Cannot read packet.\n");
-                        goto cleanup2;
+        if (numStreamDevices==1) {
+                for (int c=0; c<NCHANS; c++) {
+                        printf("LSL channel %2d: %8s, %8s, %8s\n", c+1, unicorn_label[c], unicorn_unit[c], unicorn_type[c]);
+                        lsl_xml_ptr chn = lsl_append_child(chns, "channel");
+                        lsl_append_child_value(chn, "label", unicorn_label[c]);
+                        lsl_append_child_value(chn, "unit", unicorn_unit[c]);
+                        lsl_append_child_value(chn, "type", unicorn_type[c]);
                 }
-                else {
-                        float dat[16];
-                        counter++;
-
-                        for (int ch=0; ch<8; ch++) {
-                                unsigned long val = (unsigned long)buf[3+ch*3] << 16 | (unsigned long)buf[4+ch*3] << 8 | (unsigned long)buf[5+ch*3];
-                                if (val & 0x00800000) {
-                                        val = val | 0xFF000000;
-                                }
-                                dat[ch] = (float)val * 4500000. / 50331642.;
-                        }
-
-                        for (int ch=0; ch<3; ch++) {
-                                short val = (short)buf[27+ch*2] | (short)buf[28+ch*2] << 8;
-                                dat[8+ch] = (float)val / 4096.;
+        }
+        else {
+                for (int i=0; i<numStreamDevices; i++) {
+                        for (int c=0; c<=NCHANS; c++) {
+                                const char *unit = (c<NCHANS ? unicorn_unit[c] : "boolean");
+                                const char *type = (c<NCHANS ? unicorn_type[c] : "GAP");
+                                snprintf(chanLabel, STRLEN, "%s_%d", (c<NCHANS ? unicorn_label[c] : "gap"), i+1);
+                                printf("LSL channel %2d: %8s, %8s, %8s\n", i*(NCHANS+1)+c+1, chanLabel, unit, type);
+                                lsl_xml_ptr chn = lsl_append_child(chns, "channel");
+                                lsl_append_child_value(chn, "label", chanLabel);
+                                lsl_append_child_value(chn, "unit", unit);
+                                lsl_append_child_value(chn, "type", type);
                         }
+                }
+        }
 
-                        for (int ch=0; ch<3; ch++) {
-                                short val = (short)buf[33+ch*2] | (short)buf[34+ch*2] << 8;
-                                dat[11+ch] = (float)val / 32.8;
-                        }
+        return lsl_create_outlet(info, 0, LSLBUFFER);
+}
 
-                        dat[14] = (buf[2] & 0x0F) * 100. / 15.;
-                        dat[15] = (unsigned long)buf[39] | (unsigned long)buf[40] << 8 | (unsigned long)buf[41] << 16 | (unsigned long)buf[42] << 24;
+/* Helper function to create an LSL outlet for the band power, the channels are repeated for each band and device. */
+lsl_outlet create_band_outlet(const char *streamName, int numStreamDevices)
+{
+        char bandName[STRLEN+16], outputUID[STRLEN], chanLabel[STRLEN];
+        int numChannels = numStreamDevices*BANDPOWER_NUMBANDS*NEEG;
 
-                        /* write this sample to LSL */
-                        lsl_push_sample_f(outlet, dat);
+        snprintf(bandName, sizeof(bandName), "%s-bandpower", streamName);
+        rand_str(outputUID, 8);
+        lsl_streaminfo info = lsl_create_streaminfo(bandName, LSLBANDTYPE, numChannels, bandRate, cft_float32, outputUID);
+        printf("Opened LSL stream.\n");
+        printf("LSL name = %s\n", bandName);
+        printf("LSL type = %s\n", LSLBANDTYPE);
+        printf("LSL uid = %s\n", outputUID);
+        printf("LSL rate = %d Hz, window = %d samples\n", bandRate, BANDPOWER_WINDOW);
 
-                        /* give some feedback on screen */
-                        if ((counter % FSAMPLE)==0) {
-                                printf("Wrote %lu samples.\n", counter);
+        lsl_xml_ptr desc = lsl_get_desc(info);
+        lsl_xml_ptr chns = lsl_append_child(desc, "channels");
+        for (int i=0; i<numStreamDevices; i++) {
+                for (int b=0; b<BANDPOWER_NUMBANDS; b++) {
+                        for (int c=0; c<NEEG; c++) {
+                                if (numStreamDevices==1)
+                                        snprintf(chanLabel, STRLEN, "%s_%s", unicorn_label[c], unicorn_band[b].name);
+                                else
+                                        snprintf(chanLabel, STRLEN, "%s_%s_%d", unicorn_label[c], unicorn_band[b].name, i+1);
+                                lsl_xml_ptr chn = lsl_append_child(chns, "channel");
+                                lsl_append_child_value(chn, "label", chanLabel);
+                                lsl_append_child_value(chn, "unit", "uV^2");
+                                lsl_append_child_value(chn, "type", LSLBANDTYPE);
                         }
                 }
         }
 
-cleanup2:
-        sp_blocking_write(port, stop_acq, 3, TIMEOUT);
-
-cleanup1:
-        lsl_destroy_outlet(outlet);
-
-cleanup0:
-        sp_close(port);
-        sp_free_port(port);
-
-        return 0;
+        return lsl_create_outlet(info, 0, LSLBUFFER);
 }
 
-
 /* Helper function for error handling. */
 int check(enum sp_return result)
 {
@@ -0,0 +1,343 @@
+/*
+ * This application reads EEG data from the Unicorn from a serial-over-bluetooth device
+ * and sends it as Open Sound Control (OSC) messages over UDP, for example to Max/MSP, Pure
+ * Data, SuperCollider or TouchDesigner. It can send the raw samples, and/or the power of
+ * the EEG in the classical frequency bands at a reduced rate.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+
+#include "libserialport.h"
+#include "unicorn.h"
+#include "unicorn_latency.h"
+#include "unicorn_metrics.h"
+#include "unicorn_realtime.h"
+#include "unicorn_bandpower.h"
+#include "unicorn_osc.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+/* Helper function for serial port error handling. */
+int check(enum sp_return result);
+
+/* Helper function for stopping properly. */
+void signal_handler(int signum);
+
+/* Helper function to decode one packet. */
+void put_packet(unicorn_t *dev, const unsigned char *packet, void *userData);
+
+/* Helper function to send one sample. */
+void put_sample(unicorn_t *dev, unsigned long counter, const float *dat, int filled, void *userData);
+
+#define STRLEN      (80)
+#define NEEG        (8)
+
+/* These are the options for what is sent. */
+#define OUTPUT_RAW        (1)
+#define OUTPUT_BANDPOWER  (2)
+
+unicorn_t device[MAXDEVICES];
+int numDevices = 0;
+int running = 1;
+int fillMode = FILL_NAN;
+int output = OUTPUT_RAW;
+unicorn_osc_t osc[MAXDEVICES];
+unicorn_bandpower_t bandpower[MAXDEVICES];
+char dataPath[MAXDEVICES][OSC_PATHLEN], bandPath[MAXDEVICES][BANDPOWER_NUMBANDS][OSC_PATHLEN];
+int haveTime[MAXDEVICES];
+unsigned long firstCounter[MAXDEVICES];
+double firstTime[MAXDEVICES];
+unicorn_latency_t latency;
+unicorn_metrics_t metrics;
+unicorn_realtime_t realtime;
+
+int main(int argc, char **argv)
+{
+        char line[STRLEN], outputAddress[STRLEN], metricsAddress[STRLEN];
+        int inputDevice = 0, bundleSize = OSC_BUNDLESIZE, rate = BANDPOWER_RATE;
+        unsigned long sent = 0;
+        struct sp_port **port_list = NULL;
+        unicorn_loop_t loop;
+
+        if (argc > 1) {
+                /* the ports or serial numbers can also be given on the command line, then the ports are not listed */
+                unicorn_arguments(line, STRLEN, argc, argv);
+        }
+        else {
+                if ((inputDevice = unicorn_list(&port_list)) < 0)
+                        return 1;
+                printf("Select one or multiple ports [%d]: ", inputDevice);
+                unicorn_input(line, STRLEN);
+        }
+        numDevices = unicorn_select(line, port_list, inputDevice, device, MAXDEVICES);
+
+        if (unicorn_replay(device, numDevices)) {
+                printf("Replay speed relative to real time, 0 is as fast as possible [1]: ");
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        unicorn_set_speed(device, numDevices, atof(line));
+        }
+
+        /* every device has its own OSC address, hence they are not aligned */
+        printf("Fill missing samples with nan, linear or none [nan]: ");
+        unicorn_input(line, STRLEN);
+        fillMode = unicorn_fill_mode(line, FILL_NAN);
+
+        memset(outputAddress, 0, STRLEN);
+        printf("OSC destination [%s:%d]: ", OSC_DEFAULTHOST, OSC_DEFAULTPORT);
+        unicorn_input(line, STRLEN);
+        if (strlen(line)>1)
+                strncpy(outputAddress, line, strlen(line)-1);
+
+        printf("Send raw, bandpower or both [raw]: ");
+        unicorn_input(line, STRLEN);
+        if (strncmp(line, "band", 4)==0)
+                output = OUTPUT_BANDPOWER;
+        else if (strncmp(line, "both", 4)==0)
+                output = OUTPUT_RAW | OUTPUT_BANDPOWER;
+
+        if (output & OUTPUT_RAW) {
+                printf("Samples per bundle [%d]: ", OSC_BUNDLESIZE);
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        bundleSize = max(1, min(OSC_MAXMESSAGES, atoi(line)));
+        }
+
+        if (output & OUTPUT_BANDPOWER) {
+                printf("Band power updates per second [%d]: ", BANDPOWER_RATE);
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        rate = max(1, min(FSAMPLE, atoi(line)));
+        }
+
+        memset(metricsAddress, 0, STRLEN);
+        printf("Metrics port or socket file [none]: ");
+        unicorn_input(line, STRLEN);
+        if (strlen(line)>1)
+                strncpy(metricsAddress, line, strlen(line)-1);
+
+        printf("Real-time options, any of fifo:priority rr:priority cpu:list lock [none]: ");
+        unicorn_input(line, STRLEN);
+        if (unicorn_realtime_parse(&realtime, line)!=0) {
+                printf("Cannot parse the real-time options.\n");
+                sp_free_port_list(port_list);
+                return 1;
+        }
+
+        /* the selected ports have been copied, clear the others */
+        sp_free_port_list(port_list);
+
+        if (numDevices==0) {
+                printf("No port selected.\n");
+                return 1;
+        }
+
+        /* only the sockets that were opened are closed again */
+        for (int i = 0; i < MAXDEVICES; i++)
+                osc[i].fd = -1;
+
+        unicorn_latency_init(&latency);
+        for (int i = 0; i < numDevices; i++) {
+                int tooLong = 0;
+                if (unicorn_osc_open(&osc[i], outputAddress, bundleSize, &latency)!=0)
+                        goto cleanup0;
+                unicorn_bandpower_init(&bandpower[i], NEEG, rate);
+                tooLong |= (snprintf(dataPath[i], OSC_PATHLEN, "/unicorn/%d/data", i+1) >= OSC_PATHLEN);
+                for (int b = 0; b < BANDPOWER_NUMBANDS; b++)
+                        tooLong |= (snprintf(bandPath[i][b], OSC_PATHLEN, "/unicorn/%d/%s", i+1, unicorn_band[b].name) >= OSC_PATHLEN);
+                if (tooLong) {
+                        printf("The OSC address is too long.\n");
+                        goto cleanup0;
+                }
+        }
+        printf("Sending OSC to %s.\n", (strlen(outputAddress) ? outputAddress : OSC_DEFAULTHOST));
+
+        for (int i = 0; i < numDevices; i++) {
+                if (unicorn_open(&device[i])!=0)
+                        goto cleanup0;
+        }
+
+        if (unicorn_start_all(device, numDevices)!=0)
+                goto cleanup1;
+
+        printf("Started data stream.\n");
+
+        signal(SIGINT, signal_handler);
+#ifndef _WIN32
+        signal(SIGHUP, signal_handler);
+        signal(SIGUSR1, signal_handler);
+        signal(SIGUSR2, signal_handler);
+#endif
+
+        unicorn_metrics_init(&metrics, numDevices, &latency);
+        if (strlen(metricsAddress) && unicorn_metrics_start(&metrics, metricsAddress)!=0)
+                goto cleanup2;
+
+        /* the options apply to the main thread, which reads the data from all devices */
+        unicorn_realtime_start(&realtime);
+
+        if (unicorn_loop_init(&loop, device, numDevices)!=0) {
+                printf("Cannot set up event loop.\n");
+                goto cleanup2;
+        }
+
+        while (running) {
+                int result = unicorn_loop_poll(&loop, TIMEOUT, put_packet, NULL);
+                /* the end of a capture file is not an error */
+                if (result==REPLAY_END)
+                        break;
+                if (result<0) {
+                        printf("Cannot read packet.\n");
+                        break;
+                }
+                unicorn_metrics_update(&metrics, device);
+        }
+
+        unicorn_loop_free(&loop);
+        for (int i = 0; i < numDevices; i++) {
+                unicorn_osc_flush(&osc[i]);
+                sent += osc[i].sent;
+        }
+
+        printf("Sent %lu messages, ", sent);
+        unicorn_latency_print(&latency);
+        printf(".\n");
+
+cleanup2:
+        unicorn_metrics_stop(&metrics);
+
+cleanup1:
+        unicorn_stop_all(device, numDevices);
+        for (int i = 0; i < numDevices; i++)
+                unicorn_print_stats(&device[i]);
+
+cleanup0:
+        for (int i = 0; i < numDevices; i++) {
+                unicorn_close(&device[i]);
+                unicorn_osc_close(&osc[i]);
+        }
+
+        return 0;
+}
+
+
+/* Helper function to decode one packet. */
+void put_packet(unicorn_t *dev, const unsigned char *packet, void *userData)
+{
+        float dat[NCHANS];
+
+        unicorn_decode(packet, dat);
+        unicorn_fill(dev, unicorn_counter(packet), dat, fillMode, put_sample, userData);
+}
+
+
+/* Helper function to send one sample. */
+void put_sample(unicorn_t *dev, unsigned long counter, const float *dat, int filled, void *userData)
+{
+        int i = (int)(dev - device);
+        float power[BANDPOWER_NUMBANDS*NEEG];
+
+        /* the timetag follows from the hardware counter, starting at the wall clock time of the first sample */
+        if (!haveTime[i]) {
+                firstCounter[i] = counter;
+                firstTime[i] = unicorn_osc_wallclock() - (unicorn_clock() - dev->lastRead);
+                haveTime[i] = 1;
+        }
+        double time = firstTime[i] + (double)(counter - firstCounter[i]) / FSAMPLE;
+
+        if (output & OUTPUT_RAW) {
+                if (unicorn_osc_put(&osc[i], dataPath[i], time, counter, dat, NCHANS, dev->lastRead)!=0) {
+                        running = 0;
+                        return;
+                }
+        }
+
+        if ((output & OUTPUT_BANDPOWER) && unicorn_bandpower_put(&bandpower[i], dat, power)) {
+                /* the power is computed over the preceding window, the update is sent right away */
+                for (int b = 0; b < BANDPOWER_NUMBANDS; b++)
+                        unicorn_osc_put(&osc[i], bandPath[i][b], time, counter, power + b*NEEG, NEEG, dev->lastRead);
+                unicorn_osc_flush(&osc[i]);
+        }
+
+        /* give some feedback on screen */
+        if ((counter % FSAMPLE)==0) {
+                printf("Sent %lu samples, ", counter);
+                unicorn_latency_print(&latency);
+                printf(".\n");
+        }
+}
+
+
+/* Helper function for serial port error handling. */
+int check(enum sp_return result)
+{
+        char *error_message;
+        switch (result) {
+        case SP_ERR_ARG:
+                printf("Error: Invalid argument.\n");
+                abort();
+        case SP_ERR_FAIL:
+                error_message = sp_last_error_message();
+                printf("Error: Failed: %s\n", error_message);
+                sp_free_error_message(error_message);
+                abort();
+        case SP_ERR_SUPP:
+                printf("Error: Not supported.\n");
+                abort();
+        case SP_ERR_MEM:
+                printf("Error: Couldn't allocate memory.\n");
+                abort();
+        case SP_OK:
+        default:
+                return result;
+        }
+}
+
+/* Helper function for stopping properly. */
+void signal_handler(int signum) {
+        switch (signum) {
+        case SIGINT:
+                printf("Received SIGINT\n");
+                running = 0;
+                break;
+#ifndef _WIN32
+        case SIGHUP:
+                printf("Received SIGHUP\n");
+                break;
+        case SIGUSR1:
+                printf("Received SIGUSR1\n");
+                break;
+        case SIGUSR2:
+                printf("Received SIGUSR2\n");
+                break;
+#endif
+        }
+}
@@ -0,0 +1,336 @@
+/*
+ * This application reads EEG data from the Unicorn from a serial-over-bluetooth device
+ * and writes it to a ring buffer in POSIX shared memory. Other processes on the same
+ * computer can read the data from there at their own pace without it being copied,
+ * using the small reader library in unicorn_shm_reader.c.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+
+#include "libserialport.h"
+#include "unicorn.h"
+#include "unicorn_sync.h"
+#include "unicorn_latency.h"
+#include "unicorn_metrics.h"
+#include "unicorn_realtime.h"
+#include "unicorn_shm.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+/* Helper function for serial port error handling. */
+int check(enum sp_return result);
+
+/* Helper function for stopping properly. */
+void signal_handler(int signum);
+
+/* Helper function to decode one packet. */
+void put_packet(unicorn_t *dev, const unsigned char *packet, void *userData);
+
+/* Helper function to write one sample to the shared memory. */
+void put_sample(unicorn_t *dev, unsigned long counter, const float *dat, int filled, void *userData);
+
+/* Helper function to write one aligned frame with the data of all devices. */
+void put_frame(const float *frame, const unsigned char *flag, double time, void *userData);
+
+#define STRLEN      (80)
+
+unicorn_t device[MAXDEVICES];
+int numDevices = 0;
+int running = 1;
+int fillMode = FILL_NAN;
+unicorn_sync_t timeline;
+unsigned long reconnects[MAXDEVICES];
+unicorn_shm_t ring;
+unsigned long framesWritten = 0;
+unicorn_latency_t latency;
+unicorn_metrics_t metrics;
+unicorn_realtime_t realtime;
+
+int main(int argc, char **argv)
+{
+        char line[STRLEN], outputName[STRLEN], metricsAddress[STRLEN];
+        char labelBuf[MAXDEVICES*(NCHANS+1)][STRLEN];
+        const char *label[MAXDEVICES*(NCHANS+1)];
+        int inputDevice = 0, numChannels;
+        struct sp_port **port_list = NULL;
+        unicorn_loop_t loop;
+
+        if (argc > 1) {
+                /* the ports or serial numbers can also be given on the command line, then the ports are not listed */
+                unicorn_arguments(line, STRLEN, argc, argv);
+        }
+        else {
+                if ((inputDevice = unicorn_list(&port_list)) < 0)
+                        return 1;
+                printf("Select one or multiple ports [%d]: ", inputDevice);
+                unicorn_input(line, STRLEN);
+        }
+        numDevices = unicorn_select(line, port_list, inputDevice, device, MAXDEVICES);
+
+        if (unicorn_replay(device, numDevices)) {
+                printf("Replay speed relative to real time, 0 is as fast as possible [1]: ");
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        unicorn_set_speed(device, numDevices, atof(line));
+        }
+
+        /* the ring holds a single stream, hence multiple devices are always aligned */
+        if (numDevices==1) {
+                printf("Fill missing samples with nan, linear or none [nan]: ");
+                unicorn_input(line, STRLEN);
+                fillMode = unicorn_fill_mode(line, FILL_NAN);
+        }
+
+        memset(outputName, 0, STRLEN);
+        sprintf(outputName, SHM_DEFAULTNAME);
+        printf("Shared memory name [%s]: ", SHM_DEFAULTNAME);
+        unicorn_input(line, STRLEN);
+        if (strlen(line)>1)
+                strncpy(outputName, line, strlen(line)-1);
+
+        memset(metricsAddress, 0, STRLEN);
+        printf("Metrics port or socket file [none]: ");
+        unicorn_input(line, STRLEN);
+        if (strlen(line)>1)
+                strncpy(metricsAddress, line, strlen(line)-1);
+
+        printf("Real-time options, any of fifo:priority rr:priority cpu:list lock [none]: ");
+        unicorn_input(line, STRLEN);
+        if (unicorn_realtime_parse(&realtime, line)!=0) {
+                printf("Cannot parse the real-time options.\n");
+                sp_free_port_list(port_list);
+                return 1;
+        }
+
+        /* the selected ports have been copied, clear the others */
+        sp_free_port_list(port_list);
+
+        if (numDevices==0) {
+                printf("No port selected.\n");
+                return 1;
+        }
+
+        /* with multiple devices each device contributes its channels, followed by the gap flag */
+        numChannels = (numDevices==1 ? NCHANS : numDevices*(NCHANS+1));
+        for (int i = 0; i < numChannels; i++) {
+                int c = (numDevices==1 ? i : i % (NCHANS+1));
+                if (numDevices==1)
+                        snprintf(labelBuf[i], STRLEN, "%s", unicorn_label[c]);
+                else
+                        snprintf(labelBuf[i], STRLEN, "%s_%d", (c<NCHANS ? unicorn_label[c] : "gap"), i/(NCHANS+1)+1);
+                label[i] = labelBuf[i];
+        }
+
+        unicorn_latency_init(&latency);
+        if (unicorn_shm_create(&ring, outputName, numChannels, SHM_CAPACITY, FSAMPLE, label)!=0)
+                return 1;
+
+        for (int i = 0; i < numDevices; i++) {
+                if (unicorn_open(&device[i])!=0)
+                        goto cleanup0;
+        }
+
+        if (unicorn_start_all(device, numDevices)!=0)
+                goto cleanup1;
+
+        printf("Started data stream.\n");
+
+        signal(SIGINT, signal_handler);
+#ifndef _WIN32
+        signal(SIGHUP, signal_handler);
+        signal(SIGUSR1, signal_handler);
+        signal(SIGUSR2, signal_handler);
+#endif
+
+        if (numDevices>1)
+                unicorn_sync_init(&timeline, numDevices, put_frame, &ring);
+
+        unicorn_metrics_init(&metrics, numDevices, &latency);
+        if (strlen(metricsAddress) && unicorn_metrics_start(&metrics, metricsAddress)!=0)
+                goto cleanup2;
+
+        /* the options apply to the main thread, which reads the data from all devices */
+        unicorn_realtime_start(&realtime);
+
+        if (unicorn_loop_init(&loop, device, numDevices)!=0) {
+                printf("Cannot set up event loop.\n");
+                goto cleanup2;
+        }
+
+        while (running) {
+                int result = unicorn_loop_poll(&loop, TIMEOUT, put_packet, &ring);
+                /* the end of a capture file is not an error */
+                if (result==REPLAY_END)
+                        break;
+                if (result<0) {
+                        printf("Cannot read packet.\n");
+                        break;
+                }
+                unicorn_metrics_update(&metrics, device);
+        }
+
+        unicorn_loop_free(&loop);
+
+        printf("Wrote %lu samples, ", framesWritten);
+        unicorn_latency_print(&latency);
+        printf(".\n");
+
+cleanup2:
+        unicorn_metrics_stop(&metrics);
+
+cleanup1:
+        unicorn_stop_all(device, numDevices);
+        for (int i = 0; i < numDevices; i++)
+                unicorn_print_stats(&device[i]);
+
+cleanup0:
+        for (int i = 0; i < numDevices; i++)
+                unicorn_close(&device[i]);
+        unicorn_shm_destroy(&ring);
+
+        return 0;
+}
+
+
+/* Helper function to decode one packet. */
+void put_packet(unicorn_t *dev, const unsigned char *packet, void *userData)
+{
+        float dat[NCHANS];
+
+        unicorn_decode(packet, dat);
+
+        /* the alignment deals with missing samples by itself */
+        unicorn_fill(dev, unicorn_counter(packet), dat, (numDevices>1 ? FILL_NONE : fillMode), put_sample, userData);
+}
+
+
+/* Helper function to write one sample to the shared memory. */
+void put_sample(unicorn_t *dev, unsigned long counter, const float *dat, int filled, void *userData)
+{
+        unicorn_shm_t *shm = (unicorn_shm_t *)userData;
+
+        if (numDevices>1) {
+                int i = (int)(dev - device);
+                /* the hardware counter starts again after a reconnect */
+                if (dev->stats.reconnects != reconnects[i]) {
+                        reconnects[i] = dev->stats.reconnects;
+                        unicorn_sync_reset(&timeline, i);
+                }
+                unicorn_sync_push(&timeline, i, counter, dev->lastRead, dat);
+                return;
+        }
+
+        unicorn_shm_write(shm, dat, counter, dev->lastRead);
+        unicorn_latency_record(&latency, unicorn_clock() - dev->lastRead);
+        framesWritten++;
+
+        /* give some feedback on screen */
+        if ((counter % FSAMPLE)==0) {
+                printf("Wrote %lu samples, ", counter);
+                unicorn_latency_print(&latency);
+                printf(".\n");
+        }
+}
+
+
+/* Helper function to write one aligned frame with the data of all devices. */
+void put_frame(const float *frame, const unsigned char *flag, double time, void *userData)
+{
+        unicorn_shm_t *shm = (unicorn_shm_t *)userData;
+        float dat[MAXDEVICES*(NCHANS+1)];
+
+        for (int i = 0; i < numDevices; i++) {
+                memcpy(dat + i*(NCHANS+1), frame + i*NCHANS, NCHANS * sizeof(float));
+                dat[i*(NCHANS+1) + NCHANS] = flag[i];
+        }
+
+        /* the aligned frames are numbered from one, like the hardware counter */
+        framesWritten++;
+        unicorn_shm_write(shm, dat, framesWritten, time);
+        unicorn_latency_record(&latency, unicorn_clock() - time);
+
+        /* give some feedback on screen */
+        if ((framesWritten % FSAMPLE)==0) {
+                printf("Wrote %lu aligned samples, drift =", framesWritten);
+                for (int i = 0; i < numDevices; i++)
+                        printf(" %.1f", unicorn_sync_drift(&timeline, i));
+                printf(" ppm, ");
+                unicorn_latency_print(&latency);
+                printf(".\n");
+        }
+}
+
+
+/* Helper function for serial port error handling. */
+int check(enum sp_return result)
+{
+        char *error_message;
+        switch (result) {
+        case SP_ERR_ARG:
+                printf("Error: Invalid argument.\n");
+                abort();
+        case SP_ERR_FAIL:
+                error_message = sp_last_error_message();
+                printf("Error: Failed: %s\n", error_message);
+                sp_free_error_message(error_message);
+                abort();
+        case SP_ERR_SUPP:
+                printf("Error: Not supported.\n");
+                abort();
+        case SP_ERR_MEM:
+                printf("Error: Couldn't allocate memory.\n");
+                abort();
+        case SP_OK:
+        default:
+                return result;
+        }
+}
+
+/* Helper function for stopping properly. */
+void signal_handler(int signum) {
+        switch (signum) {
+        case SIGINT:
+                printf("Received SIGINT\n");
+                running = 0;
+                break;
+#ifndef _WIN32
+        case SIGHUP:
+                printf("Received SIGHUP\n");
+                break;
+        case SIGUSR1:
+                printf("Received SIGUSR1\n");
+                break;
+        case SIGUSR2:
+                printf("Received SIGUSR2\n");
+                break;
+#endif
+        }
+}
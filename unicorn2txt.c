@@ -27,6 +27,11 @@
 #include <signal.h>
 
 #include "libserialport.h"
+#include "unicorn.h"
+#include "unicorn_sync.h"
+#include "unicorn_latency.h"
+#include "unicorn_metrics.h"
+#include "unicorn_realtime.h"
 
 #if defined __linux__ || defined __APPLE__
 // Linux and macOS code goes here
@@ -43,88 +48,103 @@ int check(enum sp_return result);
 /* Helper function for stopping properly. */
 void signal_handler(int signum);
 
-char start_acq[]      = {0x61, 0x7C, 0x87};
-char stop_acq[]       = {0x63, 0x5C, 0xC5};
-char start_response[] = {0x00, 0x00, 0x00};
-char stop_response[]  = {0x00, 0x00, 0x00};
-char start_sequence[] = {0xC0, 0x00};
-char stop_sequence[]  = {0x0D, 0x0A};
+/* Helper function to decode one packet. */
+void write_packet(unicorn_t *dev, const unsigned char *packet, void *userData);
+
+/* Helper function to write one sample. */
+void write_sample(unicorn_t *dev, unsigned long counter, const float *dat, int filled, void *userData);
+
+/* Helper function to write one aligned frame with the data of all devices. */
+void write_frame(const float *frame, const unsigned char *flag, double time, void *userData);
 
-#define FSAMPLE     (250)
 #define STRLEN      (80)
-#define PACKETSIZE  (45)
-#define TIMEOUT     (5000)
 
-struct sp_port *port = NULL;
+unicorn_t device[MAXDEVICES];
+int numDevices = 0;
 int running = 1;
+int toFile = 0;
+int alignDevices = 0;
+int fillMode = FILL_NAN;
+unicorn_sync_t timeline;
+unsigned long reconnects[MAXDEVICES];
+unsigned long framesWritten = 0;
+unicorn_latency_t latency;
+unicorn_metrics_t metrics;
+unicorn_realtime_t realtime;
 
 int main(int argc, char **argv)
 {
-        char line[STRLEN], outputFile[STRLEN];
+        char line[STRLEN], outputFile[STRLEN], metricsAddress[STRLEN];
         FILE *fp;
         int inputDevice = 0;
         struct sp_port **port_list = NULL;
+        unicorn_loop_t loop;
 
-        printf("Getting port list.\n");
-        check(sp_list_ports(&port_list));
-
-        /* Iterate through the ports. When port_list[i] is NULL
-         * this indicates the end of the list. */
-        for (int i = 0; port_list[i] != NULL; i++) {
-                struct sp_port *port = port_list[i];
-
-                /* Get the name of the port. */
-                char *port_name = sp_get_port_name(port);
-                char *port_description = sp_get_port_description(port);
+        if (argc > 1) {
+                /* the ports or serial numbers can also be given on the command line, then the ports are not listed */
+                unicorn_arguments(line, STRLEN, argc, argv);
+        }
+        else {
+                if ((inputDevice = unicorn_list(&port_list)) < 0)
+                        return 1;
+                printf("Select one or multiple ports [%d]: ", inputDevice);
+                unicorn_input(line, STRLEN);
+        }
+        numDevices = unicorn_select(line, port_list, inputDevice, device, MAXDEVICES);
 
-                /* try to identify the serial port with a name or description like UN-20211209 */
-                if (strstr(port_name, "UN")!=0 || strstr(port_description, "UN")!=0)
-                        inputDevice = i;
+        if (unicorn_replay(device, numDevices)) {
+                printf("Replay speed relative to real time, 0 is as fast as possible [1]: ");
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        unicorn_set_speed(device, numDevices, atof(line));
+        }
 
-                printf("port %d: %s\n", i, port_name);
+        if (numDevices>1) {
+                printf("Align devices on a common timeline [no]: ");
+                unicorn_input(line, STRLEN);
+                alignDevices = (line[0]=='y' || line[0]=='Y');
         }
 
-        printf("Select port [%d]: ", inputDevice);
-        fgets(line, STRLEN, stdin);
-        if (strlen(line)==1)
-                inputDevice = inputDevice;
-        else
-                inputDevice = atoi(line);
+        printf("Fill missing samples with nan, linear or none [nan]: ");
+        unicorn_input(line, STRLEN);
+        fillMode = unicorn_fill_mode(line, FILL_NAN);
 
         memset(outputFile, 0, STRLEN);
         printf("Output file [stdout]: ");
-        fgets(line, STRLEN, stdin);
+        unicorn_input(line, STRLEN);
         if (strlen(line)>1)
                 strncpy(outputFile, line, strlen(line)-1);
 
-        /* copy the selected port, clear the others */
-        check(sp_copy_port(port_list[inputDevice], &port));
-        sp_free_port_list(port_list);
-
-        printf("Opening port %s (%s).\n", sp_get_port_name(port), sp_get_port_description(port));
-        check(sp_open(port, SP_MODE_READ_WRITE));
-
-        printf("Setting port to 115200, 8N1, no flow control.\n");
-        check(sp_set_baudrate(port, 115200));
-        check(sp_set_bits(port, 8));
-        check(sp_set_parity(port, SP_PARITY_NONE));
-        check(sp_set_stopbits(port, 1));
-        check(sp_set_flowcontrol(port, SP_FLOWCONTROL_NONE));
+        memset(metricsAddress, 0, STRLEN);
+        printf("Metrics port or socket file [none]: ");
+        unicorn_input(line, STRLEN);
+        if (strlen(line)>1)
+                strncpy(metricsAddress, line, strlen(line)-1);
+
+        printf("Real-time options, any of fifo:priority rr:priority cpu:list lock [none]: ");
+        unicorn_input(line, STRLEN);
+        if (unicorn_realtime_parse(&realtime, line)!=0) {
+                printf("Cannot parse the real-time options.\n");
+                sp_free_port_list(port_list);
+                return 1;
+        }
 
-        unsigned char *buf = malloc(PACKETSIZE);
-        memset(buf, 0, PACKETSIZE);
+        /* the selected ports have been copied, clear the others */
+        sp_free_port_list(port_list);
 
-        if (sp_blocking_write(port, start_acq, 3, TIMEOUT)!=3) {
-                printf("Cannot start data stream.\n");
-                goto cleanup0;
+        if (numDevices==0) {
+                printf("No port selected.\n");
+                return 1;
         }
 
-        int result = sp_blocking_read(port, buf, 3, TIMEOUT);
-        if (result!=3 || buf[0]!=0x00 || buf[1]!=0x00 || buf[2]!=0x00) {
-                printf("Incorrect response.\n");
-                goto cleanup0;
+        for (int i = 0; i < numDevices; i++) {
+                if (unicorn_open(&device[i])!=0)
+                        goto cleanup0;
         }
 
+        if (unicorn_start_all(device, numDevices)!=0)
+                goto cleanup1;
+
         printf("Started data stream.\n");
 
         if (strlen(outputFile)) {
@@ -135,6 +155,7 @@ int main(int argc, char **argv)
                         printf("Cannot open file: %s\n", strerror(errno));
                         goto cleanup1;
                 }
+                toFile = 1;
         }
         else {
                 /* output goes to the screen */
@@ -148,63 +169,151 @@ int main(int argc, char **argv)
         signal(SIGUSR2, signal_handler);
 #endif
 
-        fprintf(fp, "eeg1\teeg2\teeg3\teeg4\teeg5\teeg6\teeg7\teeg8\taccel1\taccel2\taccel3\tgyro1\tgyro2\tgyro3\tbattery\tcounter\n");
+        if (alignDevices) {
+                /* each line contains the time, followed by the channels and a gap flag for each device */
+                fprintf(fp, "time");
+                for (int i = 0; i < numDevices; i++) {
+                        for (int c = 0; c < NCHANS; c++)
+                                fprintf(fp, "\t%s_%d", unicorn_label[c], i+1);
+                        fprintf(fp, "\tgap_%d", i+1);
+                }
+                fprintf(fp, "\n");
+                unicorn_sync_init(&timeline, numDevices, write_frame, fp);
+        }
+        else {
+                /* with multiple devices the first column indicates from which device the sample comes */
+                if (numDevices>1)
+                        fprintf(fp, "device\t");
+                fprintf(fp, "eeg1\teeg2\teeg3\teeg4\teeg5\teeg6\teeg7\teeg8\taccel1\taccel2\taccel3\tgyro1\tgyro2\tgyro3\tbattery\tcounter\n");
+        }
+
+        unicorn_latency_init(&latency);
+        unicorn_metrics_init(&metrics, numDevices, &latency);
+        if (strlen(metricsAddress) && unicorn_metrics_start(&metrics, metricsAddress)!=0)
+                goto cleanup2;
+
+        /* the options apply to the main thread, which reads the data from all devices */
+        unicorn_realtime_start(&realtime);
+
+        if (unicorn_loop_init(&loop, device, numDevices)!=0) {
+                printf("Cannot set up event loop.\n");
+                goto cleanup2;
+        }
 
         while (running) {
-                int result = sp_blocking_read(port, buf, PACKETSIZE, TIMEOUT);
-                if (result!=PACKETSIZE || buf[0]!=0xC0 || buf[1]!=0x00) {
+                int result = unicorn_loop_poll(&loop, TIMEOUT, write_packet, fp);
+                /* the end of a capture file is not an error */
+                if (result==REPLAY_END)
+                        break;
+                if (result<0) {
                         printf("Cannot read packet.\n");
-                        goto cleanup2;
-                }
-                else {
-                        float battery = (buf[2] & 0x0F) * 100. / 15.;
-                        unsigned long counter = (unsigned long)buf[39] | (unsigned long)buf[40] << 8 | (unsigned long)buf[41] << 16 | (unsigned long)buf[42] << 24;
-                        float eeg[8], accel[3], gyro[3];
-
-                        for (int ch=0; ch<8; ch++) {
-                                unsigned long val = (unsigned long)buf[3+ch*3] << 16 | (unsigned long)buf[4+ch*3] << 8 | (unsigned long)buf[5+ch*3];
-                                if (val & 0x00800000) {
-                                        val = val | 0xFF000000;
-                                }
-                                eeg[ch] = (float)val * 4500000. / 50331642.;
-                        }
-
-                        for (int ch=0; ch<3; ch++) {
-                                short val = (short)buf[27+ch*2] | (short)buf[28+ch*2] << 8;
-                                accel[ch] = (float)val / 4096.;
-                        }
-
-                        for (int ch=0; ch<3; ch++) {
-                                short val = (short)buf[33+ch*2] | (short)buf[34+ch*2] << 8;
-                                gyro[ch] = (float)val / 32.8;
-                        }
-
-                        fprintf(fp, "%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t", eeg[0], eeg[1], eeg[2], eeg[3], eeg[4], eeg[5], eeg[6], eeg[7]);
-                        fprintf(fp, "%f\t%f\t%f\t", accel[0], accel[1], accel[2]);
-                        fprintf(fp, "%f\t%f\t%f\t", gyro[0], gyro[1], gyro[2]);
-                        fprintf(fp, "%.2f\t%lu\n", battery, counter);
-
-                        /* give some feedback on screen when writing data to file */
-                        if (strlen(outputFile) && (counter % FSAMPLE)==0) {
-                                printf("Wrote %lu samples.\n", counter);
-                        }
+                        break;
                 }
+                unicorn_metrics_update(&metrics, device);
         }
 
+        unicorn_loop_free(&loop);
+
+        printf("Wrote %lu samples, ", unicorn_latency_count(&latency));
+        unicorn_latency_print(&latency);
+        printf(".\n");
+
 cleanup2:
-        sp_blocking_write(port, stop_acq, 3, TIMEOUT);
+        unicorn_metrics_stop(&metrics);
+        if (fp!=stdout)
+                fclose(fp);
 
 cleanup1:
-        fclose(fp);
+        unicorn_stop_all(device, numDevices);
+        for (int i = 0; i < numDevices; i++)
+                unicorn_print_stats(&device[i]);
 
 cleanup0:
-        sp_close(port);
-        sp_free_port(port);
+        for (int i = 0; i < numDevices; i++)
+                unicorn_close(&device[i]);
 
         return 0;
 }
 
 
+/* Helper function to decode one packet. */
+void write_packet(unicorn_t *dev, const unsigned char *packet, void *userData)
+{
+        float dat[NCHANS];
+
+        unicorn_decode(packet, dat);
+
+        /* the alignment deals with missing samples by itself */
+        unicorn_fill(dev, unicorn_counter(packet), dat, (alignDevices ? FILL_NONE : fillMode), write_sample, userData);
+}
+
+
+/* Helper function to write one sample. */
+void write_sample(unicorn_t *dev, unsigned long counter, const float *dat, int filled, void *userData)
+{
+        FILE *fp = (FILE *)userData;
+
+        if (alignDevices) {
+                int i = (int)(dev - device);
+                /* the hardware counter starts again after a reconnect */
+                if (dev->stats.reconnects != reconnects[i]) {
+                        reconnects[i] = dev->stats.reconnects;
+                        unicorn_sync_reset(&timeline, i);
+                }
+                unicorn_sync_push(&timeline, i, counter, dev->lastRead, dat);
+                return;
+        }
+
+        if (numDevices>1)
+                fprintf(fp, "%d\t", (int)(dev - device));
+        fprintf(fp, "%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t", dat[0], dat[1], dat[2], dat[3], dat[4], dat[5], dat[6], dat[7]);
+        fprintf(fp, "%f\t%f\t%f\t", dat[8], dat[9], dat[10]);
+        fprintf(fp, "%f\t%f\t%f\t", dat[11], dat[12], dat[13]);
+        fprintf(fp, "%.2f\t%lu\n", dat[14], counter);
+
+        /* the latency is measured from the arrival of the packet on the serial port */
+        unicorn_latency_record(&latency, unicorn_clock() - dev->lastRead);
+
+        /* give some feedback on screen when writing data to file */
+        if (toFile && (counter % FSAMPLE)==0) {
+                printf("Wrote %lu samples, ", counter);
+                unicorn_latency_print(&latency);
+                printf(".\n");
+        }
+}
+
+
+/* Helper function to write one aligned frame with the data of all devices. */
+void write_frame(const float *frame, const unsigned char *flag, double time, void *userData)
+{
+        FILE *fp = (FILE *)userData;
+
+        fprintf(fp, "%.4f", time);
+        for (int i = 0; i < numDevices; i++) {
+                const float *dat = frame + i * NCHANS;
+                fprintf(fp, "\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f", dat[0], dat[1], dat[2], dat[3], dat[4], dat[5], dat[6], dat[7]);
+                fprintf(fp, "\t%f\t%f\t%f", dat[8], dat[9], dat[10]);
+                fprintf(fp, "\t%f\t%f\t%f", dat[11], dat[12], dat[13]);
+                fprintf(fp, "\t%.2f\t%.0f\t%d", dat[14], dat[15], flag[i]);
+        }
+        fprintf(fp, "\n");
+        framesWritten++;
+
+        /* the time of the frame is the estimated arrival time on the common timeline */
+        unicorn_latency_record(&latency, unicorn_clock() - time);
+
+        /* give some feedback on screen when writing data to file */
+        if (toFile && (framesWritten % FSAMPLE)==0) {
+                printf("Wrote %lu aligned samples, drift =", framesWritten);
+                for (int i = 0; i < numDevices; i++)
+                        printf(" %.1f", unicorn_sync_drift(&timeline, i));
+                printf(" ppm, ");
+                unicorn_latency_print(&latency);
+                printf(".\n");
+        }
+}
+
+
 /* Helper function for serial port error handling. */
 int check(enum sp_return result)
 {
@@ -0,0 +1,1058 @@
+/*
+ * This application reads EEG data from one or multiple Unicorn devices and writes it to
+ * any combination of outputs at the same time: a text file, a binary file, LSL, a (virtual)
+ * audio device, the network, a FieldTrip buffer and shared memory. The data is read and
+ * decoded once, and every output runs in its own thread with its own queue, so that a
+ * slow output does not hold up the others.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <assert.h>
+
+#include "libserialport.h"
+#include "lsl_c.h"
+#include "portaudio.h"
+#include "unicorn.h"
+#include "unicorn_sync.h"
+#include "unicorn_latency.h"
+#include "unicorn_metrics.h"
+#include "unicorn_realtime.h"
+#include "unicorn_fanout.h"
+#include "unicorn_audio.h"
+#include "unicorn_stream.h"
+#include "unicorn_fieldtrip.h"
+#include "unicorn_shm.h"
+#include "unicorn_bandpower.h"
+#include "unicorn_quality.h"
+#include "unicorn_decimate.h"
+#include "unicorn_montage.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+/* Helper function for serial port error handling. */
+int check(enum sp_return result);
+
+/* Helper function for stopping properly. */
+void signal_handler(int signum);
+
+/* Helper function to generate random UID string. */
+void rand_str(char *, size_t);
+
+/* Helper function to decode one packet. */
+void put_packet(unicorn_t *dev, const unsigned char *packet, void *userData);
+
+/* Helper function to pass one sample to the sinks. */
+void put_sample(unicorn_t *dev, unsigned long counter, const float *dat, int filled, void *userData);
+
+/* Helper function to pass one aligned frame with the data of all devices to the sinks. */
+void put_frame(const float *frame, const unsigned char *flag, double time, void *userData);
+
+/* These are called in the thread of each sink with a block of frames. */
+int put_text(void *state, const unicorn_block_t *block, unicorn_latency_t *latency);
+int put_binary(void *state, const unicorn_block_t *block, unicorn_latency_t *latency);
+int put_lsl(void *state, const unicorn_block_t *block, unicorn_latency_t *latency);
+int put_audio(void *state, const unicorn_block_t *block, unicorn_latency_t *latency);
+int put_net(void *state, const unicorn_block_t *block, unicorn_latency_t *latency);
+int put_ft(void *state, const unicorn_block_t *block, unicorn_latency_t *latency);
+int put_shm(void *state, const unicorn_block_t *block, unicorn_latency_t *latency);
+int put_band(void *state, const unicorn_block_t *block, unicorn_latency_t *latency);
+int put_quality(void *state, const unicorn_block_t *block, unicorn_latency_t *latency);
+int put_stage(void *state, const unicorn_block_t *block, unicorn_latency_t *latency);
+void idle_net(void *state);
+void idle_stage(void *state);
+
+/* Helper function to record the latency of all frames in a block that has been written. */
+void record_latency(unicorn_latency_t *latency, const unicorn_block_t *block);
+
+/* Helper function to ask whether an output should be downsampled. */
+int ask_factor(const char *name);
+
+/* Helper function to add a sink, which is wrapped in a stage when it is downsampled or when it uses the montage. */
+unicorn_sink_t *add_sink(const char *name, void *state, unicorn_sink_put_t put, unicorn_sink_idle_t idle, int factor, int remix);
+
+#define STRLEN      (80)
+#define LSLSTREAM   "Unicorn"
+#define LSLTYPE     "EEG"
+#define LSLBANDTYPE "BandPower"
+#define LSLQUALITYTYPE "Quality"
+#define LSLBUFFER   (360)
+#define NEEG        (8)
+#define TEXTFILE    "unicorn.txt"
+#define BINARYFILE  "unicorn.bin"
+#define REPORTTIME  (10)    // in seconds, how often the state of the sinks is printed
+
+unicorn_t device[MAXDEVICES];
+int numDevices = 0, numChannels = 0;
+int running = 1;
+int fillMode = FILL_NAN;
+unicorn_sync_t timeline;
+unsigned long reconnects[MAXDEVICES];
+unsigned long framesAligned = 0;
+unicorn_montage_t montage;
+double clockOffset = 0;
+
+/* every sink has its own state */
+unicorn_fanout_t fanout;
+
+/* a sink that is downsampled or that uses the montage passes its blocks through its own stage */
+typedef struct {
+        void *state;
+        unicorn_sink_put_t put;
+        unicorn_sink_idle_t idle;
+        int factor;
+        int remix;
+        unicorn_decimate_t decimate;
+        unicorn_block_t output;         /* the blocks in the queue are shared by all sinks, hence each stage has its own */
+} stage_t;
+stage_t stage[FANOUT_MAXSINKS];
+int numStages = 0;
+FILE *textFile = NULL, *binaryFile = NULL;
+lsl_outlet outlet = NULL, bandOutlet = NULL, qualityOutlet = NULL;
+unicorn_bandpower_t bandpower[MAXDEVICES];
+unicorn_quality_t quality[MAXDEVICES];
+atomic_int qualityOk[MAXDEVICES];      /* one bit for each EEG channel */
+unicorn_audio_t audio;
+unicorn_stream_t stream;
+unicorn_fieldtrip_t buffer;
+unicorn_shm_t ring;
+int haveAudio = 0, haveStream = 0, haveBuffer = 0, haveRing = 0;
+
+/* the metrics of each sink have a sink label */
+unicorn_metrics_t metrics;
+unicorn_realtime_t realtime;
+unicorn_metric_t *metricProcessed[FANOUT_MAXSINKS], *metricQueued[FANOUT_MAXSINKS], *metricDropped[FANOUT_MAXSINKS], *metricLatency[FANOUT_MAXSINKS];
+unicorn_metric_t *metricQuality[MAXDEVICES][QUALITY_NEEG];
+
+int main(int argc, char **argv)
+{
+        char line[STRLEN], metricsAddress[STRLEN];
+        char textName[STRLEN], binaryName[STRLEN], streamName[STRLEN], netAddress[STRLEN], ftAddress[STRLEN], shmName[STRLEN], bandName[STRLEN], qualityName[STRLEN];
+        char labelBuf[MAXDEVICES*(NCHANS+1)][STRLEN], rawLabelBuf[MAXDEVICES*(NCHANS+1)][STRLEN];
+        const char *label[MAXDEVICES*(NCHANS+1)], *rawLabel[MAXDEVICES*(NCHANS+1)], *type[MAXDEVICES*(NCHANS+1)], *unit[MAXDEVICES*(NCHANS+1)];
+        double resolution[MAXDEVICES*(NCHANS+1)];
+        int inputDevice = 0, netFormat = STREAM_FLOAT32;
+        int outputDevice = 0, channelCount = AUDIO_MAXCHANS, bandRate = BANDPOWER_RATE, lineFrequency = QUALITY_LINEFREQ;
+        float outputRate = AUDIO_DEFAULTRATE;
+        int textFactor = 1, binaryFactor = 1, lslFactor = 1, netFactor = 1, ftFactor = 1, shmFactor = 1;
+        int useText = 0, useBinary = 0, useLsl = 0, useAudio = 0, useNet = 0, useFt = 0, useShm = 0, useBand = 0, useQuality = 0;
+        unsigned long lastReport = 0, allocations = 0;
+        struct sp_port **port_list = NULL;
+        unicorn_sink_t *sink;
+        unicorn_loop_t loop;
+
+        if (argc > 1) {
+                /* the ports or serial numbers can also be given on the command line, then the ports are not listed */
+                unicorn_arguments(line, STRLEN, argc, argv);
+        }
+        else {
+                if ((inputDevice = unicorn_list(&port_list)) < 0)
+                        return 1;
+                printf("Select one or multiple ports [%d]: ", inputDevice);
+                unicorn_input(line, STRLEN);
+        }
+        numDevices = unicorn_select(line, port_list, inputDevice, device, MAXDEVICES);
+
+        if (unicorn_replay(device, numDevices)) {
+                printf("Replay speed relative to real time, 0 is as fast as possible [1]: ");
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        unicorn_set_speed(device, numDevices, atof(line));
+        }
+
+        /* all sinks receive the same frames, hence multiple devices are always aligned */
+        if (numDevices==1) {
+                printf("Fill missing samples with nan, linear or none [nan]: ");
+                unicorn_input(line, STRLEN);
+                fillMode = unicorn_fill_mode(line, FILL_NAN);
+        }
+
+        /* the montage is applied by the outputs, the files and the signal quality get the channels as they were recorded */
+        printf("Montage none, car, bipolar or matrix file [none]: ");
+        unicorn_input(line, STRLEN);
+        if (unicorn_montage_init(&montage, line)!=0) {
+                sp_free_port_list(port_list);
+                return 1;
+        }
+
+        printf("Outputs, any of txt bin lsl audio net ft shm band quality [txt]: ");
+        unicorn_input(line, STRLEN);
+        if (strlen(line)==1)
+                useText = 1;
+        for (char *token = strtok(line, " ,\t\n"); token; token = strtok(NULL, " ,\t\n")) {
+                if (strcmp(token, "txt")==0)
+                        useText = 1;
+                else if (strcmp(token, "bin")==0)
+                        useBinary = 1;
+                else if (strcmp(token, "lsl")==0)
+                        useLsl = 1;
+                else if (strcmp(token, "audio")==0)
+                        useAudio = 1;
+                else if (strcmp(token, "net")==0)
+                        useNet = 1;
+                else if (strcmp(token, "ft")==0)
+                        useFt = 1;
+                else if (strcmp(token, "shm")==0)
+                        useShm = 1;
+                else if (strcmp(token, "band")==0)
+                        useBand = 1;
+                else if (strcmp(token, "quality")==0)
+                        useQuality = 1;
+                else
+                        printf("Unknown output: %s\n", token);
+        }
+
+        /* each of the outputs asks for its own settings */
+        if (useText) {
+                snprintf(textName, STRLEN, TEXTFILE);
+                printf("Text file [%s]: ", TEXTFILE);
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        snprintf(textName, STRLEN, "%.*s", (int)strlen(line)-1, line);
+                textFactor = ask_factor("text file");
+        }
+
+        if (useBinary) {
+                snprintf(binaryName, STRLEN, BINARYFILE);
+                printf("Binary file [%s]: ", BINARYFILE);
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        snprintf(binaryName, STRLEN, "%.*s", (int)strlen(line)-1, line);
+                binaryFactor = ask_factor("binary file");
+        }
+
+        if (useLsl) {
+                snprintf(streamName, STRLEN, LSLSTREAM);
+                printf("LSL stream name [%s]: ", LSLSTREAM);
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        snprintf(streamName, STRLEN, "%.*s", (int)strlen(line)-1, line);
+                lslFactor = ask_factor("LSL stream");
+        }
+
+        if (useAudio) {
+                if (unicorn_audio_init()!=0) {
+                        useAudio = 0;
+                }
+                else {
+                        outputDevice = Pa_GetDefaultOutputDevice();
+                        printf("Select output device [%d]: ", outputDevice);
+                        unicorn_input(line, STRLEN);
+                        if (strlen(line)>1)
+                                outputDevice = atoi(line);
+
+                        printf("Output sampling rate [%.0f]: ", AUDIO_DEFAULTRATE);
+                        unicorn_input(line, STRLEN);
+                        if (strlen(line)>1)
+                                outputRate = atof(line);
+
+                        channelCount = min(channelCount, Pa_GetDeviceInfo(outputDevice)->maxOutputChannels);
+                        printf("Number of channels [%d]: ", channelCount);
+                        unicorn_input(line, STRLEN);
+                        if (strlen(line)>1)
+                                channelCount = min(channelCount, atoi(line));
+                }
+        }
+
+        if (useNet) {
+                memset(netAddress, 0, STRLEN);
+                printf("Network destination [udp://%s:%d]: ", STREAM_DEFAULTHOST, STREAM_DEFAULTPORT);
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        strncpy(netAddress, line, strlen(line)-1);
+
+                printf("Sample format int24 or float32 [float32]: ");
+                unicorn_input(line, STRLEN);
+                if (strncmp(line, "int24", 5)==0)
+                        netFormat = STREAM_INT24;
+                netFactor = ask_factor("network stream");
+        }
+
+        if (useFt) {
+                memset(ftAddress, 0, STRLEN);
+                printf("FieldTrip buffer [%s:%d]: ", FT_DEFAULTHOST, FT_DEFAULTPORT);
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        strncpy(ftAddress, line, strlen(line)-1);
+                ftFactor = ask_factor("FieldTrip buffer");
+        }
+
+        if (useShm) {
+                snprintf(shmName, STRLEN, SHM_DEFAULTNAME);
+                printf("Shared memory name [%s]: ", SHM_DEFAULTNAME);
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        snprintf(shmName, STRLEN, "%.*s", (int)strlen(line)-1, line);
+                shmFactor = ask_factor("shared memory");
+        }
+
+        if (useBand) {
+                snprintf(bandName, STRLEN, "%s-bandpower", LSLSTREAM);
+                printf("Band power LSL stream name [%s]: ", bandName);
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        snprintf(bandName, STRLEN, "%.*s", (int)strlen(line)-1, line);
+
+                printf("Band power updates per second [%d]: ", BANDPOWER_RATE);
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        bandRate = min(FSAMPLE, max(1, atoi(line)));
+        }
+
+        if (useQuality) {
+                snprintf(qualityName, STRLEN, "%s-quality", LSLSTREAM);
+                printf("Signal quality LSL stream name [%s]: ", qualityName);
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        snprintf(qualityName, STRLEN, "%.*s", (int)strlen(line)-1, line);
+
+                printf("Line frequency [%d]: ", QUALITY_LINEFREQ);
+                unicorn_input(line, STRLEN);
+                if (strlen(line)>1)
+                        lineFrequency = min(FSAMPLE/2, max(1, atoi(line)));
+        }
+
+        memset(metricsAddress, 0, STRLEN);
+        printf("Metrics port or socket file [none]: ");
+        unicorn_input(line, STRLEN);
+        if (strlen(line)>1)
+                strncpy(metricsAddress, line, strlen(line)-1);
+
+        printf("Real-time options, any of fifo:priority rr:priority cpu:list audio:list lock [none]: ");
+        unicorn_input(line, STRLEN);
+        if (unicorn_realtime_parse(&realtime, line)!=0) {
+                printf("Cannot parse the real-time options.\n");
+                sp_free_port_list(port_list);
+                return 1;
+        }
+
+        /* the selected ports have been copied, clear the others */
+        sp_free_port_list(port_list);
+
+        if (numDevices==0) {
+                printf("No port selected.\n");
+                return 1;
+        }
+
+        /* with multiple devices each device contributes its channels, followed by the gap flag */
+        numChannels = (numDevices==1 ? NCHANS : numDevices*(NCHANS+1));
+        for (int i = 0; i < numChannels; i++) {
+                int c = (numDevices==1 ? i : i % (NCHANS+1));
+                const char *name = (c<MONTAGE_NEEG ? montage.label[c] : (c<NCHANS ? unicorn_label[c] : "gap"));
+                const char *rawName = (c<NCHANS ? unicorn_label[c] : "gap");
+                if (numDevices==1) {
+                        snprintf(labelBuf[i], STRLEN, "%s", name);
+                        snprintf(rawLabelBuf[i], STRLEN, "%s", rawName);
+                }
+                else {
+                        snprintf(labelBuf[i], STRLEN, "%s_%d", name, i/(NCHANS+1)+1);
+                        snprintf(rawLabelBuf[i], STRLEN, "%s_%d", rawName, i/(NCHANS+1)+1);
+                }
+                label[i] = labelBuf[i];
+                rawLabel[i] = rawLabelBuf[i];
+                unit[i] = (c<NCHANS ? unicorn_unit[c] : "boolean");
+                type[i] = (c<NCHANS ? unicorn_type[c] : "GAP");
+                resolution[i] = (c<NCHANS ? unicorn_resolution[c] : 1);
+        }
+
+        /* set up all sinks before the data starts to flow */
+        unicorn_fanout_init(&fanout, numChannels);
+
+        if (useText) {
+                if ((textFile = fopen(textName, "w"))==NULL) {
+                        printf("Cannot open file: %s\n", strerror(errno));
+                        goto cleanup0;
+                }
+                /* each line contains the counter, followed by the channels and for multiple devices the gap flags */
+                fprintf(textFile, "counter\ttime");
+                for (int i = 0; i < numChannels; i++)
+                        fprintf(textFile, "\t%s", rawLabel[i]);
+                fprintf(textFile, "\n");
+                if (add_sink("txt", textFile, put_text, NULL, textFactor, 0)==NULL)
+                        goto cleanup0;
+                printf("Writing text at %g Hz to %s.\n", (double)FSAMPLE/textFactor, textName);
+        }
+
+        if (useBinary) {
+                if ((binaryFile = fopen(binaryName, "wb"))==NULL) {
+                        printf("Cannot open file: %s\n", strerror(errno));
+                        goto cleanup0;
+                }
+                if (add_sink("bin", binaryFile, put_binary, NULL, binaryFactor, 0)==NULL)
+                        goto cleanup0;
+                printf("Writing %d float32 channels at %g Hz to %s.\n", numChannels, (double)FSAMPLE/binaryFactor, binaryName);
+        }
+
+        if (useLsl) {
+                char outputUID[STRLEN];
+                rand_str(outputUID, 8);
+                lsl_streaminfo info = lsl_create_streaminfo(streamName, LSLTYPE, numChannels, (double)FSAMPLE/lslFactor, cft_float32, outputUID);
+                lsl_xml_ptr desc = lsl_get_desc(info);
+                lsl_xml_ptr acquisition = lsl_append_child(desc, "acquisition");
+                lsl_append_child_value(acquisition, "manufacturer", "Gtec");
+                lsl_append_child_value(acquisition, "model", "Unicorn");
+                lsl_append_child_value(acquisition, "precision", "24");
+                lsl_xml_ptr chns = lsl_append_child(desc, "channels");
+                for (int i = 0; i < numChannels; i++) {
+                        lsl_xml_ptr chn = lsl_append_child(chns, "channel");
+                        lsl_append_child_value(chn, "label", label[i]);
+                        lsl_append_child_value(chn, "unit", unit[i]);
+                        lsl_append_child_value(chn, "type", type[i]);
+                }
+                outlet = lsl_create_outlet(info, 0, LSLBUFFER);
+                /* the aligned timeline uses the monotonic clock, LSL has its own clock */
+                clockOffset = lsl_local_clock() - unicorn_clock();
+                if (add_sink("lsl", outlet, put_lsl, NULL, lslFactor, 1)==NULL)
+                        goto cleanup0;
+                printf("Opened LSL stream %s with uid %s at %g Hz.\n", streamName, outputUID, (double)FSAMPLE/lslFactor);
+        }
+
+        if (useAudio) {
+                if ((sink = add_sink("audio", &audio, put_audio, NULL, 1, 1))==NULL)
+                        goto cleanup0;
+                if (unicorn_audio_open(&audio, outputDevice, outputRate, channelCount, AUDIO_BUFFERSIZE, AUDIO_BLOCKSIZE, AUDIO_HPFILTER, 0, &sink->latency)!=0)
+                        goto cleanup0;
+                unicorn_audio_realtime(&audio, &realtime);
+                haveAudio = 1;
+        }
+
+        if (useNet) {
+                if ((sink = add_sink("net", &stream, put_net, idle_net, netFactor, 1))==NULL)
+                        goto cleanup0;
+                if (unicorn_stream_open(&stream, netAddress, netFormat, numChannels, STREAM_BATCH, resolution, &sink->latency)!=0)
+                        goto cleanup0;
+                haveStream = 1;
+        }
+
+        if (useFt) {
+                if ((sink = add_sink("ft", &buffer, put_ft, NULL, ftFactor, 1))==NULL)
+                        goto cleanup0;
+                if (unicorn_fieldtrip_open(&buffer, ftAddress, numChannels, FT_BLOCKSIZE, &sink->latency)!=0)
+                        goto cleanup0;
+                haveBuffer = 1;
+                if (unicorn_fieldtrip_header(&buffer, (float)FSAMPLE/ftFactor, label, type, unit)!=0) {
+                        printf("Cannot write header.\n");
+                        goto cleanup0;
+                }
+                printf("Wrote header with %d channels at %g Hz.\n", numChannels, (double)FSAMPLE/ftFactor);
+        }
+
+        if (useShm) {
+                if (unicorn_shm_create(&ring, shmName, numChannels, SHM_CAPACITY, (double)FSAMPLE/shmFactor, label)!=0)
+                        goto cleanup0;
+                haveRing = 1;
+                if (add_sink("shm", &ring, put_shm, NULL, shmFactor, 1)==NULL)
+                        goto cleanup0;
+        }
+
+        if (useBand) {
+                char outputUID[STRLEN], chanLabel[STRLEN];
+                rand_str(outputUID, 8);
+                /* each device contributes the power in each band for each EEG channel */
+                lsl_streaminfo info = lsl_create_streaminfo(bandName, LSLBANDTYPE, numDevices*BANDPOWER_NUMBANDS*NEEG, bandRate, cft_float32, outputUID);
+                lsl_xml_ptr desc = lsl_get_desc(info);
+                lsl_xml_ptr chns = lsl_append_child(desc, "channels");
+                for (int i = 0; i < numDevices; i++) {
+                        for (int b = 0; b < BANDPOWER_NUMBANDS; b++) {
+                                for (int c = 0; c < NEEG; c++) {
+                                        if (numDevices==1)
+                                                snprintf(chanLabel, STRLEN, "%s_%s", montage.label[c], unicorn_band[b].name);
+                                        else
+                                                snprintf(chanLabel, STRLEN, "%s_%s_%d", montage.label[c], unicorn_band[b].name, i+1);
+                                        lsl_xml_ptr chn = lsl_append_child(chns, "channel");
+                                        lsl_append_child_value(chn, "label", chanLabel);
+                                        lsl_append_child_value(chn, "unit", "uV^2");
+                                        lsl_append_child_value(chn, "type", LSLBANDTYPE);
+                                }
+                        }
+                }
+                bandOutlet = lsl_create_outlet(info, 0, LSLBUFFER);
+                clockOffset = lsl_local_clock() - unicorn_clock();
+                for (int i = 0; i < numDevices; i++)
+                        unicorn_bandpower_init(&bandpower[i], NEEG, bandRate);
+                if (add_sink("band", bandOutlet, put_band, NULL, 1, 1)==NULL)
+                        goto cleanup0;
+                printf("Opened LSL stream %s with uid %s at %d Hz.\n", bandName, outputUID, bandRate);
+        }
+
+        if (useQuality) {
+                char outputUID[STRLEN], chanLabel[STRLEN];
+                rand_str(outputUID, 8);
+                /* each device contributes all measures for each EEG channel */
+                lsl_streaminfo info = lsl_create_streaminfo(qualityName, LSLQUALITYTYPE, numDevices*QUALITY_NUMMEASURES*QUALITY_NEEG, QUALITY_RATE, cft_float32, outputUID);
+                lsl_xml_ptr desc = lsl_get_desc(info);
+                lsl_xml_ptr chns = lsl_append_child(desc, "channels");
+                for (int i = 0; i < numDevices; i++) {
+                        for (int m = 0; m < QUALITY_NUMMEASURES; m++) {
+                                for (int c = 0; c < QUALITY_NEEG; c++) {
+                                        if (numDevices==1)
+                                                snprintf(chanLabel, STRLEN, "%s_%s", unicorn_label[c], unicorn_quality_label[m]);
+                                        else
+                                                snprintf(chanLabel, STRLEN, "%s_%s_%d", unicorn_label[c], unicorn_quality_label[m], i+1);
+                                        lsl_xml_ptr chn = lsl_append_child(chns, "channel");
+                                        lsl_append_child_value(chn, "label", chanLabel);
+                                        lsl_append_child_value(chn, "unit", (m==QUALITY_RMS ? "uV" : "fraction"));
+                                        lsl_append_child_value(chn, "type", LSLQUALITYTYPE);
+                                }
+                        }
+                }
+                qualityOutlet = lsl_create_outlet(info, 0, LSLBUFFER);
+                clockOffset = lsl_local_clock() - unicorn_clock();
+                for (int i = 0; i < numDevices; i++) {
+                        unicorn_quality_init(&quality[i], QUALITY_RATE, lineFrequency);
+                        atomic_init(&qualityOk[i], 0);
+                }
+                if (unicorn_fanout_add(&fanout, "quality", qualityOutlet, put_quality, NULL)==NULL)
+                        goto cleanup0;
+                printf("Opened LSL stream %s with uid %s at %d Hz.\n", qualityName, outputUID, QUALITY_RATE);
+        }
+
+        if (fanout.numSinks==0) {
+                printf("No output selected.\n");
+                goto cleanup0;
+        }
+
+        for (int i = 0; i < numDevices; i++) {
+                if (unicorn_open(&device[i])!=0)
+                        goto cleanup0;
+        }
+
+        if (unicorn_start_all(device, numDevices)!=0)
+                goto cleanup1;
+
+        printf("Started data stream.\n");
+
+        signal(SIGINT, signal_handler);
+#ifndef _WIN32
+        signal(SIGHUP, signal_handler);
+        signal(SIGUSR1, signal_handler);
+        signal(SIGUSR2, signal_handler);
+        /* the network receivers can go away at any moment */
+        signal(SIGPIPE, SIG_IGN);
+#endif
+
+        if (numDevices>1)
+                unicorn_sync_init(&timeline, numDevices, put_frame, NULL);
+
+        unicorn_metrics_init(&metrics, numDevices, NULL);
+        for (int i = 0; i < fanout.numSinks; i++)
+                metricProcessed[i] = unicorn_metrics_add(&metrics, "unicorn_sink_processed_frames_total", "Number of frames that were processed by the sink.", "counter");
+        for (int i = 0; i < fanout.numSinks; i++)
+                metricQueued[i] = unicorn_metrics_add(&metrics, "unicorn_sink_queued_frames", "Number of frames waiting in the queue of the sink.", "gauge");
+        for (int i = 0; i < fanout.numSinks; i++)
+                metricDropped[i] = unicorn_metrics_add(&metrics, "unicorn_sink_dropped_frames_total", "Number of frames that were dropped because the queue of the sink was full.", "counter");
+        for (int i = 0; i < fanout.numSinks; i++)
+                metricLatency[i] = unicorn_metrics_add(&metrics, "unicorn_sink_latency_p99_seconds", "99th percentile of the latency from the arrival of a packet until the sink has written the sample.", "gauge");
+        for (int i = 0; i < fanout.numSinks; i++) {
+                snprintf(metricProcessed[i]->label, METRICSLEN, "sink=\"%s\"", fanout.sink[i].name);
+                snprintf(metricQueued[i]->label, METRICSLEN, "sink=\"%s\"", fanout.sink[i].name);
+                snprintf(metricDropped[i]->label, METRICSLEN, "sink=\"%s\"", fanout.sink[i].name);
+                snprintf(metricLatency[i]->label, METRICSLEN, "sink=\"%s\"", fanout.sink[i].name);
+        }
+        for (int i = 0; useQuality && i < numDevices; i++) {
+                for (int c = 0; c < QUALITY_NEEG; c++) {
+                        metricQuality[i][c] = unicorn_metrics_add(&metrics, "unicorn_channel_ok", "Whether the signal quality of the EEG channel is good.", "gauge");
+                        if (metricQuality[i][c])
+                                snprintf(metricQuality[i][c]->label, METRICSLEN, "device=\"%d\",channel=\"%s\"", i+1, unicorn_label[c]);
+                }
+        }
+        if (strlen(metricsAddress) && unicorn_metrics_start(&metrics, metricsAddress)!=0)
+                goto cleanup2;
+
+        if (unicorn_fanout_start(&fanout)!=0)
+                goto cleanup2;
+        allocations = atomic_load(&unicorn_block_allocations);
+
+        /* the options apply to the main thread, which reads the data, the threads of the sinks are not affected */
+        unicorn_realtime_start(&realtime);
+
+        if (unicorn_loop_init(&loop, device, numDevices)!=0) {
+                printf("Cannot set up event loop.\n");
+                goto cleanup2;
+        }
+
+        while (running) {
+                int result = unicorn_loop_poll(&loop, TIMEOUT, put_packet, NULL);
+                /* the end of a capture file is not an error */
+                if (result==REPLAY_END)
+                        break;
+                if (result<0) {
+                        printf("Cannot read packet.\n");
+                        break;
+                }
+
+                /* all frames that arrived together are processed together */
+                unicorn_fanout_wake(&fanout);
+
+                unicorn_metrics_update(&metrics, device);
+                for (int i = 0; i < fanout.numSinks; i++) {
+                        unicorn_sink_t *s = &fanout.sink[i];
+                        unsigned long head = atomic_load(&s->head), tail = atomic_load(&s->tail);
+                        unicorn_metrics_set(metricProcessed[i], tail);
+                        unicorn_metrics_set(metricQueued[i], head - tail);
+                        unicorn_metrics_set(metricDropped[i], atomic_load(&s->dropped));
+                }
+
+                /* give some feedback on screen */
+                unsigned long acquired = atomic_load(&fanout.sink[0].head) + atomic_load(&fanout.sink[0].dropped);
+                if (acquired / (REPORTTIME*FSAMPLE) != lastReport) {
+                        lastReport = acquired / (REPORTTIME*FSAMPLE);
+                        printf("Acquired %lu samples", acquired);
+                        if (numDevices>1) {
+                                printf(", drift =");
+                                for (int i = 0; i < numDevices; i++)
+                                        printf(" %.1f", unicorn_sync_drift(&timeline, i));
+                                printf(" ppm");
+                        }
+                        printf(".\n");
+                        unicorn_fanout_print(&fanout);
+                        if (haveAudio)
+                                unicorn_audio_realtime_report(&audio);
+                        for (int i = 0; useQuality && i < numDevices; i++) {
+                                int ok = atomic_load(&qualityOk[i]);
+                                printf("Signal quality of device %d:", i+1);
+                                for (int c = 0; c < QUALITY_NEEG; c++)
+                                        printf(" %s %s", unicorn_label[c], (ok & (1<<c)) ? "ok" : "bad");
+                                printf(".\n");
+                        }
+                        for (int i = 0; i < fanout.numSinks; i++)
+                                unicorn_metrics_set(metricLatency[i], unicorn_latency_percentile(&fanout.sink[i].latency, 99));
+                }
+        }
+
+        /* the blocks are reused from the pool, hence streaming should not have allocated any */
+        assert(atomic_load(&unicorn_block_allocations) == allocations);
+        unicorn_loop_free(&loop);
+
+cleanup2:
+        unicorn_fanout_stop(&fanout);
+        /* all blocks return to the pool once the sinks have processed them */
+        assert(unicorn_pool_available(&fanout.pool) == fanout.pool.numBlocks);
+        unicorn_metrics_stop(&metrics);
+
+cleanup1:
+        unicorn_stop_all(device, numDevices);
+        for (int i = 0; i < numDevices; i++)
+                unicorn_print_stats(&device[i]);
+
+cleanup0:
+        for (int i = 0; i < numDevices; i++)
+                unicorn_close(&device[i]);
+
+        /* the sinks are closed after their threads have processed the remaining frames */
+        if (textFile)
+                fclose(textFile);
+        if (binaryFile)
+                fclose(binaryFile);
+        if (outlet)
+                lsl_destroy_outlet(outlet);
+        if (bandOutlet)
+                lsl_destroy_outlet(bandOutlet);
+        if (qualityOutlet)
+                lsl_destroy_outlet(qualityOutlet);
+        if (haveAudio)
+                unicorn_audio_close(&audio);
+        if (useAudio)
+                unicorn_audio_terminate();
+        if (haveStream) {
+                unicorn_stream_flush(&stream);
+                unicorn_stream_close(&stream);
+        }
+        if (haveBuffer) {
+                unicorn_fieldtrip_flush(&buffer);
+                unicorn_fieldtrip_close(&buffer);
+        }
+        if (haveRing)
+                unicorn_shm_destroy(&ring);
+
+        unicorn_fanout_print(&fanout);
+        unicorn_fanout_free(&fanout);
+        for (int i = 0; i < numStages; i++) {
+                unicorn_decimate_free(&stage[i].decimate);
+                unicorn_block_free(&stage[i].output);
+        }
+
+        return 0;
+}
+
+
+/* Helper function to decode one packet. */
+void put_packet(unicorn_t *dev, const unsigned char *packet, void *userData)
+{
+        float dat[NCHANS];
+
+        unicorn_decode(packet, dat);
+
+        /* the alignment deals with missing samples by itself */
+        unicorn_fill(dev, unicorn_counter(packet), dat, (numDevices>1 ? FILL_NONE : fillMode), put_sample, userData);
+}
+
+
+/* Helper function to pass one sample to the sinks. */
+void put_sample(unicorn_t *dev, unsigned long counter, const float *dat, int filled, void *userData)
+{
+        if (numDevices>1) {
+                int i = (int)(dev - device);
+                /* the hardware counter starts again after a reconnect */
+                if (dev->stats.reconnects != reconnects[i]) {
+                        reconnects[i] = dev->stats.reconnects;
+                        unicorn_sync_reset(&timeline, i);
+                }
+                unicorn_sync_push(&timeline, i, counter, dev->lastRead, dat);
+                return;
+        }
+
+        unicorn_fanout_put(&fanout, counter, dev->lastRead, dat);
+}
+
+
+/* Helper function to pass one aligned frame with the data of all devices to the sinks. */
+void put_frame(const float *frame, const unsigned char *flag, double time, void *userData)
+{
+        float dat[MAXDEVICES*(NCHANS+1)];
+
+        for (int i = 0; i < numDevices; i++) {
+                memcpy(dat + i*(NCHANS+1), frame + i*NCHANS, NCHANS * sizeof(float));
+                dat[i*(NCHANS+1) + NCHANS] = flag[i];
+        }
+
+        /* the aligned frames are numbered from one, like the hardware counter */
+        unicorn_fanout_put(&fanout, ++framesAligned, time, dat);
+}
+
+
+/* Pass one block through the decimation and the montage, only the remaining frames are passed on to the sink. */
+int put_stage(void *state, const unicorn_block_t *block, unicorn_latency_t *latency)
+{
+        stage_t *st = (stage_t *)state;
+
+        if (st->factor>1) {
+                if (unicorn_decimate_put_block(&st->decimate, block, &st->output)==0)
+                        return 0;
+                /* the time is corrected for the delay of the filter, the counter is that of the most recent sample */
+                for (int s = 0; s < st->output.numSamples; s++)
+                        st->output.time[s] -= st->decimate.delay;
+        }
+        else {
+                unicorn_block_copy(&st->output, block);
+        }
+
+        /* the montage is applied to the channels of each device */
+        if (st->remix)
+                unicorn_montage_apply_block(&montage, &st->output, (numDevices==1 ? NCHANS : NCHANS+1));
+
+        return st->put(st->state, &st->output, latency);
+}
+
+
+void idle_stage(void *state)
+{
+        stage_t *st = (stage_t *)state;
+        st->idle(st->state);
+}
+
+
+/* Helper function to record the latency of all frames in a block that has been written. */
+void record_latency(unicorn_latency_t *latency, const unicorn_block_t *block)
+{
+        double now = unicorn_clock();
+
+        for (int s = 0; s < block->numSamples; s++)
+                unicorn_latency_record(latency, now - block->time[s]);
+}
+
+
+/* Write each frame as a line of text. */
+int put_text(void *state, const unicorn_block_t *block, unicorn_latency_t *latency)
+{
+        FILE *fp = (FILE *)state;
+
+        for (int s = 0; s < block->numSamples; s++) {
+                fprintf(fp, "%lu\t%.4f", block->counter[s], block->time[s]);
+                for (int i = 0; i < numChannels; i++)
+                        fprintf(fp, "\t%f", unicorn_block_channel(block, i)[s]);
+                if (fprintf(fp, "\n") < 0)
+                        return 1;
+        }
+
+        record_latency(latency, block);
+        return 0;
+}
+
+
+/* Write the frames as float32 values, the channels of each frame are after each other. */
+int put_binary(void *state, const unicorn_block_t *block, unicorn_latency_t *latency)
+{
+        FILE *fp = (FILE *)state;
+        float dat[FANOUT_BLOCKSIZE*FANOUT_MAXCHANS];
+        size_t count = (size_t)block->numSamples * numChannels;
+
+        for (int s = 0; s < block->numSamples; s++)
+                unicorn_block_sample(block, s, dat + s*numChannels);
+        if (fwrite(dat, sizeof(float), count, fp) != count)
+                return 1;
+
+        record_latency(latency, block);
+        return 0;
+}
+
+
+/* Push the frames to LSL as one chunk, each frame has its time on the common timeline. */
+int put_lsl(void *state, const unicorn_block_t *block, unicorn_latency_t *latency)
+{
+        float dat[FANOUT_BLOCKSIZE*FANOUT_MAXCHANS];
+        double timestamp[FANOUT_BLOCKSIZE];
+
+        for (int s = 0; s < block->numSamples; s++) {
+                unicorn_block_sample(block, s, dat + s*numChannels);
+                timestamp[s] = block->time[s] + clockOffset;
+        }
+        lsl_push_chunk_ftp((lsl_outlet)state, dat, (unsigned long)block->numSamples * numChannels, timestamp);
+
+        record_latency(latency, block);
+        return 0;
+}
+
+
+/* Pass the frames to the audio output, this uses the EEG channels of the first device. */
+int put_audio(void *state, const unicorn_block_t *block, unicorn_latency_t *latency)
+{
+        static int firstBlock = 1;
+
+        /* the resampling is done in the thread of this sink, which gets the same options as the thread of the audio interface */
+        if (firstBlock && (realtime.policy != REALTIME_OTHER || realtime.audioCpus)) {
+                char report[REALTIME_REPORTLEN];
+                unicorn_realtime_thread(&realtime, realtime.audioCpus, report, REALTIME_REPORTLEN);
+                printf("Resampler thread: %s.\n", report);
+        }
+        firstBlock = 0;
+
+        /* the latency is recorded by the audio output itself, when the sample is played */
+        return unicorn_audio_put_block((unicorn_audio_t *)state, block);
+}
+
+
+/* Add the frames to the network stream. */
+int put_net(void *state, const unicorn_block_t *block, unicorn_latency_t *latency)
+{
+        float dat[FANOUT_MAXCHANS];
+
+        for (int s = 0; s < block->numSamples; s++) {
+                unicorn_block_sample(block, s, dat);
+                if (unicorn_stream_put((unicorn_stream_t *)state, dat, block->counter[s], block->time[s])!=0)
+                        return 1;
+        }
+        return 0;
+}
+
+
+/* Send the complete messages when there are no more frames, the last one may still wait for more. */
+void idle_net(void *state)
+{
+        unicorn_stream_send((unicorn_stream_t *)state, unicorn_clock());
+}
+
+
+/* Add the frames to the FieldTrip buffer. */
+int put_ft(void *state, const unicorn_block_t *block, unicorn_latency_t *latency)
+{
+        float dat[FANOUT_MAXCHANS];
+
+        for (int s = 0; s < block->numSamples; s++) {
+                unicorn_block_sample(block, s, dat);
+                if (unicorn_fieldtrip_put((unicorn_fieldtrip_t *)state, dat, block->time[s])!=0)
+                        return 1;
+        }
+        return 0;
+}
+
+
+/* Write the frames to the shared memory. */
+int put_shm(void *state, const unicorn_block_t *block, unicorn_latency_t *latency)
+{
+        float dat[FANOUT_MAXCHANS];
+
+        for (int s = 0; s < block->numSamples; s++) {
+                unicorn_block_sample(block, s, dat);
+                unicorn_shm_write((unicorn_shm_t *)state, dat, block->counter[s], block->time[s]);
+        }
+
+        record_latency(latency, block);
+        return 0;
+}
+
+
+/* Compute the band power of the EEG channels of each device, this is pushed to LSL at a lower rate. */
+int put_band(void *state, const unicorn_block_t *block, unicorn_latency_t *latency)
+{
+        float power[MAXDEVICES*BANDPOWER_NUMBANDS*NEEG];
+        int position[MAXDEVICES] = {0}, update = 1;
+
+        /* the devices are aligned, hence they are all updated at the same frame of the block */
+        while (update) {
+                for (int i = 0; i < numDevices; i++)
+                        update = unicorn_bandpower_put_block(&bandpower[i], block, i*(numDevices==1 ? NCHANS : NCHANS+1), &position[i], power + i*BANDPOWER_NUMBANDS*NEEG);
+
+                if (update) {
+                        double time = block->time[position[0]-1];
+                        lsl_push_sample_ft((lsl_outlet)state, power, time + clockOffset);
+                        unicorn_latency_record(latency, unicorn_clock() - time);
+                }
+        }
+        return 0;
+}
+
+
+/* Compute the signal quality of the EEG channels of each device, this is pushed to LSL at a lower rate. */
+int put_quality(void *state, const unicorn_block_t *block, unicorn_latency_t *latency)
+{
+        float result[MAXDEVICES*QUALITY_NUMMEASURES*QUALITY_NEEG];
+        int position[MAXDEVICES] = {0}, update = 1;
+
+        /* the devices are aligned, hence they are all updated at the same frame of the block */
+        while (update) {
+                for (int i = 0; i < numDevices; i++) {
+                        float *r = result + i*QUALITY_NUMMEASURES*QUALITY_NEEG;
+                        if ((update = unicorn_quality_put_block(&quality[i], block, i*(numDevices==1 ? NCHANS : NCHANS+1), &position[i], r))) {
+                                int ok = 0;
+                                for (int c = 0; c < QUALITY_NEEG; c++) {
+                                        ok |= (r[QUALITY_OK*QUALITY_NEEG + c]!=0) << c;
+                                        unicorn_metrics_set(metricQuality[i][c], r[QUALITY_OK*QUALITY_NEEG + c]);
+                                }
+                                atomic_store(&qualityOk[i], ok);
+                        }
+                }
+
+                if (update) {
+                        double time = block->time[position[0]-1];
+                        lsl_push_sample_ft((lsl_outlet)state, result, time + clockOffset);
+                        unicorn_latency_record(latency, unicorn_clock() - time);
+                }
+        }
+        return 0;
+}
+
+
+/* Helper function to ask whether an output should be downsampled. */
+int ask_factor(const char *name)
+{
+        char line[STRLEN];
+        int factor = 1;
+
+        printf("Downsample the %s by a factor, 1 is none [1]: ", name);
+        unicorn_input(line, STRLEN);
+        if (strlen(line)>1)
+                factor = min(DECIMATE_MAXFACTOR, max(1, atoi(line)));
+        return factor;
+}
+
+
+/* Helper function to add a sink, which is wrapped in a stage when it is downsampled or when it uses the montage. */
+unicorn_sink_t *add_sink(const char *name, void *state, unicorn_sink_put_t put, unicorn_sink_idle_t idle, int factor, int remix)
+{
+        remix = (remix && montage.type!=MONTAGE_NONE);
+        if (factor==1 && !remix)
+                return unicorn_fanout_add(&fanout, name, state, put, idle);
+
+        if (numStages==FANOUT_MAXSINKS)
+                return NULL;
+        stage_t *st = &stage[numStages++];
+
+        /* the output block is allocated now, the memory does not change once the data is streaming */
+        if (unicorn_block_alloc(&st->output, numChannels, FANOUT_BLOCKSIZE)!=0)
+                return NULL;
+        if (factor>1 && unicorn_decimate_init(&st->decimate, numChannels, (numDevices==1 ? NCHANS : NCHANS+1), factor)!=0)
+                return NULL;
+        st->state = state;
+        st->put = put;
+        st->idle = idle;
+        st->factor = factor;
+        st->remix = remix;
+        return unicorn_fanout_add(&fanout, name, st, put_stage, (idle ? idle_stage : NULL));
+}
+
+
+/* Helper function for serial port error handling. */
+int check(enum sp_return result)
+{
+        char *error_message;
+        switch (result) {
+        case SP_ERR_ARG:
+                printf("Error: Invalid argument.\n");
+                abort();
+        case SP_ERR_FAIL:
+                error_message = sp_last_error_message();
+                printf("Error: Failed: %s\n", error_message);
+                sp_free_error_message(error_message);
+                abort();
+        case SP_ERR_SUPP:
+                printf("Error: Not supported.\n");
+                abort();
+        case SP_ERR_MEM:
+                printf("Error: Couldn't allocate memory.\n");
+                abort();
+        case SP_OK:
+        default:
+                return result;
+        }
+}
+
+/* Helper function for stopping properly. */
+void signal_handler(int signum) {
+        switch (signum) {
+        case SIGINT:
+                printf("Received SIGINT\n");
+                running = 0;
+                break;
+#ifndef _WIN32
+        case SIGHUP:
+                printf("Received SIGHUP\n");
+                break;
+        case SIGUSR1:
+                printf("Received SIGUSR1\n");
+                break;
+        case SIGUSR2:
+                printf("Received SIGUSR2\n");
+                break;
+#endif
+        }
+}
+
+/* Helper function to generate random UID string. */
+void rand_str(char *dest, size_t length) {
+        char charset[] = "0123456789"
+                         "abcdefghijklmnopqrstuvwxyz";
+
+        while (length-- > 0) {
+                size_t index = (double) rand() / RAND_MAX * (sizeof charset - 1);
+                *dest++ = charset[index];
+        }
+        *dest = '\0';
+}
@@ -0,0 +1,565 @@
+/*
+ * Audio output that upsamples the EEG data to an audio sampling rate and writes it to a
+ * (virtual) audio device. The EEG is high-pass filtered and scaled between -1 and +1, and
+ * the resampling ratio is continuously adjusted to keep the output buffer half full.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+
+#include "unicorn_audio.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+/* Helper function for low-pass filtering. */
+#define smooth(old, new, lambda) ((1.0-lambda)*(old) + (lambda)*(new))
+
+/*******************************************************************************************************/
+static int resample_buffers(unicorn_audio_t *audio) {
+        unicorn_audio_buffer_t *inputData = &audio->inputData, *outputData = &audio->outputData;
+        SRC_DATA *resampleData = &audio->resampleData;
+
+        resampleData->src_ratio      = audio->resampleRatio;
+        resampleData->end_of_input   = 0;
+        resampleData->data_in        = inputData->data;
+        resampleData->input_frames   = inputData->frames;
+        resampleData->data_out       = outputData->data + outputData->frames * audio->channelCount;
+        resampleData->output_frames  = audio->outputBufsize - outputData->frames;
+
+        /* check whether there is data in the input buffer */
+        if (inputData->frames==0)
+                return 0;
+
+        /* check whether there is room for new data in the output buffer */
+        if (outputData->frames==(unsigned long)audio->outputBufsize)
+                return 0;
+
+        int srcErr = src_process (audio->resampleState, resampleData);
+        if (srcErr)
+        {
+                printf("ERROR: Cannot resample the input data\n");
+                printf("ERROR: %s\n", src_strerror(srcErr));
+                exit(srcErr);
+        }
+
+        /* the output data buffer increased */
+        outputData->frames += resampleData->output_frames_gen;
+
+        /* the input data buffer decreased */
+        size_t len = (inputData->frames - resampleData->input_frames_used) * audio->channelCount * sizeof(float);
+        memmove(inputData->data, inputData->data + resampleData->input_frames_used * audio->channelCount, len);
+        inputData->frames -= resampleData->input_frames_used;
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+static int update_ratio(unicorn_audio_t *audio) {
+        float nominal = (float)audio->outputRate/audio->inputRate;
+        float estimate = nominal + (0.5*audio->outputBufsize - audio->outputData.frames) / audio->outputBlocksize;
+
+        /* do not change the ratio by too much */
+        estimate = min(estimate, 1.2*nominal);
+        estimate = max(estimate, 0.8*nominal);
+
+        /* allow some variation of the target buffer size */
+        /* it should fall between the lower and upper range */
+        float verylow   = (0.40*audio->outputBufsize);
+        float low       = (0.48*audio->outputBufsize);
+        float high      = (0.52*audio->outputBufsize);
+        float veryhigh  = (0.60*audio->outputBufsize);
+
+        /* this is called every 0.01 seconds, hence lambda=1.0*BLOCKSIZE implements a 1 second smoothing
+           and 10*BLOCKSIZE implements a 0.1 second smoothing */
+        if (audio->outputData.frames<verylow)
+                audio->resampleRatio = smooth(audio->resampleRatio, estimate, 10. * AUDIO_BLOCKSIZE);
+        else if (audio->outputData.frames<low)
+                audio->resampleRatio = smooth(audio->resampleRatio, estimate, 1. * AUDIO_BLOCKSIZE);
+        else if (audio->outputData.frames>high)
+                audio->resampleRatio = smooth(audio->resampleRatio, estimate, 1. * AUDIO_BLOCKSIZE);
+        else if (audio->outputData.frames>veryhigh)
+                audio->resampleRatio = smooth(audio->resampleRatio, estimate, 10. * AUDIO_BLOCKSIZE);
+        else
+                audio->resampleRatio = smooth(audio->resampleRatio, nominal, 10. * AUDIO_BLOCKSIZE);
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+static int output_callback(const void *input,
+                           void *output,
+                           unsigned long frameCount,
+                           const PaStreamCallbackTimeInfo* timeInfo,
+                           PaStreamCallbackFlags statusFlags,
+                           void *userData)
+{
+        float *data = (float *)output;
+        unicorn_audio_t *audio = (unicorn_audio_t *)userData;
+        unicorn_audio_buffer_t *outputData = &audio->outputData;
+        int channelCount = audio->channelCount;
+        unsigned int newFrames = min(frameCount, outputData->frames);
+
+        /* this is only done once, the report is printed by the main thread */
+        if (atomic_load_explicit(&audio->realtimeState, memory_order_relaxed) == REALTIME_REQUESTED) {
+                unicorn_realtime_thread(&audio->realtime, audio->realtime.audioCpus, audio->realtimeReport, REALTIME_REPORTLEN);
+                atomic_store_explicit(&audio->realtimeState, REALTIME_APPLIED, memory_order_release);
+        }
+
+        /* PortAudio reports when the audio interface ran out of data, or could not keep up */
+        if (statusFlags & paOutputUnderflow)
+                atomic_fetch_add_explicit(&audio->underflow, 1, memory_order_relaxed);
+        if (statusFlags & paOutputOverflow)
+                atomic_fetch_add_explicit(&audio->overflow, 1, memory_order_relaxed);
+
+        /* keep track of the range of the output buffer level since the last report */
+        if (outputData->frames < atomic_load_explicit(&audio->fillMin, memory_order_relaxed))
+                atomic_store_explicit(&audio->fillMin, outputData->frames, memory_order_relaxed);
+        if (outputData->frames > atomic_load_explicit(&audio->fillMax, memory_order_relaxed))
+                atomic_store_explicit(&audio->fillMax, outputData->frames, memory_order_relaxed);
+
+        size_t len = newFrames * channelCount * sizeof(float);
+        memcpy(data, outputData->data, len);
+
+        /* the resampler did not deliver enough data, the remainder is silent */
+        if (newFrames < frameCount && audio->enableResampleBuffers)
+                atomic_fetch_add_explicit(&audio->zeroFilled, frameCount - newFrames, memory_order_relaxed);
+
+        len = (frameCount - newFrames) * channelCount * sizeof(float);
+        memset(data + newFrames * channelCount, 0, len);
+
+        len = (outputData->frames - newFrames) * channelCount * sizeof(float);
+        memmove(outputData->data, outputData->data + newFrames * channelCount, len);
+
+        outputData->frames -= newFrames;
+
+        if (audio->enableUpdateLimit) {
+               for (unsigned int i = 0; i < (newFrames * channelCount); i++)
+                        audio->outputLimit = max(audio->outputLimit, fabsf(data[i]));
+        }
+
+        if (audio->enableResampleBuffers)
+                resample_buffers(audio);
+
+        if (audio->enableUpdateRatio)
+                update_ratio(audio);
+
+        if (audio->enableResampleBuffers && audio->lastArrival > 0 && audio->latency) {
+                /* the newest sample is played after this buffer and all frames that are still queued */
+                double dacTime = unicorn_clock();
+                if (timeInfo->outputBufferDacTime > 0 && timeInfo->currentTime > 0)
+                        dacTime += timeInfo->outputBufferDacTime - timeInfo->currentTime;
+                dacTime += (frameCount + outputData->frames) / audio->outputRate + audio->inputData.frames / audio->inputRate;
+                unicorn_latency_record(audio->latency, dacTime - audio->lastArrival);
+        }
+
+        return paContinue;
+}
+
+/*******************************************************************************************************/
+/* Helper function for stopping properly. */
+static void stream_finished(void *userData) {
+        unicorn_audio_t *audio = (unicorn_audio_t *)userData;
+        atomic_store(&audio->finished, 1);
+}
+
+/*******************************************************************************************************/
+int unicorn_audio_init(void)
+{
+        const PaDeviceInfo *deviceInfo;
+        int numDevices;
+
+        printf("PortAudio version: 0x%08X\n", Pa_GetVersion());
+
+        /* Initialize library before making any other calls. */
+        PaError paErr = Pa_Initialize();
+        if(paErr != paNoError) {
+                printf("ERROR: Cannot initialize PortAudio.\n");
+                printf("ERROR: %s\n", Pa_GetErrorText(paErr));
+                return 1;
+        }
+
+        numDevices = Pa_GetDeviceCount();
+        if (numDevices <= 0) {
+                printf("ERROR: No audio devices available.\n");
+                return 1;
+        }
+
+        printf("Number of host APIs = %d\n", Pa_GetHostApiCount());
+        printf("Number of devices = %d\n", numDevices);
+        for (int i = 0; i < numDevices; i++) {
+                deviceInfo = Pa_GetDeviceInfo(i);
+                if (Pa_GetHostApiCount() == 1)
+                        printf("device %2d - %s (%d in, %d out)\n", i,
+                               deviceInfo->name,
+                               deviceInfo->maxInputChannels,
+                               deviceInfo->maxOutputChannels);
+                else
+                        printf("device %2d - %s - %s (%d in, %d out)\n", i,
+                               Pa_GetHostApiInfo(deviceInfo->hostApi)->name,
+                               deviceInfo->name,
+                               deviceInfo->maxInputChannels,
+                               deviceInfo->maxOutputChannels);
+        }
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+void unicorn_audio_terminate(void)
+{
+        Pa_Terminate();
+}
+
+/*******************************************************************************************************/
+int unicorn_audio_open(unicorn_audio_t *audio, int outputDevice, double outputRate, int channelCount, double bufferSize, double blockSize, double hpFilter, double outputLimit, unicorn_latency_t *latency)
+{
+        PaStreamParameters outputParameters;
+        PaError paErr;
+        int srcErr;
+
+        memset(audio, 0, sizeof(unicorn_audio_t));
+        atomic_init(&audio->fillMin, ULONG_MAX);
+        audio->latency = latency;
+        audio->inputRate = FSAMPLE;
+        audio->outputRate = outputRate;
+        audio->channelCount = max(1, min(channelCount, AUDIO_MAXCHANS));
+        audio->inputBufsize = bufferSize * audio->inputRate;
+        audio->outputBufsize = bufferSize * outputRate;
+        audio->outputBlocksize = blockSize * outputRate;
+
+        /* this implements an exponential decay of 1/2 after the specified number of seconds */
+        audio->hpFilter = 1.0 - pow(0.5, 1.0/(FSAMPLE*hpFilter));
+
+        if (outputLimit == 0) {
+                /* start with the default and update automatically */
+                audio->outputLimit = AUDIO_OUTPUTLIMIT;
+                audio->enableUpdateLimit = 1;
+        }
+        else {
+                /* use the user-supplied value and do not update automatically */
+                audio->outputLimit = outputLimit;
+                audio->enableUpdateLimit = 0;
+        }
+
+        printf("outputDevice = %d\n", outputDevice);
+        printf("outputRate = %f\n", outputRate);
+        printf("channelCount = %d\n", audio->channelCount);
+
+        outputParameters.device = outputDevice;
+        outputParameters.channelCount = audio->channelCount;
+        outputParameters.sampleFormat = AUDIO_SAMPLETYPE;
+        outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
+        outputParameters.hostApiSpecificStreamInfo = NULL;
+
+        paErr = Pa_OpenStream(
+                &audio->stream,
+                NULL,
+                &outputParameters,
+                outputRate,
+                audio->outputBlocksize,
+                paNoFlag,
+                output_callback,
+                audio);
+        if(paErr != paNoError)
+        {
+                printf("ERROR: Cannot open output stream.\n");
+                printf("ERROR: %s\n", Pa_GetErrorText(paErr));
+                audio->stream = NULL;
+                return 1;
+        }
+
+        printf("Opened output stream with %d channels at %.0f Hz.\n", audio->channelCount, outputRate);
+
+        /* ensure a gracefull exit when the audio stream is closed */
+        Pa_SetStreamFinishedCallback(audio->stream, stream_finished);
+
+        if ((audio->inputData.data = calloc(audio->inputBufsize * audio->channelCount, sizeof(float))) == NULL)
+                goto fail;
+        if ((audio->outputData.data = calloc(audio->outputBufsize * audio->channelCount, sizeof(float))) == NULL)
+                goto fail;
+
+        printf("Setting up %s rate converter with %s\n",
+               src_get_name (SRC_SINC_MEDIUM_QUALITY),
+               src_get_description (SRC_SINC_MEDIUM_QUALITY));
+
+        audio->resampleState = src_new (SRC_SINC_MEDIUM_QUALITY, audio->channelCount, &srcErr);
+        if (audio->resampleState == NULL) {
+                printf("ERROR: Cannot set up resample state.\n");
+                printf("ERROR: %s\n", src_strerror(srcErr));
+                goto fail;
+        }
+
+        return 0;
+
+fail:
+        unicorn_audio_close(audio);
+        return 1;
+}
+
+/*******************************************************************************************************/
+/* Helper function to detect the end of the initial transient, this returns 1 once the signal is stable. */
+static int settle(unicorn_audio_t *audio, const float *eegdata)
+{
+        int n = audio->samples % AUDIO_SETTLEWINDOW, stable = 1;
+
+        if (audio->samples == 1) {
+                for (int i = 0; i < audio->channelCount; i++)
+                        audio->settleOffset[i] = eegdata[i];
+        }
+
+        for (int i = 0; i < audio->channelCount; i++) {
+                double x = eegdata[i] - audio->settleOffset[i];
+                audio->settleSum[i] += x;
+                audio->settleSumSq[i] += x * x;
+        }
+
+        if (n != 0)
+                return 0;
+
+        /* compare the window that just ended with the previous one */
+        for (int i = 0; i < audio->channelCount; i++) {
+                double mean = audio->settleSum[i] / AUDIO_SETTLEWINDOW;
+                double var = max(0, audio->settleSumSq[i] / AUDIO_SETTLEWINDOW - mean * mean);
+                if (audio->samples == AUDIO_SETTLEWINDOW)
+                        stable = 0;
+                else if (var > AUDIO_SETTLERATIO * audio->settleVar[i] + AUDIO_SETTLEFLOOR || audio->settleVar[i] > AUDIO_SETTLERATIO * var + AUDIO_SETTLEFLOOR)
+                        stable = 0;
+                else if (fabs(mean - audio->settleMean[i]) > AUDIO_SETTLESHIFT * sqrt(max(var, AUDIO_SETTLEFLOOR)))
+                        stable = 0;
+                audio->settleMean[i] = mean;
+                audio->settleVar[i] = var;
+                audio->settleSum[i] = 0;
+                audio->settleSumSq[i] = 0;
+        }
+
+        audio->settleStable = (stable ? audio->settleStable + 1 : 0);
+        return (audio->settleStable >= AUDIO_SETTLESTABLE || audio->samples >= AUDIO_SETTLE);
+}
+
+/*******************************************************************************************************/
+int unicorn_audio_put(unicorn_audio_t *audio, const float *dat, double arrival)
+{
+        float eegdata[AUDIO_MAXCHANS];
+
+        /* the audio output needs a constant rate, a missing value is replaced by the previous one */
+        for (int i = 0; i < audio->channelCount; i++) {
+                if (!isnan(dat[i]))
+                        audio->lastValue[i] = dat[i];
+                eegdata[i] = audio->lastValue[i];
+        }
+        audio->samples++;
+
+        if (audio->state == AUDIO_SETTLING) {
+                if (audio->samples == 1)
+                        printf("Flushing initial data...\n");
+
+                /* discard the first samples until the initial transient has decayed, this tends to have weird values */
+                if (!settle(audio, eegdata))
+                        return 0;
+
+                /* initialize the exponential smoothing filter with the mean of the last window, rather than with a single sample */
+                for (int i = 0; i < audio->channelCount; i++)
+                        audio->eegfilt[i] = audio->settleOffset[i] + audio->settleMean[i];
+
+                printf("Settled after %.2f seconds.\n", (double)audio->samples / FSAMPLE);
+                printf("Filling buffer...\n");
+                audio->state = AUDIO_FILLING;
+                audio->samples = 0;
+                return 0;
+        }
+
+        /* apply a highpass filter by subtracting a smoothed version of the signal */
+        for (int i = 0; i < audio->channelCount; i++) {
+                audio->eegfilt[i] = smooth(audio->eegfilt[i], eegdata[i], audio->hpFilter);
+                eegdata[i] -= audio->eegfilt[i];
+        }
+
+        /* the signal is ramped in, so that the output does not start with a click */
+        if (audio->ramp < AUDIO_RAMP * audio->inputRate) {
+                audio->ramp++;
+                for (int i = 0; i < audio->channelCount; i++)
+                        eegdata[i] *= audio->ramp / (AUDIO_RAMP * audio->inputRate);
+        }
+
+        /* the sample is dropped when the resampler does not keep up and the input buffer is full */
+        if (audio->inputData.frames == (unsigned long)audio->inputBufsize) {
+                audio->overrun++;
+        }
+        else {
+                /* add the current sample to the input buffer and increment the counter */
+                for (int i = 0; i < audio->channelCount; i++) {
+                        if (audio->enableUpdateLimit) {
+                                audio->outputLimit = max(audio->outputLimit, fabsf(eegdata[i]));
+                        }
+                        audio->inputData.data[audio->inputData.frames * audio->channelCount + i] = eegdata[i] / audio->outputLimit;
+                }
+                audio->inputData.frames++;
+                if (audio->state == AUDIO_PLAYING)
+                        audio->lastArrival = arrival;
+        }
+
+        /* wait until the input buffer has the prefill */
+        if (audio->state == AUDIO_FILLING && audio->inputData.frames >= min(audio->inputBufsize/2, AUDIO_PREFILL * audio->inputRate)) {
+                audio->resampleRatio = audio->outputRate / audio->inputRate;
+                printf("Initial resampleRatio = %f\n", audio->resampleRatio);
+
+                /* the output buffer starts with silence up to its target level, the prefill comes on top of that */
+                unsigned long pad = max(0, audio->outputBufsize/2 - (int)(audio->inputData.frames * audio->resampleRatio));
+                memset(audio->outputData.data, 0, pad * audio->channelCount * sizeof(float));
+                audio->outputData.frames = pad;
+
+                int srcErr = src_set_ratio (audio->resampleState, audio->resampleRatio);
+                if (srcErr) {
+                        printf("ERROR: Cannot set resampling ratio.\n");
+                        printf("ERROR: %s\n", src_strerror(srcErr));
+                        return 1;
+                }
+
+                PaError paErr = Pa_StartStream(audio->stream);
+                if(paErr != paNoError) {
+                        printf("ERROR: Cannot start output audio stream.\n");
+                        printf("ERROR: %s\n", Pa_GetErrorText(paErr));
+                        return 1;
+                }
+
+                printf("Started output audio stream.\n");
+
+                /* enable the resampling and the dynamic updating of the samplerate ratio */
+                audio->enableResampleBuffers = 1;
+                audio->enableUpdateRatio = 1;
+                audio->state = AUDIO_PLAYING;
+                audio->samples = 0;
+        }
+
+        return atomic_load(&audio->finished);
+}
+
+/*******************************************************************************************************/
+int unicorn_audio_put_block(unicorn_audio_t *audio, const unicorn_block_t *block)
+{
+        float dat[AUDIO_MAXCHANS];
+        int s = 0;
+
+        /* the initial samples change the state of the output or are ramped in, these are added one at a time */
+        while (s < block->numSamples && (audio->state != AUDIO_PLAYING || audio->ramp < AUDIO_RAMP * audio->inputRate)) {
+                for (int i = 0; i < audio->channelCount; i++)
+                        dat[i] = unicorn_block_channel(block, i)[s];
+                if (unicorn_audio_put(audio, dat, block->time[s])!=0)
+                        return 1;
+                s++;
+        }
+
+        int n = block->numSamples - s;
+        if (n == 0)
+                return atomic_load(&audio->finished);
+        audio->samples += n;
+
+        /* the samples that do not fit are dropped when the resampler does not keep up and the input buffer is full */
+        int room = min(n, audio->inputBufsize - (int)audio->inputData.frames);
+        audio->overrun += n - room;
+
+        /* each channel is filtered in one go, this also determines the largest value in the block */
+        float *output = audio->inputData.data + audio->inputData.frames * audio->channelCount;
+        float peak = 0;
+        for (int i = 0; i < audio->channelCount; i++) {
+                const float *x = unicorn_block_channel(block, i) + s;
+                float lastValue = audio->lastValue[i], eegfilt = audio->eegfilt[i];
+                for (int k = 0; k < n; k++) {
+                        /* a missing value is replaced by the previous one */
+                        float value = (isnan(x[k]) ? lastValue : x[k]);
+                        lastValue = value;
+                        eegfilt = smooth(eegfilt, value, audio->hpFilter);
+                        if (k < room) {
+                                output[k * audio->channelCount + i] = value - eegfilt;
+                                peak = max(peak, fabsf(value - eegfilt));
+                        }
+                }
+                audio->lastValue[i] = lastValue;
+                audio->eegfilt[i] = eegfilt;
+        }
+
+        /* the scaling is updated once for the whole block */
+        if (audio->enableUpdateLimit)
+                audio->outputLimit = max(audio->outputLimit, peak);
+        for (int k = 0; k < room * audio->channelCount; k++)
+                output[k] /= audio->outputLimit;
+
+        if (room > 0) {
+                audio->inputData.frames += room;
+                audio->lastArrival = block->time[s + room - 1];
+        }
+
+        return atomic_load(&audio->finished);
+}
+
+/*******************************************************************************************************/
+void unicorn_audio_realtime(unicorn_audio_t *audio, const unicorn_realtime_t *rt)
+{
+        audio->realtime = *rt;
+        if (rt->policy != REALTIME_OTHER || rt->audioCpus)
+                atomic_store(&audio->realtimeState, REALTIME_REQUESTED);
+}
+
+/*******************************************************************************************************/
+void unicorn_audio_realtime_report(unicorn_audio_t *audio)
+{
+        if (atomic_load_explicit(&audio->realtimeState, memory_order_acquire) == REALTIME_APPLIED) {
+                printf("Audio thread: %s.\n", audio->realtimeReport);
+                atomic_store(&audio->realtimeState, REALTIME_REPORTED);
+        }
+}
+
+/*******************************************************************************************************/
+void unicorn_audio_fill(unicorn_audio_t *audio, unsigned long *fillMin, unsigned long *fillMax)
+{
+        /* the range of the output buffer level is reported and starts again for the next period */
+        *fillMin = atomic_exchange(&audio->fillMin, ULONG_MAX);
+        *fillMax = atomic_exchange(&audio->fillMax, 0);
+        if (*fillMin > *fillMax)
+                *fillMin = *fillMax = audio->outputData.frames;
+}
+
+/*******************************************************************************************************/
+void unicorn_audio_close(unicorn_audio_t *audio)
+{
+        audio->enableResampleBuffers = 0;
+        audio->enableUpdateRatio = 0;
+        audio->enableUpdateLimit = 0;
+        if (audio->stream) {
+                Pa_StopStream(audio->stream);
+                Pa_CloseStream(audio->stream);
+                audio->stream = NULL;
+        }
+        if (audio->resampleState)
+                src_delete (audio->resampleState);
+        audio->resampleState = NULL;
+        free(audio->inputData.data);
+        free(audio->outputData.data);
+        audio->inputData.data = NULL;
+        audio->outputData.data = NULL;
+}
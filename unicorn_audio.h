@@ -0,0 +1,123 @@
+/*
+ * Audio output that upsamples the EEG data to an audio sampling rate and writes it to a
+ * (virtual) audio device. The EEG is high-pass filtered and scaled between -1 and +1, and
+ * the resampling ratio is continuously adjusted to keep the output buffer half full.
+ *
+ * The output starts as soon as the initial transient of the signal has decayed, which is
+ * detected by comparing the mean and variance of successive short windows. The output
+ * buffer is padded with silence up to its target level and the signal is ramped in.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_AUDIO_H
+#define UNICORN_AUDIO_H
+
+#include <stdatomic.h>
+
+#include "portaudio.h"
+#include "samplerate.h"
+#include "unicorn.h"
+#include "unicorn_latency.h"
+#include "unicorn_block.h"
+#include "unicorn_realtime.h"
+
+#define AUDIO_SAMPLETYPE    paFloat32
+#define AUDIO_BLOCKSIZE     (0.01)  // in seconds
+#define AUDIO_BUFFERSIZE    (2.00)  // in seconds
+#define AUDIO_DEFAULTRATE   (44100.0)
+#define AUDIO_HPFILTER      (10.0)  // in seconds
+#define AUDIO_OUTPUTLIMIT   (1.0)
+#define AUDIO_MAXCHANS      (8)     // the automatic scaling messes up when using all 16 channels
+#define AUDIO_SETTLE        (5*FSAMPLE)     // the initial samples are discarded for at most this long
+#define AUDIO_SETTLEWINDOW  (FSAMPLE/4)     // in samples
+#define AUDIO_SETTLESTABLE  (2)             // successive windows that should be similar
+#define AUDIO_SETTLERATIO   (2.0)           // of the variance between successive windows
+#define AUDIO_SETTLESHIFT   (1.0)           // of the mean between successive windows, relative to the standard deviation
+#define AUDIO_SETTLEFLOOR   (1e-3)          // in uV^2, below this a channel is considered flat
+#define AUDIO_PREFILL       (0.1)           // in seconds
+#define AUDIO_RAMP          (0.5)           // in seconds
+
+/* The output only starts after the initial transient has been discarded and the input buffer has the prefill. */
+#define AUDIO_SETTLING      (0)
+#define AUDIO_FILLING       (1)
+#define AUDIO_PLAYING       (2)
+
+typedef struct {
+        float *data;
+        unsigned long frames;
+} unicorn_audio_buffer_t;
+
+typedef struct {
+        PaStream *stream;
+        SRC_STATE *resampleState;
+        SRC_DATA resampleData;
+        unicorn_audio_buffer_t inputData, outputData;
+        float inputRate, outputRate, resampleRatio;
+        short enableResampleBuffers, enableUpdateRatio, enableUpdateLimit;
+        int channelCount, outputBlocksize, inputBufsize, outputBufsize;
+        float outputLimit;
+        float hpFilter;
+        float eegfilt[AUDIO_MAXCHANS];
+        float lastValue[AUDIO_MAXCHANS];        /* missing values are replaced by the previous one */
+        int state;
+        unsigned long samples;                  /* in the current state */
+        /* the settling is detected from the mean and variance of successive windows */
+        float settleOffset[AUDIO_MAXCHANS];     /* the first sample, this keeps the sums small */
+        double settleSum[AUDIO_MAXCHANS], settleSumSq[AUDIO_MAXCHANS];
+        double settleMean[AUDIO_MAXCHANS], settleVar[AUDIO_MAXCHANS];
+        int settleStable;
+        unsigned long ramp;                     /* samples that have been ramped in */
+        /* the latency is measured from the arrival of the newest sample in the input buffer until it is played */
+        unicorn_latency_t *latency;             /* optional */
+        double lastArrival;
+        /* the output callback keeps track of problems with the audio stream */
+        atomic_ulong underflow, overflow, zeroFilled;
+        atomic_ulong fillMin, fillMax;
+        unsigned long overrun;                  /* samples that were dropped because the input buffer was full */
+        atomic_int finished;
+        /* the real-time options are applied by the output callback, in the thread of the audio interface */
+        unicorn_realtime_t realtime;
+        atomic_int realtimeState;
+        char realtimeReport[REALTIME_REPORTLEN];
+} unicorn_audio_t;
+
+/* Initialize PortAudio and print the list of audio devices. */
+int unicorn_audio_init(void);
+void unicorn_audio_terminate(void);
+
+/* Open the output stream, the high-pass filter is in seconds and an output limit of 0 means automatic scaling. */
+int unicorn_audio_open(unicorn_audio_t *audio, int outputDevice, double outputRate, int channelCount, double bufferSize, double blockSize, double hpFilter, double outputLimit, unicorn_latency_t *latency);
+
+/* Add one sample, the first channelCount channels are used. The output stream starts automatically. */
+int unicorn_audio_put(unicorn_audio_t *audio, const float *dat, double arrival);
+
+/* Add a block of samples, this is equivalent to adding the samples one at a time. */
+int unicorn_audio_put_block(unicorn_audio_t *audio, const unicorn_block_t *block);
+
+/* Request the real-time options for the thread of the audio interface, this should be called before the first sample. */
+void unicorn_audio_realtime(unicorn_audio_t *audio, const unicorn_realtime_t *rt);
+
+/* Print what was granted to the thread of the audio interface, this only prints once. */
+void unicorn_audio_realtime_report(unicorn_audio_t *audio);
+
+/* Get the range of the output buffer level since the previous call. */
+void unicorn_audio_fill(unicorn_audio_t *audio, unsigned long *fillMin, unsigned long *fillMax);
+
+void unicorn_audio_close(unicorn_audio_t *audio);
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * Band power of the EEG channels in the classical frequency bands, this is computed over
+ * a sliding window that is updated at a reduced rate.
+ *
+ * The frequency bins in the bands are updated with every sample using a sliding DFT, which
+ * costs a fixed number of operations per sample and channel. The Hann window is applied in
+ * the frequency domain when the power is computed. The samples of a block are processed up to
+ * the next update at once, which keeps each bin in the cache while it is rotated.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "unicorn_bandpower.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+const unicorn_band_t unicorn_band[BANDPOWER_NUMBANDS] = {
+        {"delta", 1, 4},
+        {"theta", 4, 8},
+        {"alpha", 8, 13},
+        {"beta", 13, 30},
+        {"gamma", 30, 45},
+};
+
+/*******************************************************************************************************/
+/* Helper function to return the first bin of a band, the last bin is not included. */
+static int first_bin(int b)
+{
+        return (int)ceil(unicorn_band[b].low * BANDPOWER_WINDOW / FSAMPLE);
+}
+
+static int last_bin(int b)
+{
+        return (int)ceil(unicorn_band[b].high * BANDPOWER_WINDOW / FSAMPLE);
+}
+
+/*******************************************************************************************************/
+/* Helper function to compute the bins from scratch, this prevents the rounding errors of the sliding DFT from accumulating. */
+static void recompute(unicorn_bandpower_t *bp)
+{
+        int oldest = bp->count % BANDPOWER_WINDOW;
+
+        for (int j = 0; j < bp->numBins; j++) {
+                int k = bp->firstBin + j;
+                for (int c = 0; c < bp->numChannels; c++) {
+                        bp->re[j][c] = 0;
+                        bp->im[j][c] = 0;
+                }
+                for (int m = 0; m < BANDPOWER_WINDOW; m++) {
+                        const float *x = bp->history[(oldest + m) % BANDPOWER_WINDOW];
+                        double cosine = bp->cosine[(k * m) % BANDPOWER_WINDOW];
+                        double sine = bp->sine[(k * m) % BANDPOWER_WINDOW];
+                        for (int c = 0; c < bp->numChannels; c++) {
+                                bp->re[j][c] += x[c] * cosine;
+                                bp->im[j][c] -= x[c] * sine;
+                        }
+                }
+        }
+}
+
+/*******************************************************************************************************/
+void unicorn_bandpower_init(unicorn_bandpower_t *bp, int numChannels, int rate)
+{
+        int lastBin = 0;
+
+        memset(bp, 0, sizeof(unicorn_bandpower_t));
+        bp->numChannels = min(numChannels, BANDPOWER_MAXCHANS);
+        bp->hop = max(1, FSAMPLE / max(1, rate));
+
+        /* the DC bin is not needed, it is taken as zero, which is the same as removing the mean over the window */
+        bp->firstBin = BANDPOWER_MAXBINS;
+        for (int b = 0; b < BANDPOWER_NUMBANDS; b++) {
+                bp->firstBin = min(bp->firstBin, max(1, first_bin(b) - 1));
+                lastBin = max(lastBin, last_bin(b));
+        }
+        bp->numBins = min(lastBin, BANDPOWER_MAXBINS - 1) - bp->firstBin + 1;
+
+        for (int i = 0; i < BANDPOWER_WINDOW; i++) {
+                bp->cosine[i] = cos(2 * M_PI * i / BANDPOWER_WINDOW);
+                bp->sine[i] = sin(2 * M_PI * i / BANDPOWER_WINDOW);
+                /* this is the sum of squares of the Hann window */
+                double w = 0.5 - 0.5 * bp->cosine[i];
+                bp->norm += w * w;
+        }
+}
+
+/*******************************************************************************************************/
+/* Helper function to add n samples, channel c of sample s is at dat[c*stride+s]. The samples should not cross the end of the window. */
+static void slide(unicorn_bandpower_t *bp, const float *dat, size_t stride, int n)
+{
+        double delta[BANDPOWER_WINDOW][BANDPOWER_MAXCHANS];
+
+        /* the oldest samples leave the window and the new samples enter it */
+        for (int s = 0; s < n; s++) {
+                float *oldest = bp->history[(bp->count + s) % BANDPOWER_WINDOW];
+                const float *newest = bp->history[(bp->count + s + BANDPOWER_WINDOW - 1) % BANDPOWER_WINDOW];
+                for (int c = 0; c < bp->numChannels; c++) {
+                        /* a missing sample repeats the previous one, a nan would otherwise remain in the bins until they are recomputed */
+                        float x = dat[c * stride + s];
+                        x = (isfinite(x) ? x : newest[c]);
+                        delta[s][c] = (double)x - oldest[c];
+                        oldest[c] = x;
+                }
+        }
+        bp->count += n;
+
+        if ((bp->count % BANDPOWER_WINDOW) == 0) {
+                recompute(bp);
+                return;
+        }
+
+        /* each bin is rotated by one sample at a time, this keeps the oldest sample in the window at phase zero */
+        for (int j = 0; j < bp->numBins; j++) {
+                int k = bp->firstBin + j;
+                double cosine = bp->cosine[k], sine = bp->sine[k];
+                double *re = bp->re[j], *im = bp->im[j];
+                for (int s = 0; s < n; s++) {
+                        for (int c = 0; c < bp->numChannels; c++) {
+                                double a = re[c] + delta[s][c];
+                                double b = im[c];
+                                re[c] = a * cosine - b * sine;
+                                im[c] = a * sine + b * cosine;
+                        }
+                }
+        }
+}
+
+/*******************************************************************************************************/
+/* Helper function to compute the power in each band from the bins. */
+static void band_power(const unicorn_bandpower_t *bp, float *power)
+{
+        for (int b = 0; b < BANDPOWER_NUMBANDS; b++) {
+                float *p = power + b * bp->numChannels;
+                for (int c = 0; c < bp->numChannels; c++)
+                        p[c] = 0;
+
+                for (int k = first_bin(b); k < last_bin(b); k++) {
+                        int j = k - bp->firstBin;
+                        /* the Hann window in the frequency domain combines each bin with its neighbours, the DC bin is taken as zero */
+                        const double *re0 = (k - 1 > 0 ? bp->re[j - 1] : NULL), *im0 = (k - 1 > 0 ? bp->im[j - 1] : NULL);
+                        for (int c = 0; c < bp->numChannels; c++) {
+                                double re = 0.5 * bp->re[j][c] - 0.25 * bp->re[j + 1][c];
+                                double im = 0.5 * bp->im[j][c] - 0.25 * bp->im[j + 1][c];
+                                if (re0) {
+                                        re -= 0.25 * re0[c];
+                                        im -= 0.25 * im0[c];
+                                }
+                                /* one-sided power spectral density integrated over the bins in the band */
+                                p[c] += 2 * (re * re + im * im) / (bp->norm * BANDPOWER_WINDOW);
+                        }
+                }
+        }
+}
+
+/*******************************************************************************************************/
+int unicorn_bandpower_put(unicorn_bandpower_t *bp, const float *dat, float *power)
+{
+        slide(bp, dat, 1, 1);
+
+        if (bp->count < BANDPOWER_WINDOW || (bp->count % bp->hop) != 0)
+                return 0;
+
+        band_power(bp, power);
+        return 1;
+}
+
+/*******************************************************************************************************/
+int unicorn_bandpower_put_block(unicorn_bandpower_t *bp, const unicorn_block_t *block, int first, int *position, float *power)
+{
+        while (*position < block->numSamples) {
+                /* the samples up to the next update or the end of the window are added together */
+                int n = block->numSamples - *position;
+                n = min(n, bp->hop - (int)(bp->count % bp->hop));
+                n = min(n, BANDPOWER_WINDOW - (int)(bp->count % BANDPOWER_WINDOW));
+                slide(bp, unicorn_block_channel(block, first) + *position, block->stride, n);
+                *position += n;
+
+                if (bp->count >= BANDPOWER_WINDOW && (bp->count % bp->hop) == 0) {
+                        band_power(bp, power);
+                        return 1;
+                }
+        }
+        return 0;
+}
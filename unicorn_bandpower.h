@@ -0,0 +1,69 @@
+/*
+ * Band power of the EEG channels in the classical frequency bands, this is computed over
+ * a sliding window that is updated at a reduced rate.
+ *
+ * The frequency bins in the bands are updated with every sample using a sliding DFT, which
+ * costs a fixed number of operations per sample and channel. The Hann window is applied in
+ * the frequency domain when the power is computed, with the DC bin taken as zero, so that the
+ * electrode offset does not leak into the lowest band.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_BANDPOWER_H
+#define UNICORN_BANDPOWER_H
+
+#include "unicorn.h"
+#include "unicorn_block.h"
+
+#define BANDPOWER_WINDOW    (FSAMPLE)   // in samples, this gives a resolution of 1 Hz
+#define BANDPOWER_RATE      (10)        // updates per second
+#define BANDPOWER_NUMBANDS  (5)
+#define BANDPOWER_MAXCHANS  (NCHANS)
+#define BANDPOWER_MAXBINS   (BANDPOWER_WINDOW/2)
+
+typedef struct {
+        const char *name;
+        double low, high;               /* in Hz, the high edge is not included */
+} unicorn_band_t;
+
+extern const unicorn_band_t unicorn_band[BANDPOWER_NUMBANDS];
+
+typedef struct {
+        int numChannels;
+        int hop;                        /* in samples between updates */
+        int firstBin, numBins;          /* the bins in the bands, plus their neighbours for the Hann window */
+        float history[BANDPOWER_WINDOW][BANDPOWER_MAXCHANS];
+        /* the channels are the inner dimension, so that the compiler can vectorize the loops over channels */
+        double re[BANDPOWER_MAXBINS][BANDPOWER_MAXCHANS];
+        double im[BANDPOWER_MAXBINS][BANDPOWER_MAXCHANS];
+        double cosine[BANDPOWER_WINDOW], sine[BANDPOWER_WINDOW];
+        double norm;
+        unsigned long count;
+} unicorn_bandpower_t;
+
+/* Initialize for the first numChannels channels, which should be the EEG channels. */
+void unicorn_bandpower_init(unicorn_bandpower_t *bp, int numChannels, int rate);
+
+/* Add one sample, this returns 1 and fills power[band*numChannels+channel] in uV^2 when an update is due. */
+int unicorn_bandpower_put(unicorn_bandpower_t *bp, const float *dat, float *power);
+
+/* Add the samples of a block from the position onwards, the EEG channels start at the first channel. This stops after
+ * the sample that completes an update and returns 1, call it again with the updated position for the rest of the block. */
+int unicorn_bandpower_put_block(unicorn_bandpower_t *bp, const unicorn_block_t *block, int first, int *position, float *power);
+
+#endif
@@ -0,0 +1,581 @@
+/*
+ * This application measures the time per packet or per sample of the different processing
+ * steps: decoding, framing, filtering, resampling, text formatting, LSL output and the
+ * latency measurement. The results are written as JSON in the same format as Google
+ * Benchmark, so that they can be compared between versions with the tools that come with it.
+ *
+ * Use as
+ *   unicorn_bench [-t mintime] [-f filter] [-o output.json]
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "libserialport.h"
+#include "lsl_c.h"
+#include "samplerate.h"
+#include "unicorn.h"
+#include "unicorn_sync.h"
+#include "unicorn_latency.h"
+#include "unicorn_bandpower.h"
+#include "unicorn_quality.h"
+#include "unicorn_decimate.h"
+#include "unicorn_montage.h"
+#include "unicorn_block.h"
+#include "unicorn_pool.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#define NULLFILE "/dev/null"
+#elif defined _WIN32
+// Windows code goes here
+#define NULLFILE "NUL"
+#endif
+
+/* This is the same low-pass filter as in unicorn2audio. */
+#define smooth(old, new, lambda) ((1.0-lambda)*(old) + (lambda)*(new))
+
+#define STRLEN        (80)
+#define NPACKETS      (4096)    // number of packets that are prepared for each run
+#define NAUDIO        (8)       // number of channels that are resampled
+#define CHUNKSIZE     (32)      // number of samples per LSL chunk
+#define MINTIME       (0.5)     // in seconds
+
+/* the assertions are disabled in a release build */
+#ifdef NDEBUG
+#define BUILDTYPE     "release"
+#else
+#define BUILDTYPE     "debug"
+#endif
+
+/* Each benchmark processes the specified number of packets or samples. */
+typedef void (*bench_t)(unsigned long n);
+
+unsigned char packet[NPACKETS][PACKETSIZE];
+float sample[NPACKETS][NCHANS];
+unsigned char *stream = NULL;
+size_t streamSize = 0;
+unsigned long sink = 0;
+FILE *nullFile = NULL;
+lsl_outlet outlet = NULL;
+SRC_STATE *resampleState = NULL;
+double resampleRatio = 0;
+float *resampleOutput = NULL;
+unicorn_t device[2];
+unicorn_sync_t timeline;
+unicorn_latency_t latency;
+unicorn_bandpower_t bandpower;
+unicorn_quality_t quality;
+unicorn_decimate_t decimate;
+unicorn_montage_t montage;
+unicorn_block_t block, decimated;
+unicorn_pool_t pool;
+
+/*******************************************************************************************************/
+/* The callbacks only count, so that the compiler cannot optimize the work away. */
+static void count_packet(unicorn_t *dev, const unsigned char *buf, void *userData)
+{
+        sink += buf[39];
+}
+
+static void count_sample(unicorn_t *dev, unsigned long counter, const float *dat, int filled, void *userData)
+{
+        sink += counter;
+}
+
+static void count_frame(const float *frame, const unsigned char *flag, double time, void *userData)
+{
+        sink += flag[0];
+}
+
+/*******************************************************************************************************/
+static void bench_decode(unsigned long n)
+{
+        float dat[NCHANS];
+        for (unsigned long i = 0; i < n; i++) {
+                unicorn_decode(packet[i % NPACKETS], dat);
+                sink += (dat[0] > 0);
+        }
+}
+
+/* This decodes into a channel-major block, as it is used by the processing stages. */
+static void bench_decode_block(unsigned long n)
+{
+        for (unsigned long i = 0; i < n; i++) {
+                if (unicorn_block_decode(&block, packet[i % NPACKETS], 0)) {
+                        sink += (block.dat[0] > 0);
+                        unicorn_block_clear(&block);
+                }
+        }
+}
+
+static void bench_framer(unsigned long n)
+{
+        /* the stream is fed in pieces of the size that is read from the serial port */
+        for (unsigned long i = 0; i < n; i += NPACKETS) {
+                for (size_t offset = 0; offset < streamSize; offset += READSIZE)
+                        unicorn_feed(&device[0], stream + offset, min(READSIZE, streamSize - offset), count_packet, NULL);
+        }
+}
+
+static void bench_fill(unsigned long n)
+{
+        for (unsigned long i = 0; i < n; i++)
+                unicorn_fill(&device[0], device[0].lastCounter + 1 + (i % 100 == 0), sample[i % NPACKETS], FILL_LINEAR, count_sample, NULL);
+}
+
+static void bench_sync(unsigned long n)
+{
+        static unsigned long counter = 0;
+        static double arrival = 0;
+        for (unsigned long i = 0; i < n; i++) {
+                counter++;
+                arrival += 1.0 / FSAMPLE;
+                unicorn_sync_push(&timeline, 0, counter, arrival, sample[i % NPACKETS]);
+                unicorn_sync_push(&timeline, 1, counter, arrival, sample[i % NPACKETS]);
+        }
+}
+
+static void bench_smooth(unsigned long n)
+{
+        static float filt[NAUDIO] = {0};
+        float hpFilter = 1.0 - pow(0.5, 1.0/(FSAMPLE*10.0));
+        for (unsigned long i = 0; i < n; i++) {
+                float *dat = sample[i % NPACKETS];
+                for (int ch = 0; ch < NAUDIO; ch++) {
+                        filt[ch] = smooth(filt[ch], dat[ch], hpFilter);
+                        sink += (dat[ch] - filt[ch] > 0);
+                }
+        }
+}
+
+static void bench_resample(unsigned long n)
+{
+        static float input[FSAMPLE * NAUDIO];
+        SRC_DATA data;
+
+        /* resample one second of data at a time */
+        for (unsigned long i = 0; i < n; i += FSAMPLE) {
+                for (int s = 0; s < FSAMPLE; s++)
+                        memcpy(input + s * NAUDIO, sample[(i + s) % NPACKETS], NAUDIO * sizeof(float));
+                data.data_in = input;
+                data.input_frames = FSAMPLE;
+                data.data_out = resampleOutput;
+                data.output_frames = (long)(2 * resampleRatio * FSAMPLE);
+                data.end_of_input = 0;
+                data.src_ratio = resampleRatio;
+                src_process(resampleState, &data);
+                sink += data.output_frames_gen;
+        }
+}
+
+static void bench_resample_44100(unsigned long n)
+{
+        resampleRatio = 44100.0 / FSAMPLE;
+        bench_resample(n);
+}
+
+static void bench_resample_48000(unsigned long n)
+{
+        resampleRatio = 48000.0 / FSAMPLE;
+        bench_resample(n);
+}
+
+/*******************************************************************************************************/
+/* This is how unicorn2txt writes each sample. */
+static void bench_text_fprintf(unsigned long n)
+{
+        for (unsigned long i = 0; i < n; i++) {
+                float *dat = sample[i % NPACKETS];
+                fprintf(nullFile, "%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t", dat[0], dat[1], dat[2], dat[3], dat[4], dat[5], dat[6], dat[7]);
+                fprintf(nullFile, "%f\t%f\t%f\t", dat[8], dat[9], dat[10]);
+                fprintf(nullFile, "%f\t%f\t%f\t", dat[11], dat[12], dat[13]);
+                fprintf(nullFile, "%.2f\t%lu\n", dat[14], (unsigned long)dat[15]);
+        }
+}
+
+/* The alternative formats the complete line in memory and writes it at once. */
+static void bench_text_snprintf(unsigned long n)
+{
+        char line[1024];
+        for (unsigned long i = 0; i < n; i++) {
+                float *dat = sample[i % NPACKETS];
+                int len = snprintf(line, sizeof(line), "%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%.2f\t%lu\n",
+                                   dat[0], dat[1], dat[2], dat[3], dat[4], dat[5], dat[6], dat[7],
+                                   dat[8], dat[9], dat[10], dat[11], dat[12], dat[13], dat[14], (unsigned long)dat[15]);
+                fwrite(line, 1, len, nullFile);
+        }
+}
+
+/* Helper function that formats a value with a fixed number of decimals, like %f does. */
+static char *format_fixed(char *dest, double val, int decimals)
+{
+        static const double scale[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+        char digits[32];
+        int n = 0;
+
+        if (!isfinite(val)) {
+                strcpy(dest, "nan");
+                return dest + 3;
+        }
+        if (val < 0) {
+                *dest++ = '-';
+                val = -val;
+        }
+
+        unsigned long long fixed = (unsigned long long)(val * scale[decimals] + 0.5);
+        for (int d = 0; d < decimals; d++) {
+                digits[n++] = '0' + fixed % 10;
+                fixed /= 10;
+        }
+        if (decimals > 0)
+                digits[n++] = '.';
+        do {
+                digits[n++] = '0' + fixed % 10;
+                fixed /= 10;
+        } while (fixed > 0);
+
+        while (n > 0)
+                *dest++ = digits[--n];
+        return dest;
+}
+
+/* The alternative with a dedicated number formatter. */
+static void bench_text_custom(unsigned long n)
+{
+        char line[1024];
+        for (unsigned long i = 0; i < n; i++) {
+                float *dat = sample[i % NPACKETS];
+                char *p = line;
+                for (int ch = 0; ch < 14; ch++) {
+                        p = format_fixed(p, dat[ch], 6);
+                        *p++ = '\t';
+                }
+                p = format_fixed(p, dat[14], 2);
+                *p++ = '\t';
+                p = format_fixed(p, dat[15], 0);
+                *p++ = '\n';
+                fwrite(line, 1, p - line, nullFile);
+        }
+}
+
+/*******************************************************************************************************/
+/* This is how unicorn2lsl writes each sample. */
+static void bench_lsl_sample(unsigned long n)
+{
+        for (unsigned long i = 0; i < n; i++)
+                lsl_push_sample_f(outlet, sample[i % NPACKETS]);
+}
+
+/* The alternative writes multiple samples at once. */
+static void bench_lsl_chunk(unsigned long n)
+{
+        for (unsigned long i = 0; i < n; i += CHUNKSIZE)
+                lsl_push_chunk_f(outlet, sample[i % NPACKETS], CHUNKSIZE * NCHANS);
+}
+
+/*******************************************************************************************************/
+/* This is the cost of the sliding band power of the 8 EEG channels for each sample. */
+static void bench_bandpower(unsigned long n)
+{
+        float power[BANDPOWER_NUMBANDS*8];
+        for (unsigned long i = 0; i < n; i++)
+                if (unicorn_bandpower_put(&bandpower, sample[i % NPACKETS], power))
+                        sink += (power[0] > 0);
+}
+
+/* The same for each sample, applied to blocks of samples as in unicorn2xx. */
+static void bench_bandpower_block(unsigned long n)
+{
+        float power[BANDPOWER_NUMBANDS*8];
+        unicorn_block_clear(&block);
+        for (int s = 0; s < block.capacity; s++)
+                unicorn_block_append(&block, s, 0, sample[s]);
+        for (unsigned long i = 0; i < n; i += block.capacity) {
+                int position = 0;
+                while (unicorn_bandpower_put_block(&bandpower, &block, 0, &position, power))
+                        sink += (power[0] > 0);
+        }
+}
+
+/* This is the cost of the signal quality of the 8 EEG channels for each sample. */
+static void bench_quality(unsigned long n)
+{
+        float result[QUALITY_NUMMEASURES*QUALITY_NEEG];
+        for (unsigned long i = 0; i < n; i++)
+                if (unicorn_quality_put(&quality, sample[i % NPACKETS], result))
+                        sink += (result[0] > 0);
+}
+
+static void bench_quality_block(unsigned long n)
+{
+        float result[QUALITY_NUMMEASURES*QUALITY_NEEG];
+        unicorn_block_clear(&block);
+        for (int s = 0; s < block.capacity; s++)
+                unicorn_block_append(&block, s, 0, sample[s]);
+        for (unsigned long i = 0; i < n; i += block.capacity) {
+                int position = 0;
+                while (unicorn_quality_put_block(&quality, &block, 0, &position, result))
+                        sink += (result[0] > 0);
+        }
+}
+
+/* This is the cost of downsampling by a factor 2 for each sample. */
+static void bench_decimate(unsigned long n)
+{
+        float output[NCHANS];
+        for (unsigned long i = 0; i < n; i++)
+                if (unicorn_decimate_put(&decimate, sample[i % NPACKETS], output))
+                        sink += (output[0] > 0);
+}
+
+static void bench_decimate_block(unsigned long n)
+{
+        unicorn_block_clear(&block);
+        for (int s = 0; s < block.capacity; s++)
+                unicorn_block_append(&block, s, 0, sample[s]);
+        for (unsigned long i = 0; i < n; i += block.capacity)
+                if (unicorn_decimate_put_block(&decimate, &block, &decimated))
+                        sink += (decimated.dat[0] > 0);
+}
+
+/* This is the cost of the common average reference for each sample, applied to blocks of samples. */
+static void bench_montage(unsigned long n)
+{
+        static float block[NPACKETS][NCHANS];
+        for (unsigned long i = 0; i < n; i += NPACKETS) {
+                memcpy(block, sample, sizeof(block));
+                unicorn_montage_apply(&montage, block[0], NPACKETS, NCHANS);
+                sink += (block[0][0] > 0);
+        }
+}
+
+static void bench_montage_block(unsigned long n)
+{
+        unicorn_block_clear(&block);
+        for (int s = 0; s < block.capacity; s++)
+                unicorn_block_append(&block, s, 0, sample[s]);
+        for (unsigned long i = 0; i < n; i += block.capacity) {
+                unicorn_montage_apply_block(&montage, &block, NCHANS);
+                sink += (block.dat[0] > 0);
+        }
+}
+
+/* This is how the fan-out passes the samples in blocks from the pool, without any allocations. */
+static void bench_pool(unsigned long n)
+{
+        unicorn_block_t *current = NULL;
+        for (unsigned long i = 0; i < n; i++) {
+                if (current == NULL)
+                        current = unicorn_pool_acquire(&pool);
+                if (unicorn_block_append(current, i, 0, sample[i % NPACKETS])) {
+                        sink += current->counter[0];
+                        unicorn_pool_release(current);
+                        current = NULL;
+                }
+        }
+        if (current)
+                unicorn_pool_release(current);
+}
+
+/*******************************************************************************************************/
+/* This is the overhead of the latency measurement for each sample. */
+static void bench_latency(unsigned long n)
+{
+        double arrival = unicorn_clock();
+        for (unsigned long i = 0; i < n; i++)
+                unicorn_latency_record(&latency, unicorn_clock() - arrival);
+}
+
+/*******************************************************************************************************/
+/* Helper function to run one benchmark for at least the minimum time and write the result as JSON. */
+static void run(FILE *fp, const char *name, bench_t fn, unsigned long batch, double minTime, int *first)
+{
+        unsigned long items = 0;
+
+        /* warm up the caches and the branch predictors */
+        fn(batch);
+
+        double t0 = unicorn_clock();
+        clock_t c0 = clock();
+        do {
+                fn(batch);
+                items += batch;
+        } while (unicorn_clock() - t0 < minTime);
+        double realTime = unicorn_clock() - t0;
+        double cpuTime = (double)(clock() - c0) / CLOCKS_PER_SEC;
+
+        fprintf(fp, "%s    {\n", *first ? "" : ",\n");
+        fprintf(fp, "      \"name\": \"%s\",\n", name);
+        fprintf(fp, "      \"run_name\": \"%s\",\n", name);
+        fprintf(fp, "      \"run_type\": \"iteration\",\n");
+        fprintf(fp, "      \"iterations\": %lu,\n", items);
+        fprintf(fp, "      \"real_time\": %.3f,\n", 1e9 * realTime / items);
+        fprintf(fp, "      \"cpu_time\": %.3f,\n", 1e9 * cpuTime / items);
+        fprintf(fp, "      \"time_unit\": \"ns\",\n");
+        fprintf(fp, "      \"items_per_second\": %.1f\n", items / realTime);
+        fprintf(fp, "    }");
+        fflush(fp);
+        *first = 0;
+
+        fprintf(stderr, "%-20s %10.1f ns/item %14.0f items/s\n", name, 1e9 * realTime / items, items / realTime);
+}
+
+/*******************************************************************************************************/
+int main(int argc, char **argv)
+{
+        FILE *fp = stdout;
+        const char *filter = NULL;
+        double minTime = MINTIME;
+        int first = 1, srcErr;
+        char date[STRLEN];
+
+        for (int i = 1; i < argc; i++) {
+                if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+                        minTime = atof(argv[++i]);
+                else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+                        filter = argv[++i];
+                else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+                        if ((fp = fopen(argv[++i], "w")) == NULL) {
+                                printf("Cannot open file: %s\n", strerror(errno));
+                                return 1;
+                        }
+                }
+                else {
+                        printf("Use as %s [-t mintime] [-f filter] [-o output.json]\n", argv[0]);
+                        return 1;
+                }
+        }
+
+        /* prepare packets and samples with a realistic signal */
+        srand(1);
+        for (int i = 0; i < NPACKETS; i++) {
+                float dat[NCHANS];
+                for (int ch = 0; ch < 8; ch++)
+                        dat[ch] = 20.0 * sin(2 * M_PI * 10.0 * i / FSAMPLE + ch) + (rand() % 100) / 50.0;
+                for (int ch = 8; ch < 14; ch++)
+                        dat[ch] = (rand() % 100) / 100.0;
+                dat[14] = 100;
+                dat[15] = i + 1;
+                unicorn_encode(packet[i], i + 1, dat);
+                unicorn_decode(packet[i], sample[i]);
+        }
+
+        /* the stream for the framer contains all packets back-to-back */
+        streamSize = NPACKETS * PACKETSIZE;
+        stream = malloc(streamSize);
+        memcpy(stream, packet, streamSize);
+
+        nullFile = fopen(NULLFILE, "w");
+        if (nullFile == NULL) {
+                printf("Cannot open %s: %s\n", NULLFILE, strerror(errno));
+                return 1;
+        }
+
+        resampleState = src_new(SRC_SINC_MEDIUM_QUALITY, NAUDIO, &srcErr);
+        resampleOutput = malloc(2 * (48000 / FSAMPLE + 1) * FSAMPLE * NAUDIO * sizeof(float));
+        if (resampleState == NULL || resampleOutput == NULL) {
+                printf("Cannot set up resample state.\n");
+                return 1;
+        }
+
+        lsl_streaminfo info = lsl_create_streaminfo("UnicornBench", "EEG", NCHANS, FSAMPLE, cft_float32, "unicornbench");
+        outlet = lsl_create_outlet(info, 0, 360);
+
+        memset(device, 0, sizeof(device));
+        unicorn_framer_init(&device[0].framer);
+        unicorn_sync_init(&timeline, 2, count_frame, NULL);
+        unicorn_latency_init(&latency);
+        unicorn_bandpower_init(&bandpower, 8, BANDPOWER_RATE);
+        unicorn_quality_init(&quality, QUALITY_RATE, QUALITY_LINEFREQ);
+        unicorn_decimate_init(&decimate, NCHANS, NCHANS, 2);
+        unicorn_montage_init(&montage, "car");
+        unicorn_block_alloc(&block, NCHANS, BLOCK_MAXSAMPLES);
+        unicorn_block_alloc(&decimated, NCHANS, BLOCK_MAXSAMPLES);
+        unicorn_pool_init(&pool, 64, NCHANS, BLOCK_MINSAMPLES);
+
+        time_t now = time(NULL);
+        strftime(date, STRLEN, "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+        fprintf(fp, "{\n");
+        fprintf(fp, "  \"context\": {\n");
+        fprintf(fp, "    \"date\": \"%s\",\n", date);
+        fprintf(fp, "    \"executable\": \"%s\",\n", argv[0]);
+        fprintf(fp, "    \"library_build_type\": \"%s\",\n", BUILDTYPE);
+        fprintf(fp, "    \"min_time\": %.3f\n", minTime);
+        fprintf(fp, "  },\n");
+        fprintf(fp, "  \"benchmarks\": [\n");
+
+        struct {
+                const char *name;
+                bench_t fn;
+                unsigned long batch;
+        } benchmark[] = {
+                {"decode",           bench_decode,          NPACKETS},
+                {"decode_block",     bench_decode_block,    NPACKETS},
+                {"framer",           bench_framer,          NPACKETS},
+                {"fill",             bench_fill,            NPACKETS},
+                {"sync",             bench_sync,            NPACKETS},
+                {"smooth",           bench_smooth,          NPACKETS},
+                {"resample_44100",   bench_resample_44100,  FSAMPLE},
+                {"resample_48000",   bench_resample_48000,  FSAMPLE},
+                {"text_fprintf",     bench_text_fprintf,    NPACKETS},
+                {"text_snprintf",    bench_text_snprintf,   NPACKETS},
+                {"text_custom",      bench_text_custom,     NPACKETS},
+                {"lsl_push_sample",  bench_lsl_sample,      NPACKETS},
+                {"lsl_push_chunk",   bench_lsl_chunk,       NPACKETS},
+                {"bandpower",        bench_bandpower,       NPACKETS},
+                {"bandpower_block",  bench_bandpower_block, BLOCK_MAXSAMPLES},
+                {"quality",          bench_quality,         NPACKETS},
+                {"quality_block",    bench_quality_block,   BLOCK_MAXSAMPLES},
+                {"decimate",         bench_decimate,        NPACKETS},
+                {"decimate_block",   bench_decimate_block,  BLOCK_MAXSAMPLES},
+                {"montage",          bench_montage,         NPACKETS},
+                {"montage_block",    bench_montage_block,   BLOCK_MAXSAMPLES},
+                {"pool",             bench_pool,            NPACKETS},
+                {"latency",          bench_latency,         NPACKETS},
+        };
+
+        for (unsigned int i = 0; i < sizeof(benchmark) / sizeof(benchmark[0]); i++) {
+                if (filter && strstr(benchmark[i].name, filter) == NULL)
+                        continue;
+                run(fp, benchmark[i].name, benchmark[i].fn, benchmark[i].batch, minTime, &first);
+        }
+
+        fprintf(fp, "\n  ]\n");
+        fprintf(fp, "}\n");
+
+        lsl_destroy_outlet(outlet);
+        src_delete(resampleState);
+        free(resampleOutput);
+        free(stream);
+        fclose(nullFile);
+        if (fp != stdout)
+                fclose(fp);
+
+        /* this prevents the compiler from removing the work */
+        return (sink == 42);
+}
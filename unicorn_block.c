@@ -0,0 +1,159 @@
+/*
+ * Blocks of samples that are stored channel after channel, i.e. as a structure of arrays.
+ * The samples of each channel are contiguous and aligned in memory, which allows the
+ * processing stages to work on a block at a time with loops that the compiler can
+ * vectorize, and which amortizes the overhead of the function calls over the block.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "unicorn_block.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+atomic_ulong unicorn_block_allocations = 0;
+
+/*******************************************************************************************************/
+/* Helper function to determine the size of a block, the stride is rounded up so that every channel starts at an aligned address. */
+static void layout(unicorn_block_t *block, int numChannels, int capacity)
+{
+        int perLine = BLOCK_ALIGN / sizeof(float);
+
+        block->numChannels = min(max(1, numChannels), BLOCK_MAXCHANS);
+        block->capacity = min(max(BLOCK_MINSAMPLES, capacity), BLOCK_MAXSAMPLES);
+        block->stride = (block->capacity + perLine - 1) / perLine * perLine;
+        block->numSamples = 0;
+}
+
+/*******************************************************************************************************/
+size_t unicorn_block_size(int numChannels, int capacity)
+{
+        unicorn_block_t block;
+        layout(&block, numChannels, capacity);
+
+        /* the samples are followed by the times and the counters, the total is rounded up to the alignment */
+        size_t size = block.numChannels * block.stride * sizeof(float) + block.capacity * (sizeof(double) + sizeof(unsigned long));
+        return (size + BLOCK_ALIGN - 1) / BLOCK_ALIGN * BLOCK_ALIGN;
+}
+
+/*******************************************************************************************************/
+void unicorn_block_place(unicorn_block_t *block, int numChannels, int capacity, void *memory)
+{
+        layout(block, numChannels, capacity);
+        block->memory = NULL;
+        block->dat = (float *)memory;
+        block->time = (double *)(block->dat + block->numChannels * block->stride);
+        block->counter = (unsigned long *)(block->time + block->capacity);
+        atomic_init(&block->references, 0);
+}
+
+/*******************************************************************************************************/
+int unicorn_block_alloc(unicorn_block_t *block, int numChannels, int capacity)
+{
+        memset(block, 0, sizeof(unicorn_block_t));
+
+        /* a single allocation holds the samples, the counters and the times, the extra bytes are for the alignment */
+        void *memory = malloc(unicorn_block_size(numChannels, capacity) + BLOCK_ALIGN);
+        if (memory == NULL) {
+                printf("Cannot allocate memory for block.\n");
+                return 1;
+        }
+        atomic_fetch_add(&unicorn_block_allocations, 1);
+
+        uintptr_t aligned = ((uintptr_t)memory + BLOCK_ALIGN - 1) & ~(uintptr_t)(BLOCK_ALIGN - 1);
+        unicorn_block_place(block, numChannels, capacity, (void *)aligned);
+        block->memory = memory;
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+void unicorn_block_free(unicorn_block_t *block)
+{
+        free(block->memory);
+        memset(block, 0, sizeof(unicorn_block_t));
+}
+
+/*******************************************************************************************************/
+void unicorn_block_clear(unicorn_block_t *block)
+{
+        block->numSamples = 0;
+}
+
+/*******************************************************************************************************/
+int unicorn_block_append(unicorn_block_t *block, unsigned long counter, double time, const float *dat)
+{
+        int s = block->numSamples;
+
+        if (s == block->capacity)
+                return 1;
+
+        for (int c = 0; c < block->numChannels; c++)
+                block->dat[c * block->stride + s] = dat[c];
+        block->counter[s] = counter;
+        block->time[s] = time;
+        block->numSamples++;
+
+        return (block->numSamples == block->capacity);
+}
+
+/*******************************************************************************************************/
+int unicorn_block_decode(unicorn_block_t *block, const unsigned char *packet, double time)
+{
+        int s = block->numSamples;
+
+        if (s == block->capacity)
+                return 1;
+
+        /* the decoder writes each channel with the stride of the block */
+        unicorn_decode_strided(packet, block->dat + s, block->stride);
+        block->counter[s] = unicorn_counter(packet);
+        block->time[s] = time;
+        block->numSamples++;
+
+        return (block->numSamples == block->capacity);
+}
+
+/*******************************************************************************************************/
+void unicorn_block_copy(unicorn_block_t *block, const unicorn_block_t *source)
+{
+        int n = min(source->numSamples, block->capacity);
+
+        for (int c = 0; c < min(source->numChannels, block->numChannels); c++)
+                memcpy(block->dat + c * block->stride, source->dat + c * source->stride, n * sizeof(float));
+        memcpy(block->counter, source->counter, n * sizeof(unsigned long));
+        memcpy(block->time, source->time, n * sizeof(double));
+        block->numSamples = n;
+}
+
+/*******************************************************************************************************/
+void unicorn_block_sample(const unicorn_block_t *block, int s, float *dat)
+{
+        for (int c = 0; c < block->numChannels; c++)
+                dat[c] = block->dat[c * block->stride + s];
+}
@@ -0,0 +1,78 @@
+/*
+ * Blocks of samples that are stored channel after channel, i.e. as a structure of arrays.
+ * The samples of each channel are contiguous and aligned in memory, which allows the
+ * processing stages to work on a block at a time with loops that the compiler can
+ * vectorize, and which amortizes the overhead of the function calls over the block.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_BLOCK_H
+#define UNICORN_BLOCK_H
+
+#include <stdatomic.h>
+
+#include "unicorn.h"
+
+#define BLOCK_MINSAMPLES    (16)
+#define BLOCK_MAXSAMPLES    (256)
+#define BLOCK_DEFAULTSIZE   (32)
+#define BLOCK_ALIGN         (64)    // in bytes, this is the size of a cache line
+#define BLOCK_MAXCHANS      (MAXDEVICES*(NCHANS+1))
+
+typedef struct {
+        int numChannels;
+        int capacity;                   /* in samples */
+        int numSamples;
+        int stride;                     /* in floats, from one channel to the next */
+        float *dat;                     /* channel-major, each channel starts at an aligned address */
+        unsigned long *counter;
+        double *time;
+        void *memory;                   /* NULL when the block is part of a pool */
+        atomic_int references;          /* only used for blocks in a pool */
+} unicorn_block_t;
+
+/* This counts every allocation of memory for blocks, it should not change while the data is streaming. */
+extern atomic_ulong unicorn_block_allocations;
+
+/* This returns a pointer to the samples of one channel. */
+#define unicorn_block_channel(block, c) ((block)->dat + (size_t)(c) * (block)->stride)
+
+/* Allocate and free the memory of a block, the capacity is between 16 and 256 samples. */
+int unicorn_block_alloc(unicorn_block_t *block, int numChannels, int capacity);
+
+/* Set up a block in memory that is provided by the caller, which must be aligned and at least unicorn_block_size bytes. */
+size_t unicorn_block_size(int numChannels, int capacity);
+void unicorn_block_place(unicorn_block_t *block, int numChannels, int capacity, void *memory);
+void unicorn_block_free(unicorn_block_t *block);
+
+/* Remove all samples from the block, the memory is kept. */
+void unicorn_block_clear(unicorn_block_t *block);
+
+/* Add one sample with all channels, this returns 1 when the block is full. */
+int unicorn_block_append(unicorn_block_t *block, unsigned long counter, double time, const float *dat);
+
+/* Decode one packet directly into the next sample of a block with 16 channels, this returns 1 when the block is full. */
+int unicorn_block_decode(unicorn_block_t *block, const unsigned char *packet, double time);
+
+/* Copy the samples of one block into another one, as far as they fit. */
+void unicorn_block_copy(unicorn_block_t *block, const unicorn_block_t *source);
+
+/* Copy one sample with all channels out of the block. */
+void unicorn_block_sample(const unicorn_block_t *block, int s, float *dat);
+
+#endif
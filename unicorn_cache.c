@@ -0,0 +1,181 @@
+/*
+ * Persistent cache that maps the serial numbers of Unicorn devices, like UN-2021.05.36, to
+ * the serial port on which they were found. This allows selecting the devices by their
+ * serial number without listing all ports, which can be slow for Bluetooth devices.
+ *
+ * The cache is a text file with one serial number and port per line. It is stored in the
+ * home directory, unless the UNICORN_CACHE environment variable specifies another file.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "unicorn_cache.h"
+
+/*******************************************************************************************************/
+/* Helper function to determine the name of the cache file, this returns 1 when there is no place for it. */
+static int cache_file(char *fileName, size_t len)
+{
+        const char *home;
+
+        if ((home = getenv("UNICORN_CACHE")) != NULL && strlen(home) > 0) {
+                snprintf(fileName, len, "%s", home);
+                return 0;
+        }
+        if ((home = getenv("HOME")) == NULL)
+                home = getenv("USERPROFILE");
+        if (home == NULL)
+                return 1;
+#if defined _WIN32
+        snprintf(fileName, len, "%s\\%s", home, CACHE_FILENAME);
+#else
+        snprintf(fileName, len, "%s/%s", home, CACHE_FILENAME);
+#endif
+        return 0;
+}
+
+/*******************************************************************************************************/
+void unicorn_cache_load(unicorn_cache_t *cache)
+{
+        char fileName[CACHE_PATHLEN], line[SERIALLEN + CACHE_PATHLEN + 2];
+        FILE *fp;
+
+        cache->numEntries = 0;
+        if (cache_file(fileName, sizeof(fileName)) != 0 || (fp = fopen(fileName, "r")) == NULL)
+                return;
+
+        while (cache->numEntries < CACHE_MAXENTRIES && fgets(line, sizeof(line), fp)) {
+                unicorn_cache_entry_t *entry = &cache->entry[cache->numEntries];
+                char *port = strpbrk(line, " \t");
+                /* the port follows the serial number, it can contain spaces but not at the end */
+                if (line[0] == '#' || port == NULL)
+                        continue;
+                *port++ = 0;
+                port += strspn(port, " \t");
+                port[strcspn(port, "\r\n")] = 0;
+                if (strlen(line) == 0 || strlen(line) >= SERIALLEN || strlen(port) == 0)
+                        continue;
+                strcpy(entry->serial, line);
+                strcpy(entry->port, port);
+                cache->numEntries++;
+        }
+
+        fclose(fp);
+}
+
+/*******************************************************************************************************/
+int unicorn_cache_save(const unicorn_cache_t *cache)
+{
+        char fileName[CACHE_PATHLEN], tempName[CACHE_PATHLEN + 4];
+        FILE *fp;
+
+        if (cache_file(fileName, sizeof(fileName)) != 0)
+                return 1;
+
+        /* the new cache replaces the old one at once, so that another application never reads half of it */
+        snprintf(tempName, sizeof(tempName), "%s.tmp", fileName);
+        if ((fp = fopen(tempName, "w")) == NULL)
+                return 1;
+        for (int i = 0; i < cache->numEntries; i++)
+                fprintf(fp, "%s %s\n", cache->entry[i].serial, cache->entry[i].port);
+        if (fclose(fp) != 0) {
+                remove(tempName);
+                return 1;
+        }
+
+#if defined _WIN32
+        remove(fileName);
+#endif
+        if (rename(tempName, fileName) != 0) {
+                remove(tempName);
+                return 1;
+        }
+        return 0;
+}
+
+/*******************************************************************************************************/
+const char *unicorn_cache_lookup(const unicorn_cache_t *cache, const char *serial)
+{
+        for (int i = 0; i < cache->numEntries; i++)
+                if (strcmp(cache->entry[i].serial, serial) == 0)
+                        return cache->entry[i].port;
+        return NULL;
+}
+
+/*******************************************************************************************************/
+int unicorn_cache_update(unicorn_cache_t *cache, const char *serial, const char *port)
+{
+        int i;
+
+        for (i = 0; i < cache->numEntries; i++)
+                if (strcmp(cache->entry[i].serial, serial) == 0)
+                        break;
+
+        if (port == NULL) {
+                if (i == cache->numEntries)
+                        return 0;
+                memmove(&cache->entry[i], &cache->entry[i + 1], (cache->numEntries - i - 1) * sizeof(unicorn_cache_entry_t));
+                cache->numEntries--;
+                return 1;
+        }
+
+        if (strlen(serial) >= SERIALLEN || strlen(port) >= CACHE_PATHLEN)
+                return 0;
+        if (i < cache->numEntries && strcmp(cache->entry[i].port, port) == 0)
+                return 0;
+
+        /* a new serial number replaces the oldest one when the cache is full */
+        if (i == CACHE_MAXENTRIES) {
+                memmove(&cache->entry[0], &cache->entry[1], (CACHE_MAXENTRIES - 1) * sizeof(unicorn_cache_entry_t));
+                i = CACHE_MAXENTRIES - 1;
+        }
+        else if (i == cache->numEntries) {
+                cache->numEntries++;
+        }
+
+        strcpy(cache->entry[i].serial, serial);
+        strcpy(cache->entry[i].port, port);
+        return 1;
+}
+
+/*******************************************************************************************************/
+int unicorn_serial(const char *text, char *serial)
+{
+        const char *s = text;
+
+        /* the serial number starts with UN- and continues with digits and dots, e.g. UN-2021.05.36 or UN-20211209 */
+        while (text && (s = strstr(s, "UN-")) != NULL) {
+                size_t len = 3;
+                while (isdigit((unsigned char)s[len]) || s[len] == '.')
+                        len++;
+                /* a trailing dot is not part of it */
+                while (len > 3 && s[len - 1] == '.')
+                        len--;
+                if (len >= 3 + 8 && len < SERIALLEN) {
+                        memcpy(serial, s, len);
+                        serial[len] = 0;
+                        return 1;
+                }
+                s += 3;
+        }
+
+        return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * Persistent cache that maps the serial numbers of Unicorn devices, like UN-2021.05.36, to
+ * the serial port on which they were found. This allows selecting the devices by their
+ * serial number without listing all ports, which can be slow for Bluetooth devices.
+ *
+ * The cache is a text file with one serial number and port per line. It is stored in the
+ * home directory, unless the UNICORN_CACHE environment variable specifies another file.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_CACHE_H
+#define UNICORN_CACHE_H
+
+#include "unicorn.h"
+
+#define CACHE_MAXENTRIES    (64)
+#define CACHE_PATHLEN       (256)
+#define CACHE_FILENAME      ".unicorn-ports"
+
+typedef struct {
+        char serial[SERIALLEN];
+        char port[CACHE_PATHLEN];
+} unicorn_cache_entry_t;
+
+typedef struct {
+        int numEntries;
+        unicorn_cache_entry_t entry[CACHE_MAXENTRIES];
+} unicorn_cache_t;
+
+/* Read the cache from disk, a cache that does not exist yet is empty. */
+void unicorn_cache_load(unicorn_cache_t *cache);
+
+/* Write the cache to disk, this returns 0 on success. */
+int unicorn_cache_save(const unicorn_cache_t *cache);
+
+/* Return the port of a serial number, or NULL when it is not in the cache. */
+const char *unicorn_cache_lookup(const unicorn_cache_t *cache, const char *serial);
+
+/* Add or update the port of a serial number, a port of NULL removes it. This returns 1 when the cache changed. */
+int unicorn_cache_update(unicorn_cache_t *cache, const char *serial, const char *port);
+
+/* Helper function to find a serial number like UN-2021.05.36 in a port name or description, this returns 1 when found. */
+int unicorn_serial(const char *text, char *serial);
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * Decimation of the EEG channels to a lower sampling rate, for example 125 Hz or 62.5 Hz.
+ * The EEG channels are low-pass filtered with a windowed-sinc FIR filter to prevent
+ * aliasing, the other channels such as the counter and the gap flag are simply subsampled.
+ *
+ * Only the output samples that are kept are computed, which makes the cost the same as that
+ * of a polyphase implementation. The loops over the filtered channels are contiguous in memory,
+ * so that the compiler can vectorize them.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "unicorn_decimate.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*******************************************************************************************************/
+int unicorn_decimate_init(unicorn_decimate_t *d, int numChannels, int channelsPerDevice, int factor)
+{
+        double sum = 0;
+
+        memset(d, 0, sizeof(unicorn_decimate_t));
+        d->factor = min(DECIMATE_MAXFACTOR, max(1, factor));
+        d->numChannels = min(numChannels, DECIMATE_MAXCHANS);
+        d->numTaps = DECIMATE_TAPSPERPHASE * d->factor + 1;
+        d->delay = (d->numTaps - 1) / 2.0 / FSAMPLE;
+
+        for (int c = 0; c < d->numChannels; c++)
+                if ((c % channelsPerDevice) < DECIMATE_NEEG)
+                        d->channel[d->numFiltered++] = c;
+
+        /* a windowed sinc with the cutoff below the Nyquist frequency of the output, the Blackman window gives a good stopband attenuation */
+        double cutoff = DECIMATE_CUTOFF * 0.5 / d->factor;
+        for (int k = 0; k < d->numTaps; k++) {
+                double t = k - (d->numTaps - 1) / 2.0;
+                double sinc = (t == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * t) / (M_PI * t));
+                double window = 0.42 - 0.5 * cos(2 * M_PI * k / (d->numTaps - 1)) + 0.08 * cos(4 * M_PI * k / (d->numTaps - 1));
+                d->coefficient[k] = sinc * window;
+                sum += d->coefficient[k];
+        }
+        /* the gain at DC is one */
+        for (int k = 0; k < d->numTaps; k++)
+                d->coefficient[k] /= sum;
+
+        d->history = calloc(2 * d->numTaps * d->numFiltered, sizeof(float));
+        if (d->numFiltered && d->history == NULL) {
+                printf("Cannot allocate memory for decimation.\n");
+                return 1;
+        }
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Helper function to start the history with the first sample, so that the output does not ramp up from zero. */
+static void prime(unicorn_decimate_t *d, const float *dat, size_t stride)
+{
+        int n = d->numFiltered;
+
+        for (int k = 0; k < 2 * d->numTaps; k++)
+                for (int j = 0; j < n; j++)
+                        d->history[k * n + j] = dat[d->channel[j] * stride];
+}
+
+/*******************************************************************************************************/
+/* Helper function to add one sample to the history, channel c is at dat[c*stride]. */
+static void add(unicorn_decimate_t *d, const float *dat, size_t stride)
+{
+        int n = d->numFiltered;
+
+        /* the new sample is written at both copies of the history */
+        float *first = d->history + d->position * n;
+        float *second = d->history + (d->position + d->numTaps) * n;
+        for (int j = 0; j < n; j++)
+                first[j] = second[j] = dat[d->channel[j] * stride];
+        if (++d->position == d->numTaps)
+                d->position = 0;
+        d->count++;
+}
+
+/*******************************************************************************************************/
+/* Helper function to apply the filter to the history, channel c of the output is written at output[c*stride]. */
+static void filter(const unicorn_decimate_t *d, float *output, size_t stride)
+{
+        int n = d->numFiltered;
+
+        /* the oldest sample is at the current position, the newest one is numTaps-1 further */
+        const float *oldest = d->history + d->position * n;
+
+        /* the sums of the EEG channels of one device fit in registers */
+        for (int j0 = 0; j0 < n; j0 += DECIMATE_NEEG) {
+                int m = min(DECIMATE_NEEG, n - j0);
+                float sum[DECIMATE_NEEG] = {0};
+                if (m == DECIMATE_NEEG) {
+                        for (int k = 0; k < d->numTaps; k++) {
+                                /* the filter is symmetric, hence the order of the coefficients does not matter */
+                                const float *x = oldest + k * n + j0;
+                                float h = d->coefficient[k];
+                                for (int j = 0; j < DECIMATE_NEEG; j++)
+                                        sum[j] += h * x[j];
+                        }
+                }
+                else {
+                        for (int k = 0; k < d->numTaps; k++) {
+                                const float *x = oldest + k * n + j0;
+                                float h = d->coefficient[k];
+                                for (int j = 0; j < m; j++)
+                                        sum[j] += h * x[j];
+                        }
+                }
+                for (int j = 0; j < m; j++)
+                        output[d->channel[j0 + j] * stride] = sum[j];
+        }
+}
+
+/*******************************************************************************************************/
+int unicorn_decimate_put(unicorn_decimate_t *d, const float *dat, float *output)
+{
+        if (d->count == 0)
+                prime(d, dat, 1);
+
+        add(d, dat, 1);
+        if ((d->count % d->factor) != 0)
+                return 0;
+
+        /* the other channels are taken from the most recent sample */
+        memcpy(output, dat, d->numChannels * sizeof(float));
+        filter(d, output, 1);
+
+        return 1;
+}
+
+/*******************************************************************************************************/
+int unicorn_decimate_put_block(unicorn_decimate_t *d, const unicorn_block_t *input, unicorn_block_t *output)
+{
+        int source[BLOCK_MAXSAMPLES];
+
+        unicorn_block_clear(output);
+        if (input->numSamples && d->count == 0)
+                prime(d, input->dat, input->stride);
+
+        /* the channels are read from and written to the blocks with their stride, only the remaining samples are filtered */
+        for (int s = 0; s < input->numSamples; s++) {
+                add(d, input->dat + s, input->stride);
+                if ((d->count % d->factor) != 0 || output->numSamples == output->capacity)
+                        continue;
+
+                int k = output->numSamples++;
+                source[k] = s;
+                filter(d, output->dat + k, output->stride);
+                output->counter[k] = input->counter[s];
+                output->time[k] = input->time[s];
+        }
+
+        /* the other channels are taken from the most recent sample */
+        for (int c = 0, j = 0; c < min(input->numChannels, output->numChannels); c++) {
+                if (j < d->numFiltered && d->channel[j] == c) {
+                        j++;
+                        continue;
+                }
+                const float *x = unicorn_block_channel(input, c);
+                float *y = unicorn_block_channel(output, c);
+                for (int k = 0; k < output->numSamples; k++)
+                        y[k] = x[source[k]];
+        }
+
+        return output->numSamples;
+}
+
+/*******************************************************************************************************/
+void unicorn_decimate_free(unicorn_decimate_t *d)
+{
+        free(d->history);
+        d->history = NULL;
+}
@@ -0,0 +1,66 @@
+/*
+ * Decimation of the EEG channels to a lower sampling rate, for example 125 Hz or 62.5 Hz.
+ * The EEG channels are low-pass filtered with a windowed-sinc FIR filter to prevent
+ * aliasing, the other channels such as the counter and the gap flag are simply subsampled.
+ * The filter has a linear phase, its group delay is 16 input samples times the decimation
+ * factor, i.e. 64 ms times the factor at 250 Hz. The delay in seconds is stored in the struct.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_DECIMATE_H
+#define UNICORN_DECIMATE_H
+
+#include "unicorn.h"
+#include "unicorn_block.h"
+
+#define DECIMATE_MAXFACTOR  (8)
+#define DECIMATE_TAPSPERPHASE (32)  // the length of the filter is this times the factor, plus one
+#define DECIMATE_MAXTAPS    (DECIMATE_TAPSPERPHASE*DECIMATE_MAXFACTOR+1)
+#define DECIMATE_CUTOFF     (0.9)   // relative to the Nyquist frequency of the output
+#define DECIMATE_MAXCHANS   (MAXDEVICES*(NCHANS+1))
+#define DECIMATE_NEEG       (8)
+
+typedef struct {
+        int factor;
+        int numChannels;
+        int numTaps;
+        int numFiltered;
+        int channel[DECIMATE_MAXCHANS]; /* the index of each filtered channel */
+        float coefficient[DECIMATE_MAXTAPS];
+        /* the history of the filtered channels is stored twice after each other, so that the
+         * most recent samples are always contiguous, the channels are the inner dimension */
+        float *history;
+        int position;
+        unsigned long count;
+        double delay;                   /* in seconds */
+} unicorn_decimate_t;
+
+/* Initialize for frames with the specified number of channels, which consist of one or multiple
+ * devices with the specified number of channels each. The first 8 channels of each device are filtered. */
+int unicorn_decimate_init(unicorn_decimate_t *decimate, int numChannels, int channelsPerDevice, int factor);
+
+/* Add one frame, this returns 1 when an output frame is available. */
+int unicorn_decimate_put(unicorn_decimate_t *decimate, const float *dat, float *output);
+
+/* Add a block, the output block is filled with the remaining samples and needs room for numSamples/factor+1 of them.
+ * The counter and time of each output sample are those of the most recent input sample. This returns the number of output samples. */
+int unicorn_decimate_put_block(unicorn_decimate_t *decimate, const unicorn_block_t *input, unicorn_block_t *output);
+
+void unicorn_decimate_free(unicorn_decimate_t *decimate);
+
+#endif
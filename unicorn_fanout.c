@@ -0,0 +1,313 @@
+/*
+ * The fan-out passes every frame from the acquisition thread to multiple sinks. Each sink
+ * has its own queue and runs in its own thread, so that a slow sink does not stall the
+ * acquisition or the other sinks. When the queue of a sink is full, the frame is dropped
+ * for that sink only.
+ *
+ * The frames are collected in blocks from a pool, and each block is shared by the queues
+ * of all sinks, which also receive and process them as a block. The memory is allocated
+ * when the sinks are started, not while streaming.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include "unicorn_fanout.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <sys/time.h>
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+#define WAITTIME  (100)     // in milliseconds, how often an idle sink checks whether it should stop
+
+/*******************************************************************************************************/
+void unicorn_fanout_init(unicorn_fanout_t *fanout, int numChannels)
+{
+        memset(fanout, 0, sizeof(unicorn_fanout_t));
+        fanout->numChannels = min(numChannels, FANOUT_MAXCHANS);
+}
+
+/*******************************************************************************************************/
+unicorn_sink_t *unicorn_fanout_add(unicorn_fanout_t *fanout, const char *name, void *state, unicorn_sink_put_t put, unicorn_sink_idle_t idle)
+{
+        if (fanout->numSinks == FANOUT_MAXSINKS)
+                return NULL;
+
+        unicorn_sink_t *sink = &fanout->sink[fanout->numSinks];
+        memset(sink, 0, sizeof(unicorn_sink_t));
+        sink->name = name;
+        sink->state = state;
+        sink->put = put;
+        sink->idle = idle;
+        unicorn_latency_init(&sink->latency);
+        fanout->numSinks++;
+        return sink;
+}
+
+/*******************************************************************************************************/
+/* Helper function to process one block, this returns 1 when there was nothing to do. */
+static int process_block(unicorn_sink_t *sink)
+{
+        unsigned long tail = atomic_load_explicit(&sink->blockTail, memory_order_relaxed);
+        unsigned long head = atomic_load_explicit(&sink->blockHead, memory_order_acquire);
+
+        if (tail == head)
+                return 1;
+
+        unicorn_block_t *block = sink->queue[tail % FANOUT_QUEUE];
+
+        if (!atomic_load(&sink->failed) && sink->put(sink->state, block, &sink->latency) != 0) {
+                printf("Sink %s failed, it will not receive any more data.\n", sink->name);
+                atomic_store(&sink->failed, 1);
+        }
+        sink->idleCalled = 0;
+        atomic_fetch_add_explicit(&sink->tail, block->numSamples, memory_order_relaxed);
+
+        /* the block returns to the pool once all sinks are done with it, and the slot can be reused */
+        unicorn_pool_release(block);
+        atomic_store_explicit(&sink->blockTail, tail + 1, memory_order_release);
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Helper function to add the current block to the queues of all sinks. */
+static void publish(unicorn_fanout_t *fanout)
+{
+        unicorn_block_t *block = fanout->current;
+
+        if (block == NULL || block->numSamples == 0)
+                return;
+        fanout->current = NULL;
+
+        for (int i = 0; i < fanout->numSinks; i++) {
+                unicorn_sink_t *sink = &fanout->sink[i];
+                unsigned long head = atomic_load_explicit(&sink->blockHead, memory_order_relaxed);
+                unsigned long tail = atomic_load_explicit(&sink->blockTail, memory_order_acquire);
+
+                /* a slow sink loses frames, the others are not affected */
+                if (head - tail == FANOUT_QUEUE) {
+                        atomic_fetch_add_explicit(&sink->dropped, block->numSamples, memory_order_relaxed);
+                        continue;
+                }
+
+                unicorn_pool_retain(block);
+                sink->queue[head % FANOUT_QUEUE] = block;
+                atomic_store_explicit(&sink->blockHead, head + 1, memory_order_release);
+                atomic_fetch_add_explicit(&sink->head, block->numSamples, memory_order_relaxed);
+        }
+
+        /* the reference of the acquisition thread is not needed any more */
+        unicorn_pool_release(block);
+}
+
+/*******************************************************************************************************/
+/* Helper function to check whether one of the sinks has processed all blocks. */
+static int waiting(unicorn_fanout_t *fanout)
+{
+        for (int i = 0; i < fanout->numSinks; i++) {
+                unicorn_sink_t *sink = &fanout->sink[i];
+                if (!atomic_load(&sink->failed) && atomic_load(&sink->blockHead) == atomic_load(&sink->blockTail))
+                        return 1;
+        }
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Helper function to allocate the blocks, each sink can hold a full queue and there is one block being filled. */
+static int start_pool(unicorn_fanout_t *fanout)
+{
+        fanout->current = NULL;
+        return unicorn_pool_init(&fanout->pool, fanout->numSinks * FANOUT_QUEUE + 1, fanout->numChannels, FANOUT_BLOCKSIZE);
+}
+
+/*******************************************************************************************************/
+/* Helper function to let the sink flush its output when there are no frames waiting. */
+static void idle_sink(unicorn_sink_t *sink)
+{
+        if (sink->idle && !sink->idleCalled && !atomic_load(&sink->failed))
+                sink->idle(sink->state);
+        sink->idleCalled = 1;
+}
+
+#ifndef _WIN32
+
+/*******************************************************************************************************/
+static void *sink_thread(void *arg)
+{
+        unicorn_sink_t *sink = (unicorn_sink_t *)arg;
+
+        while (1) {
+                if (process_block(sink) == 0)
+                        continue;
+
+                /* the queue is empty, hence this is a good moment to write out whatever the sink buffers */
+                idle_sink(sink);
+
+                pthread_mutex_lock(&sink->mutex);
+                if (atomic_load(&sink->blockHead) == atomic_load(&sink->blockTail)) {
+                        if (!atomic_load(&sink->running)) {
+                                pthread_mutex_unlock(&sink->mutex);
+                                break;
+                        }
+                        struct timeval now;
+                        struct timespec deadline;
+                        gettimeofday(&now, NULL);
+                        deadline.tv_sec = now.tv_sec + (now.tv_usec + WAITTIME * 1000) / 1000000;
+                        deadline.tv_nsec = ((now.tv_usec + WAITTIME * 1000) % 1000000) * 1000;
+                        pthread_cond_timedwait(&sink->cond, &sink->mutex, &deadline);
+                }
+                pthread_mutex_unlock(&sink->mutex);
+        }
+
+        return NULL;
+}
+
+/*******************************************************************************************************/
+int unicorn_fanout_start(unicorn_fanout_t *fanout)
+{
+        if (start_pool(fanout) != 0)
+                return 1;
+
+        for (int i = 0; i < fanout->numSinks; i++) {
+                unicorn_sink_t *sink = &fanout->sink[i];
+                pthread_mutex_init(&sink->mutex, NULL);
+                pthread_cond_init(&sink->cond, NULL);
+                atomic_store(&sink->running, 1);
+                if (pthread_create(&sink->thread, NULL, sink_thread, sink) != 0) {
+                        printf("Cannot start thread for sink %s.\n", sink->name);
+                        atomic_store(&sink->running, 0);
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Helper function to wake up the thread of the sink. */
+static void wake_sink(unicorn_sink_t *sink)
+{
+        pthread_mutex_lock(&sink->mutex);
+        pthread_cond_signal(&sink->cond);
+        pthread_mutex_unlock(&sink->mutex);
+}
+
+/*******************************************************************************************************/
+void unicorn_fanout_stop(unicorn_fanout_t *fanout)
+{
+        publish(fanout);
+
+        for (int i = 0; i < fanout->numSinks; i++) {
+                unicorn_sink_t *sink = &fanout->sink[i];
+                if (atomic_load(&sink->running)) {
+                        atomic_store(&sink->running, 0);
+                        wake_sink(sink);
+                        pthread_join(sink->thread, NULL);
+                        pthread_cond_destroy(&sink->cond);
+                        pthread_mutex_destroy(&sink->mutex);
+                }
+        }
+}
+
+#else
+
+/*******************************************************************************************************/
+int unicorn_fanout_start(unicorn_fanout_t *fanout)
+{
+        if (start_pool(fanout) != 0)
+                return 1;
+
+        /* without threads the sinks are processed in the acquisition thread */
+        for (int i = 0; i < fanout->numSinks; i++)
+                atomic_store(&fanout->sink[i].running, 1);
+        return 0;
+}
+
+/*******************************************************************************************************/
+static void wake_sink(unicorn_sink_t *sink)
+{
+        while (process_block(sink) == 0)
+                ;
+        idle_sink(sink);
+}
+
+/*******************************************************************************************************/
+void unicorn_fanout_stop(unicorn_fanout_t *fanout)
+{
+        publish(fanout);
+
+        for (int i = 0; i < fanout->numSinks; i++) {
+                wake_sink(&fanout->sink[i]);
+                atomic_store(&fanout->sink[i].running, 0);
+        }
+}
+
+#endif
+
+/*******************************************************************************************************/
+void unicorn_fanout_put(unicorn_fanout_t *fanout, unsigned long counter, double arrival, const float *dat)
+{
+        if (fanout->current == NULL && (fanout->current = unicorn_pool_acquire(&fanout->pool)) == NULL) {
+                /* this does not happen, since the pool is large enough for all queues */
+                for (int i = 0; i < fanout->numSinks; i++)
+                        atomic_fetch_add_explicit(&fanout->sink[i].dropped, 1, memory_order_relaxed);
+                return;
+        }
+
+        if (unicorn_block_append(fanout->current, counter, arrival, dat))
+                publish(fanout);
+}
+
+/*******************************************************************************************************/
+void unicorn_fanout_wake(unicorn_fanout_t *fanout)
+{
+        /* a block that is not full is passed on when a sink is waiting for it */
+        if (waiting(fanout))
+                publish(fanout);
+
+        for (int i = 0; i < fanout->numSinks; i++)
+                wake_sink(&fanout->sink[i]);
+}
+
+/*******************************************************************************************************/
+void unicorn_fanout_print(unicorn_fanout_t *fanout)
+{
+        for (int i = 0; i < fanout->numSinks; i++) {
+                unicorn_sink_t *sink = &fanout->sink[i];
+                unsigned long head = atomic_load(&sink->head), tail = atomic_load(&sink->tail);
+                printf("Sink %s: processed %lu, queued %lu, dropped %lu, ", sink->name, tail, head - tail, atomic_load(&sink->dropped));
+                unicorn_latency_print(&sink->latency);
+                printf("%s.\n", (atomic_load(&sink->failed) ? ", failed" : ""));
+        }
+}
+
+/*******************************************************************************************************/
+void unicorn_fanout_free(unicorn_fanout_t *fanout)
+{
+        unicorn_pool_free(&fanout->pool);
+        fanout->current = NULL;
+        fanout->numSinks = 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * The fan-out passes every frame from the acquisition thread to multiple sinks. Each sink
+ * has its own queue and runs in its own thread, so that a slow sink does not stall the
+ * acquisition or the other sinks. When the queue of a sink is full, the frame is dropped
+ * for that sink only.
+ *
+ * The frames are collected in blocks from a pool, and each block is shared by the queues
+ * of all sinks, which also receive and process them as a block. The memory is allocated
+ * when the sinks are started, not while streaming.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_FANOUT_H
+#define UNICORN_FANOUT_H
+
+#include <stdatomic.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "unicorn.h"
+#include "unicorn_latency.h"
+#include "unicorn_pool.h"
+
+#define FANOUT_MAXSINKS   (8)
+#define FANOUT_QUEUE      (512)     // in blocks, this is between 2 and 32 seconds
+#define FANOUT_BLOCKSIZE  (BLOCK_MINSAMPLES)
+#define FANOUT_MAXCHANS   (MAXDEVICES*(NCHANS+1))
+
+/* This is called in the thread of the sink for every block of at most FANOUT_BLOCKSIZE frames, the block
+ * is shared with the other sinks and should not be changed. A non-zero return value stops the sink. */
+typedef int (*unicorn_sink_put_t)(void *state, const unicorn_block_t *block, unicorn_latency_t *latency);
+
+/* This is called in the thread of the sink when its queue has become empty. */
+typedef void (*unicorn_sink_idle_t)(void *state);
+
+typedef struct {
+        const char *name;
+        void *state;
+        unicorn_sink_put_t put;
+        unicorn_sink_idle_t idle;       /* optional */
+        unicorn_latency_t latency;
+        unicorn_block_t *queue[FANOUT_QUEUE];
+        atomic_ulong blockHead;         /* blocks added by the acquisition thread */
+        atomic_ulong blockTail;         /* blocks processed by the sink */
+        atomic_ulong head;              /* frames added by the acquisition thread */
+        atomic_ulong tail;              /* frames processed by the sink */
+        atomic_ulong dropped;           /* frames that did not fit in the queue */
+        atomic_int failed;
+        atomic_int running;
+        int idleCalled;
+#ifndef _WIN32
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        pthread_t thread;
+#endif
+} unicorn_sink_t;
+
+typedef struct {
+        unicorn_sink_t sink[FANOUT_MAXSINKS];
+        int numSinks;
+        int numChannels;
+        unicorn_pool_t pool;
+        unicorn_block_t *current;       /* the block that is being filled by the acquisition thread */
+} unicorn_fanout_t;
+
+void unicorn_fanout_init(unicorn_fanout_t *fanout, int numChannels);
+
+/* Add a sink, this returns NULL when there is no more room. The state is passed to the callbacks. */
+unicorn_sink_t *unicorn_fanout_add(unicorn_fanout_t *fanout, const char *name, void *state, unicorn_sink_put_t put, unicorn_sink_idle_t idle);
+
+/* Allocate the blocks and start one thread per sink. */
+int unicorn_fanout_start(unicorn_fanout_t *fanout);
+
+/* Pass one frame to all sinks, this never blocks. The sinks only start processing after they are woken up,
+ * so that frames that arrive together are also processed together. When all sinks are still busy, the
+ * frames are kept until the next wake up, so that the blocks fill up when the sinks fall behind. */
+void unicorn_fanout_put(unicorn_fanout_t *fanout, unsigned long counter, double arrival, const float *dat);
+void unicorn_fanout_wake(unicorn_fanout_t *fanout);
+
+/* Let the sinks process the frames that are still queued and stop the threads. */
+void unicorn_fanout_stop(unicorn_fanout_t *fanout);
+
+/* Print the number of processed and dropped frames and the latency of each sink. */
+void unicorn_fanout_print(unicorn_fanout_t *fanout);
+
+void unicorn_fanout_free(unicorn_fanout_t *fanout);
+
+#endif
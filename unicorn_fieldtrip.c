@@ -0,0 +1,197 @@
+/*
+ * Client for the FieldTrip realtime buffer.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "unicorn.h"
+#include "unicorn_net.h"
+#include "unicorn_fieldtrip.h"
+
+/*******************************************************************************************************/
+/* Helper function to send one request and check that the buffer responds with PUT_OK. */
+static int request(unicorn_fieldtrip_t *ft, uint16_t command, const void *def, size_t defSize, const void *buf, size_t bufSize)
+{
+        ft_messagedef_t message = {FT_VERSION, command, (uint32_t)(defSize + bufSize)};
+        ft_messagedef_t response;
+
+        if (unicorn_send_all(ft->fd, &message, sizeof(message)) != 0 ||
+            unicorn_send_all(ft->fd, def, defSize) != 0 ||
+            (bufSize && unicorn_send_all(ft->fd, buf, bufSize) != 0) ||
+            unicorn_recv_all(ft->fd, &response, sizeof(response)) != 0) {
+                printf("Lost connection to the FieldTrip buffer.\n");
+                return 1;
+        }
+
+        /* the response to a put request should not contain any data, but skip it anyway */
+        char dummy[64];
+        uint32_t remaining = response.bufsize;
+        while (remaining > 0) {
+                uint32_t n = (remaining < sizeof(dummy) ? remaining : sizeof(dummy));
+                if (unicorn_recv_all(ft->fd, dummy, n) != 0)
+                        return 1;
+                remaining -= n;
+        }
+
+        if (response.command != FT_PUT_OK) {
+                printf("The FieldTrip buffer returned an error.\n");
+                return 1;
+        }
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+/* Helper function to append a chunk with a list of strings, each string is followed by a 0. */
+static size_t append_strings(char *buf, size_t len, uint32_t type, const char *first, const char **str, int num)
+{
+        ft_chunkdef_t chunk = {type, 0};
+        size_t start = len + sizeof(chunk);
+
+        len = start;
+        if (first) {
+                strcpy(buf + len, first);
+                len += strlen(first) + 1;
+        }
+        for (int i = 0; i < num; i++) {
+                strcpy(buf + len, str[i]);
+                len += strlen(str[i]) + 1;
+        }
+
+        chunk.size = len - start;
+        memcpy(buf + start - sizeof(chunk), &chunk, sizeof(chunk));
+        return len;
+}
+
+/*******************************************************************************************************/
+int unicorn_fieldtrip_open(unicorn_fieldtrip_t *ft, const char *address, int numChannels, int blockSize, unicorn_latency_t *latency)
+{
+        char host[NETLEN];
+        int port;
+
+        memset(ft, 0, sizeof(unicorn_fieldtrip_t));
+        ft->numChannels = numChannels;
+        ft->blockSize = (blockSize > 0 ? blockSize : 1);
+        ft->latency = latency;
+
+        unicorn_net_address(address, FT_DEFAULTHOST, FT_DEFAULTPORT, host, &port);
+        if ((ft->fd = unicorn_tcp_connect(host, port)) < 0)
+                return 1;
+
+        ft->block = malloc(ft->blockSize * numChannels * sizeof(float));
+        ft->arrival = malloc(ft->blockSize * sizeof(double));
+        if (ft->block == NULL || ft->arrival == NULL) {
+                printf("Cannot allocate memory.\n");
+                unicorn_fieldtrip_close(ft);
+                return 1;
+        }
+
+        printf("Connected to FieldTrip buffer at %s:%d.\n", host, port);
+        return 0;
+}
+
+/*******************************************************************************************************/
+int unicorn_fieldtrip_header(unicorn_fieldtrip_t *ft, float fsample, const char **label, const char **type, const char **unit)
+{
+        ft_headerdef_t header = {ft->numChannels, 0, 0, fsample, FT_DATATYPE_FLOAT32, 0};
+        size_t size = 3 * sizeof(ft_chunkdef_t) + 64;
+        size_t len = 0;
+
+        /* determine how much space the chunks need */
+        for (int i = 0; i < ft->numChannels; i++) {
+                size += (label ? strlen(label[i]) : 0) + 1;
+                size += (type ? strlen(type[i]) : 0) + 1;
+                size += (unit ? 2 * strlen(label[i]) + strlen(unit[i]) + 16 : 0);
+        }
+
+        char *buf = malloc(size);
+        if (buf == NULL)
+                return 1;
+
+        if (label)
+                len = append_strings(buf, len, FT_CHUNK_CHANNEL_NAMES, NULL, label, ft->numChannels);
+
+        /* the first string describes the kind of flags, followed by one string per channel */
+        if (type)
+                len = append_strings(buf, len, FT_CHUNK_CHANNEL_FLAGS, "type", type, ft->numChannels);
+
+        /* there is no chunk for the units, these are written as key-value pairs like "unit_eeg1", "uV" */
+        if (label && unit) {
+                ft_chunkdef_t chunk = {FT_CHUNK_ASCII_KEYVAL, 0};
+                size_t start = len + sizeof(chunk);
+                len = start;
+                for (int i = 0; i < ft->numChannels; i++) {
+                        len += sprintf(buf + len, "unit_%s", label[i]) + 1;
+                        len += sprintf(buf + len, "%s", unit[i]) + 1;
+                }
+                chunk.size = len - start;
+                memcpy(buf + start - sizeof(chunk), &chunk, sizeof(chunk));
+        }
+
+        header.bufsize = len;
+        int result = request(ft, FT_PUT_HDR, &header, sizeof(header), buf, len);
+        free(buf);
+        return result;
+}
+
+/*******************************************************************************************************/
+int unicorn_fieldtrip_flush(unicorn_fieldtrip_t *ft)
+{
+        if (ft->numSamples == 0)
+                return 0;
+
+        ft_datadef_t data = {ft->numChannels, ft->numSamples, FT_DATATYPE_FLOAT32, ft->numSamples * ft->numChannels * sizeof(float)};
+        if (request(ft, FT_PUT_DAT, &data, sizeof(data), ft->block, data.bufsize) != 0)
+                return 1;
+
+        if (ft->latency) {
+                double now = unicorn_clock();
+                for (int i = 0; i < ft->numSamples; i++)
+                        unicorn_latency_record(ft->latency, now - ft->arrival[i]);
+        }
+
+        ft->written += ft->numSamples;
+        ft->numSamples = 0;
+        return 0;
+}
+
+/*******************************************************************************************************/
+int unicorn_fieldtrip_put(unicorn_fieldtrip_t *ft, const float *dat, double arrival)
+{
+        memcpy(ft->block + ft->numSamples * ft->numChannels, dat, ft->numChannels * sizeof(float));
+        ft->arrival[ft->numSamples] = arrival;
+        ft->numSamples++;
+
+        if (ft->numSamples == ft->blockSize)
+                return unicorn_fieldtrip_flush(ft);
+        return 0;
+}
+
+/*******************************************************************************************************/
+void unicorn_fieldtrip_close(unicorn_fieldtrip_t *ft)
+{
+        unicorn_net_close(ft->fd);
+        ft->fd = -1;
+        free(ft->block);
+        free(ft->arrival);
+        ft->block = NULL;
+        ft->arrival = NULL;
+}
@@ -0,0 +1,96 @@
+/*
+ * Client for the FieldTrip realtime buffer. This writes the header with the channel names,
+ * types and units, followed by blocks of float32 samples, to a buffer server that can
+ * be read by MATLAB or Python.
+ *
+ * See https://www.fieldtriptoolbox.org/development/realtime/buffer_protocol/
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_FIELDTRIP_H
+#define UNICORN_FIELDTRIP_H
+
+#include <stdint.h>
+
+#include "unicorn_latency.h"
+
+#define FT_DEFAULTHOST    "localhost"
+#define FT_DEFAULTPORT    (1972)
+#define FT_BLOCKSIZE      (5)     // in samples, i.e. 20 ms
+
+/* These are the parts of the buffer protocol that are needed to write data. */
+#define FT_VERSION                (1)
+#define FT_PUT_HDR                (0x101)
+#define FT_PUT_DAT                (0x102)
+#define FT_PUT_OK                 (0x104)
+#define FT_DATATYPE_FLOAT32       (9)
+#define FT_CHUNK_CHANNEL_NAMES    (1)
+#define FT_CHUNK_CHANNEL_FLAGS    (2)
+#define FT_CHUNK_ASCII_KEYVAL     (4)
+
+typedef struct {
+        uint16_t version;
+        uint16_t command;
+        uint32_t bufsize;
+} ft_messagedef_t;
+
+typedef struct {
+        uint32_t nchans;
+        uint32_t nsamples;
+        uint32_t nevents;
+        float fsample;
+        uint32_t data_type;
+        uint32_t bufsize;
+} ft_headerdef_t;
+
+typedef struct {
+        uint32_t nchans;
+        uint32_t nsamples;
+        uint32_t data_type;
+        uint32_t bufsize;
+} ft_datadef_t;
+
+typedef struct {
+        uint32_t type;
+        uint32_t size;
+} ft_chunkdef_t;
+
+typedef struct {
+        int fd;
+        int numChannels;
+        int blockSize;
+        int numSamples;                 /* in the current block */
+        float *block;
+        double *arrival;                /* of each sample in the current block */
+        unsigned long written;
+        unicorn_latency_t *latency;     /* optional */
+} unicorn_fieldtrip_t;
+
+/* Connect to the buffer on an address like "localhost:1972", this returns 0 on success. */
+int unicorn_fieldtrip_open(unicorn_fieldtrip_t *ft, const char *address, int numChannels, int blockSize, unicorn_latency_t *latency);
+
+/* Write the header, the channel names, types and units are optional. */
+int unicorn_fieldtrip_header(unicorn_fieldtrip_t *ft, float fsample, const char **label, const char **type, const char **unit);
+
+/* Add one sample with its arrival time, the block is written when it is full. */
+int unicorn_fieldtrip_put(unicorn_fieldtrip_t *ft, const float *dat, double arrival);
+int unicorn_fieldtrip_flush(unicorn_fieldtrip_t *ft);
+
+void unicorn_fieldtrip_close(unicorn_fieldtrip_t *ft);
+
+#endif
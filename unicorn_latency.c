@@ -0,0 +1,121 @@
+/*
+ * Histogram of the latency between the arrival of a packet on the serial port and the
+ * moment that the corresponding sample is written to the output.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+
+#include "unicorn_latency.h"
+
+#define min(x, y) ((x)<(y) ? x : y)
+
+/*******************************************************************************************************/
+/* Helper function to map a value in microseconds onto a bucket. Values smaller than LATENCY_SUBCOUNT
+ * have their own bucket, larger values keep the LATENCY_SUBBITS most significant bits. */
+static unsigned int bucket_index(unsigned long value)
+{
+        if (value < LATENCY_SUBCOUNT)
+                return value;
+
+        unsigned int bits = 0;
+        while ((value >> bits) >= LATENCY_SUBCOUNT)
+                bits++;
+        if (bits > LATENCY_MAXBITS - LATENCY_SUBBITS)
+                return LATENCY_BUCKETS - 1;
+
+        /* the shifted value is between LATENCY_SUBCOUNT/2 and LATENCY_SUBCOUNT */
+        return LATENCY_SUBCOUNT + (bits - 1) * LATENCY_SUBCOUNT/2 + (value >> bits) - LATENCY_SUBCOUNT/2;
+}
+
+/*******************************************************************************************************/
+/* Helper function to return the largest value in microseconds that maps onto the bucket. */
+static unsigned long bucket_value(unsigned int index)
+{
+        if (index < LATENCY_SUBCOUNT)
+                return index;
+
+        unsigned int bits = (index - LATENCY_SUBCOUNT) / (LATENCY_SUBCOUNT/2) + 1;
+        unsigned long sub = (index - LATENCY_SUBCOUNT) % (LATENCY_SUBCOUNT/2) + LATENCY_SUBCOUNT/2;
+        return ((sub + 1) << bits) - 1;
+}
+
+/*******************************************************************************************************/
+void unicorn_latency_init(unicorn_latency_t *latency)
+{
+        for (int i = 0; i < LATENCY_BUCKETS; i++)
+                atomic_init(&latency->count[i], 0);
+        atomic_init(&latency->total, 0);
+        atomic_init(&latency->max, 0);
+}
+
+/*******************************************************************************************************/
+void unicorn_latency_record(unicorn_latency_t *latency, double seconds)
+{
+        unsigned long value = (seconds > 0 ? (unsigned long)(seconds * 1e6) : 0);
+
+        atomic_fetch_add_explicit(&latency->count[bucket_index(value)], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&latency->total, 1, memory_order_relaxed);
+
+        unsigned long previous = atomic_load_explicit(&latency->max, memory_order_relaxed);
+        while (value > previous && !atomic_compare_exchange_weak_explicit(&latency->max, &previous, value, memory_order_relaxed, memory_order_relaxed))
+                ;
+}
+
+/*******************************************************************************************************/
+double unicorn_latency_percentile(unicorn_latency_t *latency, double percentage)
+{
+        unsigned long total = atomic_load_explicit(&latency->total, memory_order_relaxed);
+        unsigned long threshold = (unsigned long)(percentage / 100. * total + 0.5);
+        unsigned long sum = 0;
+
+        if (total == 0)
+                return 0;
+        if (threshold == 0)
+                threshold = 1;
+
+        /* the buckets can be updated while they are summed, hence the total is only approximate */
+        for (int i = 0; i < LATENCY_BUCKETS; i++) {
+                sum += atomic_load_explicit(&latency->count[i], memory_order_relaxed);
+                if (sum >= threshold)
+                        return min(bucket_value(i) / 1e6, unicorn_latency_max(latency));
+        }
+
+        return unicorn_latency_max(latency);
+}
+
+/*******************************************************************************************************/
+double unicorn_latency_max(unicorn_latency_t *latency)
+{
+        return atomic_load_explicit(&latency->max, memory_order_relaxed) / 1e6;
+}
+
+/*******************************************************************************************************/
+unsigned long unicorn_latency_count(unicorn_latency_t *latency)
+{
+        return atomic_load_explicit(&latency->total, memory_order_relaxed);
+}
+
+/*******************************************************************************************************/
+void unicorn_latency_print(unicorn_latency_t *latency)
+{
+        printf("latency p50 = %.2f ms, p99 = %.2f ms, max = %.2f ms",
+               1000 * unicorn_latency_percentile(latency, 50),
+               1000 * unicorn_latency_percentile(latency, 99),
+               1000 * unicorn_latency_max(latency));
+}
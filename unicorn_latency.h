@@ -0,0 +1,56 @@
+/*
+ * Histogram of the latency between the arrival of a packet on the serial port and the
+ * moment that the corresponding sample is written to the output.
+ *
+ * The histogram has a logarithmic series of buckets, each of which is linearly divided
+ * in sub-buckets, like an HDR histogram. This gives a relative precision of about 1.5% over
+ * the whole range from microseconds to minutes. Values can be recorded from any thread
+ * without locking, e.g. from the audio callback, while another thread reads the percentiles.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_LATENCY_H
+#define UNICORN_LATENCY_H
+
+#include <stdatomic.h>
+
+#define LATENCY_SUBBITS   (7)                                   // 64 sub-buckets per power of two
+#define LATENCY_SUBCOUNT  (1<<LATENCY_SUBBITS)
+#define LATENCY_MAXBITS   (32)                                  // in microseconds, i.e. more than one hour
+#define LATENCY_BUCKETS   (LATENCY_SUBCOUNT + (LATENCY_MAXBITS-LATENCY_SUBBITS)*LATENCY_SUBCOUNT/2)
+
+typedef struct {
+        atomic_ulong count[LATENCY_BUCKETS];
+        atomic_ulong total;
+        atomic_ulong max;               /* in microseconds */
+} unicorn_latency_t;
+
+void unicorn_latency_init(unicorn_latency_t *latency);
+
+/* Add one value in seconds, negative values are counted as zero. */
+void unicorn_latency_record(unicorn_latency_t *latency, double seconds);
+
+/* Return the value in seconds below which the specified percentage of all values falls. */
+double unicorn_latency_percentile(unicorn_latency_t *latency, double percentage);
+double unicorn_latency_max(unicorn_latency_t *latency);
+unsigned long unicorn_latency_count(unicorn_latency_t *latency);
+
+/* Helper function to print the median, 99th percentile and maximum in milliseconds. */
+void unicorn_latency_print(unicorn_latency_t *latency);
+
+#endif
@@ -0,0 +1,347 @@
+/*
+ * Embedded server that exposes metrics in the Prometheus text format over HTTP, either on
+ * a TCP port on localhost or on a Unix domain socket.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdarg.h>
+
+#include "unicorn_metrics.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+#define REQUESTSIZE   (1024)
+#define RESPONSESIZE  (65536)
+#define POLLTIME      (200)     // in milliseconds, how often the server checks whether it should stop
+
+/*******************************************************************************************************/
+/* Helper function to add one metric for each device. */
+static void add_device_metric(unicorn_metrics_t *metrics, unicorn_metric_t **metric, const char *name, const char *help, const char *type)
+{
+        for (int i = 0; i < metrics->numDevices; i++) {
+                metric[i] = unicorn_metrics_add(metrics, name, help, type);
+                if (metric[i])
+                        snprintf(metric[i]->label, METRICSLEN, "device=\"%d\"", i+1);
+        }
+}
+
+/*******************************************************************************************************/
+void unicorn_metrics_init(unicorn_metrics_t *metrics, int numDevices, unicorn_latency_t *latency)
+{
+        memset(metrics, 0, sizeof(unicorn_metrics_t));
+        metrics->numDevices = numDevices;
+        metrics->latency = latency;
+        metrics->fd = -1;
+
+        /* the metrics of all devices with the same name are kept together */
+        add_device_metric(metrics, metrics->received,   "unicorn_packets_received_total",     "Number of packets received from the device.", "counter");
+        add_device_metric(metrics, metrics->discarded,  "unicorn_framer_discarded_bytes_total", "Number of bytes discarded by the framer to find the start of a packet.", "counter");
+        add_device_metric(metrics, metrics->lost,       "unicorn_packets_lost_total",         "Number of packets that are missing according to the hardware counter.", "counter");
+        add_device_metric(metrics, metrics->gaps,       "unicorn_counter_gaps_total",         "Number of gaps in the hardware counter.", "counter");
+        add_device_metric(metrics, metrics->duplicated, "unicorn_packets_duplicated_total",   "Number of packets with a repeated hardware counter.", "counter");
+        add_device_metric(metrics, metrics->outOfOrder, "unicorn_packets_out_of_order_total", "Number of packets with a decreasing hardware counter.", "counter");
+        add_device_metric(metrics, metrics->filled,     "unicorn_samples_filled_total",       "Number of samples that were inserted for missing packets.", "counter");
+        add_device_metric(metrics, metrics->reconnects, "unicorn_reconnects_total",           "Number of times that the port was opened again after the device stopped sending data.", "counter");
+        add_device_metric(metrics, metrics->battery,    "unicorn_battery_percent",            "Battery level of the device.", "gauge");
+}
+
+/*******************************************************************************************************/
+unicorn_metric_t *unicorn_metrics_add(unicorn_metrics_t *metrics, const char *name, const char *help, const char *type)
+{
+        if (metrics->numMetrics == MAXMETRICS)
+                return NULL;
+
+        unicorn_metric_t *metric = &metrics->metric[metrics->numMetrics++];
+        metric->name = name;
+        metric->help = help;
+        metric->type = type;
+        metric->label[0] = 0;
+        atomic_init(&metric->value, 0);
+        return metric;
+}
+
+/*******************************************************************************************************/
+void unicorn_metrics_set(unicorn_metric_t *metric, double value)
+{
+        if (metric)
+                atomic_store_explicit(&metric->value, value, memory_order_relaxed);
+}
+
+/*******************************************************************************************************/
+void unicorn_metrics_update(unicorn_metrics_t *metrics, const unicorn_t *device)
+{
+        for (int i = 0; i < metrics->numDevices; i++) {
+                const unicorn_t *dev = &device[i];
+                unicorn_metrics_set(metrics->received[i],   dev->packets);
+                unicorn_metrics_set(metrics->discarded[i],  dev->framer.discarded);
+                unicorn_metrics_set(metrics->lost[i],       dev->stats.lost);
+                unicorn_metrics_set(metrics->gaps[i],       dev->stats.gaps);
+                unicorn_metrics_set(metrics->duplicated[i], dev->stats.duplicated);
+                unicorn_metrics_set(metrics->outOfOrder[i], dev->stats.outOfOrder);
+                unicorn_metrics_set(metrics->filled[i],     dev->stats.filled);
+                unicorn_metrics_set(metrics->reconnects[i], dev->stats.reconnects);
+                if (dev->haveCounter)
+                        unicorn_metrics_set(metrics->battery[i], dev->lastSample[14]);
+        }
+}
+
+/*******************************************************************************************************/
+/* Helper function to append to the buffer, this keeps track of the total length even when it does not fit. */
+static void append(char *buf, size_t size, size_t *len, const char *format, ...)
+{
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(buf + min(*len, size), (*len < size ? size - *len : 0), format, args);
+        va_end(args);
+        if (n > 0)
+                *len += n;
+}
+
+/*******************************************************************************************************/
+size_t unicorn_metrics_format(unicorn_metrics_t *metrics, char *buf, size_t size)
+{
+        size_t len = 0;
+        const char *previous = NULL;
+
+        if (size)
+                buf[0] = 0;
+
+        for (int i = 0; i < metrics->numMetrics; i++) {
+                unicorn_metric_t *metric = &metrics->metric[i];
+                double value = atomic_load_explicit(&metric->value, memory_order_relaxed);
+                if (previous == NULL || strcmp(previous, metric->name) != 0) {
+                        append(buf, size, &len, "# HELP %s %s\n", metric->name, metric->help);
+                        append(buf, size, &len, "# TYPE %s %s\n", metric->name, metric->type);
+                        previous = metric->name;
+                }
+                if (metric->label[0])
+                        append(buf, size, &len, "%s{%s} %.17g\n", metric->name, metric->label, value);
+                else
+                        append(buf, size, &len, "%s %.17g\n", metric->name, value);
+        }
+
+        if (metrics->latency) {
+                unicorn_latency_t *latency = metrics->latency;
+                append(buf, size, &len, "# HELP unicorn_latency_seconds Latency from the arrival of a packet until the sample is written.\n");
+                append(buf, size, &len, "# TYPE unicorn_latency_seconds summary\n");
+                append(buf, size, &len, "unicorn_latency_seconds{quantile=\"0.5\"} %.6f\n", unicorn_latency_percentile(latency, 50));
+                append(buf, size, &len, "unicorn_latency_seconds{quantile=\"0.99\"} %.6f\n", unicorn_latency_percentile(latency, 99));
+                append(buf, size, &len, "unicorn_latency_seconds_count %lu\n", unicorn_latency_count(latency));
+                append(buf, size, &len, "# HELP unicorn_latency_max_seconds Maximum latency from the arrival of a packet until the sample is written.\n");
+                append(buf, size, &len, "# TYPE unicorn_latency_max_seconds gauge\n");
+                append(buf, size, &len, "unicorn_latency_max_seconds %.6f\n", unicorn_latency_max(latency));
+        }
+
+        return len;
+}
+
+#ifndef _WIN32
+
+/*******************************************************************************************************/
+/* Helper function to write all bytes to the client, this gives up when the client goes away. */
+static void send_all(int fd, const char *buf, size_t len)
+{
+        while (len > 0) {
+                ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        return;
+                buf += n;
+                len -= n;
+        }
+}
+
+/*******************************************************************************************************/
+/* Helper function to answer one HTTP request, all paths return the same metrics. */
+static void serve_client(unicorn_metrics_t *metrics, int fd, char **response, size_t *responseSize)
+{
+        char request[REQUESTSIZE], header[128];
+        size_t received = 0;
+
+        /* read until the end of the request header, but do not wait too long for a slow client */
+        while (received < REQUESTSIZE - 1) {
+                struct pollfd pfd = {fd, POLLIN, 0};
+                if (poll(&pfd, 1, 1000) <= 0)
+                        break;
+                ssize_t n = recv(fd, request + received, REQUESTSIZE - 1 - received, 0);
+                if (n <= 0)
+                        break;
+                received += n;
+                request[received] = 0;
+                if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+                        break;
+        }
+
+        size_t len = unicorn_metrics_format(metrics, *response, *responseSize);
+        if (len >= *responseSize) {
+                char *larger = realloc(*response, len + 1);
+                if (larger) {
+                        *response = larger;
+                        *responseSize = len + 1;
+                        len = unicorn_metrics_format(metrics, *response, *responseSize);
+                }
+                len = min(len, *responseSize - 1);
+        }
+
+        int n = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n", (unsigned long)len);
+        send_all(fd, header, n);
+        send_all(fd, *response, len);
+}
+
+/*******************************************************************************************************/
+static void *server_thread(void *arg)
+{
+        unicorn_metrics_t *metrics = (unicorn_metrics_t *)arg;
+        size_t responseSize = RESPONSESIZE;
+        char *response = malloc(responseSize);
+
+        while (response && atomic_load(&metrics->running)) {
+                struct pollfd pfd = {metrics->fd, POLLIN, 0};
+                if (poll(&pfd, 1, POLLTIME) <= 0)
+                        continue;
+                int client = accept(metrics->fd, NULL, NULL);
+                if (client < 0)
+                        continue;
+#ifdef SO_NOSIGPIPE
+                int on = 1;
+                setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+                serve_client(metrics, client, &response, &responseSize);
+                close(client);
+        }
+
+        free(response);
+        return NULL;
+}
+
+/*******************************************************************************************************/
+int unicorn_metrics_start(unicorn_metrics_t *metrics, const char *address)
+{
+        if (strchr(address, '/')) {
+                struct sockaddr_un addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sun_family = AF_UNIX;
+                if (strlen(address) >= sizeof(addr.sun_path)) {
+                        printf("Socket file name is too long: %s\n", address);
+                        return 1;
+                }
+                strcpy(addr.sun_path, address);
+                /* a socket file that remains from a previous run is removed */
+                unlink(address);
+                if ((metrics->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(metrics->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+                        goto error;
+                metrics->socketFile = strdup(address);
+        }
+        else {
+                struct sockaddr_in addr;
+                char host[METRICSLEN] = "127.0.0.1";
+                const char *port = strrchr(address, ':');
+                memset(&addr, 0, sizeof(addr));
+                addr.sin_family = AF_INET;
+                if (port) {
+                        snprintf(host, sizeof(host), "%.*s", (int)(port - address), address);
+                        port++;
+                }
+                else {
+                        port = address;
+                }
+                addr.sin_port = htons(atoi(port));
+                if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+                        printf("Invalid address: %s\n", address);
+                        return 1;
+                }
+                int on = 1;
+                if ((metrics->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+                        goto error;
+                setsockopt(metrics->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+                if (bind(metrics->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+                        goto error;
+        }
+
+        if (listen(metrics->fd, 4) != 0)
+                goto error;
+
+        atomic_store(&metrics->running, 1);
+        if (pthread_create(&metrics->thread, NULL, server_thread, metrics) != 0) {
+                atomic_store(&metrics->running, 0);
+                goto error;
+        }
+
+        printf("Serving metrics on %s\n", address);
+        return 0;
+
+error:
+        printf("Cannot serve metrics on %s: %s\n", address, strerror(errno));
+        if (metrics->fd >= 0)
+                close(metrics->fd);
+        metrics->fd = -1;
+        return 1;
+}
+
+/*******************************************************************************************************/
+void unicorn_metrics_stop(unicorn_metrics_t *metrics)
+{
+        if (atomic_load(&metrics->running)) {
+                atomic_store(&metrics->running, 0);
+                pthread_join(metrics->thread, NULL);
+        }
+        if (metrics->fd >= 0)
+                close(metrics->fd);
+        metrics->fd = -1;
+        if (metrics->socketFile) {
+                unlink(metrics->socketFile);
+                free(metrics->socketFile);
+                metrics->socketFile = NULL;
+        }
+}
+
+#else
+
+/*******************************************************************************************************/
+int unicorn_metrics_start(unicorn_metrics_t *metrics, const char *address)
+{
+        printf("The metrics server is not available on Windows.\n");
+        return 1;
+}
+
+/*******************************************************************************************************/
+void unicorn_metrics_stop(unicorn_metrics_t *metrics)
+{
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Embedded server that exposes metrics in the Prometheus text format over HTTP, either on
+ * a TCP port on localhost or on a Unix domain socket.
+ *
+ * The acquisition thread only stores the latest values with relaxed atomic writes, the
+ * server runs in its own thread and reads them when it is scraped. All metrics must be
+ * added before the server is started.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_METRICS_H
+#define UNICORN_METRICS_H
+
+#include <stdatomic.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "unicorn.h"
+#include "unicorn_latency.h"
+
+#define MAXMETRICS    (512)
+#define METRICSLEN    (32)
+
+typedef struct {
+        const char *name;
+        const char *help;
+        const char *type;               /* counter or gauge */
+        char label[METRICSLEN];         /* e.g. device="1" */
+        _Atomic double value;
+} unicorn_metric_t;
+
+typedef struct {
+        unicorn_metric_t metric[MAXMETRICS];
+        int numMetrics;
+        int numDevices;
+        /* these are copied from each device by unicorn_metrics_update */
+        unicorn_metric_t *received[MAXDEVICES];
+        unicorn_metric_t *discarded[MAXDEVICES];
+        unicorn_metric_t *lost[MAXDEVICES];
+        unicorn_metric_t *gaps[MAXDEVICES];
+        unicorn_metric_t *duplicated[MAXDEVICES];
+        unicorn_metric_t *outOfOrder[MAXDEVICES];
+        unicorn_metric_t *filled[MAXDEVICES];
+        unicorn_metric_t *reconnects[MAXDEVICES];
+        unicorn_metric_t *battery[MAXDEVICES];
+        unicorn_latency_t *latency;
+        char *socketFile;
+        int fd;
+        atomic_int running;
+#ifndef _WIN32
+        pthread_t thread;
+#endif
+} unicorn_metrics_t;
+
+/* Initialize the metrics for a number of devices, the latency histogram is optional. */
+void unicorn_metrics_init(unicorn_metrics_t *metrics, int numDevices, unicorn_latency_t *latency);
+
+/* Add an application specific metric, this returns NULL when there is no more room. */
+unicorn_metric_t *unicorn_metrics_add(unicorn_metrics_t *metrics, const char *name, const char *help, const char *type);
+
+/* Update a single value, or copy the statistics of all devices, these are safe to call from the acquisition thread. */
+void unicorn_metrics_set(unicorn_metric_t *metric, double value);
+void unicorn_metrics_update(unicorn_metrics_t *metrics, const unicorn_t *device);
+
+/* Start the server on a port number like "9100", an address like "127.0.0.1:9100", or a socket file like "/tmp/unicorn.sock". */
+int unicorn_metrics_start(unicorn_metrics_t *metrics, const char *address);
+void unicorn_metrics_stop(unicorn_metrics_t *metrics);
+
+/* Write all metrics in the Prometheus text format, this returns the number of bytes that would have been written. */
+size_t unicorn_metrics_format(unicorn_metrics_t *metrics, char *buf, size_t size);
+
+#endif
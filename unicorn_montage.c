@@ -0,0 +1,171 @@
+/*
+ * Re-referencing and spatial filtering of the EEG channels. A montage is a matrix that
+ * is multiplied with the 8 EEG channels of each sample, such as the common average
+ * reference, a bipolar montage, or a matrix that is read from a file, for example the
+ * unmixing matrix of an ICA decomposition. The other channels are not changed.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "unicorn_montage.h"
+
+#define LINELEN (1024)
+
+/*******************************************************************************************************/
+/* Helper function to read the matrix from a text file, lines that start with # are ignored. */
+static int read_matrix(unicorn_montage_t *m, const char *fileName)
+{
+        char line[LINELEN];
+        int numRows = 0;
+        FILE *fp;
+
+        if ((fp = fopen(fileName, "r"))==NULL) {
+                printf("Cannot open file: %s\n", strerror(errno));
+                return 1;
+        }
+
+        while (fgets(line, LINELEN, fp)) {
+                char *token, *end;
+                int c = 0;
+                if (line[0]=='#' || strspn(line, " \t\r\n")==strlen(line))
+                        continue;
+                if (numRows==MONTAGE_NEEG) {
+                        printf("Montage %s has more than %d rows.\n", fileName, MONTAGE_NEEG);
+                        fclose(fp);
+                        return 1;
+                }
+                for (token = strtok(line, " ,\t\r\n"); token && c < MONTAGE_NEEG; token = strtok(NULL, " ,\t\r\n"), c++) {
+                        m->weight[c][numRows] = strtof(token, &end);
+                        if (*end!=0) {
+                                printf("Montage %s has an invalid value in row %d: %s\n", fileName, numRows+1, token);
+                                fclose(fp);
+                                return 1;
+                        }
+                }
+                if (c!=MONTAGE_NEEG || token) {
+                        printf("Montage %s should have %d values in row %d.\n", fileName, MONTAGE_NEEG, numRows+1);
+                        fclose(fp);
+                        return 1;
+                }
+                numRows++;
+        }
+        fclose(fp);
+
+        /* the remaining output channels are zero */
+        printf("Read montage with %d rows from %s.\n", numRows, fileName);
+        return 0;
+}
+
+/*******************************************************************************************************/
+int unicorn_montage_init(unicorn_montage_t *m, const char *line)
+{
+        char fileName[LINELEN];
+
+        memset(m, 0, sizeof(unicorn_montage_t));
+        snprintf(fileName, LINELEN, "%s", line);
+        fileName[strcspn(fileName, "\r\n")] = 0;
+
+        if (strlen(fileName)==0 || strcmp(fileName, "none")==0) {
+                m->type = MONTAGE_NONE;
+                for (int c = 0; c < MONTAGE_NEEG; c++)
+                        m->weight[c][c] = 1;
+        }
+        else if (strcmp(fileName, "car")==0) {
+                /* each channel minus the average of all channels */
+                m->type = MONTAGE_CAR;
+                for (int c = 0; c < MONTAGE_NEEG; c++)
+                        for (int r = 0; r < MONTAGE_NEEG; r++)
+                                m->weight[c][r] = (c==r) - 1.0f / MONTAGE_NEEG;
+        }
+        else if (strcmp(fileName, "bipolar")==0) {
+                /* each channel minus the next one, the last channel minus the first one */
+                m->type = MONTAGE_BIPOLAR;
+                for (int r = 0; r < MONTAGE_NEEG; r++) {
+                        m->weight[r][r] = 1;
+                        m->weight[(r + 1) % MONTAGE_NEEG][r] = -1;
+                }
+        }
+        else {
+                m->type = MONTAGE_MATRIX;
+                if (read_matrix(m, fileName)!=0)
+                        return 1;
+        }
+
+        for (int r = 0; r < MONTAGE_NEEG; r++) {
+                if (m->type==MONTAGE_BIPOLAR)
+                        snprintf(m->label[r], MONTAGE_LABELLEN, "%s-%s", unicorn_label[r], unicorn_label[(r + 1) % MONTAGE_NEEG]);
+                else if (m->type==MONTAGE_MATRIX)
+                        snprintf(m->label[r], MONTAGE_LABELLEN, "comp%d", r + 1);
+                else
+                        snprintf(m->label[r], MONTAGE_LABELLEN, "%s", unicorn_label[r]);
+        }
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+void unicorn_montage_apply(const unicorn_montage_t *m, float *dat, int numSamples, int stride)
+{
+        if (m->type==MONTAGE_NONE)
+                return;
+
+        /* this is a small matrix multiplication, the inner loop over the output channels can be vectorized */
+        for (int s = 0; s < numSamples; s++) {
+                float *x = dat + s * stride;
+                float y[MONTAGE_NEEG] = {0};
+                for (int c = 0; c < MONTAGE_NEEG; c++) {
+                        float xc = x[c];
+                        for (int r = 0; r < MONTAGE_NEEG; r++)
+                                y[r] += m->weight[c][r] * xc;
+                }
+                memcpy(x, y, sizeof(y));
+        }
+}
+
+/*******************************************************************************************************/
+void unicorn_montage_apply_block(const unicorn_montage_t *m, unicorn_block_t *block, int channelsPerDevice)
+{
+        float y[MONTAGE_NEEG][BLOCK_MAXSAMPLES];
+        int n = block->numSamples;
+
+        if (m->type==MONTAGE_NONE)
+                return;
+
+        /* with the channels stored after each other, the inner loop runs over the samples of one channel */
+        for (int d = 0; d + MONTAGE_NEEG <= block->numChannels; d += channelsPerDevice) {
+                for (int r = 0; r < MONTAGE_NEEG; r++)
+                        for (int s = 0; s < n; s++)
+                                y[r][s] = 0;
+                for (int c = 0; c < MONTAGE_NEEG; c++) {
+                        const float *x = unicorn_block_channel(block, d + c);
+                        for (int r = 0; r < MONTAGE_NEEG; r++) {
+                                float w = m->weight[c][r];
+                                if (w == 0)
+                                        continue;
+                                for (int s = 0; s < n; s++)
+                                        y[r][s] += w * x[s];
+                        }
+                }
+                for (int r = 0; r < MONTAGE_NEEG; r++)
+                        memcpy(unicorn_block_channel(block, d + r), y[r], n * sizeof(float));
+        }
+}
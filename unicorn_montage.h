@@ -0,0 +1,54 @@
+/*
+ * Re-referencing and spatial filtering of the EEG channels. A montage is a matrix that
+ * is multiplied with the 8 EEG channels of each sample, such as the common average
+ * reference, a bipolar montage, or a matrix that is read from a file, for example the
+ * unmixing matrix of an ICA decomposition. The other channels are not changed.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_MONTAGE_H
+#define UNICORN_MONTAGE_H
+
+#include "unicorn.h"
+#include "unicorn_block.h"
+
+#define MONTAGE_NEEG        (8)
+#define MONTAGE_LABELLEN    (16)
+
+#define MONTAGE_NONE        (0)
+#define MONTAGE_CAR         (1)
+#define MONTAGE_BIPOLAR     (2)
+#define MONTAGE_MATRIX      (3)
+
+typedef struct {
+        int type;
+        /* the matrix is stored transposed, so that the loop over the output channels is contiguous */
+        float weight[MONTAGE_NEEG][MONTAGE_NEEG];       /* input channel, output channel */
+        char label[MONTAGE_NEEG][MONTAGE_LABELLEN];
+} unicorn_montage_t;
+
+/* Initialize from a line like "none", "car", "bipolar" or the name of a file with one row of the matrix per line. */
+int unicorn_montage_init(unicorn_montage_t *montage, const char *line);
+
+/* Apply the montage to a block of samples, each sample consists of stride channels of which the first 8 are EEG. */
+void unicorn_montage_apply(const unicorn_montage_t *montage, float *dat, int numSamples, int stride);
+
+/* Apply the montage to a block, the channels of each device start at a multiple of channelsPerDevice. */
+void unicorn_montage_apply_block(const unicorn_montage_t *montage, unicorn_block_t *block, int channelsPerDevice);
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ * Helper functions for the network sinks, these hide the differences between BSD sockets
+ * and Winsock.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "unicorn_net.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#elif defined _WIN32
+// Windows code goes here
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define MSG_NOSIGNAL 0
+#endif
+
+/*******************************************************************************************************/
+void unicorn_net_address(const char *address, const char *defaultHost, int defaultPort, char *host, int *port)
+{
+        const char *colon = strrchr(address, ':');
+
+        snprintf(host, NETLEN, "%s", defaultHost);
+        *port = defaultPort;
+
+        if (colon) {
+                if (colon > address)
+                        snprintf(host, NETLEN, "%.*s", (int)(colon - address), address);
+                if (strlen(colon+1))
+                        *port = atoi(colon+1);
+        }
+        else if (strspn(address, "0123456789") == strlen(address)) {
+                if (strlen(address))
+                        *port = atoi(address);
+        }
+        else {
+                snprintf(host, NETLEN, "%s", address);
+        }
+}
+
+/*******************************************************************************************************/
+int unicorn_tcp_connect(const char *host, int port)
+{
+        struct addrinfo hints, *result, *rp;
+        char service[16];
+        int fd = -1;
+
+#if defined _WIN32
+        WSADATA wsaData;
+        WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        snprintf(service, sizeof(service), "%d", port);
+
+        if (getaddrinfo(host, service, &hints, &result) != 0) {
+                printf("Cannot resolve %s.\n", host);
+                return -1;
+        }
+
+        for (rp = result; rp != NULL; rp = rp->ai_next) {
+                fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+                if (fd < 0)
+                        continue;
+                if (connect(fd, rp->ai_addr, rp->ai_addrlen) == 0)
+                        break;
+                unicorn_net_close(fd);
+                fd = -1;
+        }
+        freeaddrinfo(result);
+
+        if (fd < 0) {
+                printf("Cannot connect to %s:%d.\n", host, port);
+                return -1;
+        }
+
+        /* small messages should be sent immediately */
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+#ifdef SO_NOSIGPIPE
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+        return fd;
+}
+
+/*******************************************************************************************************/
+int unicorn_udp_open(const char *host, int port)
+{
+        struct addrinfo hints, *result;
+        char service[16];
+        int fd;
+
+#if defined _WIN32
+        WSADATA wsaData;
+        WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        snprintf(service, sizeof(service), "%d", port);
+
+        if (getaddrinfo(host, service, &hints, &result) != 0) {
+                printf("Cannot resolve %s.\n", host);
+                return -1;
+        }
+
+        if ((fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol)) < 0) {
+                freeaddrinfo(result);
+                return -1;
+        }
+
+        /* multicast stays on the local network, and can also be received on this computer */
+        unsigned long address = ntohl(((struct sockaddr_in *)result->ai_addr)->sin_addr.s_addr);
+        if ((address >> 28) == 0xE) {
+                unsigned char ttl = 1, loop = 1;
+                setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, (const char *)&ttl, sizeof(ttl));
+                setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, (const char *)&loop, sizeof(loop));
+        }
+
+        /* the socket is connected to the destination, so that it can be used with send */
+        if (connect(fd, result->ai_addr, result->ai_addrlen) != 0) {
+                printf("Cannot send to %s:%d.\n", host, port);
+                unicorn_net_close(fd);
+                fd = -1;
+        }
+
+        freeaddrinfo(result);
+        return fd;
+}
+
+/*******************************************************************************************************/
+int unicorn_send_all(int fd, const void *buf, size_t len)
+{
+        const char *ptr = (const char *)buf;
+        while (len > 0) {
+                int n = send(fd, ptr, len, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        return 1;
+                ptr += n;
+                len -= n;
+        }
+        return 0;
+}
+
+/*******************************************************************************************************/
+int unicorn_recv_all(int fd, void *buf, size_t len)
+{
+        char *ptr = (char *)buf;
+        while (len > 0) {
+                int n = recv(fd, ptr, len, 0);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        return 1;
+                ptr += n;
+                len -= n;
+        }
+        return 0;
+}
+
+/*******************************************************************************************************/
+void unicorn_net_close(int fd)
+{
+        if (fd < 0)
+                return;
+#if defined _WIN32
+        closesocket(fd);
+#else
+        close(fd);
+#endif
+}
@@ -0,0 +1,44 @@
+/*
+ * Helper functions for the network sinks, these hide the differences between BSD sockets
+ * and Winsock.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_NET_H
+#define UNICORN_NET_H
+
+#include <stddef.h>
+
+#define NETLEN      (256)
+
+/* Split an address like "localhost:1972" or "1972" into the host and port, the defaults are used for the parts that are missing. */
+void unicorn_net_address(const char *address, const char *defaultHost, int defaultPort, char *host, int *port);
+
+/* Open a TCP connection, this returns the socket or -1 in case of an error. */
+int unicorn_tcp_connect(const char *host, int port);
+
+/* Open a UDP socket that sends to the host, which can also be a multicast group. This returns the socket or -1 in case of an error. */
+int unicorn_udp_open(const char *host, int port);
+
+/* Send or receive exactly the specified number of bytes, this returns 0 on success. */
+int unicorn_send_all(int fd, const void *buf, size_t len);
+int unicorn_recv_all(int fd, void *buf, size_t len);
+
+void unicorn_net_close(int fd);
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * Network sink that sends the samples as Open Sound Control (OSC) messages over UDP. The
+ * messages are collected in OSC bundles, each with a timetag.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "unicorn.h"
+#include "unicorn_net.h"
+#include "unicorn_osc.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#include <sys/socket.h>
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#include <winsock2.h>
+#endif
+
+/* The OSC timetag is in NTP format, which counts the seconds since 1900. */
+#define NTP_OFFSET  (2208988800UL)
+
+/*******************************************************************************************************/
+/* Helper functions to write big-endian values, OSC uses network byte order. */
+static unsigned char *put32(unsigned char *ptr, uint32_t val)
+{
+        ptr[0] = (val >> 24) & 0xFF;
+        ptr[1] = (val >> 16) & 0xFF;
+        ptr[2] = (val >> 8) & 0xFF;
+        ptr[3] = val & 0xFF;
+        return ptr + 4;
+}
+
+/* Strings are terminated with at least one zero and padded to a multiple of 4 bytes. */
+static unsigned char *put_string(unsigned char *ptr, const char *str)
+{
+        size_t len = strlen(str);
+        size_t padded = (len + 4) & ~(size_t)3;
+        memcpy(ptr, str, len);
+        memset(ptr + len, 0, padded - len);
+        return ptr + padded;
+}
+
+/*******************************************************************************************************/
+int unicorn_osc_open(unicorn_osc_t *osc, const char *address, int bundleSize, unicorn_latency_t *latency)
+{
+        char host[NETLEN];
+        int port;
+
+        memset(osc, 0, sizeof(unicorn_osc_t));
+        osc->bundleSize = max(1, min(bundleSize, OSC_MAXMESSAGES));
+        osc->latency = latency;
+
+        unicorn_net_address(address, OSC_DEFAULTHOST, OSC_DEFAULTPORT, host, &port);
+        if ((osc->fd = unicorn_udp_open(host, port)) < 0)
+                return 1;
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+int unicorn_osc_put(unicorn_osc_t *osc, const char *path, double time, int32_t counter, const float *dat, int n, double arrival)
+{
+        char types[OSC_PATHLEN];
+        size_t size;
+
+        /* the address and the type tag string must fit, a message is not sent partially */
+        if (strlen(path) >= OSC_PATHLEN || n < 0 || n > OSC_PATHLEN - 3)
+                return 1;
+
+        /* the type tag string starts with a comma, followed by one character per argument */
+        types[0] = ',';
+        types[1] = 'i';
+        memset(types + 2, 'f', n);
+        types[n + 2] = 0;
+
+        size = ((strlen(path) + 4) & ~(size_t)3) + ((n + 2 + 4) & ~(size_t)3) + 4 + 4 * n;
+
+        /* start a new bundle when the message does not fit */
+        if (osc->numMessages > 0 && osc->len + 4 + size > OSC_BUFSIZE)
+                if (unicorn_osc_flush(osc) != 0)
+                        return 1;
+
+        if (osc->numMessages == 0) {
+                /* the timetag has 32 bits for the seconds and 32 bits for the fraction */
+                double seconds = time + NTP_OFFSET;
+                uint32_t whole = (uint32_t)seconds;
+                uint32_t fraction = (uint32_t)((seconds - (double)whole) * 4294967296.0);
+                unsigned char *ptr = put_string(osc->buf, "#bundle");
+                ptr = put32(ptr, whole);
+                ptr = put32(ptr, fraction);
+                osc->len = ptr - osc->buf;
+        }
+
+        unsigned char *ptr = put32(osc->buf + osc->len, size);
+        ptr = put_string(ptr, path);
+        ptr = put_string(ptr, types);
+        ptr = put32(ptr, (uint32_t)counter);
+        for (int i = 0; i < n; i++) {
+                uint32_t val;
+                memcpy(&val, &dat[i], 4);
+                ptr = put32(ptr, val);
+        }
+        osc->len = ptr - osc->buf;
+        osc->arrival[osc->numMessages++] = arrival;
+
+        if (osc->numMessages == osc->bundleSize)
+                return unicorn_osc_flush(osc);
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+int unicorn_osc_flush(unicorn_osc_t *osc)
+{
+        if (osc->numMessages == 0)
+                return 0;
+
+        /* datagrams that cannot be delivered are lost, there is nothing that OSC can do about that */
+        send(osc->fd, (const char *)osc->buf, osc->len, 0);
+
+        double now = unicorn_clock();
+        for (int i = 0; i < osc->numMessages && osc->latency; i++)
+                unicorn_latency_record(osc->latency, now - osc->arrival[i]);
+        osc->sent += osc->numMessages;
+        osc->numMessages = 0;
+        osc->len = 0;
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+void unicorn_osc_close(unicorn_osc_t *osc)
+{
+        if (osc->fd >= 0)
+                unicorn_net_close(osc->fd);
+        osc->fd = -1;
+}
+
+/*******************************************************************************************************/
+double unicorn_osc_wallclock(void)
+{
+        struct timespec ts;
+        timespec_get(&ts, TIME_UTC);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
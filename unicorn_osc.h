@@ -0,0 +1,63 @@
+/*
+ * Network sink that sends the samples as Open Sound Control (OSC) messages over UDP. The
+ * messages are collected in OSC bundles, each with a timetag.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_OSC_H
+#define UNICORN_OSC_H
+
+#include <stdint.h>
+
+#include "unicorn_latency.h"
+
+#define OSC_DEFAULTHOST   "localhost"
+#define OSC_DEFAULTPORT   (9000)
+#define OSC_BUNDLESIZE    (5)       // messages per bundle
+#define OSC_MAXMESSAGES   (32)
+#define OSC_BUFSIZE       (1472)    // this fits in a single Ethernet frame
+#define OSC_PATHLEN       (64)
+
+typedef struct {
+        int fd;
+        int bundleSize;
+        unsigned char buf[OSC_BUFSIZE];
+        size_t len;
+        int numMessages;                        /* in the current bundle */
+        double arrival[OSC_MAXMESSAGES];        /* of each message in the current bundle */
+        unsigned long sent;                     /* messages */
+        unicorn_latency_t *latency;             /* optional */
+} unicorn_osc_t;
+
+/* Open the socket to an address like "localhost:9000". */
+int unicorn_osc_open(unicorn_osc_t *osc, const char *address, int bundleSize, unicorn_latency_t *latency);
+
+/* Add one message with an int32 counter and n float32 values, this fails when the address in the path is
+ * longer than OSC_PATHLEN or there are too many values. The time of the first message in
+ * the bundle is used as its timetag, in seconds since 1970 as from unicorn_osc_wallclock. */
+int unicorn_osc_put(unicorn_osc_t *osc, const char *path, double time, int32_t counter, const float *dat, int n, double arrival);
+
+/* Send the current bundle. */
+int unicorn_osc_flush(unicorn_osc_t *osc);
+
+void unicorn_osc_close(unicorn_osc_t *osc);
+
+/* Return the current time in seconds since 1970. */
+double unicorn_osc_wallclock(void);
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * A pool with a fixed number of blocks that is allocated once, before the data starts to
+ * flow. The blocks are handed from the acquisition thread to the threads of the outputs
+ * with a reference count, so that streaming does not allocate or free any memory.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "unicorn_pool.h"
+
+/*******************************************************************************************************/
+int unicorn_pool_init(unicorn_pool_t *pool, int numBlocks, int numChannels, int capacity)
+{
+        size_t size = unicorn_block_size(numChannels, capacity);
+
+        memset(pool, 0, sizeof(unicorn_pool_t));
+        pool->block = calloc(numBlocks, sizeof(unicorn_block_t));
+        pool->memory = malloc(numBlocks * size + BLOCK_ALIGN);
+        if (pool->block == NULL || pool->memory == NULL) {
+                printf("Cannot allocate memory for %d blocks.\n", numBlocks);
+                unicorn_pool_free(pool);
+                return 1;
+        }
+        atomic_fetch_add(&unicorn_block_allocations, 2);
+
+        /* all blocks are placed in one piece of memory */
+        uintptr_t aligned = ((uintptr_t)pool->memory + BLOCK_ALIGN - 1) & ~(uintptr_t)(BLOCK_ALIGN - 1);
+        for (int i = 0; i < numBlocks; i++)
+                unicorn_block_place(&pool->block[i], numChannels, capacity, (void *)(aligned + i * size));
+        pool->numBlocks = numBlocks;
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+void unicorn_pool_free(unicorn_pool_t *pool)
+{
+        free(pool->block);
+        free(pool->memory);
+        memset(pool, 0, sizeof(unicorn_pool_t));
+}
+
+/*******************************************************************************************************/
+unicorn_block_t *unicorn_pool_acquire(unicorn_pool_t *pool)
+{
+        /* only this thread takes blocks from the pool, hence a block that is free stays free */
+        for (int i = 0; i < pool->numBlocks; i++) {
+                unicorn_block_t *block = &pool->block[(pool->next + i) % pool->numBlocks];
+                if (atomic_load_explicit(&block->references, memory_order_acquire) == 0) {
+                        pool->next = (pool->next + i + 1) % pool->numBlocks;
+                        atomic_store_explicit(&block->references, 1, memory_order_relaxed);
+                        unicorn_block_clear(block);
+                        return block;
+                }
+        }
+        return NULL;
+}
+
+/*******************************************************************************************************/
+void unicorn_pool_retain(unicorn_block_t *block)
+{
+        atomic_fetch_add_explicit(&block->references, 1, memory_order_relaxed);
+}
+
+/*******************************************************************************************************/
+void unicorn_pool_release(unicorn_block_t *block)
+{
+        /* the release ordering makes sure that the block is not reused while it is still being read */
+        atomic_fetch_sub_explicit(&block->references, 1, memory_order_release);
+}
+
+/*******************************************************************************************************/
+int unicorn_pool_available(unicorn_pool_t *pool)
+{
+        int available = 0;
+        for (int i = 0; i < pool->numBlocks; i++)
+                available += (atomic_load_explicit(&pool->block[i].references, memory_order_relaxed) == 0);
+        return available;
+}
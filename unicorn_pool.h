@@ -0,0 +1,50 @@
+/*
+ * A pool with a fixed number of blocks that is allocated once, before the data starts to
+ * flow. The blocks are handed from the acquisition thread to the threads of the outputs
+ * with a reference count, so that streaming does not allocate or free any memory.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_POOL_H
+#define UNICORN_POOL_H
+
+#include "unicorn_block.h"
+
+typedef struct {
+        unicorn_block_t *block;
+        int numBlocks;
+        int next;                       /* where the search for a free block starts */
+        void *memory;
+} unicorn_pool_t;
+
+/* Allocate all blocks with the same number of channels and capacity. */
+int unicorn_pool_init(unicorn_pool_t *pool, int numBlocks, int numChannels, int capacity);
+void unicorn_pool_free(unicorn_pool_t *pool);
+
+/* Get an empty block with one reference, this returns NULL when all blocks are in use. This
+ * should always be called from the same thread, the blocks can be released from any thread. */
+unicorn_block_t *unicorn_pool_acquire(unicorn_pool_t *pool);
+
+/* Add or remove a reference, the block returns to the pool when the last reference is released. */
+void unicorn_pool_retain(unicorn_block_t *block);
+void unicorn_pool_release(unicorn_block_t *block);
+
+/* Return the number of blocks that are not in use. */
+int unicorn_pool_available(unicorn_pool_t *pool);
+
+#endif
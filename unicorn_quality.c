@@ -0,0 +1,229 @@
+/*
+ * Signal quality of the EEG channels, this is computed over a sliding window that is
+ * updated at a reduced rate. For each channel it reports the RMS amplitude, the fraction
+ * of the variance that is due to line noise, whether the signal is flat or saturated, and
+ * the correlation with the head movements that are measured by the gyroscope.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "unicorn_quality.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* the largest value of the 24-bit ADC, expressed in uV */
+#define FULLSCALE   (8388607 * unicorn_resolution[0])
+
+const char *unicorn_quality_label[QUALITY_NUMMEASURES] = {"rms", "line", "flat", "saturated", "motion", "ok"};
+
+/*******************************************************************************************************/
+/* Helper function to compute the sums from scratch, this prevents the rounding errors from accumulating. */
+static void recompute(unicorn_quality_t *q)
+{
+        int oldest = q->count % QUALITY_WINDOW;
+
+        /* the new offset is the mean over the window */
+        q->motionOffset = 0;
+        for (int c = 0; c < QUALITY_NEEG; c++)
+                q->offset[c] = 0;
+        for (int m = 0; m < QUALITY_WINDOW; m++) {
+                q->motionOffset += q->motion[m] / QUALITY_WINDOW;
+                for (int c = 0; c < QUALITY_NEEG; c++)
+                        q->offset[c] += q->history[m][c] / QUALITY_WINDOW;
+        }
+
+        q->motionSum = 0;
+        q->motionSumSquares = 0;
+        for (int c = 0; c < QUALITY_NEEG; c++) {
+                q->sum[c] = 0;
+                q->sumSquares[c] = 0;
+                q->sumProduct[c] = 0;
+                q->lineRe[c] = 0;
+                q->lineIm[c] = 0;
+        }
+
+        for (int m = 0; m < QUALITY_WINDOW; m++) {
+                int i = (oldest + m) % QUALITY_WINDOW;
+                double phase = 2 * M_PI * ((q->lineBin * m) % QUALITY_WINDOW) / QUALITY_WINDOW;
+                double cosine = cos(phase), sine = sin(phase);
+                double motion = q->motion[i] - q->motionOffset;
+                q->motionSum += motion;
+                q->motionSumSquares += motion * motion;
+                for (int c = 0; c < QUALITY_NEEG; c++) {
+                        double x = q->history[i][c] - q->offset[c];
+                        q->sum[c] += x;
+                        q->sumSquares[c] += x * x;
+                        q->sumProduct[c] += x * motion;
+                        q->lineRe[c] += x * cosine;
+                        q->lineIm[c] -= x * sine;
+                }
+        }
+}
+
+/*******************************************************************************************************/
+void unicorn_quality_init(unicorn_quality_t *q, int rate, int lineFrequency)
+{
+        memset(q, 0, sizeof(unicorn_quality_t));
+        q->hop = max(1, FSAMPLE / max(1, rate));
+        q->lineBin = (int)lround((double)lineFrequency * QUALITY_WINDOW / FSAMPLE);
+        q->lineCos = cos(2 * M_PI * q->lineBin / QUALITY_WINDOW);
+        q->lineSin = sin(2 * M_PI * q->lineBin / QUALITY_WINDOW);
+}
+
+/*******************************************************************************************************/
+/* Helper function to add n samples, channel c of sample s is at dat[c*stride+s]. The samples should not cross the end of the window. */
+static void slide(unicorn_quality_t *q, const float *dat, size_t stride, int n)
+{
+        double motionOld[QUALITY_WINDOW], motionNew[QUALITY_WINDOW];
+
+        for (int s = 0; s < n; s++) {
+                int i = (q->count + s) % QUALITY_WINDOW;
+                /* head movements show up as rotations, the accelerometer is dominated by gravity */
+                float gx = dat[11 * stride + s], gy = dat[12 * stride + s], gz = dat[13 * stride + s];
+                float motion = sqrtf(gx*gx + gy*gy + gz*gz);
+                if (isnan(motion))
+                        motion = q->motion[(i + QUALITY_WINDOW - 1) % QUALITY_WINDOW];
+                motionOld[s] = q->motion[i] - q->motionOffset;
+                motionNew[s] = motion - q->motionOffset;
+                q->motionSum += motionNew[s] - motionOld[s];
+                q->motionSumSquares += motionNew[s] * motionNew[s] - motionOld[s] * motionOld[s];
+                q->motion[i] = motion;
+        }
+
+        /* each channel is processed for all samples, the sums are kept in local variables meanwhile */
+        for (int c = 0; c < QUALITY_NEEG; c++) {
+                const float *x = dat + c * stride;
+                double offset = q->offset[c], sum = q->sum[c], sumSquares = q->sumSquares[c], sumProduct = q->sumProduct[c];
+                double lineRe = q->lineRe[c], lineIm = q->lineIm[c];
+                float lastValue = q->lastValue[c];
+                unsigned long run = q->run[c];
+                int saturated = q->saturated[c];
+
+                for (int s = 0; s < n; s++) {
+                        float *oldest = &q->history[(q->count + s) % QUALITY_WINDOW][c];
+
+                        /* missing samples are replaced by the previous value */
+                        float value = (isnan(x[s]) ? lastValue : x[s]);
+                        run = (value == lastValue ? run + 1 : 0);
+                        lastValue = value;
+
+                        double old = *oldest - offset;
+                        double new = value - offset;
+                        sum += new - old;
+                        sumSquares += new * new - old * old;
+                        sumProduct += new * motionNew[s] - old * motionOld[s];
+                        saturated += (fabs(value) >= QUALITY_SATURATION * FULLSCALE) - (fabs(*oldest) >= QUALITY_SATURATION * FULLSCALE);
+
+                        /* the line frequency bin is updated with a sliding DFT, like the band power */
+                        double a = lineRe + (new - old);
+                        double b = lineIm;
+                        lineRe = a * q->lineCos - b * q->lineSin;
+                        lineIm = a * q->lineSin + b * q->lineCos;
+
+                        *oldest = value;
+                }
+
+                q->sum[c] = sum;
+                q->sumSquares[c] = sumSquares;
+                q->sumProduct[c] = sumProduct;
+                q->lineRe[c] = lineRe;
+                q->lineIm[c] = lineIm;
+                q->lastValue[c] = lastValue;
+                q->run[c] = run;
+                q->saturated[c] = saturated;
+        }
+        q->count += n;
+
+        if ((q->count % QUALITY_WINDOW) == 0)
+                recompute(q);
+}
+
+/*******************************************************************************************************/
+/* Helper function to compute the measures from the sums. */
+static void measures(const unicorn_quality_t *q, float *result)
+{
+        double motionMean = q->motionSum / QUALITY_WINDOW;
+        double motionVariance = max(0, q->motionSumSquares / QUALITY_WINDOW - motionMean * motionMean);
+
+        for (int c = 0; c < QUALITY_NEEG; c++) {
+                double mean = q->sum[c] / QUALITY_WINDOW;
+                double variance = max(0, q->sumSquares[c] / QUALITY_WINDOW - mean * mean);
+                /* the power of a sine wave at the line frequency, relative to the total variance */
+                double line = 2 * (q->lineRe[c] * q->lineRe[c] + q->lineIm[c] * q->lineIm[c]) / (QUALITY_WINDOW * QUALITY_WINDOW);
+                double correlation = 0;
+                if (variance > 0 && motionVariance > QUALITY_MINMOTION * QUALITY_MINMOTION)
+                        correlation = (q->sumProduct[c] / QUALITY_WINDOW - mean * motionMean) / sqrt(variance * motionVariance);
+
+                result[QUALITY_RMS*QUALITY_NEEG + c] = sqrt(variance);
+                result[QUALITY_LINE*QUALITY_NEEG + c] = (variance > 0 ? min(1, line / variance) : 0);
+                result[QUALITY_FLAT*QUALITY_NEEG + c] = (q->run[c] + 1 >= QUALITY_FLATLINE);
+                result[QUALITY_SATURATED*QUALITY_NEEG + c] = (float)q->saturated[c] / QUALITY_WINDOW;
+                result[QUALITY_MOTION*QUALITY_NEEG + c] = fabs(correlation);
+                result[QUALITY_OK*QUALITY_NEEG + c] =
+                        result[QUALITY_RMS*QUALITY_NEEG + c] <= QUALITY_MAXRMS &&
+                        result[QUALITY_LINE*QUALITY_NEEG + c] <= QUALITY_MAXLINE &&
+                        result[QUALITY_FLAT*QUALITY_NEEG + c] == 0 &&
+                        result[QUALITY_SATURATED*QUALITY_NEEG + c] == 0 &&
+                        result[QUALITY_MOTION*QUALITY_NEEG + c] <= QUALITY_MAXMOTION;
+        }
+}
+
+/*******************************************************************************************************/
+int unicorn_quality_put(unicorn_quality_t *q, const float *dat, float *result)
+{
+        slide(q, dat, 1, 1);
+
+        if (q->count < QUALITY_WINDOW || (q->count % q->hop) != 0)
+                return 0;
+
+        measures(q, result);
+        return 1;
+}
+
+/*******************************************************************************************************/
+int unicorn_quality_put_block(unicorn_quality_t *q, const unicorn_block_t *block, int first, int *position, float *result)
+{
+        while (*position < block->numSamples) {
+                /* the samples up to the next update or the end of the window are added together */
+                int n = block->numSamples - *position;
+                n = min(n, q->hop - (int)(q->count % q->hop));
+                n = min(n, QUALITY_WINDOW - (int)(q->count % QUALITY_WINDOW));
+                slide(q, unicorn_block_channel(block, first) + *position, block->stride, n);
+                *position += n;
+
+                if (q->count >= QUALITY_WINDOW && (q->count % q->hop) == 0) {
+                        measures(q, result);
+                        return 1;
+                }
+        }
+        return 0;
+}
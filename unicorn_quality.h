@@ -0,0 +1,85 @@
+/*
+ * Signal quality of the EEG channels, this is computed over a sliding window that is
+ * updated at a reduced rate. For each channel it reports the RMS amplitude, the fraction
+ * of the variance that is due to line noise, whether the signal is flat or saturated, and
+ * the correlation with the head movements that are measured by the gyroscope.
+ *
+ * All sums are updated incrementally with every sample, and recomputed from the history
+ * once per window to prevent rounding errors from accumulating.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_QUALITY_H
+#define UNICORN_QUALITY_H
+
+#include "unicorn.h"
+#include "unicorn_block.h"
+
+#define QUALITY_WINDOW      (FSAMPLE)   // in samples
+#define QUALITY_RATE        (2)         // updates per second
+#define QUALITY_LINEFREQ    (50)        // in Hz, use 60 in the Americas
+#define QUALITY_NEEG        (8)
+#define QUALITY_NUMMEASURES (6)
+
+/* These are the thresholds for the overall judgement of each channel. */
+#define QUALITY_MAXRMS      (100.0)         // in uV
+#define QUALITY_MAXLINE     (0.5)           // fraction of the variance
+#define QUALITY_FLATLINE    (FSAMPLE/5)     // number of identical samples
+#define QUALITY_SATURATION  (0.99)          // fraction of the ADC range
+#define QUALITY_MINMOTION   (5.0)           // in deg/s, below this the movements are not considered
+#define QUALITY_MAXMOTION   (0.5)           // correlation with the movements
+
+/* The measures are returned in this order, each for all EEG channels. */
+#define QUALITY_RMS         (0)
+#define QUALITY_LINE        (1)
+#define QUALITY_FLAT        (2)
+#define QUALITY_SATURATED   (3)
+#define QUALITY_MOTION      (4)
+#define QUALITY_OK          (5)
+
+extern const char *unicorn_quality_label[QUALITY_NUMMEASURES];
+
+typedef struct {
+        int hop;                        /* in samples between updates */
+        int lineBin;
+        double lineCos, lineSin;
+        float history[QUALITY_WINDOW][QUALITY_NEEG];
+        float motion[QUALITY_WINDOW];   /* the angular velocity of the head */
+        float lastValue[QUALITY_NEEG];
+        /* the sums are relative to an offset, which keeps them small */
+        double offset[QUALITY_NEEG], motionOffset;
+        double sum[QUALITY_NEEG], sumSquares[QUALITY_NEEG], sumProduct[QUALITY_NEEG];
+        double motionSum, motionSumSquares;
+        double lineRe[QUALITY_NEEG], lineIm[QUALITY_NEEG];
+        int saturated[QUALITY_NEEG];    /* number of samples in the window */
+        unsigned long run[QUALITY_NEEG];/* number of identical samples */
+        unsigned long count;
+} unicorn_quality_t;
+
+/* Initialize for the specified number of updates per second and the line frequency in Hz. */
+void unicorn_quality_init(unicorn_quality_t *quality, int rate, int lineFrequency);
+
+/* Add one sample with all 16 channels, this returns 1 when the quality has been updated.
+ * The quality is returned as quality[m*QUALITY_NEEG+c] for measure m and EEG channel c. */
+int unicorn_quality_put(unicorn_quality_t *quality, const float *dat, float *result);
+
+/* Add the samples of a block from the position onwards, the 16 channels of the device start at the first channel. This stops
+ * after the sample that completes an update and returns 1, call it again with the updated position for the rest of the block. */
+int unicorn_quality_put_block(unicorn_quality_t *quality, const unicorn_block_t *block, int first, int *position, float *result);
+
+#endif
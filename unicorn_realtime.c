@@ -0,0 +1,196 @@
+/*
+ * Options to give a thread a real-time scheduling priority, to pin it to one or more CPU
+ * cores, and to lock the memory of the process. These are requested from the operating
+ * system, which may grant them or not; the report says which options were granted.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE     // for pthread_setaffinity_np
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "unicorn_realtime.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+/*******************************************************************************************************/
+/* Helper function to parse a list of cores like "2", "2,3" or "0-3" into a bit mask, this returns 0 on failure. */
+static unsigned long long parse_cpus(const char *list)
+{
+        unsigned long long cpus = 0;
+        char *end;
+
+        while (*list) {
+                long first = strtol(list, &end, 10), last = first;
+                if (end == list)
+                        return 0;
+                if (*end == '-') {
+                        list = end + 1;
+                        last = strtol(list, &end, 10);
+                        if (end == list)
+                                return 0;
+                }
+                if (first < 0 || last < first || last >= REALTIME_MAXCPUS)
+                        return 0;
+                for (long c = first; c <= last; c++)
+                        cpus |= (1ULL << c);
+                if (*end == ',')
+                        end++;
+                else if (*end != 0)
+                        return 0;
+                list = end;
+        }
+
+        return cpus;
+}
+
+/*******************************************************************************************************/
+int unicorn_realtime_parse(unicorn_realtime_t *rt, const char *line)
+{
+        char copy[REALTIME_REPORTLEN];
+
+        memset(rt, 0, sizeof(unicorn_realtime_t));
+        rt->priority = REALTIME_PRIORITY;
+
+        strncpy(copy, line, REALTIME_REPORTLEN - 1);
+        copy[REALTIME_REPORTLEN - 1] = 0;
+
+        for (char *token = strtok(copy, " \t\r\n"); token; token = strtok(NULL, " \t\r\n")) {
+                char *value = strchr(token, ':');
+                if (value)
+                        *value++ = 0;
+
+                if (strcmp(token, "none") == 0)
+                        continue;
+                else if (strcmp(token, "fifo") == 0 || strcmp(token, "rr") == 0) {
+                        rt->policy = (strcmp(token, "fifo") == 0 ? REALTIME_FIFO : REALTIME_RR);
+                        if (value)
+                                rt->priority = min(max(1, atoi(value)), 99);
+                }
+                else if (strcmp(token, "cpu") == 0 && value) {
+                        if ((rt->cpus = parse_cpus(value)) == 0)
+                                return 1;
+                }
+                else if (strcmp(token, "audio") == 0 && value) {
+                        if ((rt->audioCpus = parse_cpus(value)) == 0)
+                                return 1;
+                }
+                else if (strcmp(token, "lock") == 0)
+                        rt->lockMemory = 1;
+                else
+                        return 1;
+        }
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+int unicorn_realtime_enabled(const unicorn_realtime_t *rt)
+{
+        return (rt->policy != REALTIME_OTHER || rt->cpus || rt->audioCpus || rt->lockMemory);
+}
+
+#ifndef _WIN32
+
+/*******************************************************************************************************/
+void unicorn_realtime_thread(const unicorn_realtime_t *rt, unsigned long long cpus, char *report, size_t len)
+{
+        size_t n = 0;
+
+        report[0] = 0;
+
+        if (rt->policy != REALTIME_OTHER) {
+                int policy = (rt->policy == REALTIME_FIFO ? SCHED_FIFO : SCHED_RR);
+                struct sched_param param;
+                param.sched_priority = min(max(rt->priority, sched_get_priority_min(policy)), sched_get_priority_max(policy));
+                int err = pthread_setschedparam(pthread_self(), policy, &param);
+                n += snprintf(report + n, len - n, "%s priority %d %s", (policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR"), param.sched_priority,
+                              (err == 0 ? "granted" : (err == EPERM ? "denied" : "failed")));
+        }
+
+        if (cpus && n < len) {
+                n += snprintf(report + n, len - n, "%sCPU", (n ? ", " : ""));
+                for (int c = 0; c < REALTIME_MAXCPUS && n < len; c++)
+                        if (cpus & (1ULL << c))
+                                n += snprintf(report + n, len - n, " %d", c);
+#ifdef __linux__
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                for (int c = 0; c < REALTIME_MAXCPUS; c++)
+                        if (cpus & (1ULL << c))
+                                CPU_SET(c, &set);
+                int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+                if (n < len)
+                        snprintf(report + n, len - n, " %s", (err == 0 ? "granted" : "failed"));
+#else
+                if (n < len)
+                        snprintf(report + n, len - n, " not supported");
+#endif
+        }
+}
+
+/*******************************************************************************************************/
+void unicorn_realtime_start(const unicorn_realtime_t *rt)
+{
+        char report[REALTIME_REPORTLEN];
+
+        if (!unicorn_realtime_enabled(rt))
+                return;
+
+        if (rt->policy != REALTIME_OTHER || rt->cpus) {
+                unicorn_realtime_thread(rt, rt->cpus, report, REALTIME_REPORTLEN);
+                printf("Acquisition thread: %s.\n", report);
+        }
+
+        /* the memory that is allocated later is also locked, so that it is never paged out */
+        if (rt->lockMemory) {
+                if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+                        printf("Memory locking granted.\n");
+                else
+                        printf("Memory locking %s: %s\n", (errno == EPERM || errno == ENOMEM ? "denied" : "failed"), strerror(errno));
+        }
+}
+
+#else
+
+/*******************************************************************************************************/
+void unicorn_realtime_thread(const unicorn_realtime_t *rt, unsigned long long cpus, char *report, size_t len)
+{
+        snprintf(report, len, "real-time options not supported");
+}
+
+/*******************************************************************************************************/
+void unicorn_realtime_start(const unicorn_realtime_t *rt)
+{
+        if (unicorn_realtime_enabled(rt))
+                printf("Real-time options are not supported on Windows.\n");
+}
+
+#endif
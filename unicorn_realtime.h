@@ -0,0 +1,61 @@
+/*
+ * Options to give a thread a real-time scheduling priority, to pin it to one or more CPU
+ * cores, and to lock the memory of the process. These are requested from the operating
+ * system, which may grant them or not; the report says which options were granted.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_REALTIME_H
+#define UNICORN_REALTIME_H
+
+#include <stddef.h>
+
+#define REALTIME_OTHER      (0)
+#define REALTIME_FIFO       (1)
+#define REALTIME_RR         (2)
+#define REALTIME_PRIORITY   (50)
+#define REALTIME_MAXCPUS    (64)
+#define REALTIME_REPORTLEN  (256)
+
+/* These are the steps for options that are applied by another thread, such as the audio callback. */
+#define REALTIME_REQUESTED  (1)
+#define REALTIME_APPLIED    (2)
+#define REALTIME_REPORTED   (3)
+
+typedef struct {
+        int policy;                     /* REALTIME_OTHER, REALTIME_FIFO or REALTIME_RR */
+        int priority;                   /* between 1 and 99 on Linux */
+        unsigned long long cpus;        /* one bit per core for the acquisition thread, 0 is any core */
+        unsigned long long audioCpus;   /* one bit per core for the audio threads, 0 is any core */
+        int lockMemory;
+} unicorn_realtime_t;
+
+/* Parse a line like "fifo:80 cpu:2,3 audio:1 lock", this returns 0 on success and 1 if the line cannot be parsed. */
+int unicorn_realtime_parse(unicorn_realtime_t *rt, const char *line);
+
+/* Return 1 when any of the options is set. */
+int unicorn_realtime_enabled(const unicorn_realtime_t *rt);
+
+/* Apply the scheduling options and the cores to the calling thread, and describe what was granted. This
+ * does not print anything, hence it can be called from an audio callback. */
+void unicorn_realtime_thread(const unicorn_realtime_t *rt, unsigned long long cpus, char *report, size_t len);
+
+/* Apply the options to the acquisition thread and lock the memory, and print what was granted. */
+void unicorn_realtime_start(const unicorn_realtime_t *rt);
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ * Writer for the shared-memory ring buffer.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "unicorn_shm.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+#ifndef _WIN32
+
+/*******************************************************************************************************/
+int unicorn_shm_create(unicorn_shm_t *shm, const char *name, int numChannels, int capacity, double fsample, const char **label)
+{
+        memset(shm, 0, sizeof(unicorn_shm_t));
+
+        if (numChannels > SHM_MAXCHANS) {
+                printf("Too many channels for shared memory.\n");
+                return 1;
+        }
+
+        /* the data and the timestamps are aligned on 64 bytes */
+        size_t dataOffset = (sizeof(unicorn_shm_header_t) + 63) / 64 * 64;
+        size_t timeOffset = (dataOffset + (size_t)capacity * numChannels * sizeof(float) + 63) / 64 * 64;
+        shm->size = timeOffset + (size_t)capacity * sizeof(double);
+
+        /* a shared memory object that remains from a previous run is replaced */
+        shm_unlink(name);
+        if ((shm->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0)
+                goto error;
+        if (ftruncate(shm->fd, shm->size) != 0)
+                goto error;
+
+        void *ptr = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+        if (ptr == MAP_FAILED)
+                goto error;
+
+        shm->name = strdup(name);
+        shm->header = (unicorn_shm_header_t *)ptr;
+        shm->data = (float *)((char *)ptr + dataOffset);
+        shm->time = (double *)((char *)ptr + timeOffset);
+
+        unicorn_shm_header_t *header = shm->header;
+        header->numChannels = numChannels;
+        header->capacity = capacity;
+        header->fsample = fsample;
+        header->dataOffset = dataOffset;
+        header->timeOffset = timeOffset;
+        for (int i = 0; i < numChannels && label; i++)
+                snprintf(header->label[i], SHM_LABELLEN, "%s", label[i]);
+        header->version = SHM_VERSION;
+
+        /* the magic number is written last, readers check it to see whether the header is complete */
+        __atomic_store_n(&header->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+        printf("Created shared memory %s with %d channels and %d frames.\n", name, numChannels, capacity);
+        return 0;
+
+error:
+        printf("Cannot create shared memory %s: %s\n", name, strerror(errno));
+        if (shm->fd >= 0) {
+                close(shm->fd);
+                shm_unlink(name);
+        }
+        shm->fd = -1;
+        return 1;
+}
+
+/*******************************************************************************************************/
+void unicorn_shm_write(unicorn_shm_t *shm, const float *dat, unsigned long counter, double time)
+{
+        unicorn_shm_header_t *header = shm->header;
+        uint64_t index = header->writeIndex;
+        uint64_t slot = index % header->capacity;
+
+        if (index == 0)
+                header->firstCounter = counter;
+
+        memcpy(shm->data + slot * header->numChannels, dat, header->numChannels * sizeof(float));
+        shm->time[slot] = time;
+
+        /* the frame becomes visible to the readers after it has been written completely */
+        __atomic_store_n(&header->writeIndex, index + 1, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************************************/
+void unicorn_shm_destroy(unicorn_shm_t *shm)
+{
+        if (shm->header)
+                munmap(shm->header, shm->size);
+        if (shm->fd >= 0)
+                close(shm->fd);
+        if (shm->name) {
+                shm_unlink(shm->name);
+                free(shm->name);
+        }
+        memset(shm, 0, sizeof(unicorn_shm_t));
+        shm->fd = -1;
+}
+
+#else
+
+/*******************************************************************************************************/
+int unicorn_shm_create(unicorn_shm_t *shm, const char *name, int numChannels, int capacity, double fsample, const char **label)
+{
+        memset(shm, 0, sizeof(unicorn_shm_t));
+        printf("Shared memory is not available on Windows.\n");
+        return 1;
+}
+
+void unicorn_shm_write(unicorn_shm_t *shm, const float *dat, unsigned long counter, double time)
+{
+}
+
+void unicorn_shm_destroy(unicorn_shm_t *shm)
+{
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Writer for the shared-memory ring buffer, the layout is described in unicorn_shm_reader.h.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_SHM_H
+#define UNICORN_SHM_H
+
+#include "unicorn.h"
+#include "unicorn_shm_reader.h"
+
+#define SHM_DEFAULTNAME   "/unicorn"
+#define SHM_CAPACITY      (60*FSAMPLE)  // in frames, i.e. one minute
+
+typedef struct {
+        char *name;
+        int fd;
+        size_t size;
+        unicorn_shm_header_t *header;
+        float *data;
+        double *time;
+} unicorn_shm_t;
+
+/* Create the shared memory like "/unicorn", the channel labels are optional. This returns 0 on success. */
+int unicorn_shm_create(unicorn_shm_t *shm, const char *name, int numChannels, int capacity, double fsample, const char **label);
+
+/* Add one frame with its hardware counter and arrival time. */
+void unicorn_shm_write(unicorn_shm_t *shm, const float *dat, unsigned long counter, double time);
+
+/* Unmap and remove the shared memory, readers that still have it open can continue to use it. */
+void unicorn_shm_destroy(unicorn_shm_t *shm);
+
+#endif
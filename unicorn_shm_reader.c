@@ -0,0 +1,211 @@
+/*
+ * Reader for the shared-memory ring buffer that is written by unicorn2shm.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "unicorn_shm_reader.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+#ifndef _WIN32
+
+/*******************************************************************************************************/
+/* Helper function to get the number of frames that the writer has published. */
+static uint64_t write_index(const unicorn_shm_reader_t *reader)
+{
+        return __atomic_load_n(&reader->header->writeIndex, __ATOMIC_ACQUIRE);
+}
+
+/*******************************************************************************************************/
+/* Helper function to skip the frames that have been overwritten, one frame is kept free for the writer. */
+static void skip_lost(unicorn_shm_reader_t *reader, uint64_t writeIndex)
+{
+        uint64_t capacity = reader->header->capacity;
+        if (writeIndex - reader->readIndex >= capacity) {
+                reader->lost += writeIndex - reader->readIndex - (capacity - 1);
+                reader->readIndex = writeIndex - (capacity - 1);
+        }
+}
+
+/*******************************************************************************************************/
+/* Helper function to check that the header describes a ring buffer that fits in the shared memory. */
+static int valid_header(const unicorn_shm_header_t *header, uint64_t size)
+{
+        if (header->magic != SHM_MAGIC || header->version != SHM_VERSION)
+                return 0;
+        if (header->numChannels == 0 || header->numChannels > SHM_MAXCHANS || header->capacity < 2)
+                return 0;
+        if (header->dataOffset < sizeof(unicorn_shm_header_t) || header->dataOffset % sizeof(float) != 0 || header->dataOffset > size)
+                return 0;
+        if (header->timeOffset < sizeof(unicorn_shm_header_t) || header->timeOffset % sizeof(double) != 0 || header->timeOffset > size)
+                return 0;
+        /* the offsets are not larger than the size, hence these do not overflow */
+        if ((uint64_t)header->capacity * header->numChannels * sizeof(float) > size - header->dataOffset)
+                return 0;
+        if ((uint64_t)header->capacity * sizeof(double) > size - header->timeOffset)
+                return 0;
+        return 1;
+}
+
+/*******************************************************************************************************/
+int unicorn_shm_open(unicorn_shm_reader_t *reader, const char *name)
+{
+        struct stat st;
+        unicorn_shm_header_t header;
+
+        memset(reader, 0, sizeof(unicorn_shm_reader_t));
+
+        if ((reader->fd = shm_open(name, O_RDONLY, 0)) < 0)
+                return 1;
+        if (fstat(reader->fd, &st) != 0 || st.st_size < (off_t)sizeof(unicorn_shm_header_t)) {
+                close(reader->fd);
+                return 1;
+        }
+
+        /* the header is checked before the memory is mapped, so that no frame can be outside of it */
+        if (pread(reader->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || !valid_header(&header, st.st_size)) {
+                close(reader->fd);
+                return 1;
+        }
+
+        reader->size = st.st_size;
+        void *ptr = mmap(NULL, reader->size, PROT_READ, MAP_SHARED, reader->fd, 0);
+        if (ptr == MAP_FAILED) {
+                close(reader->fd);
+                return 1;
+        }
+
+        reader->header = (const unicorn_shm_header_t *)ptr;
+        reader->data = (const float *)((const char *)ptr + reader->header->dataOffset);
+        reader->time = (const double *)((const char *)ptr + reader->header->timeOffset);
+        reader->readIndex = write_index(reader);
+        return 0;
+}
+
+/*******************************************************************************************************/
+void unicorn_shm_close(unicorn_shm_reader_t *reader)
+{
+        if (reader->header)
+                munmap((void *)reader->header, reader->size);
+        if (reader->fd >= 0)
+                close(reader->fd);
+        reader->header = NULL;
+        reader->fd = -1;
+}
+
+/*******************************************************************************************************/
+uint64_t unicorn_shm_available(unicorn_shm_reader_t *reader)
+{
+        uint64_t writeIndex = write_index(reader);
+        skip_lost(reader, writeIndex);
+        return writeIndex - reader->readIndex;
+}
+
+/*******************************************************************************************************/
+const float *unicorn_shm_peek(unicorn_shm_reader_t *reader, double *time)
+{
+        if (unicorn_shm_available(reader) == 0)
+                return NULL;
+
+        uint64_t slot = reader->readIndex % reader->header->capacity;
+        if (time)
+                *time = reader->time[slot];
+        return reader->data + slot * reader->header->numChannels;
+}
+
+/*******************************************************************************************************/
+int unicorn_shm_advance(unicorn_shm_reader_t *reader)
+{
+        /* the frame is still valid if the writer did not come around to it in the meantime */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t writeIndex = write_index(reader);
+        int overwritten = (writeIndex - reader->readIndex >= reader->header->capacity - 1);
+
+        reader->readIndex++;
+        if (overwritten)
+                reader->lost++;
+        skip_lost(reader, writeIndex);
+        return overwritten;
+}
+
+/*******************************************************************************************************/
+size_t unicorn_shm_read(unicorn_shm_reader_t *reader, float *dat, double *time, size_t maxFrames)
+{
+        size_t numFrames = 0;
+        uint32_t numChannels = reader->header->numChannels;
+
+        while (numFrames < maxFrames) {
+                double t;
+                const float *frame = unicorn_shm_peek(reader, &t);
+                if (frame == NULL)
+                        break;
+                memcpy(dat + numFrames * numChannels, frame, numChannels * sizeof(float));
+                if (time)
+                        time[numFrames] = t;
+                /* a frame that was overwritten while copying is not returned */
+                if (unicorn_shm_advance(reader) == 0)
+                        numFrames++;
+        }
+
+        return numFrames;
+}
+
+#else
+
+/*******************************************************************************************************/
+int unicorn_shm_open(unicorn_shm_reader_t *reader, const char *name)
+{
+        return 1;
+}
+
+void unicorn_shm_close(unicorn_shm_reader_t *reader)
+{
+}
+
+uint64_t unicorn_shm_available(unicorn_shm_reader_t *reader)
+{
+        return 0;
+}
+
+const float *unicorn_shm_peek(unicorn_shm_reader_t *reader, double *time)
+{
+        return NULL;
+}
+
+int unicorn_shm_advance(unicorn_shm_reader_t *reader)
+{
+        return 1;
+}
+
+size_t unicorn_shm_read(unicorn_shm_reader_t *reader, float *dat, double *time, size_t maxFrames)
+{
+        return 0;
+}
+
+#endif
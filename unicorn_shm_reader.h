@@ -0,0 +1,85 @@
+/*
+ * Reader for the shared-memory ring buffer that is written by unicorn2shm. This only
+ * depends on the C library, hence it can be copied into other projects.
+ *
+ * The shared memory starts with the header below, followed by the data as capacity
+ * frames of numChannels float32 values, followed by capacity float64 timestamps in
+ * seconds of the monotonic clock. Frame i is stored at position i % capacity. The writer
+ * publishes a frame by incrementing writeIndex after it has been written. Readers keep
+ * their own read index, hence any number of readers can follow the data at their own pace.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_SHM_READER_H
+#define UNICORN_SHM_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHM_MAGIC       (0x554E4943)    // "UNIC"
+#define SHM_VERSION     (1)
+#define SHM_MAXCHANS    (272)           // 16 devices with 16 channels and a gap flag
+#define SHM_LABELLEN    (16)
+
+typedef struct {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t numChannels;
+        uint32_t capacity;              /* in frames */
+        double fsample;
+        uint64_t firstCounter;          /* hardware counter of frame 0 */
+        uint64_t writeIndex;            /* number of frames that have been written, only access this atomically */
+        uint64_t dataOffset;            /* in bytes from the start of the shared memory */
+        uint64_t timeOffset;
+        char label[SHM_MAXCHANS][SHM_LABELLEN];
+} unicorn_shm_header_t;
+
+typedef struct {
+        int fd;
+        size_t size;
+        const unicorn_shm_header_t *header;
+        const float *data;
+        const double *time;
+        uint64_t readIndex;
+        uint64_t lost;                  /* frames that were overwritten before they were read */
+} unicorn_shm_reader_t;
+
+/* Open the shared memory like "/unicorn", reading starts at the newest frame. This returns 0 on success. */
+int unicorn_shm_open(unicorn_shm_reader_t *reader, const char *name);
+void unicorn_shm_close(unicorn_shm_reader_t *reader);
+
+/* Return the number of frames that can be read. */
+uint64_t unicorn_shm_available(unicorn_shm_reader_t *reader);
+
+/* Return a pointer to the next frame in the shared memory without copying it, or NULL when there is none.
+ * After using the frame, unicorn_shm_advance returns 0 if it was still valid, or 1 if the writer overwrote it. */
+const float *unicorn_shm_peek(unicorn_shm_reader_t *reader, double *time);
+int unicorn_shm_advance(unicorn_shm_reader_t *reader);
+
+/* Copy up to maxFrames frames and their timestamps, the time is optional. This returns the number of frames. */
+size_t unicorn_shm_read(unicorn_shm_reader_t *reader, float *dat, double *time, size_t maxFrames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,279 @@
+/*
+ * Network sink that sends the samples in a compact binary format over UDP or TCP.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE     // for sendmmsg
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+
+#include "unicorn_net.h"
+#include "unicorn_stream.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#include <winsock2.h>
+#endif
+
+/*******************************************************************************************************/
+/* Helper functions to write little-endian values. */
+static unsigned char *put16(unsigned char *ptr, uint16_t val)
+{
+        ptr[0] = val & 0xFF;
+        ptr[1] = (val >> 8) & 0xFF;
+        return ptr + 2;
+}
+
+static unsigned char *put32(unsigned char *ptr, uint32_t val)
+{
+        ptr[0] = val & 0xFF;
+        ptr[1] = (val >> 8) & 0xFF;
+        ptr[2] = (val >> 16) & 0xFF;
+        ptr[3] = (val >> 24) & 0xFF;
+        return ptr + 4;
+}
+
+/*******************************************************************************************************/
+/* Helper function to close the message that is being filled, so that it is sent with the next batch. */
+static void finish_message(unicorn_stream_t *stream)
+{
+        unicorn_stream_message_t *message = &stream->message[stream->numMessages];
+        put16(message->buf + 6, message->numFrames);
+        stream->numMessages++;
+}
+
+/*******************************************************************************************************/
+/* Helper function to send all complete messages with as few system calls as possible. */
+static int send_messages(unicorn_stream_t *stream)
+{
+        int result = 0;
+
+#if defined __linux__
+        struct mmsghdr msg[STREAM_QUEUE];
+        struct iovec iov[STREAM_QUEUE];
+        memset(msg, 0, sizeof(msg));
+        for (int i = 0; i < stream->numMessages; i++) {
+                iov[i].iov_base = stream->message[i].buf;
+                iov[i].iov_len = stream->message[i].len;
+                msg[i].msg_hdr.msg_iov = &iov[i];
+                msg[i].msg_hdr.msg_iovlen = 1;
+        }
+#elif !defined _WIN32
+        struct iovec iov[STREAM_QUEUE];
+        for (int i = 0; i < stream->numMessages; i++) {
+                iov[i].iov_base = stream->message[i].buf;
+                iov[i].iov_len = stream->message[i].len;
+        }
+#endif
+
+        if (stream->protocol == STREAM_UDP) {
+                /* datagrams that cannot be delivered are lost, the receiver notices that from the sequence number */
+#if defined __linux__
+                int done = 0;
+                while (done < stream->numMessages) {
+                        int n = sendmmsg(stream->fd, msg + done, stream->numMessages - done, 0);
+                        if (n < 0 && errno == EINTR)
+                                continue;
+                        if (n <= 0) {
+                                done++;
+                                continue;
+                        }
+                        done += n;
+                }
+#else
+                for (int i = 0; i < stream->numMessages; i++)
+                        send(stream->fd, (const char *)stream->message[i].buf, stream->message[i].len, 0);
+#endif
+        }
+        else {
+                /* over TCP all messages are written at once */
+#if defined _WIN32
+                for (int i = 0; i < stream->numMessages && result == 0; i++)
+                        result = unicorn_send_all(stream->fd, stream->message[i].buf, stream->message[i].len);
+#else
+                int first = 0;
+                while (first < stream->numMessages) {
+                        ssize_t n = writev(stream->fd, iov + first, stream->numMessages - first);
+                        if (n < 0 && errno == EINTR)
+                                continue;
+                        if (n <= 0) {
+                                result = 1;
+                                break;
+                        }
+                        /* skip the parts that have been written */
+                        while (first < stream->numMessages && (size_t)n >= iov[first].iov_len) {
+                                n -= iov[first].iov_len;
+                                first++;
+                        }
+                        if (first < stream->numMessages) {
+                                iov[first].iov_base = (char *)iov[first].iov_base + n;
+                                iov[first].iov_len -= n;
+                        }
+                }
+#endif
+                if (result)
+                        printf("Lost connection to the receiver.\n");
+        }
+
+        double now = unicorn_clock();
+        for (int i = 0; i < stream->numMessages; i++) {
+                unicorn_stream_message_t *message = &stream->message[i];
+                for (int j = 0; j < message->numFrames && stream->latency; j++)
+                        unicorn_latency_record(stream->latency, now - message->arrival[j]);
+                stream->sent += message->numFrames;
+                message->numFrames = 0;
+                message->len = 0;
+        }
+        stream->numMessages = 0;
+
+        return result;
+}
+
+/*******************************************************************************************************/
+int unicorn_stream_open(unicorn_stream_t *stream, const char *address, int format, int numChannels, int batch, const double *resolution, unicorn_latency_t *latency)
+{
+        char host[NETLEN];
+        int port;
+
+        memset(stream, 0, sizeof(unicorn_stream_t));
+        stream->format = format;
+        stream->numChannels = min(numChannels, STREAM_MAXCHANS);
+        stream->batch = max(1, min(batch, STREAM_BATCH));
+        stream->latency = latency;
+        for (int i = 0; i < stream->numChannels; i++)
+                stream->resolution[i] = (resolution ? resolution[i] : 1);
+
+        if (strncmp(address, "tcp://", 6) == 0) {
+                stream->protocol = STREAM_TCP;
+                address += 6;
+        }
+        else if (strncmp(address, "udp://", 6) == 0) {
+                stream->protocol = STREAM_UDP;
+                address += 6;
+        }
+
+        unicorn_net_address(address, STREAM_DEFAULTHOST, STREAM_DEFAULTPORT, host, &port);
+        if (stream->protocol == STREAM_TCP)
+                stream->fd = unicorn_tcp_connect(host, port);
+        else
+                stream->fd = unicorn_udp_open(host, port);
+        if (stream->fd < 0)
+                return 1;
+
+        size_t size = STREAM_HEADERSIZE + stream->batch * (4 + stream->numChannels * (format == STREAM_INT24 ? 3 : 4));
+        for (int i = 0; i < STREAM_QUEUE; i++) {
+                if ((stream->message[i].buf = malloc(size)) == NULL) {
+                        printf("Cannot allocate memory.\n");
+                        unicorn_stream_close(stream);
+                        return 1;
+                }
+        }
+
+        printf("Streaming %s to %s://%s:%d.\n", (format == STREAM_INT24 ? "int24" : "float32"), (stream->protocol == STREAM_TCP ? "tcp" : "udp"), host, port);
+        return 0;
+}
+
+/*******************************************************************************************************/
+int unicorn_stream_put(unicorn_stream_t *stream, const float *dat, uint32_t counter, double arrival)
+{
+        unicorn_stream_message_t *message = &stream->message[stream->numMessages];
+        unsigned char *ptr;
+
+        if (message->numFrames == 0) {
+                ptr = message->buf;
+                ptr = put16(ptr, STREAM_MAGIC);
+                *ptr++ = STREAM_VERSION;
+                *ptr++ = stream->format;
+                ptr = put16(ptr, stream->numChannels);
+                ptr = put16(ptr, 0);
+                ptr = put32(ptr, stream->sequence);
+                message->len = ptr - message->buf;
+                message->started = unicorn_clock();
+        }
+
+        ptr = put32(message->buf + message->len, counter);
+        for (int i = 0; i < stream->numChannels; i++) {
+                if (stream->format == STREAM_FLOAT32) {
+                        uint32_t val;
+                        memcpy(&val, &dat[i], 4);
+                        ptr = put32(ptr, val);
+                }
+                else {
+                        long val = STREAM_MISSING;
+                        if (!isnan(dat[i]))
+                                val = max(-8388607, min(8388607, lround(dat[i] / stream->resolution[i])));
+                        *ptr++ = val & 0xFF;
+                        *ptr++ = (val >> 8) & 0xFF;
+                        *ptr++ = (val >> 16) & 0xFF;
+                }
+        }
+        message->len = ptr - message->buf;
+        message->arrival[message->numFrames++] = arrival;
+        stream->sequence++;
+
+        if (message->numFrames == stream->batch) {
+                finish_message(stream);
+                if (stream->numMessages == STREAM_QUEUE)
+                        return send_messages(stream);
+        }
+
+        return 0;
+}
+
+/*******************************************************************************************************/
+int unicorn_stream_send(unicorn_stream_t *stream, double now)
+{
+        unicorn_stream_message_t *message = &stream->message[stream->numMessages];
+        if (message->numFrames > 0 && now - message->started >= STREAM_MAXWAIT)
+                finish_message(stream);
+        if (stream->numMessages == 0)
+                return 0;
+        return send_messages(stream);
+}
+
+/*******************************************************************************************************/
+int unicorn_stream_flush(unicorn_stream_t *stream)
+{
+        if (stream->message[stream->numMessages].numFrames > 0)
+                finish_message(stream);
+        if (stream->numMessages == 0)
+                return 0;
+        return send_messages(stream);
+}
+
+/*******************************************************************************************************/
+void unicorn_stream_close(unicorn_stream_t *stream)
+{
+        unicorn_net_close(stream->fd);
+        stream->fd = -1;
+        for (int i = 0; i < STREAM_QUEUE; i++) {
+                free(stream->message[i].buf);
+                stream->message[i].buf = NULL;
+        }
+}
@@ -0,0 +1,95 @@
+/*
+ * Network sink that sends the samples in a compact binary format over UDP, which can be
+ * multicast, or over TCP.
+ *
+ * Each message starts with a 12-byte header, followed by numFrames frames. Each frame
+ * consists of the 32-bit hardware counter, followed by numChannels values that are either
+ * float32, or int24 in units of the resolution of the channel. All values are little-endian.
+ *
+ *   uint16  magic         0x5543
+ *   uint8   version       1
+ *   uint8   format        1 for int24, 2 for float32
+ *   uint16  numChannels
+ *   uint16  numFrames
+ *   uint32  sequence      of the first frame, this increments by one for every frame
+ *
+ * Missing values are sent as NaN in float32, or as -8388608 in int24. Over UDP every
+ * message is a single datagram, over TCP the messages follow each other.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_STREAM_H
+#define UNICORN_STREAM_H
+
+#include <stdint.h>
+
+#include "unicorn.h"
+#include "unicorn_latency.h"
+
+#define STREAM_DEFAULTHOST    "239.255.0.250"
+#define STREAM_DEFAULTPORT    (5250)
+#define STREAM_MAGIC          (0x5543)
+#define STREAM_VERSION        (1)
+#define STREAM_INT24          (1)
+#define STREAM_FLOAT32        (2)
+#define STREAM_UDP            (0)
+#define STREAM_TCP            (1)
+#define STREAM_HEADERSIZE     (12)
+#define STREAM_MISSING        (-8388608)
+#define STREAM_BATCH          (8)       // maximum number of frames per message
+#define STREAM_QUEUE          (32)      // maximum number of messages that are sent at once
+#define STREAM_MAXWAIT        (0.05)    // in seconds, how long an incomplete message waits for more frames
+#define STREAM_MAXCHANS       (MAXDEVICES*(NCHANS+1))
+
+typedef struct {
+        unsigned char *buf;
+        size_t len;
+        int numFrames;
+        double arrival[STREAM_BATCH];
+        double started;                 /* when the first frame was added, the arrival can be earlier for downsampled or replayed data */
+} unicorn_stream_message_t;
+
+typedef struct {
+        int fd;
+        int protocol;
+        int format;
+        int numChannels;
+        int batch;
+        double resolution[STREAM_MAXCHANS];
+        uint32_t sequence;
+        unicorn_stream_message_t message[STREAM_QUEUE];
+        int numMessages;                /* complete messages that are waiting to be sent */
+        unsigned long sent;             /* frames */
+        unicorn_latency_t *latency;     /* optional */
+} unicorn_stream_t;
+
+/* Open the stream to an address like "udp://239.255.0.250:5250" or "tcp://localhost:5250", the resolution is needed for int24. */
+int unicorn_stream_open(unicorn_stream_t *stream, const char *address, int format, int numChannels, int batch, const double *resolution, unicorn_latency_t *latency);
+
+/* Add one frame with its counter and arrival time, this sends the messages when the queue is full. */
+int unicorn_stream_put(unicorn_stream_t *stream, const float *dat, uint32_t counter, double arrival);
+
+/* Send the complete messages, an incomplete message is only sent when its first frame has waited too long. The time is from unicorn_clock. */
+int unicorn_stream_send(unicorn_stream_t *stream, double now);
+
+/* Send all frames that are waiting, including an incomplete message. */
+int unicorn_stream_flush(unicorn_stream_t *stream);
+
+void unicorn_stream_close(unicorn_stream_t *stream);
+
+#endif
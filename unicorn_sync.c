@@ -0,0 +1,196 @@
+/*
+ * Alignment of the samples from multiple Unicorn devices on a common timeline.
+ *
+ * Each device has its own clock that drifts relative to the host. The hardware counter
+ * in each packet is compared to the host arrival time to estimate the offset and the
+ * sample period of each device with an alpha-beta filter. The samples of all devices
+ * are then interpolated on a common timeline at the nominal sampling rate of the host.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "unicorn_sync.h"
+
+#if defined __linux__ || defined __APPLE__
+// Linux and macOS code goes here
+#include <unistd.h>
+#define min(x, y) ((x)<(y) ? x : y)
+#define max(x, y) ((x)>(y) ? x : y)
+#elif defined _WIN32
+// Windows code goes here
+#endif
+
+/* Helper function to access the samples in the ring buffer, 0 is the oldest. */
+#define SAMPLE(d, i) (&(d)->sample[((d)->head + (i)) % SYNC_BUFSIZE])
+
+/*******************************************************************************************************/
+void unicorn_sync_init(unicorn_sync_t *sync, int numDevices, unicorn_sync_callback_t callback, void *userData)
+{
+        memset(sync, 0, sizeof(unicorn_sync_t));
+        sync->numDevices = numDevices;
+        sync->callback = callback;
+        sync->userData = userData;
+        for (int i = 0; i < numDevices; i++)
+                sync->device[i].period = 1.0 / FSAMPLE;
+}
+
+/*******************************************************************************************************/
+/* Update the clock estimate of one device and return the estimated time of the sample. */
+static double update_clock(unicorn_sync_device_t *dev, unsigned long counter, double arrival)
+{
+        if (dev->numSamples == 0 || counter <= dev->lastCounter || counter - dev->lastCounter > 10*FSAMPLE) {
+                /* start again when the counter is reset or when the device was disconnected for a long time */
+                dev->numSamples = 1;
+                dev->lastCounter = counter;
+                dev->lastTime = arrival;
+                return arrival;
+        }
+
+        unsigned long delta = counter - dev->lastCounter;
+        double predicted = dev->lastTime + delta * dev->period;
+        double error = arrival - predicted;
+
+        /* the first samples are weighted more, so that the estimate converges quickly */
+        double alpha = max(SYNC_ALPHA, 1.0 / (dev->numSamples + 1));
+        double beta  = max(SYNC_BETA, 1.0 / ((dev->numSamples + 1) * (dev->numSamples + 1)));
+
+        dev->lastTime = predicted + alpha * error;
+        dev->period += beta * error / delta;
+        dev->lastCounter = counter;
+        dev->numSamples++;
+
+        /* do not let the period run away by more than 1% */
+        dev->period = min(dev->period, 1.01 / FSAMPLE);
+        dev->period = max(dev->period, 0.99 / FSAMPLE);
+
+        return dev->lastTime;
+}
+
+/*******************************************************************************************************/
+/* Interpolate the samples of one device at the specified time, this returns SYNC_OK or SYNC_GAP. */
+static int interpolate(unicorn_sync_device_t *dev, double time, float *dat)
+{
+        /* drop the samples that are not needed any more, keep the last one before the requested time */
+        while (dev->count >= 2 && SAMPLE(dev, 1)->time <= time) {
+                dev->head = (dev->head + 1) % SYNC_BUFSIZE;
+                dev->count--;
+        }
+
+        if (dev->count >= 2 && SAMPLE(dev, 0)->time <= time) {
+                unicorn_sync_sample_t *a = SAMPLE(dev, 0);
+                unicorn_sync_sample_t *b = SAMPLE(dev, 1);
+                if (b->counter - a->counter == 1) {
+                        float w = (time - a->time) / (b->time - a->time);
+                        for (int ch = 0; ch < NCHANS; ch++)
+                                dat[ch] = (1.0f - w) * a->dat[ch] + w * b->dat[ch];
+                        return SYNC_OK;
+                }
+        }
+
+        for (int ch = 0; ch < NCHANS; ch++)
+                dat[ch] = NAN;
+        dev->gaps++;
+        return SYNC_GAP;
+}
+
+/*******************************************************************************************************/
+void unicorn_sync_reset(unicorn_sync_t *sync, int index)
+{
+        /* the samples that are still buffered are kept, they are followed by a gap */
+        sync->device[index].numSamples = 0;
+}
+
+/*******************************************************************************************************/
+void unicorn_sync_push(unicorn_sync_t *sync, int index, unsigned long counter, double arrival, const float *dat)
+{
+        unicorn_sync_device_t *dev = &sync->device[index];
+
+        /* duplicate and out-of-order packets cannot be placed on the timeline */
+        if (dev->numSamples > 0 && counter <= dev->lastCounter && dev->lastCounter - counter < 10*FSAMPLE)
+                return;
+
+        double time = update_clock(dev, counter, arrival);
+
+        /* add the sample to the ring buffer, the oldest one is dropped when it is full */
+        if (dev->count == SYNC_BUFSIZE) {
+                dev->head = (dev->head + 1) % SYNC_BUFSIZE;
+                dev->count--;
+        }
+        unicorn_sync_sample_t *s = SAMPLE(dev, dev->count);
+        s->time = time;
+        s->counter = counter;
+        memcpy(s->dat, dat, NCHANS * sizeof(float));
+        dev->count++;
+
+        /* determine the newest sample over all devices */
+        double newest = -INFINITY;
+        for (int i = 0; i < sync->numDevices; i++) {
+                if (sync->device[i].count == 0) {
+                        if (!sync->started)
+                                return;
+                        continue;
+                }
+                newest = max(newest, SAMPLE(&sync->device[i], sync->device[i].count - 1)->time);
+        }
+
+        if (!sync->started) {
+                /* the timeline starts when all devices have data */
+                sync->nextTime = -INFINITY;
+                for (int i = 0; i < sync->numDevices; i++)
+                        sync->nextTime = max(sync->nextTime, SAMPLE(&sync->device[i], 0)->time);
+                sync->started = 1;
+        }
+
+        while (1) {
+                /* a frame can be emitted when all devices have data beyond it, or when they lag behind too much */
+                for (int i = 0; i < sync->numDevices; i++) {
+                        unicorn_sync_device_t *d = &sync->device[i];
+                        double last = d->count ? SAMPLE(d, d->count - 1)->time : -INFINITY;
+                        if (last < sync->nextTime && newest - last < SYNC_LATENCY)
+                                return;
+                }
+
+                for (int i = 0; i < sync->numDevices; i++)
+                        sync->flag[i] = interpolate(&sync->device[i], sync->nextTime, sync->frame + i * NCHANS);
+
+                sync->callback(sync->frame, sync->flag, sync->nextTime, sync->userData);
+                sync->nextTime += 1.0 / FSAMPLE;
+
+                if (sync->nextTime > newest)
+                        return;
+        }
+}
+
+/*******************************************************************************************************/
+/* Return the host time that corresponds to counter zero. */
+double unicorn_sync_offset(const unicorn_sync_t *sync, int index)
+{
+        const unicorn_sync_device_t *dev = &sync->device[index];
+        return dev->lastTime - dev->lastCounter * dev->period;
+}
+
+/*******************************************************************************************************/
+/* Return the clock drift of the device relative to the host in parts per million. */
+double unicorn_sync_drift(const unicorn_sync_t *sync, int index)
+{
+        const unicorn_sync_device_t *dev = &sync->device[index];
+        return (dev->period * FSAMPLE - 1.0) * 1e6;
+}
@@ -0,0 +1,77 @@
+/*
+ * Alignment of the samples from multiple Unicorn devices on a common timeline.
+ *
+ * Copyright (C) 2022, Robert Oostenveld
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UNICORN_SYNC_H
+#define UNICORN_SYNC_H
+
+#include "unicorn.h"
+
+#define SYNC_BUFSIZE  (64)      // in samples, per device
+#define SYNC_LATENCY  (0.2)     // in seconds, how long to wait for a device that lags behind
+#define SYNC_ALPHA    (0.01)    // smoothing of the clock offset
+#define SYNC_BETA     (0.0001)  // smoothing of the clock drift
+
+/* These are the flags for each device in an aligned frame. */
+#define SYNC_OK       (0)
+#define SYNC_GAP      (1)
+
+typedef struct {
+        double time;
+        unsigned long counter;
+        float dat[NCHANS];
+} unicorn_sync_sample_t;
+
+typedef struct {
+        unicorn_sync_sample_t sample[SYNC_BUFSIZE];
+        unsigned int head, count;
+        unsigned long numSamples;
+        unsigned long lastCounter;
+        double lastTime;        /* estimated time of the last sample */
+        double period;          /* estimated sample period of the device clock */
+        unsigned long gaps;
+} unicorn_sync_device_t;
+
+/* This is called for every aligned frame with numDevices*NCHANS values and numDevices flags. */
+typedef void (*unicorn_sync_callback_t)(const float *frame, const unsigned char *flag, double time, void *userData);
+
+typedef struct {
+        unicorn_sync_device_t device[MAXDEVICES];
+        int numDevices;
+        int started;
+        double nextTime;
+        float frame[MAXDEVICES*NCHANS];
+        unsigned char flag[MAXDEVICES];
+        unicorn_sync_callback_t callback;
+        void *userData;
+} unicorn_sync_t;
+
+void unicorn_sync_init(unicorn_sync_t *sync, int numDevices, unicorn_sync_callback_t callback, void *userData);
+
+/* Start the clock estimate of a device again, this is needed when its hardware counter restarts after a reconnect. */
+void unicorn_sync_reset(unicorn_sync_t *sync, int index);
+
+/* Add one sample of a device with its hardware counter and host arrival time, this emits all frames that are complete. */
+void unicorn_sync_push(unicorn_sync_t *sync, int index, unsigned long counter, double arrival, const float *dat);
+
+/* Helper functions to report the estimated clock of each device relative to the host. */
+double unicorn_sync_offset(const unicorn_sync_t *sync, int index);
+double unicorn_sync_drift(const unicorn_sync_t *sync, int index);
+
+#endif